@@ -0,0 +1,274 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "backend.h"
+#include "fs.h"
+#include "util.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/**
+ * @file backend.c
+ *
+ * Backends map parts of the overfs namespace to underfs directories.
+ *
+ * Each backend other than the one for fs->root is mounted on a top-level
+ * directory of the overfs.  Since different backends may live on different
+ * disks, each distinct device gets its own throttle domain, with its own
+ * set of per-UID budgets.  Saturating one disk then doesn't use up the budget
+ * that a UID has on another.
+ *
+ * A striped backend spreads each file over several underfs directories,
+ * RAID-0 style, to aggregate their bandwidth.  Every member directory holds
+ * the whole directory tree, and namespace operations are applied to all of
+ * them.  See stripe.c for the data path.
+ */
+
+static void backend_free(struct hub_backend *be)
+{
+    unsigned int i;
+
+    for (i = 0; i < be->nroots; i++) {
+        free(be->roots[i]);
+    }
+    free(be->roots);
+    free(be->prefix);
+    free(be);
+}
+
+/**
+ * Allocate a backend.
+ *
+ * @param prefix        The overfs prefix.
+ * @param prefix_len    Length of the prefix.
+ * @param dirs          The underfs directories.
+ * @param sep           The character separating directories in dirs, or
+ *                          '\0' if there is only one directory.
+ *
+ * @return              The new backend, or NULL on OOM.
+ */
+static struct hub_backend *backend_alloc(const char *prefix,
+        size_t prefix_len, const char *dirs, char sep)
+{
+    struct hub_backend *be;
+    const char *cur, *end;
+    unsigned int n = 1;
+
+    if (sep) {
+        for (cur = dirs; *cur; cur++) {
+            if (*cur == sep) {
+                n++;
+            }
+        }
+    }
+    be = xcalloc(1, sizeof(*be));
+    be->roots = xcalloc(n, sizeof(char*));
+    be->prefix = strndup(prefix, prefix_len);
+    if (!be->prefix) {
+        goto oom;
+    }
+    be->prefix_len = prefix_len;
+    for (cur = dirs; be->nroots < n; cur = end + 1) {
+        end = sep ? strchrnul(cur, sep) : cur + strlen(cur);
+        be->roots[be->nroots] = strndup(cur, end - cur);
+        if (!be->roots[be->nroots]) {
+            goto oom;
+        }
+        be->nroots++;
+    }
+    return be;
+
+oom:
+    backend_free(be);
+    return NULL;
+}
+
+int backend_add(struct hub_fs *fs, const char *spec, int striped)
+{
+    struct hub_backend *be, **tail;
+    const char *colon;
+    unsigned int i;
+
+    colon = strchr(spec, ':');
+    if ((!colon) || (spec[0] != '/') || (colon == spec + 1) ||
+            (colon[1] == '\0')) {
+        fprintf(stderr, "backend_add: invalid backend %s.  Backends must be "
+                "given as backend=/PREFIX:DIR or "
+                "stripe=/PREFIX:DIR,DIR[,...]\n", spec);
+        return EINVAL;
+    }
+    if (memchr(spec + 1, '/', colon - spec - 1) ||
+            (!strncmp(spec, "/.", 2))) {
+        fprintf(stderr, "backend_add: invalid backend %s.  The prefix must "
+                "be a single top-level directory.\n", spec);
+        return EINVAL;
+    }
+    for (be = fs->backends; be; be = be->next) {
+        if ((be->prefix_len == (size_t)(colon - spec)) &&
+                (!memcmp(be->prefix, spec, be->prefix_len))) {
+            fprintf(stderr, "backend_add: more than one backend is "
+                    "mounted on %s\n", be->prefix);
+            return EINVAL;
+        }
+    }
+    be = backend_alloc(spec, colon - spec, colon + 1, striped ? ',' : '\0');
+    if (!be) {
+        return ENOMEM;
+    }
+    for (i = 0; i < be->nroots; i++) {
+        if (be->roots[i][0] == '\0') {
+            fprintf(stderr, "backend_add: invalid backend %s.  Empty "
+                    "directory name.\n", spec);
+            backend_free(be);
+            return EINVAL;
+        }
+    }
+    if (striped && (be->nroots < 2)) {
+        fprintf(stderr, "backend_add: invalid backend %s.  A striped "
+                "backend needs at least two directories.\n", spec);
+        backend_free(be);
+        return EINVAL;
+    }
+    // Keep the backends in the order they were given.
+    for (tail = &fs->backends; *tail; tail = &(*tail)->next) {
+        ;
+    }
+    *tail = be;
+    return 0;
+}
+
+int backend_setup(struct hub_fs *fs)
+{
+    struct hub_backend *be, *other, **tail;
+    char path[PATH_MAX];
+    struct stat st;
+    unsigned int i;
+    int ret;
+
+    if (fs->stripe_size == 0) {
+        fprintf(stderr, "backend_setup: stripe_size must be nonzero.\n");
+        return EINVAL;
+    }
+    // The backend for fs->root goes last, since its empty prefix matches
+    // everything.
+    be = backend_alloc("", 0, fs->root, '\0');
+    if (!be) {
+        return ENOMEM;
+    }
+    for (tail = &fs->backends; *tail; tail = &(*tail)->next) {
+        ;
+    }
+    *tail = be;
+
+    fs->num_domains = 0;
+    for (be = fs->backends; be; be = be->next) {
+        for (i = 0; i < be->nroots; i++) {
+            if (stat(be->roots[i], &st) < 0) {
+                ret = errno;
+                fprintf(stderr, "backend_setup: failed to stat %s: error %d "
+                        "(%s)\n", be->roots[i], ret, strerror(ret));
+                return ret;
+            }
+            if (!S_ISDIR(st.st_mode)) {
+                fprintf(stderr, "backend_setup: %s is not a directory.\n",
+                        be->roots[i]);
+                return ENOTDIR;
+            }
+            if (i == 0) {
+                be->dev = st.st_dev;
+            }
+        }
+        be->domain = fs->num_domains;
+        if (be->nroots > 1) {
+            be->stripe_size = fs->stripe_size;
+        } else {
+            for (other = fs->backends; other != be; other = other->next) {
+                if ((other->nroots == 1) && (other->dev == be->dev)) {
+                    be->domain = other->domain;
+                    break;
+                }
+            }
+        }
+        if (be->domain == fs->num_domains) {
+            fs->num_domains++;
+        }
+        if (be->prefix_len == 0) {
+            continue;
+        }
+        // Give the backend something to show up as in readdir of the root.
+        snprintf(path, sizeof(path), "%s%s", fs->root, be->prefix);
+        if ((mkdir(path, 0755) < 0) && (errno != EEXIST)) {
+            ret = errno;
+            fprintf(stderr, "backend_setup: failed to create %s: error %d "
+                    "(%s)\n", path, ret, strerror(ret));
+            return ret;
+        }
+    }
+    for (be = fs->backends; be; be = be->next) {
+        for (i = 0; i < be->nroots; i++) {
+            fprintf(stderr, "backend_setup: %s/ -> %s (throttle domain "
+                    "%"PRId32", member %d of %d)\n", be->prefix,
+                    be->roots[i], be->domain, i + 1, be->nroots);
+        }
+    }
+    return 0;
+}
+
+void backend_free_all(struct hub_fs *fs)
+{
+    struct hub_backend *be, *next;
+
+    for (be = fs->backends; be; be = next) {
+        next = be->next;
+        backend_free(be);
+    }
+    fs->backends = NULL;
+}
+
+const struct hub_backend *backend_path(const struct hub_fs *fs,
+        const char *path, char *bpath, size_t len)
+{
+    const struct hub_backend *be;
+
+    for (be = fs->backends; be; be = be->next) {
+        if ((!strncmp(path, be->prefix, be->prefix_len)) &&
+                ((path[be->prefix_len] == '\0') ||
+                 (path[be->prefix_len] == '/'))) {
+            break;
+        }
+    }
+    // The last backend has an empty prefix, so we always find one.
+    backend_member_path(be, 0, path, bpath, len);
+    return be;
+}
+
+void backend_member_path(const struct hub_backend *be, unsigned int i,
+        const char *path, char *bpath, size_t len)
+{
+    snprintf(bpath, len, "%s%s", be->roots[i], path + be->prefix_len);
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -0,0 +1,137 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_BACKEND_H
+#define IOHUB_BACKEND_H
+
+#include <stdint.h> // for uint32_t
+#include <sys/types.h> // for dev_t
+#include <unistd.h> // for size_t
+
+struct hub_fs;
+
+/**
+ * An underfs directory which backs part of the overfs namespace.
+ */
+struct hub_backend {
+    /** Next in linked list. */
+    struct hub_backend *next;
+
+    /**
+     * The overfs directory this backend is mounted on, like "/data1", or the
+     * empty string for the backend which holds everything else.
+     */
+    char *prefix;
+
+    /** Length of prefix. */
+    size_t prefix_len;
+
+    /**
+     * The underfs directories.  There is more than one if the backend is
+     * striped, in which case each of them holds a copy of the directory tree
+     * and a member file for each file.
+     */
+    char **roots;
+
+    /** Number of underfs directories. */
+    unsigned int nroots;
+
+    /**
+     * Size in bytes of each stripe of a striped backend, or 0 if the backend
+     * isn't striped.  Stripe N of a file
+     * is stored at its natural offset in the member file under
+     * roots[N % nroots], and the member files are sparse elsewhere.
+     */
+    uint32_t stripe_size;
+
+    /** The device which roots[0] is on. */
+    dev_t dev;
+
+    /**
+     * The throttle domain for this backend.  Unstriped backends on the same
+     * device share a domain.  Each striped backend gets its own domain, so
+     * that its UIDs are throttled on the aggregate bandwidth of its members.
+     */
+    uint32_t domain;
+};
+
+/**
+ * Add a backend described by a backend=PREFIX:DIR or stripe=PREFIX:DIR,...
+ * mount option.
+ *
+ * @param fs            The filesystem.
+ * @param spec          The PREFIX:DIR string.  PREFIX must be a single
+ *                          top-level path component like "/data1".  If the
+ *                          backend is striped, DIR is a comma-separated list
+ *                          of directories.
+ * @param striped       Nonzero if the backend is striped.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+int backend_add(struct hub_fs *fs, const char *spec, int striped);
+
+/**
+ * Finish setting up the backends once all options have been parsed.
+ *
+ * This adds the backend for fs->root, sets the stripe size of striped
+ * backends, assigns throttle domains, and creates a directory in fs->root for
+ * each other backend to appear on, if there isn't one already.
+ *
+ * @param fs            The filesystem.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+int backend_setup(struct hub_fs *fs);
+
+/**
+ * Free all the backends.
+ *
+ * @param fs            The filesystem.
+ */
+void backend_free_all(struct hub_fs *fs);
+
+/**
+ * Find the backend for an overfs path and translate it to an underfs path.
+ *
+ * @param fs            The filesystem.
+ * @param path          The overfs path.
+ * @param bpath         (out param) The underfs path.
+ * @param len           Size of the bpath buffer.
+ *
+ * If the backend is striped, this gives the path in the first member.
+ *
+ * @return              The backend.  Never NULL.
+ */
+const struct hub_backend *backend_path(const struct hub_fs *fs,
+        const char *path, char *bpath, size_t len);
+
+/**
+ * Translate an overfs path to the underfs path in one member of a backend.
+ *
+ * @param be            The backend, as returned by backend_path.
+ * @param i             The index of the member, less than be->nroots.
+ * @param path          The overfs path.
+ * @param bpath         (out param) The underfs path.
+ * @param len           Size of the bpath buffer.
+ */
+void backend_member_path(const struct hub_backend *be, unsigned int i,
+        const char *path, char *bpath, size_t len);
+
+#endif
+
+// vim: ts=4:sw=4:et
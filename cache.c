@@ -0,0 +1,542 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cache.h"
+#include "htable.h"
+#include "log.h"
+#include "throttle.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * @file cache.c
+ *
+ * A block cache for the underfs, kept on a faster device.
+ *
+ * Backing files are split into fixed-size blocks.  Blocks which are read are
+ * copied into a cache file in the cache directory, and later reads of those
+ * blocks are served from there.  When the cache is full, the least recently
+ * used block is evicted.
+ *
+ * Each version of each backing file gets a unique generation number, and
+ * cached blocks are keyed by generation and block number.  When a backing
+ * file is modified, through us or behind our back, we just give it a new
+ * generation.  Its old blocks become unreachable, and age out of the cache.
+ *
+ * Blocks read from the underfs are charged to the reader in full.  Blocks
+ * served from the cache are charged at a lower rate, since they don't touch
+ * the disk that we're protecting.
+ */
+
+/**
+ * Maximum number of entries in g_cache_inos.  When we hit this, we start
+ * over.  Since generation numbers are never reused, this is safe.
+ */
+#define MAX_CACHE_INOS 65536
+
+/**
+ * The generation of a backing file.
+ */
+struct cache_ino {
+    /** Device and inode number of the backing file.  This is the key. */
+    struct hub_cache_id id;
+
+    /** Modification time of the backing file when we last opened it. */
+    struct timespec mtime;
+
+    /** Size of the backing file when we last opened it. */
+    off_t size;
+
+    /** Current generation number. */
+    uint64_t gen;
+};
+
+/**
+ * A slot in the cache file, which holds one block.
+ */
+struct cache_slot {
+    /** Generation of the file this block belongs to.  Part of the key. */
+    uint64_t gen;
+
+    /** Block number in the file.  Part of the key. */
+    uint64_t blkno;
+
+    /** Number of valid bytes.  Less than the block size at end of file. */
+    uint32_t len;
+
+    /**
+     * Number of threads using this slot.  A slot which is in use can't be
+     * evicted.
+     */
+    uint32_t refs;
+
+    /** Previous slot in the LRU list (more recently used.) */
+    struct cache_slot *prev;
+
+    /**
+     * Next slot in the LRU list (less recently used), or next slot in the
+     * free list.
+     */
+    struct cache_slot *next;
+};
+
+/** Protects everything below. */
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** File descriptor of the cache file, or -1 if the cache is disabled. */
+static int g_cache_fd = -1;
+
+/** Size of each block. */
+static uint32_t g_cache_block;
+
+/** Percentage of cache hits that we charge for. */
+static uint32_t g_cache_hit_pct;
+
+/** All the slots. */
+static struct cache_slot *g_cache_slots;
+
+/** Number of slots. */
+static uint64_t g_cache_nslots;
+
+/** Slots which don't hold a block. */
+static struct cache_slot *g_cache_free;
+
+/** Most and least recently used slots which hold a block. */
+static struct cache_slot *g_cache_lru_head, *g_cache_lru_tail;
+
+/** Maps (generation, block number) to slots. */
+static struct htable *g_cache_blocks;
+
+/** Maps backing files to cache_ino structures. */
+static struct htable *g_cache_inos;
+
+/** The last generation number we handed out. */
+static uint64_t g_cache_last_gen;
+
+static uint32_t cache_slot_hash(const void *key, uint32_t capacity)
+{
+    const struct cache_slot *slot = key;
+    uint64_t h = (slot->gen * 0x9e3779b97f4a7c15ULL) ^ slot->blkno;
+
+    return (uint32_t)((h ^ (h >> 32)) % capacity);
+}
+
+static int cache_slot_eq(const void *a, const void *b)
+{
+    const struct cache_slot *sa = a, *sb = b;
+
+    return (sa->gen == sb->gen) && (sa->blkno == sb->blkno);
+}
+
+static uint32_t cache_ino_hash(const void *key, uint32_t capacity)
+{
+    const struct hub_cache_id *id = key;
+    uint64_t h = (((uint64_t)id->dev) * 31) + id->ino;
+
+    return (uint32_t)((h ^ (h >> 32)) % capacity);
+}
+
+static int cache_ino_eq(const void *a, const void *b)
+{
+    const struct hub_cache_id *ia = a, *ib = b;
+
+    return (ia->dev == ib->dev) && (ia->ino == ib->ino);
+}
+
+static void free_cache_ino(void *ctx __attribute__((unused)),
+                           void *key __attribute__((unused)), void *val)
+{
+    free(val);
+}
+
+int cache_init(const char *dir, uint64_t size, uint32_t block,
+               uint32_t hit_pct)
+{
+    char path[PATH_MAX];
+    uint64_t i;
+    int ret;
+
+    if ((!dir) || (block == 0) || (size < block)) {
+        return EINVAL;
+    }
+    snprintf(path, sizeof(path), "%s/iohub-cache.XXXXXX", dir);
+    g_cache_fd = mkstemp(path);
+    if (g_cache_fd < 0) {
+        ret = errno;
+        fprintf(stderr, "cache_init: failed to create a cache file in "
+                "%s: error %d (%s)\n", dir, ret, terror(ret));
+        return ret;
+    }
+    // Nobody else needs to see the cache file, and we want it to go away
+    // when we exit.
+    unlink(path);
+    g_cache_block = block;
+    g_cache_hit_pct = hit_pct;
+    g_cache_nslots = size / block;
+    g_cache_slots = xcalloc(g_cache_nslots, sizeof(struct cache_slot));
+    for (i = 0; i < g_cache_nslots; i++) {
+        g_cache_slots[i].next = g_cache_free;
+        g_cache_free = &g_cache_slots[i];
+    }
+    g_cache_blocks = htable_alloc(g_cache_nslots * 2, cache_slot_hash,
+                                  cache_slot_eq);
+    g_cache_inos = htable_alloc(128, cache_ino_hash, cache_ino_eq);
+    if ((!g_cache_blocks) || (!g_cache_inos)) {
+        cache_shutdown();
+        return ENOMEM;
+    }
+    fprintf(stderr, "cache_init: caching %"PRId64" blocks of %"PRId32
+            " bytes in %s\n", g_cache_nslots, block, dir);
+    return 0;
+}
+
+void cache_shutdown(void)
+{
+    if (g_cache_fd >= 0) {
+        close(g_cache_fd);
+        g_cache_fd = -1;
+    }
+    htable_free(g_cache_blocks);
+    g_cache_blocks = NULL;
+    if (g_cache_inos) {
+        htable_visit(g_cache_inos, free_cache_ino, NULL);
+        htable_free(g_cache_inos);
+        g_cache_inos = NULL;
+    }
+    free(g_cache_slots);
+    g_cache_slots = NULL;
+    g_cache_nslots = 0;
+    g_cache_free = NULL;
+    g_cache_lru_head = NULL;
+    g_cache_lru_tail = NULL;
+}
+
+int cache_open(int fd, struct hub_cache_id *id)
+{
+    struct stat st;
+    struct cache_ino *ino;
+    int ret = 0;
+
+    if (g_cache_fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) < 0) {
+        return 0;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        return 0;
+    }
+    memset(id, 0, sizeof(*id));
+    id->dev = st.st_dev;
+    id->ino = st.st_ino;
+    pthread_mutex_lock(&g_cache_lock);
+    if (htable_used(g_cache_inos) >= MAX_CACHE_INOS) {
+        htable_visit(g_cache_inos, free_cache_ino, NULL);
+        htable_free(g_cache_inos);
+        g_cache_inos = htable_alloc(128, cache_ino_hash, cache_ino_eq);
+        if (!g_cache_inos) {
+            fprintf(stderr, "cache_open: out of memory.\n");
+            abort();
+        }
+    }
+    ino = htable_get(g_cache_inos, id);
+    if (!ino) {
+        ino = calloc(1, sizeof(*ino));
+        if (!ino) {
+            goto done;
+        }
+        ino->id = *id;
+        if (htable_put(g_cache_inos, &ino->id, ino)) {
+            free(ino);
+            goto done;
+        }
+        ino->gen = ++g_cache_last_gen;
+    } else if ((ino->mtime.tv_sec != st.st_mtim.tv_sec) ||
+               (ino->mtime.tv_nsec != st.st_mtim.tv_nsec) ||
+               (ino->size != st.st_size)) {
+        ino->gen = ++g_cache_last_gen;
+    }
+    ino->mtime = st.st_mtim;
+    ino->size = st.st_size;
+    ret = 1;
+done:
+    pthread_mutex_unlock(&g_cache_lock);
+    return ret;
+}
+
+void cache_invalidate(const struct hub_cache_id *id)
+{
+    struct cache_ino *ino;
+
+    pthread_mutex_lock(&g_cache_lock);
+    ino = htable_get(g_cache_inos, id);
+    if (ino) {
+        ino->gen = ++g_cache_last_gen;
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+}
+
+static void cache_lru_remove(struct cache_slot *slot)
+{
+    if (slot->prev) {
+        slot->prev->next = slot->next;
+    } else {
+        g_cache_lru_head = slot->next;
+    }
+    if (slot->next) {
+        slot->next->prev = slot->prev;
+    } else {
+        g_cache_lru_tail = slot->prev;
+    }
+    slot->prev = NULL;
+    slot->next = NULL;
+}
+
+static void cache_lru_push(struct cache_slot *slot)
+{
+    slot->prev = NULL;
+    slot->next = g_cache_lru_head;
+    if (g_cache_lru_head) {
+        g_cache_lru_head->prev = slot;
+    } else {
+        g_cache_lru_tail = slot;
+    }
+    g_cache_lru_head = slot;
+}
+
+/**
+ * Get a slot to fill with a new block.  The slot is returned pinned, and not
+ * in the block table.  Must be called with the lock held.
+ *
+ * @return              The slot, or NULL if every slot is in use.
+ */
+static struct cache_slot *cache_get_victim(void)
+{
+    struct cache_slot *slot;
+    void *key, *val;
+
+    slot = g_cache_free;
+    if (slot) {
+        g_cache_free = slot->next;
+    } else {
+        for (slot = g_cache_lru_tail; slot; slot = slot->prev) {
+            if (slot->refs == 0) {
+                break;
+            }
+        }
+        if (!slot) {
+            return NULL;
+        }
+        cache_lru_remove(slot);
+        htable_pop(g_cache_blocks, slot, &key, &val);
+    }
+    slot->next = NULL;
+    slot->prev = NULL;
+    slot->refs = 1;
+    return slot;
+}
+
+static void cache_put_free(struct cache_slot *slot)
+{
+    slot->refs = 0;
+    slot->next = g_cache_free;
+    g_cache_free = slot;
+}
+
+static off_t cache_slot_off(const struct cache_slot *slot)
+{
+    return ((off_t)(slot - g_cache_slots)) * g_cache_block;
+}
+
+/**
+ * Read a block from the backing file, and add it to the cache.
+ *
+ * The caller must have pinned the victim slot.  This function unpins it.
+ *
+ * @param victim        The slot to put the block in.
+ * @param id            The cache ID of the file.
+ * @param gen           The generation of the file when we started.
+ * @param fd            The backing file descriptor.
+ * @param dom           The throttle domain of the backing file.
+ * @param uid           The UID doing the read.
+ * @param blkno         The block number to read.
+ * @param bbuf          A buffer big enough for one block.
+ *
+ * @return              The number of bytes in the block, or a negative error
+ *                          code.
+ */
+static ssize_t cache_fill(struct cache_slot *victim,
+        const struct hub_cache_id *id, uint64_t gen, int fd, uint32_t dom,
+        uint32_t uid, uint64_t blkno, char *bbuf)
+{
+    struct cache_ino *ino;
+    struct iovec iov;
+    ssize_t res;
+    int insert = 0;
+
+    throttle(dom, uid, g_cache_block);
+    res = pread_fully(fd, bbuf, g_cache_block, blkno * g_cache_block);
+    if (res > 0) {
+        iov.iov_base = bbuf;
+        iov.iov_len = res;
+        insert = (pwritev_fully(g_cache_fd, &iov, 1,
+                                cache_slot_off(victim)) == 0);
+    }
+    pthread_mutex_lock(&g_cache_lock);
+    victim->gen = gen;
+    victim->blkno = blkno;
+    victim->len = (res > 0) ? res : 0;
+    if (insert) {
+        // If the file was modified while we were reading it, the block we
+        // read may be stale.  If another thread beat us to it, there's
+        // already a copy.  Either way, don't add it.
+        ino = htable_get(g_cache_inos, id);
+        if ((!ino) || (ino->gen != gen) ||
+                htable_get(g_cache_blocks, victim)) {
+            insert = 0;
+        }
+    }
+    if (insert && (htable_put(g_cache_blocks, victim, victim) == 0)) {
+        victim->refs = 0;
+        cache_lru_push(victim);
+    } else {
+        cache_put_free(victim);
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+    return res;
+}
+
+ssize_t cache_read(const struct hub_cache_id *id, int fd, uint32_t dom,
+                   uint32_t uid, char *buf, size_t size, off_t off)
+{
+    struct cache_slot key, *slot;
+    struct cache_ino *ino;
+    char *bbuf = NULL;
+    uint64_t gen, hit = 0;
+    size_t done = 0, boff, amt;
+    ssize_t res;
+    int eof;
+
+    while (done < size) {
+        key.blkno = (off + done) / g_cache_block;
+        boff = (off + done) % g_cache_block;
+        amt = size - done;
+        if (amt > g_cache_block - boff) {
+            amt = g_cache_block - boff;
+        }
+        pthread_mutex_lock(&g_cache_lock);
+        ino = htable_get(g_cache_inos, id);
+        if (!ino) {
+            // The inode table was reset since we opened the file.  Just
+            // bypass the cache.
+            pthread_mutex_unlock(&g_cache_lock);
+            goto bypass;
+        }
+        gen = ino->gen;
+        key.gen = gen;
+        slot = htable_get(g_cache_blocks, &key);
+        if (slot) {
+            slot->refs++;
+            cache_lru_remove(slot);
+            cache_lru_push(slot);
+            pthread_mutex_unlock(&g_cache_lock);
+            eof = (slot->len < g_cache_block);
+            if (boff >= slot->len) {
+                res = 0;
+            } else {
+                if (amt > slot->len - boff) {
+                    amt = slot->len - boff;
+                }
+                res = pread_fully(g_cache_fd, buf + done, amt,
+                                  cache_slot_off(slot) + boff);
+            }
+            pthread_mutex_lock(&g_cache_lock);
+            slot->refs--;
+            pthread_mutex_unlock(&g_cache_lock);
+            if (res < 0) {
+                goto bypass;
+            }
+            hit += res;
+        } else {
+            slot = cache_get_victim();
+            pthread_mutex_unlock(&g_cache_lock);
+            if (!slot) {
+                goto bypass;
+            }
+            if (!bbuf) {
+                bbuf = malloc(g_cache_block);
+                if (!bbuf) {
+                    pthread_mutex_lock(&g_cache_lock);
+                    cache_put_free(slot);
+                    pthread_mutex_unlock(&g_cache_lock);
+                    goto bypass;
+                }
+            }
+            res = cache_fill(slot, id, gen, fd, dom, uid, key.blkno, bbuf);
+            if (res < 0) {
+                goto done;
+            }
+            eof = ((size_t)res < g_cache_block);
+            if (boff >= (size_t)res) {
+                res = 0;
+            } else {
+                if (amt > res - boff) {
+                    amt = res - boff;
+                }
+                memcpy(buf + done, bbuf + boff, amt);
+                res = amt;
+            }
+        }
+        done += res;
+        if (eof) {
+            // A short block is the last block in the file.
+            break;
+        }
+    }
+    res = done;
+    goto done;
+
+bypass:
+    // Something went wrong with the cache.  Read the rest directly.
+    throttle(dom, uid, size - done);
+    res = pread_fully(fd, buf + done, size - done, off + done);
+    if (res >= 0) {
+        res += done;
+    }
+
+done:
+    free(bbuf);
+    if (hit > 0) {
+        throttle(dom, uid, (hit * g_cache_hit_pct) / 100);
+    }
+    return res;
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -0,0 +1,99 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_CACHE_H
+#define IOHUB_CACHE_H
+
+#include <stdint.h> // for uint32_t
+#include <sys/types.h> // for dev_t, ino_t, off_t
+#include <unistd.h> // for size_t
+
+/**
+ * Identifies a backing file in the cache.
+ */
+struct hub_cache_id {
+    dev_t dev;
+    ino_t ino;
+};
+
+/**
+ * Start the cache tier.
+ *
+ * @param dir           Directory on a fast device to keep cached blocks in.
+ * @param size          Maximum size of the cache in bytes.
+ * @param block         Size of each cached block in bytes.
+ * @param hit_pct       Percentage of the bytes served from the cache that we
+ *                          charge to the reader's budget.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+int cache_init(const char *dir, uint64_t size, uint32_t block,
+               uint32_t hit_pct);
+
+/**
+ * Stop the cache tier and free its resources.
+ */
+void cache_shutdown(void);
+
+/**
+ * Start caching a newly opened backing file.
+ *
+ * If the backing file's size or modification time have changed since we last
+ * saw it, anything we have cached for it is discarded.
+ *
+ * @param fd            The backing file descriptor.
+ * @param id            (out param) The ID to use for the file in other cache
+ *                          calls.
+ *
+ * @return              1 if the file should be read through the cache; 0
+ *                          otherwise.
+ */
+int cache_open(int fd, struct hub_cache_id *id);
+
+/**
+ * Read from a backing file through the cache.
+ *
+ * Blocks which aren't in the cache are read from the backing file, charging
+ * the reader for the whole block, and added to the cache.  Blocks which are
+ * in the cache are charged at the cache hit rate.
+ *
+ * @param id            The cache ID of the file.
+ * @param fd            The backing file descriptor.
+ * @param dom           The throttle domain of the backing file.
+ * @param uid           The UID doing the read.
+ * @param buf           The buffer to read into.
+ * @param size          Number of bytes to read.
+ * @param off           File offset to read from.
+ *
+ * @return              The number of bytes read, which is only less than
+ *                          size at the end of the file; or a negative error
+ *                          code.
+ */
+ssize_t cache_read(const struct hub_cache_id *id, int fd, uint32_t dom,
+                   uint32_t uid, char *buf, size_t size, off_t off);
+
+/**
+ * Discard everything cached for a file which has been modified.
+ *
+ * @param id            The cache ID of the file.
+ */
+void cache_invalidate(const struct hub_cache_id *id);
+
+#endif
+
+// vim: ts=4:sw=4:et
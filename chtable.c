@@ -0,0 +1,683 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "chtable.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @file chtable.c
+ *
+ * A concurrent hash table with lock-free lookups.
+ *
+ * The table is an array of buckets, each of which is a singly linked list of
+ * nodes.  Lookups just walk the list for their bucket without taking any
+ * locks.  Inserts and removals take the lock for the bucket's stripe, so
+ * writers to different stripes don't contend.  New nodes are linked in at the
+ * head of the list with a release store, after they have been filled in, so a
+ * lookup always sees a complete node.  A removed node is unlinked, but its
+ * next pointer is left alone, so a lookup which is standing on it can carry
+ * on.
+ *
+ * When the table gets too full, we take every stripe lock and build a new
+ * bucket array with copies of all the nodes.  Relinking the existing nodes
+ * instead would be cheaper, but a lookup walking one of them could then be
+ * diverted into the wrong bucket and miss its key.
+ *
+ * Removed nodes and old bucket arrays are freed with epoch-based
+ * reclamation.  Each thread which uses a table has a record saying whether it
+ * is inside a lookup, and which global epoch it saw when it started.  The
+ * global epoch can only advance when every thread inside a lookup has seen
+ * the current one.  So once the epoch has advanced twice since something was
+ * removed, nobody can still be looking at it.
+ */
+
+/** Number of stripe locks per table.  Must be a power of 2. */
+#define CHTABLE_NUM_STRIPES 64
+
+/** Number of retired items between attempts to free some of them. */
+#define EBR_COLLECT_INTERVAL 64
+
+/**
+ * Something waiting to be freed.
+ */
+struct ebr_item {
+    /** Next in the limbo list. */
+    struct ebr_item *next;
+
+    /** The global epoch when this was retired. */
+    uint64_t epoch;
+
+    /** The memory to free. */
+    void *ptr;
+
+    /** The function to free it with. */
+    void (*fn)(void *ptr);
+
+    /** Nonzero if this item was allocated by chtable_defer_free. */
+    int owned;
+};
+
+/**
+ * A thread's epoch record.  Records are never freed, but they are reused
+ * when their thread exits.
+ */
+struct ebr_rec {
+    /** Next in the global list of records.  Immutable once published. */
+    struct ebr_rec *next;
+
+    /** The global epoch this thread saw when it last started a lookup. */
+    uint64_t epoch;
+
+    /** Nonzero if this thread is inside a lookup. */
+    int active;
+
+    /** Nesting depth of lookups.  Only used by the owning thread. */
+    int nest;
+
+    /** Nonzero if the record belongs to a thread. */
+    int in_use;
+} __attribute__((aligned(64)));
+
+/** The global epoch. */
+static uint64_t g_ebr_epoch = 1;
+
+/** All the epoch records. */
+static struct ebr_rec *g_ebr_recs;
+
+/** Protects the limbo list. */
+static pthread_mutex_t g_ebr_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Items waiting to be freed, newest first. */
+static struct ebr_item *g_ebr_limbo;
+
+/** Number of items retired since we last tried to free some. */
+static uint32_t g_ebr_since_collect;
+
+/** Releases a thread's record when it exits. */
+static pthread_key_t g_ebr_key;
+
+static pthread_once_t g_ebr_once = PTHREAD_ONCE_INIT;
+
+/** This thread's record, or NULL if it doesn't have one yet. */
+static __thread struct ebr_rec *t_ebr_rec;
+
+struct chtable_node {
+    /** Next node in the bucket. */
+    struct chtable_node *next;
+
+    /** The key.  Immutable. */
+    void *key;
+
+    /** The value.  Immutable. */
+    void *val;
+
+    /** Used when the node is retired. */
+    struct ebr_item retire;
+};
+
+struct chtable_tbl {
+    /** Number of buckets.  A power of 2, and at least CHTABLE_NUM_STRIPES. */
+    uint32_t nbuckets;
+
+    /** Used when the bucket array is retired. */
+    struct ebr_item retire;
+
+    /** The buckets. */
+    struct chtable_node *buckets[0];
+};
+
+struct chtable_stripe {
+    pthread_mutex_t lock;
+} __attribute__((aligned(64)));
+
+struct chtable {
+    /** The current bucket array. */
+    struct chtable_tbl *tbl;
+
+    /** Number of entries. */
+    uint32_t used;
+
+    htable_hash_fn_t hash_fun;
+    htable_eq_fn_t eq_fun;
+
+    /**
+     * The stripe locks.  Bucket i is protected by stripe
+     * i % CHTABLE_NUM_STRIPES.  Changing tbl requires every stripe lock.
+     */
+    struct chtable_stripe stripes[CHTABLE_NUM_STRIPES];
+};
+
+static void ebr_release_rec(void *arg)
+{
+    struct ebr_rec *rec = arg;
+
+    __atomic_store_n(&rec->active, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void ebr_init_once(void)
+{
+    if (pthread_key_create(&g_ebr_key, ebr_release_rec)) {
+        fprintf(stderr, "ebr_init_once: pthread_key_create failed.\n");
+        abort();
+    }
+}
+
+/**
+ * Get the calling thread's epoch record, claiming or allocating one if it
+ * doesn't have one yet.
+ */
+static struct ebr_rec *ebr_get_rec(void)
+{
+    struct ebr_rec *rec = t_ebr_rec, *head;
+
+    if (rec) {
+        return rec;
+    }
+    pthread_once(&g_ebr_once, ebr_init_once);
+    for (rec = __atomic_load_n(&g_ebr_recs, __ATOMIC_ACQUIRE); rec;
+            rec = rec->next) {
+        if (__sync_bool_compare_and_swap(&rec->in_use, 0, 1)) {
+            goto done;
+        }
+    }
+    if (posix_memalign((void**)&rec, 64, sizeof(*rec))) {
+        fprintf(stderr, "ebr_get_rec: out of memory.\n");
+        abort();
+    }
+    memset(rec, 0, sizeof(*rec));
+    rec->in_use = 1;
+    head = __atomic_load_n(&g_ebr_recs, __ATOMIC_ACQUIRE);
+    do {
+        rec->next = head;
+    } while (!__atomic_compare_exchange_n(&g_ebr_recs, &head, rec, 0,
+                    __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+done:
+    pthread_setspecific(g_ebr_key, rec);
+    t_ebr_rec = rec;
+    return rec;
+}
+
+/**
+ * Start a section in which shared nodes may be looked at.
+ */
+static void ebr_enter(void)
+{
+    struct ebr_rec *rec = ebr_get_rec();
+
+    if (rec->nest++ > 0) {
+        return;
+    }
+    __atomic_store_n(&rec->epoch, __atomic_load_n(&g_ebr_epoch,
+                     __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->active, 1, __ATOMIC_RELAXED);
+    // Make sure that anyone trying to advance the epoch sees that we're
+    // active before we look at any nodes.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * End a section started with ebr_enter.
+ */
+static void ebr_exit(void)
+{
+    struct ebr_rec *rec = t_ebr_rec;
+
+    if (--rec->nest > 0) {
+        return;
+    }
+    __atomic_store_n(&rec->active, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Try to advance the global epoch.
+ *
+ * @return          The global epoch after the attempt.
+ */
+static uint64_t ebr_try_advance(void)
+{
+    struct ebr_rec *rec;
+    uint64_t epoch;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    epoch = __atomic_load_n(&g_ebr_epoch, __ATOMIC_ACQUIRE);
+    for (rec = __atomic_load_n(&g_ebr_recs, __ATOMIC_ACQUIRE); rec;
+            rec = rec->next) {
+        if (__atomic_load_n(&rec->active, __ATOMIC_ACQUIRE) &&
+                (__atomic_load_n(&rec->epoch, __ATOMIC_ACQUIRE) != epoch)) {
+            return epoch;
+        }
+    }
+    if (__atomic_compare_exchange_n(&g_ebr_epoch, &epoch, epoch + 1, 0,
+                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return epoch + 1;
+    }
+    // Somebody else advanced it.  epoch has been updated.
+    return epoch;
+}
+
+/**
+ * Free everything in limbo which nobody can be looking at anymore.
+ */
+static void ebr_collect(void)
+{
+    struct ebr_item *item, *next, **prev, *dead = NULL;
+    uint64_t epoch;
+    int owned;
+
+    epoch = ebr_try_advance();
+    pthread_mutex_lock(&g_ebr_lock);
+    g_ebr_since_collect = 0;
+    prev = &g_ebr_limbo;
+    for (item = g_ebr_limbo; item; item = next) {
+        next = item->next;
+        if (item->epoch + 2 <= epoch) {
+            *prev = next;
+            item->next = dead;
+            dead = item;
+        } else {
+            prev = &item->next;
+        }
+    }
+    pthread_mutex_unlock(&g_ebr_lock);
+    for (item = dead; item; item = next) {
+        next = item->next;
+        // The item may be part of the memory being freed.
+        owned = item->owned;
+        item->fn(item->ptr);
+        if (owned) {
+            free(item);
+        }
+    }
+}
+
+/**
+ * Free something once nobody can be looking at it anymore.
+ *
+ * @param item      The limbo item to use.  Its ptr, fn and owned fields
+ *                      must be set.
+ */
+static void ebr_retire(struct ebr_item *item)
+{
+    int collect;
+
+    pthread_mutex_lock(&g_ebr_lock);
+    item->epoch = __atomic_load_n(&g_ebr_epoch, __ATOMIC_ACQUIRE);
+    item->next = g_ebr_limbo;
+    g_ebr_limbo = item;
+    collect = (++g_ebr_since_collect >= EBR_COLLECT_INTERVAL);
+    pthread_mutex_unlock(&g_ebr_lock);
+    if (collect) {
+        ebr_collect();
+    }
+}
+
+void chtable_synchronize(void)
+{
+    uint64_t start, epoch;
+
+    start = __atomic_load_n(&g_ebr_epoch, __ATOMIC_ACQUIRE);
+    while (1) {
+        epoch = ebr_try_advance();
+        if (epoch >= start + 2) {
+            break;
+        }
+        sched_yield();
+    }
+    ebr_collect();
+}
+
+void chtable_defer_free(void *ptr, void (*fn)(void *ptr))
+{
+    struct ebr_item *item;
+
+    item = calloc(1, sizeof(*item));
+    if (!item) {
+        // We can't wait in limbo, so wait here instead.
+        chtable_synchronize();
+        fn(ptr);
+        return;
+    }
+    item->ptr = ptr;
+    item->fn = fn;
+    item->owned = 1;
+    ebr_retire(item);
+}
+
+static void chtable_retire_node(struct chtable_node *node)
+{
+    node->retire.ptr = node;
+    node->retire.fn = free;
+    node->retire.owned = 0;
+    ebr_retire(&node->retire);
+}
+
+static struct chtable_tbl *chtable_tbl_alloc(uint32_t nbuckets)
+{
+    return calloc(1, sizeof(struct chtable_tbl) +
+                  (sizeof(struct chtable_node *) * nbuckets));
+}
+
+static uint32_t round_up_to_power_of_2(uint32_t i)
+{
+    if (i == 0) {
+        return 1;
+    }
+    i--;
+    i |= i >> 1;
+    i |= i >> 2;
+    i |= i >> 4;
+    i |= i >> 8;
+    i |= i >> 16;
+    i++;
+    return i;
+}
+
+struct chtable *chtable_alloc(uint32_t capacity, htable_hash_fn_t hash_fun,
+                              htable_eq_fn_t eq_fun)
+{
+    struct chtable *chtable;
+    int i;
+
+    if (posix_memalign((void**)&chtable, 64, sizeof(*chtable))) {
+        return NULL;
+    }
+    memset(chtable, 0, sizeof(*chtable));
+    capacity = round_up_to_power_of_2(capacity);
+    if (capacity < CHTABLE_NUM_STRIPES) {
+        capacity = CHTABLE_NUM_STRIPES;
+    }
+    chtable->tbl = chtable_tbl_alloc(capacity);
+    if (!chtable->tbl) {
+        free(chtable);
+        return NULL;
+    }
+    chtable->tbl->nbuckets = capacity;
+    chtable->hash_fun = hash_fun;
+    chtable->eq_fun = eq_fun;
+    for (i = 0; i < CHTABLE_NUM_STRIPES; i++) {
+        pthread_mutex_init(&chtable->stripes[i].lock, NULL);
+    }
+    return chtable;
+}
+
+static void chtable_lock_all(struct chtable *chtable)
+{
+    int i;
+
+    for (i = 0; i < CHTABLE_NUM_STRIPES; i++) {
+        pthread_mutex_lock(&chtable->stripes[i].lock);
+    }
+}
+
+static void chtable_unlock_all(struct chtable *chtable)
+{
+    int i;
+
+    for (i = CHTABLE_NUM_STRIPES - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&chtable->stripes[i].lock);
+    }
+}
+
+void chtable_visit(struct chtable *chtable, visitor_fn_t fun, void *ctx)
+{
+    struct chtable_tbl *tbl;
+    struct chtable_node *node;
+    uint32_t i;
+
+    chtable_lock_all(chtable);
+    tbl = chtable->tbl;
+    for (i = 0; i < tbl->nbuckets; i++) {
+        for (node = tbl->buckets[i]; node; node = node->next) {
+            fun(ctx, node->key, node->val);
+        }
+    }
+    chtable_unlock_all(chtable);
+}
+
+void chtable_free(struct chtable *chtable)
+{
+    struct chtable_node *node, *next;
+    uint32_t i;
+
+    if (!chtable) {
+        return;
+    }
+    for (i = 0; i < chtable->tbl->nbuckets; i++) {
+        for (node = chtable->tbl->buckets[i]; node; node = next) {
+            next = node->next;
+            free(node);
+        }
+    }
+    free(chtable->tbl);
+    for (i = 0; i < CHTABLE_NUM_STRIPES; i++) {
+        pthread_mutex_destroy(&chtable->stripes[i].lock);
+    }
+    free(chtable);
+}
+
+/**
+ * Lock the stripe for a key's bucket in the current bucket array.
+ *
+ * Must be called inside ebr_enter, so that the bucket array can't be freed
+ * out from under us before we have the lock.
+ *
+ * @param chtable   The hash table.
+ * @param key       The key.
+ * @param bucket    (out param) The key's bucket.
+ *
+ * @return          The current bucket array, which can't change until the
+ *                      stripe is unlocked.
+ */
+static struct chtable_tbl *chtable_lock_key(struct chtable *chtable,
+        const void *key, uint32_t *bucket)
+{
+    struct chtable_tbl *tbl;
+    pthread_mutex_t *lock;
+
+    while (1) {
+        tbl = __atomic_load_n(&chtable->tbl, __ATOMIC_ACQUIRE);
+        *bucket = chtable->hash_fun(key, tbl->nbuckets);
+        lock = &chtable->stripes[*bucket % CHTABLE_NUM_STRIPES].lock;
+        pthread_mutex_lock(lock);
+        if (chtable->tbl == tbl) {
+            return tbl;
+        }
+        // The table was resized while we were waiting.
+        pthread_mutex_unlock(lock);
+    }
+}
+
+/**
+ * Double the number of buckets, if the table is still too full.
+ *
+ * If we run out of memory, the table just stays the size it is.  Chains get
+ * longer, but nothing breaks.
+ */
+static void chtable_grow(struct chtable *chtable)
+{
+    struct chtable_tbl *tbl, *ntbl = NULL;
+    struct chtable_node *node, *nnode, *next;
+    uint32_t i, b, nbuckets;
+
+    chtable_lock_all(chtable);
+    tbl = chtable->tbl;
+    if ((chtable->used <= tbl->nbuckets) || (tbl->nbuckets >= 0x80000000U)) {
+        goto done;
+    }
+    nbuckets = tbl->nbuckets * 2;
+    ntbl = chtable_tbl_alloc(nbuckets);
+    if (!ntbl) {
+        goto done;
+    }
+    ntbl->nbuckets = nbuckets;
+    for (i = 0; i < tbl->nbuckets; i++) {
+        for (node = tbl->buckets[i]; node; node = node->next) {
+            nnode = calloc(1, sizeof(*nnode));
+            if (!nnode) {
+                goto oom;
+            }
+            nnode->key = node->key;
+            nnode->val = node->val;
+            b = chtable->hash_fun(node->key, nbuckets);
+            nnode->next = ntbl->buckets[b];
+            ntbl->buckets[b] = nnode;
+        }
+    }
+    __atomic_store_n(&chtable->tbl, ntbl, __ATOMIC_RELEASE);
+    chtable_unlock_all(chtable);
+    // Lookups may still be walking the old nodes.
+    for (i = 0; i < tbl->nbuckets; i++) {
+        for (node = tbl->buckets[i]; node; node = next) {
+            next = node->next;
+            chtable_retire_node(node);
+        }
+    }
+    tbl->retire.ptr = tbl;
+    tbl->retire.fn = free;
+    tbl->retire.owned = 0;
+    ebr_retire(&tbl->retire);
+    return;
+
+oom:
+    // Nobody else has seen the new nodes, so we can free them right away.
+    for (i = 0; i < nbuckets; i++) {
+        for (node = ntbl->buckets[i]; node; node = next) {
+            next = node->next;
+            free(node);
+        }
+    }
+    free(ntbl);
+done:
+    chtable_unlock_all(chtable);
+}
+
+int chtable_put(struct chtable *chtable, void *key, void *val)
+{
+    struct chtable_tbl *tbl;
+    struct chtable_node *node;
+    uint32_t bucket, used, nbuckets;
+
+    ebr_enter();
+    tbl = chtable_lock_key(chtable, key, &bucket);
+    for (node = tbl->buckets[bucket]; node; node = node->next) {
+        if (chtable->eq_fun(node->key, key)) {
+            pthread_mutex_unlock(
+                &chtable->stripes[bucket % CHTABLE_NUM_STRIPES].lock);
+            ebr_exit();
+            return EEXIST;
+        }
+    }
+    node = calloc(1, sizeof(*node));
+    if (!node) {
+        pthread_mutex_unlock(
+            &chtable->stripes[bucket % CHTABLE_NUM_STRIPES].lock);
+        ebr_exit();
+        return ENOMEM;
+    }
+    node->key = key;
+    node->val = val;
+    node->next = tbl->buckets[bucket];
+    __atomic_store_n(&tbl->buckets[bucket], node, __ATOMIC_RELEASE);
+    used = __atomic_add_fetch(&chtable->used, 1, __ATOMIC_RELAXED);
+    nbuckets = tbl->nbuckets;
+    pthread_mutex_unlock(&chtable->stripes[bucket % CHTABLE_NUM_STRIPES].lock);
+    ebr_exit();
+    if (used > nbuckets) {
+        chtable_grow(chtable);
+    }
+    return 0;
+}
+
+void *chtable_get(struct chtable *chtable, const void *key)
+{
+    struct chtable_tbl *tbl;
+    struct chtable_node *node;
+    void *val = NULL;
+
+    ebr_enter();
+    tbl = __atomic_load_n(&chtable->tbl, __ATOMIC_ACQUIRE);
+    node = __atomic_load_n(&tbl->buckets[chtable->hash_fun(key,
+                           tbl->nbuckets)], __ATOMIC_ACQUIRE);
+    for (; node; node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) {
+        if (chtable->eq_fun(node->key, key)) {
+            val = node->val;
+            break;
+        }
+    }
+    ebr_exit();
+    return val;
+}
+
+void chtable_pop(struct chtable *chtable, const void *key,
+                 void **found_key, void **found_val)
+{
+    struct chtable_tbl *tbl;
+    struct chtable_node *node, **prev;
+    uint32_t bucket;
+
+    *found_key = NULL;
+    *found_val = NULL;
+    ebr_enter();
+    tbl = chtable_lock_key(chtable, key, &bucket);
+    prev = &tbl->buckets[bucket];
+    for (node = *prev; node; node = node->next) {
+        if (chtable->eq_fun(node->key, key)) {
+            break;
+        }
+        prev = &node->next;
+    }
+    if (node) {
+        // Lookups standing on this node can still follow its next pointer.
+        __atomic_store_n(prev, node->next, __ATOMIC_RELEASE);
+        __atomic_sub_fetch(&chtable->used, 1, __ATOMIC_RELAXED);
+        *found_key = node->key;
+        *found_val = node->val;
+    }
+    pthread_mutex_unlock(&chtable->stripes[bucket % CHTABLE_NUM_STRIPES].lock);
+    ebr_exit();
+    if (node) {
+        chtable_retire_node(node);
+    }
+}
+
+uint32_t chtable_used(const struct chtable *chtable)
+{
+    return __atomic_load_n(&chtable->used, __ATOMIC_RELAXED);
+}
+
+uint32_t chtable_capacity(const struct chtable *chtable)
+{
+    struct chtable_tbl *tbl;
+    uint32_t nbuckets;
+
+    ebr_enter();
+    tbl = __atomic_load_n(&chtable->tbl, __ATOMIC_ACQUIRE);
+    nbuckets = tbl->nbuckets;
+    ebr_exit();
+    return nbuckets;
+}
+
+// vim: ts=4:sw=4:tw=79:et
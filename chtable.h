@@ -0,0 +1,152 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_CHTABLE_H
+#define IOHUB_CHTABLE_H
+
+#include "htable.h"
+
+#include <stdint.h>
+
+/**
+ * A concurrent hash table.
+ *
+ * This has the same interface as struct htable, but it can be used from many
+ * threads at once.  Lookups never take a lock, and don't write to any shared
+ * cache lines.  Inserts and removals take one of a set of striped locks.
+ *
+ * Memory which a lookup might still be looking at, like a removed entry, is
+ * only freed once every lookup which was running at the time has finished.
+ * The same goes for keys and values: a key or value which has been removed
+ * from the table must not be freed until chtable_synchronize returns, or
+ * should be handed to chtable_defer_free instead.
+ */
+struct chtable;
+
+/**
+ * Allocate a new concurrent hash table.
+ *
+ * @param capacity  The minimum suggested starting capacity.
+ * @param hash_fun  The hash function to use in this hash table.  Must be safe
+ *                      to call from any thread.
+ * @param eq_fun    The equals function to use in this hash table.  Must be
+ *                      safe to call from any thread.
+ *
+ * @return          The new hash table on success; NULL on OOM.
+ */
+struct chtable *chtable_alloc(uint32_t capacity, htable_hash_fn_t hash_fun,
+                              htable_eq_fn_t eq_fun);
+
+/**
+ * Visit all of the entries in the hash table.
+ *
+ * Inserts and removals block while this runs, so the callback must not modify
+ * the table.
+ *
+ * @param chtable   The hash table.
+ * @param fun       The callback function to invoke on each key and value.
+ * @param ctx       Context pointer to pass to the callback.
+ */
+void chtable_visit(struct chtable *chtable, visitor_fn_t fun, void *ctx);
+
+/**
+ * Free the hash table.
+ *
+ * No other thread may be using the table.  It is up the calling code to ensure
+ * that the keys and values inside the table are de-allocated, if that is
+ * necessary.
+ *
+ * @param chtable   The hash table, or NULL.
+ */
+void chtable_free(struct chtable *chtable);
+
+/**
+ * Add an entry to the hash table.
+ *
+ * @param chtable   The hash table.
+ * @param key       The key to add.  This cannot be NULL.
+ * @param val       The value to add.  This cannot be NULL.
+ *
+ * @return          0 on success;
+ *                  EEXIST if the value already exists in the table;
+ *                  ENOMEM if there is not enough memory to add the element.
+ */
+int chtable_put(struct chtable *chtable, void *key, void *val);
+
+/**
+ * Get an entry from the hash table.
+ *
+ * @param chtable   The hash table.
+ * @param key       The key to find.
+ *
+ * @return          NULL if there is no such entry; the entry otherwise.
+ */
+void *chtable_get(struct chtable *chtable, const void *key);
+
+/**
+ * Get an entry from the hash table and remove it.
+ *
+ * @param chtable   The hash table.
+ * @param key       The key for the entry find and remove.
+ * @param found_key (out param) NULL if the entry was not found; the found key
+ *                      otherwise.
+ * @param found_val (out param) NULL if the entry was not found; the found
+ *                      value otherwise.
+ */
+void chtable_pop(struct chtable *chtable, const void *key,
+                 void **found_key, void **found_val);
+
+/**
+ * Get the number of entries used in the hash table.
+ *
+ * @param chtable   The hash table.
+ *
+ * @return          The number of entries used in the hash table.
+ */
+uint32_t chtable_used(const struct chtable *chtable);
+
+/**
+ * Get the number of buckets in the hash table.
+ *
+ * @param chtable   The hash table.
+ *
+ * @return          The number of buckets in the hash table.
+ */
+uint32_t chtable_capacity(const struct chtable *chtable);
+
+/**
+ * Wait until every lookup which is running now has finished.
+ *
+ * After this returns, keys and values which were removed before it was called
+ * can be freed.
+ *
+ * This must not be called from inside a visitor callback.
+ */
+void chtable_synchronize(void);
+
+/**
+ * Free some memory once every lookup which is running now has finished.
+ *
+ * @param ptr       The memory to free.
+ * @param fn        The function to free it with.
+ */
+void chtable_defer_free(void *ptr, void (*fn)(void *ptr));
+
+#endif
+
+// vim: ts=4:sw=4:tw=79:et
@@ -0,0 +1,318 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "chtable.h"
+#include "test.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Number of writer threads in the stress test. */
+#define STRESS_WRITERS 4
+
+/** Number of reader threads in the stress test. */
+#define STRESS_READERS 4
+
+/** Number of keys each writer owns. */
+#define STRESS_KEYS 2000
+
+/** Number of passes each writer makes over its keys. */
+#define STRESS_PASSES 20
+
+/** Number of keys which are always present. */
+#define STRESS_STABLE_KEYS 1000
+
+static uint32_t simple_hash(const void *key, uint32_t size)
+{
+    uintptr_t k = (uintptr_t)key;
+    return ((13 + k) * 6367) % size;
+}
+
+static int simple_compare(const void *a, const void *b)
+{
+    return a == b;
+}
+
+static uint32_t zero_hash(const void *key __attribute__((unused)),
+                          uint32_t size __attribute__((unused)))
+{
+    return 0;
+}
+
+static void expect_102(void *f, void *k, void *v)
+{
+    int *found_102 = f;
+    uintptr_t key = (uintptr_t)k;
+    uintptr_t val = (uintptr_t)v;
+
+    if ((key == 2) && (val == 102)) {
+        *found_102 = 1;
+    } else {
+        abort();
+    }
+}
+
+static void *chtable_pop_val(struct chtable *ht, void *key)
+{
+    void *old_key, *old_val;
+
+    chtable_pop(ht, key, &old_key, &old_val);
+    return old_val;
+}
+
+static int test_basic(void)
+{
+    struct chtable *ht;
+    int found_102 = 0;
+
+    ht = chtable_alloc(4, simple_hash, simple_compare);
+    EXPECT_NONNULL(ht);
+    EXPECT_INT_EQ(0, chtable_used(ht));
+    EXPECT_NULL(chtable_get(ht, (void*)123));
+    EXPECT_NULL(chtable_pop_val(ht, (void*)123));
+    EXPECT_INT_ZERO(chtable_put(ht, (void*)123, (void*)456));
+    EXPECT_INT_EQ(EEXIST, chtable_put(ht, (void*)123, (void*)789));
+    EXPECT_INT_EQ(456, (uintptr_t)chtable_get(ht, (void*)123));
+    EXPECT_INT_EQ(456, (uintptr_t)chtable_pop_val(ht, (void*)123));
+    EXPECT_NULL(chtable_pop_val(ht, (void*)123));
+
+    EXPECT_INT_ZERO(chtable_put(ht, (void*)1, (void*)101));
+    EXPECT_INT_ZERO(chtable_put(ht, (void*)2, (void*)102));
+    EXPECT_INT_ZERO(chtable_put(ht, (void*)3, (void*)103));
+    EXPECT_INT_EQ(3, chtable_used(ht));
+    EXPECT_INT_EQ(102, (uintptr_t)chtable_get(ht, (void*)2));
+    EXPECT_INT_EQ(101, (uintptr_t)chtable_pop_val(ht, (void*)1));
+    EXPECT_INT_EQ(103, (uintptr_t)chtable_pop_val(ht, (void*)3));
+    EXPECT_INT_EQ(1, chtable_used(ht));
+    chtable_visit(ht, expect_102, &found_102);
+    EXPECT_INT_EQ(1, found_102);
+    chtable_free(ht);
+    return 0;
+}
+
+static int test_grow(void)
+{
+    struct chtable *ht;
+    uintptr_t i;
+    uint32_t capacity;
+
+    ht = chtable_alloc(1, simple_hash, simple_compare);
+    EXPECT_NONNULL(ht);
+    capacity = chtable_capacity(ht);
+    for (i = 1; i <= 10000; i++) {
+        EXPECT_INT_ZERO(chtable_put(ht, (void*)i, (void*)(i + 1)));
+    }
+    EXPECT_INT_EQ(10000, chtable_used(ht));
+    EXPECT_INT_GT(chtable_capacity(ht), capacity);
+    for (i = 1; i <= 10000; i++) {
+        EXPECT_INT_EQ(i + 1, (uintptr_t)chtable_get(ht, (void*)i));
+    }
+    for (i = 1; i <= 10000; i += 2) {
+        EXPECT_INT_EQ(i + 1, (uintptr_t)chtable_pop_val(ht, (void*)i));
+    }
+    for (i = 1; i <= 10000; i++) {
+        if (i & 1) {
+            EXPECT_NULL(chtable_get(ht, (void*)i));
+        } else {
+            EXPECT_INT_EQ(i + 1, (uintptr_t)chtable_get(ht, (void*)i));
+        }
+    }
+    EXPECT_INT_EQ(5000, chtable_used(ht));
+    chtable_free(ht);
+    return 0;
+}
+
+static int test_pop_colliding(void)
+{
+    struct chtable *ht;
+
+    // Every key lands in the same bucket.
+    ht = chtable_alloc(16, zero_hash, simple_compare);
+    EXPECT_NONNULL(ht);
+    EXPECT_INT_ZERO(chtable_put(ht, (void*)1, (void*)101));
+    EXPECT_INT_ZERO(chtable_put(ht, (void*)2, (void*)102));
+    EXPECT_INT_ZERO(chtable_put(ht, (void*)3, (void*)103));
+    EXPECT_INT_EQ(102, (uintptr_t)chtable_pop_val(ht, (void*)2));
+    EXPECT_INT_EQ(101, (uintptr_t)chtable_get(ht, (void*)1));
+    EXPECT_INT_EQ(103, (uintptr_t)chtable_get(ht, (void*)3));
+    EXPECT_INT_EQ(103, (uintptr_t)chtable_pop_val(ht, (void*)3));
+    EXPECT_INT_EQ(101, (uintptr_t)chtable_get(ht, (void*)1));
+    EXPECT_INT_EQ(1, chtable_used(ht));
+    chtable_free(ht);
+    return 0;
+}
+
+static int g_deferred;
+
+static void count_deferred(void *ptr)
+{
+    __sync_fetch_and_add(&g_deferred, 1);
+    free(ptr);
+}
+
+static int test_defer_free(void)
+{
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        chtable_defer_free(malloc(16), count_deferred);
+    }
+    chtable_synchronize();
+    EXPECT_INT_EQ(10, g_deferred);
+    return 0;
+}
+
+struct stress_ctx {
+    struct chtable *ht;
+    int id;
+    int done;
+    int failed;
+};
+
+/**
+ * Keys are heap-allocated strings, so that a key freed too early would show
+ * up under a memory checker.
+ */
+static uint32_t stress_hash(const void *key, uint32_t size)
+{
+    return ht_hash_string(key, size);
+}
+
+static void *stress_writer(void *arg)
+{
+    struct stress_ctx *ctx = arg;
+    char **keys, buf[32];
+    void *fkey, *fval;
+    int i, pass;
+
+    keys = calloc(STRESS_KEYS, sizeof(char*));
+    for (pass = 0; pass < STRESS_PASSES; pass++) {
+        for (i = 0; i < STRESS_KEYS; i++) {
+            snprintf(buf, sizeof(buf), "w%d.%d", ctx->id, i);
+            keys[i] = strdup(buf);
+            if (chtable_put(ctx->ht, keys[i], (void*)(uintptr_t)(i + 1))) {
+                ctx->failed = 1;
+            }
+        }
+        for (i = 0; i < STRESS_KEYS; i++) {
+            if ((uintptr_t)chtable_get(ctx->ht, keys[i]) !=
+                    (uintptr_t)(i + 1)) {
+                ctx->failed = 1;
+            }
+        }
+        for (i = 0; i < STRESS_KEYS; i++) {
+            chtable_pop(ctx->ht, keys[i], &fkey, &fval);
+            if ((fkey != keys[i]) || ((uintptr_t)fval != (uintptr_t)(i + 1))) {
+                ctx->failed = 1;
+            }
+            // Readers may still be comparing against this key.
+            chtable_defer_free(fkey, free);
+        }
+    }
+    free(keys);
+    return NULL;
+}
+
+static void *stress_reader(void *arg)
+{
+    struct stress_ctx *ctx = arg;
+    char buf[32];
+    int i;
+
+    while (!__atomic_load_n(&ctx->done, __ATOMIC_ACQUIRE)) {
+        for (i = 0; i < STRESS_STABLE_KEYS; i++) {
+            snprintf(buf, sizeof(buf), "s%d", i);
+            if ((uintptr_t)chtable_get(ctx->ht, buf) !=
+                    (uintptr_t)(i + 1)) {
+                ctx->failed = 1;
+            }
+        }
+        // Nobody ever inserts this one.
+        if (chtable_get(ctx->ht, "missing")) {
+            ctx->failed = 1;
+        }
+    }
+    return NULL;
+}
+
+static void free_key(void *ctx __attribute__((unused)), void *key,
+                     void *val __attribute__((unused)))
+{
+    free(key);
+}
+
+static int test_stress(void)
+{
+    struct chtable *ht;
+    pthread_t writers[STRESS_WRITERS], readers[STRESS_READERS];
+    struct stress_ctx wctx[STRESS_WRITERS], rctx;
+    char buf[32];
+    int i;
+
+    ht = chtable_alloc(16, stress_hash, ht_compare_string);
+    EXPECT_NONNULL(ht);
+    for (i = 0; i < STRESS_STABLE_KEYS; i++) {
+        snprintf(buf, sizeof(buf), "s%d", i);
+        EXPECT_INT_ZERO(chtable_put(ht, strdup(buf),
+                                    (void*)(uintptr_t)(i + 1)));
+    }
+    memset(&rctx, 0, sizeof(rctx));
+    rctx.ht = ht;
+    for (i = 0; i < STRESS_READERS; i++) {
+        EXPECT_INT_ZERO(pthread_create(&readers[i], NULL,
+                                       stress_reader, &rctx));
+    }
+    for (i = 0; i < STRESS_WRITERS; i++) {
+        memset(&wctx[i], 0, sizeof(wctx[i]));
+        wctx[i].ht = ht;
+        wctx[i].id = i;
+        EXPECT_INT_ZERO(pthread_create(&writers[i], NULL,
+                                       stress_writer, &wctx[i]));
+    }
+    for (i = 0; i < STRESS_WRITERS; i++) {
+        EXPECT_INT_ZERO(pthread_join(writers[i], NULL));
+        EXPECT_INT_ZERO(wctx[i].failed);
+    }
+    __atomic_store_n(&rctx.done, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < STRESS_READERS; i++) {
+        EXPECT_INT_ZERO(pthread_join(readers[i], NULL));
+    }
+    EXPECT_INT_ZERO(rctx.failed);
+    EXPECT_INT_EQ(STRESS_STABLE_KEYS, chtable_used(ht));
+    chtable_synchronize();
+    chtable_visit(ht, free_key, NULL);
+    chtable_free(ht);
+    return 0;
+}
+
+int main(void)
+{
+    EXPECT_INT_ZERO(test_basic());
+    EXPECT_INT_ZERO(test_grow());
+    EXPECT_INT_ZERO(test_pop_colliding());
+    EXPECT_INT_ZERO(test_defer_free());
+    EXPECT_INT_ZERO(test_stress());
+
+    return EXIT_SUCCESS;
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -0,0 +1,415 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ctl.h"
+#include "fs.h"
+#include "hist.h"
+#include "op.h"
+#include "stats.h"
+#include "throttle.h"
+#include "trace.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fuse.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Room for one "name=value" field. */
+#define CTL_FIELD_MAX 48
+
+/** Number of fields in each line of the latency file. */
+#define CTL_LATENCY_FIELDS 15
+
+/** The names of the control files, indexed by node. */
+static const char * const CTL_NAMES[] = {
+    [HUB_CTL_STATS] = "stats",
+    [HUB_CTL_LATENCY] = "latency",
+    [HUB_CTL_TRACE_LEVEL] = "trace_level",
+};
+
+#define CTL_FIRST_FILE HUB_CTL_STATS
+#define CTL_LAST_FILE HUB_CTL_TRACE_LEVEL
+
+/** The SIGUSR1 dump thread. */
+static pthread_t g_dump_thread;
+
+/** Nonzero if the dump thread is running. */
+static int g_dump_running;
+
+/** Set to tell the dump thread to exit. */
+static int g_dump_stop;
+
+/** The filesystem the dump thread reports on. */
+static const struct hub_fs *g_dump_fs;
+
+enum hub_ctl_node ctl_lookup(const char *path)
+{
+    size_t len = sizeof(CTL_DIR_NAME) - 1;
+    int node;
+
+    if ((path[0] != '/') || (strncmp(path + 1, CTL_DIR_NAME, len) != 0)) {
+        return HUB_CTL_NONE;
+    }
+    path += len + 1;
+    if (path[0] == '\0') {
+        return HUB_CTL_DIR;
+    }
+    if (path[0] != '/') {
+        // Something like /.iohubfoo, which is an ordinary path.
+        return HUB_CTL_NONE;
+    }
+    for (node = CTL_FIRST_FILE; node <= CTL_LAST_FILE; node++) {
+        if (strcmp(path + 1, CTL_NAMES[node]) == 0) {
+            return node;
+        }
+    }
+    return HUB_CTL_MISSING;
+}
+
+int ctl_getattr(enum hub_ctl_node node, struct stat *stbuf)
+{
+    memset(stbuf, 0, sizeof(*stbuf));
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+    stbuf->st_atime = stbuf->st_mtime = stbuf->st_ctime = time(NULL);
+    switch (node) {
+    case HUB_CTL_DIR:
+        stbuf->st_mode = S_IFDIR | 0555;
+        stbuf->st_nlink = 2;
+        return 0;
+    case HUB_CTL_STATS:
+    case HUB_CTL_LATENCY:
+        // Like the files in /proc, we don't know how big the contents are
+        // until somebody opens the file.  Control files use direct I/O, so
+        // readers don't rely on the size.
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+        return 0;
+    case HUB_CTL_TRACE_LEVEL:
+        stbuf->st_mode = S_IFREG | 0644;
+        stbuf->st_nlink = 1;
+        return 0;
+    default:
+        return -ENOENT;
+    }
+}
+
+int ctl_readdir(void *buf, fuse_fill_dir_t filler)
+{
+    int node;
+
+    for (node = CTL_FIRST_FILE; node <= CTL_LAST_FILE; node++) {
+        if (filler(buf, CTL_NAMES[node], NULL, 0)) {
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Append a line for the UID of a class to a control file.
+ */
+static int ctl_append_uid(char *str, size_t max, uint32_t cls)
+{
+    uint32_t uid = throttle_class_uid(cls);
+
+    if (uid == UNKNOWN_UID) {
+        return snappend(str, max, "uid=unknown");
+    }
+    return snappend(str, max, "uid=%"PRIu32, uid);
+}
+
+/**
+ * Append the summary of a latency histogram to a control file.
+ */
+static int ctl_append_hist(char *str, size_t max, const char *prefix,
+                           const struct hist *h)
+{
+    return snappend(str, max, " %s_mean_ns=%"PRIu64" %s_p50_ns=%"PRIu64
+                    " %s_p99_ns=%"PRIu64" %s_p999_ns=%"PRIu64
+                    " %s_max_ns=%"PRIu64,
+                    prefix, h->count ? (h->sum / h->count) : 0,
+                    prefix, hist_percentile(h, 0.50),
+                    prefix, hist_percentile(h, 0.99),
+                    prefix, hist_percentile(h, 0.999),
+                    prefix, h->max);
+}
+
+/**
+ * Render the latency file.
+ *
+ * Each operation which a class has done gets a line of space-separated
+ * name=value fields: the UID, the operation, the number of times it was done,
+ * and the mean, percentiles and maximum of the time spent waiting for the
+ * throttler and of the service time.
+ *
+ * @param out           (out param) The snapshot.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+static int ctl_render_latency(struct hub_ctl_snap **out)
+{
+    struct hub_ctl_snap *snap;
+    struct stats_op_hist *oh;
+    uint32_t cls, op, num_classes = throttle_num_classes();
+    size_t max;
+    int ret = 0;
+
+    max = num_classes * HUB_NUM_OPS * CTL_FIELD_MAX * CTL_LATENCY_FIELDS;
+    snap = malloc(sizeof(*snap) + max + 1);
+    oh = malloc(sizeof(*oh));
+    if ((!snap) || (!oh)) {
+        free(snap);
+        free(oh);
+        return -ENOMEM;
+    }
+    snap->data[0] = '\0';
+    for (cls = 0; cls < num_classes; cls++) {
+        for (op = 0; op < HUB_NUM_OPS; op++) {
+            stats_op_sum(cls, op, oh);
+            if (oh->service.count == 0) {
+                continue;
+            }
+            ret = ctl_append_uid(snap->data, max, cls);
+            ret = ret ? ret : snappend(snap->data, max,
+                    " op=%s count=%"PRIu64, hub_op_name(op),
+                    oh->service.count);
+            ret = ret ? ret : ctl_append_hist(snap->data, max, "wait",
+                                              &oh->wait);
+            ret = ret ? ret : ctl_append_hist(snap->data, max, "svc",
+                                              &oh->service);
+            ret = ret ? ret : snappend(snap->data, max, "\n");
+            if (ret) {
+                goto done;
+            }
+        }
+    }
+    snap->node = HUB_CTL_LATENCY;
+    snap->len = strlen(snap->data);
+    *out = snap;
+done:
+    free(oh);
+    if (ret) {
+        free(snap);
+    }
+    return ret;
+}
+
+/**
+ * Render the statistics file.
+ *
+ * Each class gets a line of space-separated name=value fields: the UID, the
+ * stats.h counters, the number of threads waiting in the throttler, and the
+ * bytes and metadata units left in the current period in each domain.
+ *
+ * @param num_domains   The number of throttle domains.
+ * @param out           (out param) The snapshot.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+static int ctl_render_stats(uint32_t num_domains, struct hub_ctl_snap **out)
+{
+    struct hub_ctl_snap *snap;
+    uint64_t ctrs[HUB_NUM_STATS], bytes, meta;
+    uint32_t cls, dom, stat, num_classes = throttle_num_classes();
+    size_t max;
+    int ret;
+
+    max = num_classes * CTL_FIELD_MAX *
+        (2 + HUB_NUM_STATS + (2 * num_domains));
+    snap = malloc(sizeof(*snap) + max + 1);
+    if (!snap) {
+        return -ENOMEM;
+    }
+    snap->data[0] = '\0';
+    for (cls = 0; cls < num_classes; cls++) {
+        ret = ctl_append_uid(snap->data, max, cls);
+        stats_sum(cls, ctrs);
+        for (stat = 0; stat < HUB_NUM_STATS; stat++) {
+            ret = ret ? ret : snappend(snap->data, max, " %s=%"PRIu64,
+                                       stats_name(stat), ctrs[stat]);
+        }
+        ret = ret ? ret : snappend(snap->data, max, " queue_depth=%"PRIu32,
+                                   throttle_class_waiters(cls));
+        for (dom = 0; dom < num_domains; dom++) {
+            throttle_class_avail(cls, dom, &bytes, &meta);
+            ret = ret ? ret : snappend(snap->data, max,
+                    " dom%"PRIu32"_avail_bytes=%"PRIu64
+                    " dom%"PRIu32"_avail_meta=%"PRIu64,
+                    dom, bytes, dom, meta);
+        }
+        ret = ret ? ret : snappend(snap->data, max, "\n");
+        if (ret) {
+            free(snap);
+            return ret;
+        }
+    }
+    snap->node = HUB_CTL_STATS;
+    snap->len = strlen(snap->data);
+    *out = snap;
+    return 0;
+}
+
+/**
+ * Render the trace level file, which holds just the level.
+ *
+ * @param out           (out param) The snapshot.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+static int ctl_render_trace_level(struct hub_ctl_snap **out)
+{
+    struct hub_ctl_snap *snap;
+    size_t max = CTL_FIELD_MAX;
+
+    snap = calloc(1, sizeof(*snap) + max);
+    if (!snap) {
+        return -ENOMEM;
+    }
+    snprintf(snap->data, max, "%d\n", trace_get_level());
+    snap->node = HUB_CTL_TRACE_LEVEL;
+    snap->len = strlen(snap->data);
+    *out = snap;
+    return 0;
+}
+
+int ctl_snapshot(const struct hub_fs *fs, enum hub_ctl_node node,
+                 struct hub_ctl_snap **out)
+{
+    switch (node) {
+    case HUB_CTL_STATS:
+        return ctl_render_stats(fs->num_domains, out);
+    case HUB_CTL_LATENCY:
+        return ctl_render_latency(out);
+    case HUB_CTL_TRACE_LEVEL:
+        return ctl_render_trace_level(out);
+    case HUB_CTL_DIR:
+        return -EISDIR;
+    default:
+        return -ENOENT;
+    }
+}
+
+int ctl_read(const struct hub_ctl_snap *snap, char *buf, size_t size,
+             off_t offset)
+{
+    if ((offset < 0) || ((size_t)offset >= snap->len)) {
+        return 0;
+    }
+    if (size > snap->len - offset) {
+        size = snap->len - offset;
+    }
+    memcpy(buf, snap->data + offset, size);
+    return size;
+}
+
+int ctl_write(enum hub_ctl_node node, const char *buf, size_t size)
+{
+    char str[CTL_FIELD_MAX], *end;
+    long level;
+    int ret;
+
+    if (node != HUB_CTL_TRACE_LEVEL) {
+        return -EBADF;
+    }
+    if (size >= sizeof(str)) {
+        return -EINVAL;
+    }
+    memcpy(str, buf, size);
+    str[size] = '\0';
+    errno = 0;
+    level = strtol(str, &end, 10);
+    if ((errno) || (end == str) || (level < 0) || (level > INT_MAX)) {
+        return -EINVAL;
+    }
+    // Allow the trailing newline that echo adds.
+    while ((*end == '\n') || (*end == ' ')) {
+        end++;
+    }
+    if (*end != '\0') {
+        return -EINVAL;
+    }
+    ret = trace_set_level(level);
+    if (ret) {
+        return -ret;
+    }
+    return size;
+}
+
+static void *ctl_dump_thread(void *arg __attribute__((unused)))
+{
+    struct hub_ctl_snap *snap;
+    sigset_t set;
+    int node, sig;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    while (1) {
+        if (sigwait(&set, &sig)) {
+            continue;
+        }
+        if (__atomic_load_n(&g_dump_stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        for (node = CTL_FIRST_FILE; node <= CTL_LAST_FILE; node++) {
+            if (ctl_snapshot(g_dump_fs, node, &snap)) {
+                continue;
+            }
+            fprintf(stderr, "==== %s/%s ====\n%.*s", CTL_DIR_NAME,
+                    CTL_NAMES[node], (int)snap->len, snap->data);
+            free(snap);
+        }
+    }
+    return NULL;
+}
+
+int ctl_dump_init(const struct hub_fs *fs)
+{
+    int ret;
+
+    g_dump_fs = fs;
+    g_dump_stop = 0;
+    ret = pthread_create(&g_dump_thread, NULL, ctl_dump_thread, NULL);
+    if (ret) {
+        return ret;
+    }
+    g_dump_running = 1;
+    return 0;
+}
+
+void ctl_dump_shutdown(void)
+{
+    if (!g_dump_running) {
+        return;
+    }
+    __atomic_store_n(&g_dump_stop, 1, __ATOMIC_RELEASE);
+    pthread_kill(g_dump_thread, SIGUSR1);
+    pthread_join(g_dump_thread, NULL);
+    g_dump_running = 0;
+}
+
+// vim: ts=4:sw=4:tw=79:et
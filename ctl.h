@@ -0,0 +1,176 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_CTL_H
+#define IOHUB_CTL_H
+
+#include <fuse.h>
+#include <stdint.h>
+#include <sys/types.h> // for off_t
+
+struct hub_fs;
+struct stat;
+
+/**
+ * The control directory.
+ *
+ * iohub serves a few virtual files of its own under /.iohub, which don't
+ * exist in the underfs.  They let administrators look at what the daemon is
+ * doing without attaching a debugger:
+ *
+ *  /.iohub/stats       Per-UID counters and throttler state, one line per
+ *                          configured UID.
+ *  /.iohub/latency     Per-UID latency percentiles for each operation, split
+ *                          into throttler wait and service time.
+ *  /.iohub/trace_level The trace level (see trace.h).  Writing a number to
+ *                          this file changes it.
+ *
+ * Apart from trace_level, the control directory and its files are read-only.
+ * The same text can be written to stderr by sending the daemon SIGUSR1; see
+ * ctl_dump_init.
+ */
+
+/** The name of the control directory in the root of the mount. */
+#define CTL_DIR_NAME ".iohub"
+
+enum hub_ctl_node {
+    /** Not a control path. */
+    HUB_CTL_NONE = 0,
+
+    /** The control directory itself. */
+    HUB_CTL_DIR,
+
+    /** The statistics file. */
+    HUB_CTL_STATS,
+
+    /** The latency file. */
+    HUB_CTL_LATENCY,
+
+    /** The trace level file. */
+    HUB_CTL_TRACE_LEVEL,
+
+    /** A path under the control directory which doesn't exist. */
+    HUB_CTL_MISSING,
+};
+
+/**
+ * The contents of a control file, captured when the file was opened so that
+ * a reader sees a consistent snapshot however it splits up its reads.
+ */
+struct hub_ctl_snap {
+    /** The control node the snapshot is of. */
+    enum hub_ctl_node node;
+
+    /** Length of data in bytes. */
+    size_t len;
+
+    /** The text. */
+    char data[0];
+};
+
+/**
+ * Find out whether a path refers to the control directory.
+ *
+ * @param path          The overfs path.
+ *
+ * @return              The control node, or HUB_CTL_NONE if the path is an
+ *                          ordinary underfs path.
+ */
+enum hub_ctl_node ctl_lookup(const char *path);
+
+/**
+ * Get the attributes of a control node.
+ *
+ * @param node          The control node.
+ * @param stbuf         (out param) The attributes.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+int ctl_getattr(enum hub_ctl_node node, struct stat *stbuf);
+
+/**
+ * List the control directory.
+ *
+ * @param buf           The buffer to pass to filler.
+ * @param filler        The FUSE directory filler.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+int ctl_readdir(void *buf, fuse_fill_dir_t filler);
+
+/**
+ * Capture the contents of a control file.
+ *
+ * @param fs            The filesystem.
+ * @param node          The control node.
+ * @param out           (out param) The snapshot.  Free it with free().
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+int ctl_snapshot(const struct hub_fs *fs, enum hub_ctl_node node,
+                 struct hub_ctl_snap **out);
+
+/**
+ * Read from a control file snapshot.
+ *
+ * @param snap          The snapshot.
+ * @param buf           The buffer to read into.
+ * @param size          The size of buf.
+ * @param offset        The offset to read from.
+ *
+ * @return              The number of bytes read.
+ */
+int ctl_read(const struct hub_ctl_snap *snap, char *buf, size_t size,
+             off_t offset);
+
+/**
+ * Write to a control file.
+ *
+ * Writes are not buffered, so each one must hold a whole value.
+ *
+ * @param node          The control node.
+ * @param buf           The data to write.
+ * @param size          The size of buf.
+ *
+ * @return              The number of bytes written; negative error code
+ *                          otherwise.
+ */
+int ctl_write(enum hub_ctl_node node, const char *buf, size_t size);
+
+/**
+ * Start a thread which writes the contents of the control files to stderr
+ * whenever the daemon gets SIGUSR1.
+ *
+ * SIGUSR1 must be blocked in every thread, so that only this one receives it.
+ * Since this starts a thread, it must be called after FUSE daemonizes.
+ *
+ * @param fs            The filesystem.  Must remain valid until
+ *                          ctl_dump_shutdown.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+int ctl_dump_init(const struct hub_fs *fs);
+
+/**
+ * Stop the thread started by ctl_dump_init, if it is running.
+ */
+void ctl_dump_shutdown(void);
+
+#endif
+
+// vim: ts=4:sw=4:et
@@ -0,0 +1,317 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fdcache.h"
+#include "htable.h"
+#include "log.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Flags which only affect opening the file, and not what can be done with
+ * the fd afterwards.
+ */
+#define FDCACHE_OPEN_FLAGS \
+    (O_CREAT | O_EXCL | O_TRUNC | O_NOCTTY | O_NOFOLLOW | O_CLOEXEC)
+
+/**
+ * A parked fd.
+ */
+struct fdcache_ent {
+    /** The key.  The first entry with a key is what g_fdcache maps it to. */
+    struct fdcache_key key;
+
+    /** The fd, or -1 if this entry is free. */
+    int fd;
+
+    /** Next entry with the same key, or the next free entry. */
+    struct fdcache_ent *next;
+
+    /** Next more recently parked entry. */
+    struct fdcache_ent *newer;
+
+    /** Next less recently parked entry. */
+    struct fdcache_ent *older;
+};
+
+/** Protects everything below. */
+static pthread_mutex_t g_fdcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Maps keys to parked fds, or NULL if the cache is disabled. */
+static struct htable *g_fdcache;
+
+/** All the entries. */
+static struct fdcache_ent *g_fdcache_ents;
+
+/** The free entries. */
+static struct fdcache_ent *g_fdcache_free;
+
+/** The most recently parked entry. */
+static struct fdcache_ent *g_fdcache_newest;
+
+/** The least recently parked entry. */
+static struct fdcache_ent *g_fdcache_oldest;
+
+/**
+ * Number of parked fds.  Only modified with g_fdcache_lock held, but may be
+ * read without it via atomic operations.
+ */
+static uint32_t g_fdcache_len;
+
+/** Most fds to park. */
+static uint32_t g_fdcache_max;
+
+static uint32_t fdcache_hash(const void *key, uint32_t capacity)
+{
+    const struct fdcache_key *k = key;
+    uint64_t h = (((((uint64_t)k->dev) * 31) + k->ino) * 31) + k->flags;
+
+    return (uint32_t)((h ^ (h >> 32)) % capacity);
+}
+
+static int fdcache_eq(const void *a, const void *b)
+{
+    const struct fdcache_key *ka = a, *kb = b;
+
+    return (ka->dev == kb->dev) && (ka->ino == kb->ino) &&
+        (ka->flags == kb->flags);
+}
+
+/**
+ * Remove an entry from the cache and free it.
+ *
+ * Must be called with g_fdcache_lock held.
+ *
+ * @param ent           The entry.
+ *
+ * @return              The entry's fd, which the caller now owns.
+ */
+static int fdcache_remove(struct fdcache_ent *ent)
+{
+    struct fdcache_ent *head, **cur;
+    void *found_key, *found_val;
+    int fd = ent->fd;
+
+    head = htable_get(g_fdcache, &ent->key);
+    if (head == ent) {
+        // The table points at the entry's key, so it has to be re-added
+        // with the next entry's.
+        htable_pop(g_fdcache, &ent->key, &found_key, &found_val);
+        if (ent->next) {
+            // This can't fail.  See fdcache_init.
+            htable_put(g_fdcache, &ent->next->key, ent->next);
+        }
+    } else {
+        for (cur = &head->next; *cur != ent; cur = &(*cur)->next) {
+            ;
+        }
+        *cur = ent->next;
+    }
+    if (ent->newer) {
+        ent->newer->older = ent->older;
+    } else {
+        g_fdcache_newest = ent->older;
+    }
+    if (ent->older) {
+        ent->older->newer = ent->newer;
+    } else {
+        g_fdcache_oldest = ent->newer;
+    }
+    __atomic_store_n(&g_fdcache_len, g_fdcache_len - 1, __ATOMIC_RELAXED);
+    memset(ent, 0, sizeof(*ent));
+    ent->fd = -1;
+    ent->next = g_fdcache_free;
+    g_fdcache_free = ent;
+    return fd;
+}
+
+int fdcache_init(unsigned int max_fds)
+{
+    struct rlimit rlim;
+    uint32_t i;
+
+    if (max_fds == 0) {
+        return 0;
+    }
+    if ((getrlimit(RLIMIT_NOFILE, &rlim) == 0) &&
+            (rlim.rlim_cur != RLIM_INFINITY) &&
+            (max_fds > rlim.rlim_cur / 4)) {
+        max_fds = rlim.rlim_cur / 4;
+        fprintf(stderr, "fdcache_init: RLIMIT_NOFILE is %lld, so only "
+                "parking up to %u fds.\n", (long long)rlim.rlim_cur, max_fds);
+        if (max_fds == 0) {
+            return 0;
+        }
+    }
+    pthread_mutex_lock(&g_fdcache_lock);
+    // There are never more keys than fds, so the table never has to grow,
+    // and adding to it never fails.
+    g_fdcache = htable_alloc((max_fds * 2) + 2, fdcache_hash, fdcache_eq);
+    if (!g_fdcache) {
+        pthread_mutex_unlock(&g_fdcache_lock);
+        return ENOMEM;
+    }
+    g_fdcache_ents = xcalloc(max_fds, sizeof(struct fdcache_ent));
+    for (i = 0; i < max_fds; i++) {
+        g_fdcache_ents[i].fd = -1;
+        g_fdcache_ents[i].next = g_fdcache_free;
+        g_fdcache_free = &g_fdcache_ents[i];
+    }
+    g_fdcache_max = max_fds;
+    pthread_mutex_unlock(&g_fdcache_lock);
+    return 0;
+}
+
+void fdcache_shutdown(void)
+{
+    fdcache_shrink();
+    pthread_mutex_lock(&g_fdcache_lock);
+    if (g_fdcache) {
+        htable_free(g_fdcache);
+        g_fdcache = NULL;
+    }
+    free(g_fdcache_ents);
+    g_fdcache_ents = NULL;
+    g_fdcache_free = NULL;
+    g_fdcache_max = 0;
+    pthread_mutex_unlock(&g_fdcache_lock);
+}
+
+int fdcache_get(const char *bpath, int flags, struct fdcache_key *key)
+{
+    struct fdcache_ent *ent;
+    struct stat st;
+    int fd = -1;
+
+    memset(key, 0, sizeof(*key));
+    key->flags = flags & ~FDCACHE_OPEN_FLAGS;
+    // O_TRUNC and O_EXCL have effects which we can only get by opening the
+    // file.  If nothing is parked, there's no point in looking the file up.
+    if ((flags & (O_TRUNC | O_EXCL)) ||
+            (__atomic_load_n(&g_fdcache_len, __ATOMIC_RELAXED) == 0)) {
+        return -1;
+    }
+    if (((flags & O_NOFOLLOW) ? lstat(bpath, &st) : stat(bpath, &st)) < 0) {
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        return -1;
+    }
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    pthread_mutex_lock(&g_fdcache_lock);
+    if (g_fdcache) {
+        ent = htable_get(g_fdcache, key);
+        if (ent) {
+            fd = fdcache_remove(ent);
+        }
+    }
+    pthread_mutex_unlock(&g_fdcache_lock);
+    DEBUG("fdcache_get(bpath=%s, dev=%"PRId64", ino=%"PRId64") = %d\n",
+          bpath, (int64_t)key->dev, (int64_t)key->ino, fd);
+    return fd;
+}
+
+int fdcache_put(const struct fdcache_key *key, int fd)
+{
+    struct fdcache_key fkey = *key;
+    struct fdcache_ent *ent, *head;
+    void *found_key, *found_val;
+    struct stat st;
+    int evicted = -1;
+
+    if (!__atomic_load_n(&g_fdcache_max, __ATOMIC_RELAXED)) {
+        goto close_fd;
+    }
+    if (fkey.ino == 0) {
+        // We didn't know which file this was when we opened it, probably
+        // because we created it.
+        if ((fstat(fd, &st) < 0) || (!S_ISREG(st.st_mode))) {
+            goto close_fd;
+        }
+        fkey.dev = st.st_dev;
+        fkey.ino = st.st_ino;
+    }
+    pthread_mutex_lock(&g_fdcache_lock);
+    if (!g_fdcache) {
+        pthread_mutex_unlock(&g_fdcache_lock);
+        goto close_fd;
+    }
+    if (!g_fdcache_free) {
+        evicted = fdcache_remove(g_fdcache_oldest);
+    }
+    ent = g_fdcache_free;
+    g_fdcache_free = ent->next;
+    ent->key = fkey;
+    ent->fd = fd;
+    htable_pop(g_fdcache, &fkey, &found_key, &found_val);
+    head = found_val;
+    ent->next = head;
+    htable_put(g_fdcache, &ent->key, ent);
+    ent->older = g_fdcache_newest;
+    ent->newer = NULL;
+    if (g_fdcache_newest) {
+        g_fdcache_newest->newer = ent;
+    } else {
+        g_fdcache_oldest = ent;
+    }
+    g_fdcache_newest = ent;
+    __atomic_store_n(&g_fdcache_len, g_fdcache_len + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g_fdcache_lock);
+    if (evicted >= 0) {
+        close(evicted);
+    }
+    return 0;
+
+close_fd:
+    if (close(fd) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+int fdcache_shrink(void)
+{
+    int fd, nclosed = 0;
+
+    while (1) {
+        pthread_mutex_lock(&g_fdcache_lock);
+        if (!g_fdcache_oldest) {
+            pthread_mutex_unlock(&g_fdcache_lock);
+            break;
+        }
+        fd = fdcache_remove(g_fdcache_oldest);
+        pthread_mutex_unlock(&g_fdcache_lock);
+        close(fd);
+        nclosed++;
+    }
+    return nclosed;
+}
+
+// vim: ts=4:sw=4:tw=79:et
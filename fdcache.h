@@ -0,0 +1,106 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_FDCACHE_H
+#define IOHUB_FDCACHE_H
+
+#include <sys/types.h> // for dev_t, ino_t
+
+/**
+ * The backing-fd cache.
+ *
+ * Opening a file through iohub costs an open() on the underfs, and releasing
+ * it costs a close().  Workloads which open and close the same files over
+ * and over, like config files or an object store's hot objects, pay for both
+ * every time.  Instead, hub_release parks the backing fd here, and the next
+ * open of the same file with the same flags takes it back, so a reopen costs
+ * a single stat().
+ *
+ * Parked fds are keyed by the device and inode number of the file and the
+ * flags it was opened with, so an fd is only reused if the path still names
+ * the same file.  All our I/O is positional, so the file offset of a parked
+ * fd doesn't matter.  The kernel has already checked permissions by the time
+ * we open anything, since we mount with default_permissions.
+ *
+ * The cache holds a bounded number of fds, and evicts the least recently
+ * parked one when it is full.  The bound is capped at a quarter of
+ * RLIMIT_NOFILE, so that parked fds never crowd out open files.  A parked fd
+ * for a file which has since been deleted keeps its space allocated until
+ * it is evicted.
+ */
+
+struct fdcache_key {
+    /** Device of the backing file, or 0 if unknown. */
+    dev_t dev;
+
+    /** Inode number of the backing file, or 0 if unknown. */
+    ino_t ino;
+
+    /** The open flags, less those which only affect opening the file. */
+    int flags;
+};
+
+/**
+ * Start the backing-fd cache.
+ *
+ * @param max_fds       Most fds to park.  0 disables the cache.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+int fdcache_init(unsigned int max_fds);
+
+/**
+ * Close every parked fd and stop the backing-fd cache.
+ */
+void fdcache_shutdown(void);
+
+/**
+ * Take a parked fd for a file.
+ *
+ * @param bpath         The backing path.
+ * @param flags         The flags to open the file with.
+ * @param key           (out param) The key to park the fd under when the
+ *                          file is released.  The device and inode are 0 if
+ *                          we couldn't find them out.
+ *
+ * @return              The fd, or -1 if there is no suitable parked fd and
+ *                          the caller must open the file itself.
+ */
+int fdcache_get(const char *bpath, int flags, struct fdcache_key *key);
+
+/**
+ * Park an fd, or close it if the cache is disabled.
+ *
+ * @param key           The key from fdcache_get.
+ * @param fd            The fd.  The cache owns it after this call.
+ *
+ * @return              0 on success; negative error code if we closed the fd
+ *                          and close failed.
+ */
+int fdcache_put(const struct fdcache_key *key, int fd);
+
+/**
+ * Close every parked fd, to make room when we run out of fds.
+ *
+ * @return              The number of fds closed.
+ */
+int fdcache_shrink(void);
+
+#endif
+
+// vim: ts=4:sw=4:et
@@ -0,0 +1,128 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fdcache.h"
+#include "log.h"
+#include "test.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FDCACHE_TEST_MAX 2
+
+static int open_file(const char *path, int flags, struct fdcache_key *key)
+{
+    int fd;
+
+    fd = fdcache_get(path, flags, key);
+    if (fd < 0) {
+        fd = open(path, flags, 0644);
+    }
+    return fd;
+}
+
+static int test_reuse(const char *path)
+{
+    struct fdcache_key key;
+    int fd, fd2;
+
+    fd = open_file(path, O_RDWR | O_CREAT, &key);
+    EXPECT_INT_NONNEGATIVE(fd);
+    // We created the file, so we didn't know which one it was.
+    EXPECT_INT_ZERO(key.ino);
+    EXPECT_INT_ZERO(fdcache_put(&key, fd));
+    // The same flags get the same fd back.
+    fd2 = fdcache_get(path, O_RDWR, &key);
+    EXPECT_INT_EQ(fd, fd2);
+    EXPECT_INT_NE(0, key.ino);
+    EXPECT_INT_ZERO(fdcache_put(&key, fd2));
+    // Different flags don't.
+    EXPECT_INT_EQ(-1, fdcache_get(path, O_RDONLY, &key));
+    // Nor does O_TRUNC.
+    EXPECT_INT_EQ(-1, fdcache_get(path, O_RDWR | O_TRUNC, &key));
+    fd2 = fdcache_get(path, O_RDWR | O_CREAT, &key);
+    EXPECT_INT_EQ(fd, fd2);
+    EXPECT_INT_ZERO(fdcache_put(&key, fd2));
+    return 0;
+}
+
+static int test_replaced(const char *path)
+{
+    struct fdcache_key key;
+    int fd;
+
+    // Once the path names a different file, the parked fd isn't used.
+    EXPECT_POSIX_SUCC(unlink(path));
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    EXPECT_INT_NONNEGATIVE(fd);
+    close(fd);
+    EXPECT_INT_EQ(-1, fdcache_get(path, O_RDWR, &key));
+    return 0;
+}
+
+static int test_evict(const char *dir)
+{
+    char path[FDCACHE_TEST_MAX + 1][PATH_MAX];
+    struct fdcache_key key;
+    int i, fd;
+
+    for (i = 0; i < FDCACHE_TEST_MAX + 1; i++) {
+        snprintf(path[i], sizeof(path[i]), "%s/evict%d", dir, i);
+        fd = open_file(path[i], O_RDONLY | O_CREAT, &key);
+        EXPECT_INT_NONNEGATIVE(fd);
+        EXPECT_INT_ZERO(fdcache_put(&key, fd));
+    }
+    // The least recently parked fd was evicted to make room for the last.
+    EXPECT_INT_EQ(-1, fdcache_get(path[0], O_RDONLY, &key));
+    for (i = 1; i < FDCACHE_TEST_MAX + 1; i++) {
+        fd = fdcache_get(path[i], O_RDONLY, &key);
+        EXPECT_INT_NONNEGATIVE(fd);
+        EXPECT_INT_ZERO(fdcache_put(&key, fd));
+    }
+    EXPECT_INT_EQ(FDCACHE_TEST_MAX, fdcache_shrink());
+    EXPECT_INT_EQ(-1, fdcache_get(path[1], O_RDONLY, &key));
+    for (i = 0; i < FDCACHE_TEST_MAX + 1; i++) {
+        unlink(path[i]);
+    }
+    return 0;
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/fdcache_unit.XXXXXX";
+    char path[PATH_MAX];
+
+    die_if(!mkdtemp(dir));
+    snprintf(path, sizeof(path), "%s/file", dir);
+    EXPECT_INT_ZERO(fdcache_init(FDCACHE_TEST_MAX));
+    EXPECT_INT_ZERO(test_reuse(path));
+    EXPECT_INT_ZERO(test_replaced(path));
+    EXPECT_INT_ZERO(test_evict(dir));
+    fdcache_shutdown();
+    unlink(path);
+    rmdir(dir);
+    return EXIT_SUCCESS;
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -16,10 +16,21 @@
  * limitations under the License.
  */
 
+#include "backend.h"
+#include "cache.h"
+#include "ctl.h"
+#include "fdcache.h"
 #include "file.h"
 #include "fs.h"
+#include "htable.h"
 #include "log.h"
+#include "pool.h"
+#include "readahead.h"
+#include "stats.h"
+#include "stripe.h"
+#include "syncq.h"
 #include "throttle.h"
+#include "trace.h"
 #include "util.h"
 
 #include <ctype.h>
@@ -28,23 +39,570 @@
 #include <fcntl.h>
 #include <fuse.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/xattr.h>
 #include <unistd.h>
 
+/**
+ * A write-behind buffer, which coalesces small sequential writes into larger
+ * ones.
+ */
+struct hub_wbuf {
+    /** The buffered data, or NULL if we haven't buffered anything yet. */
+    char *data;
+
+    /** Number of bytes of buffered data. */
+    size_t len;
+
+    /** File offset of the first byte of buffered data. */
+    off_t off;
+
+    /** UID whose budget the buffered data will be charged to. */
+    uint32_t uid;
+
+    /** Monotonic time at which the oldest buffered data was added. */
+    uint64_t since_ns;
+
+    /**
+     * Negative error code from a failed flush which nobody has been told
+     * about yet, or 0.
+     */
+    int err;
+};
+
+/**
+ * Write smoothing state.
+ *
+ * Rather than leaving everything written to a file in the underfs page cache
+ * for the kernel to write out in bursts, we start writeback of each window of
+ * data once it has been written, and then wait for the window before it to
+ * reach the disk.  That keeps each file down to about two windows of dirty
+ * data, and the writer pays for its own writeback.
+ */
+struct hub_smooth {
+    /** Bytes in each window, or 0 if smoothing is disabled.  Immutable. */
+    uint64_t window;
+
+    /** Protects everything below. */
+    pthread_mutex_t lock;
+
+    /** Start of the range written to since we last started writeback. */
+    off_t lo;
+
+    /** End of that range.  Equal to lo if the range is empty. */
+    off_t hi;
+
+    /** Bytes written to that range. */
+    uint64_t pending;
+
+    /** Start of the range we last started writeback on. */
+    off_t prev_lo;
+
+    /** End of that range.  Equal to prev_lo if the range is empty. */
+    off_t prev_hi;
+};
+
 struct hub_file {
     int fd;
+
+    /** The throttle domain of the backend the file is on.  Immutable. */
+    uint32_t domain;
+
+    /** The trace_path_id of the path the file was opened with.  Immutable. */
+    uint64_t path_id;
+
+    /**
+     * The key to park fd under in the fd cache when the file is released, if
+     * the file isn't striped.  Immutable.
+     */
+    struct fdcache_key fd_key;
+
+    /**
+     * Bytes written through this file since the last fsync.  This is what we
+     * charge the next fsync for, since that's roughly how much the fsync
+     * will force out to the disk.
+     *
+     * This must be accessed via atomic operations.
+     */
+    uint64_t dirty;
+
+    /** Nonzero if writes to this file may be buffered.  Immutable. */
+    int wb_enabled;
+
+    /** Protects wb. */
+    pthread_mutex_t lock;
+
+    /** The write-behind buffer. */
+    struct hub_wbuf wb;
+
+    /** Write smoothing state. */
+    struct hub_smooth smooth;
+
+    /** Read-ahead state, or NULL if we don't read ahead on this file. */
+    struct hub_ra *ra;
+
+    /** Nonzero if this file is in the cache tier.  Immutable. */
+    int cached;
+
+    /** The cache ID of this file, if cached is set.  Immutable. */
+    struct hub_cache_id cache_id;
+
+    /**
+     * The member files.  If the file is not striped, this just points at fd.
+     * Otherwise, fd is the first member.  Immutable.
+     */
+    struct hub_stripe stripe;
+
+    /**
+     * The contents of a control file, or NULL if this is an underfs file.
+     * Control files have no member files.  Immutable.
+     */
+    struct hub_ctl_snap *ctl;
 };
 
+/**
+ * Where struct hub_file comes from.  A file is allocated on every open and
+ * freed on every release, often on different threads.
+ */
+static struct pool g_file_pool = POOL_INITIALIZER(sizeof(struct hub_file));
+
+/**
+ * Open the members of a striped file other than the first.
+ *
+ * @param be            The striped backend.
+ * @param path          The overfs path.
+ * @param flags         The flags the first member was opened with.
+ * @param mode          The mode the first member was opened with.
+ * @param file          The file.  file->fd must already be open.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+static int hub_open_members(const struct hub_backend *be, const char *path,
+            int flags, mode_t mode, struct hub_file *file)
+{
+    char bpath[PATH_MAX];
+    unsigned int i;
+
+    file->stripe.fds = calloc(be->nroots, sizeof(int));
+    if (!file->stripe.fds) {
+        file->stripe.fds = &file->fd;
+        return -ENOMEM;
+    }
+    file->stripe.fds[0] = file->fd;
+    file->stripe.nfds = 1;
+    file->stripe.stripe_size = be->stripe_size;
+    // The first member has already been exclusively created, if that was
+    // asked for.
+    flags &= ~O_EXCL;
+    for (i = 1; i < be->nroots; i++) {
+        backend_member_path(be, i, path, bpath, sizeof(bpath));
+        file->stripe.fds[i] = open(bpath, flags, mode);
+        if (file->stripe.fds[i] < 0) {
+            return -errno;
+        }
+        file->stripe.nfds++;
+    }
+    return 0;
+}
+
+/**
+ * Close all the backing files of a file.
+ *
+ * @param file          The file.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+static int hub_close_members(struct hub_file *file)
+{
+    unsigned int i;
+    int ret = 0;
+
+    for (i = 0; i < file->stripe.nfds; i++) {
+        if (close(file->stripe.fds[i]) < 0) {
+            // Portability: HP/UX has "issues" where close will sometimes
+            // fail with EINTR.  But we can't just retry because that would
+            // cause problems on Linux.
+            ret = -errno;
+        }
+    }
+    if (file->stripe.fds != &file->fd) {
+        free(file->stripe.fds);
+    }
+    file->stripe.fds = &file->fd;
+    file->stripe.nfds = 0;
+    file->fd = -1;
+    return ret;
+}
+
+/**
+ * The version of a backing file that the kernel page cache may hold data
+ * for.
+ */
+struct hub_ino_ver {
+    /** Device and inode number of the backing file.  This is the key. */
+    dev_t dev;
+    ino_t ino;
+
+    /** Modification time of the backing file when we last opened it. */
+    struct timespec mtime;
+
+    /** Size of the backing file when we last opened it. */
+    off_t size;
+};
+
+/**
+ * Maximum number of entries in g_ino_vers.  When we hit this, we just start
+ * over, which costs us nothing more than some unnecessary cache
+ * invalidations.
+ */
+#define MAX_INO_VERS 65536
+
+/** Protects g_ino_vers. */
+static pthread_mutex_t g_ino_vers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Maps backing files opened with the page cache enabled to the version of
+ * the file we last opened.
+ */
+static struct htable *g_ino_vers;
+
+static uint32_t ino_ver_hash(const void *key, uint32_t capacity)
+{
+    const struct hub_ino_ver *ver = key;
+    uint64_t h = (((uint64_t)ver->dev) * 31) + ver->ino;
+
+    return (uint32_t)((h ^ (h >> 32)) % capacity);
+}
+
+static int ino_ver_eq(const void *a, const void *b)
+{
+    const struct hub_ino_ver *va = a, *vb = b;
+
+    return (va->dev == vb->dev) && (va->ino == vb->ino);
+}
+
+static void free_ino_ver(void *ctx __attribute__((unused)),
+                         void *key __attribute__((unused)), void *val)
+{
+    free(val);
+}
+
+/**
+ * Determine whether the kernel may keep the data it has cached for a file.
+ *
+ * The cached data is still good if the backing file has the same
+ * modification time and size as it did the last time we opened it.
+ *
+ * @param fd            The backing file descriptor.
+ *
+ * @return              1 if the cached data is still good; 0 otherwise.
+ */
+static int hub_keep_cache(int fd)
+{
+    struct stat st;
+    struct hub_ino_ver key, *ver;
+    int keep = 0;
+
+    if (fstat(fd, &st) < 0) {
+        return 0;
+    }
+    memset(&key, 0, sizeof(key));
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    pthread_mutex_lock(&g_ino_vers_lock);
+    if ((!g_ino_vers) || (htable_used(g_ino_vers) >= MAX_INO_VERS)) {
+        if (g_ino_vers) {
+            htable_visit(g_ino_vers, free_ino_ver, NULL);
+            htable_free(g_ino_vers);
+        }
+        g_ino_vers = htable_alloc(128, ino_ver_hash, ino_ver_eq);
+        if (!g_ino_vers) {
+            goto done;
+        }
+    }
+    ver = htable_get(g_ino_vers, &key);
+    if (ver) {
+        keep = (ver->mtime.tv_sec == st.st_mtim.tv_sec) &&
+            (ver->mtime.tv_nsec == st.st_mtim.tv_nsec) &&
+            (ver->size == st.st_size);
+    } else {
+        ver = calloc(1, sizeof(*ver));
+        if (!ver) {
+            goto done;
+        }
+        ver->dev = st.st_dev;
+        ver->ino = st.st_ino;
+        if (htable_put(g_ino_vers, ver, ver)) {
+            free(ver);
+            goto done;
+        }
+    }
+    ver->mtime = st.st_mtim;
+    ver->size = st.st_size;
+done:
+    pthread_mutex_unlock(&g_ino_vers_lock);
+    return keep;
+}
+
+/**
+ * Take some bytes off a file's dirty count, without going below zero.
+ *
+ * @param file          The file.
+ * @param amt           The number of bytes.
+ */
+static void hub_undirty(struct hub_file *file, uint64_t amt)
+{
+    uint64_t old, new;
+
+    old = __atomic_load_n(&file->dirty, __ATOMIC_RELAXED);
+    do {
+        new = (old > amt) ? (old - amt) : 0;
+    } while (!__atomic_compare_exchange_n(&file->dirty, &old, new, 0,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * Note that some data has been written to a file, and if a window's worth
+ * has built up, start writing it out to the disk and wait for the previous
+ * window.
+ *
+ * Writeback is charged to the writer.  Since the next fsync won't have to
+ * write that data out, it comes off what the fsync is charged for.
+ *
+ * @param file          The file.
+ * @param uid           The UID which did the write.
+ * @param off           Offset of the data.
+ * @param len           Length of the data.
+ */
+static void hub_smooth_write(struct hub_file *file, uint32_t uid, off_t off,
+                             uint64_t len)
+{
+    struct hub_smooth *sm = &file->smooth;
+    off_t end = off + len, lo, hi, prev_lo, prev_hi;
+    uint64_t amt;
+
+    if ((sm->window == 0) || (len == 0)) {
+        return;
+    }
+    pthread_mutex_lock(&sm->lock);
+    if (sm->lo == sm->hi) {
+        sm->lo = off;
+        sm->hi = end;
+    } else {
+        sm->lo = (off < sm->lo) ? off : sm->lo;
+        sm->hi = (end > sm->hi) ? end : sm->hi;
+    }
+    sm->pending += len;
+    if (sm->pending < sm->window) {
+        pthread_mutex_unlock(&sm->lock);
+        return;
+    }
+    lo = sm->lo;
+    hi = sm->hi;
+    amt = sm->pending;
+    prev_lo = sm->prev_lo;
+    prev_hi = sm->prev_hi;
+    sm->prev_lo = lo;
+    sm->prev_hi = hi;
+    sm->lo = sm->hi = 0;
+    sm->pending = 0;
+    pthread_mutex_unlock(&sm->lock);
+
+    throttle(file->domain, uid, amt);
+    hub_undirty(file, amt);
+    // Get the disk going on this window before we wait for the last one.
+    // Failures here just leave the data for the kernel or the next fsync to
+    // write out, so we don't report them.
+    if (sync_file_range(file->fd, lo, hi - lo, SYNC_FILE_RANGE_WRITE) < 0) {
+        DEBUG("hub_smooth_write(fd=%d): sync_file_range(%"PRId64", "
+              "%"PRId64") failed: %d\n", file->fd, (int64_t)lo,
+              (int64_t)(hi - lo), errno);
+    }
+    if ((prev_hi > prev_lo) && (sync_file_range(file->fd, prev_lo,
+                prev_hi - prev_lo, SYNC_FILE_RANGE_WAIT_BEFORE |
+                SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) < 0)) {
+        DEBUG("hub_smooth_write(fd=%d): waiting for (%"PRId64", %"PRId64") "
+              "failed: %d\n", file->fd, (int64_t)prev_lo,
+              (int64_t)(prev_hi - prev_lo), errno);
+    }
+}
+
+/**
+ * Write out a file's write-behind buffer, followed by some data which is
+ * contiguous with it, in a single pwritev.
+ *
+ * The buffer is empty afterwards, even if the write failed.  Must be called
+ * with the file lock held.
+ *
+ * @param file          The file.
+ * @param extra         Data to write after the buffered data, or NULL.
+ * @param extra_len     Length of extra.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+static int hub_wbuf_flush(struct hub_file *file, const char *extra,
+                          size_t extra_len)
+{
+    struct hub_wbuf *wb = &file->wb;
+    struct iovec iov[2];
+    int iovcnt = 0, ret;
+    uint64_t total = wb->len + extra_len;
+
+    if (total == 0) {
+        return 0;
+    }
+    if (wb->len > 0) {
+        iov[iovcnt].iov_base = wb->data;
+        iov[iovcnt].iov_len = wb->len;
+        iovcnt++;
+    }
+    if (extra_len > 0) {
+        iov[iovcnt].iov_base = (char*)extra;
+        iov[iovcnt].iov_len = extra_len;
+        iovcnt++;
+    }
+    throttle(file->domain, wb->uid, total);
+    ret = pwritev_fully(file->fd, iov, iovcnt, wb->off);
+    if (ret == 0) {
+        __sync_fetch_and_add(&file->dirty, total);
+        hub_smooth_write(file, wb->uid, wb->off, total);
+    }
+    if (file->cached) {
+        cache_invalidate(&file->cache_id);
+    }
+    DEBUG("hub_wbuf_flush(fd=%d, off=%"PRId64", len=%"PRId64", "
+          "uid=%"PRId32") = %d\n", file->fd, (int64_t)wb->off, total,
+          wb->uid, ret);
+    wb->len = 0;
+    return ret;
+}
+
+/**
+ * Write out everything in a file's write-behind buffer.
+ *
+ * @param file          The file.
+ * @param take_err      If nonzero, return and clear any error from an earlier
+ *                          flush.  Otherwise, leave such errors for a later
+ *                          flush or fsync to report.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+static int hub_wbuf_sync(struct hub_file *file, int take_err)
+{
+    int ret;
+
+    if (!file->wb_enabled) {
+        return 0;
+    }
+    pthread_mutex_lock(&file->lock);
+    ret = hub_wbuf_flush(file, NULL, 0);
+    if (take_err) {
+        if (file->wb.err) {
+            ret = file->wb.err;
+        }
+        file->wb.err = 0;
+    } else if (ret && !file->wb.err) {
+        file->wb.err = ret;
+    }
+    pthread_mutex_unlock(&file->lock);
+    return ret;
+}
+
+/**
+ * Write some data through a file's write-behind buffer.
+ *
+ * @param fs            The filesystem.
+ * @param file          The file.
+ * @param uid           The UID doing the write.
+ * @param buf           The data to write.
+ * @param size          Length of buf.
+ * @param offset        File offset to write at.
+ *
+ * @return              size on success; negative error code otherwise.
+ */
+static int hub_wbuf_write(const struct hub_fs *fs, struct hub_file *file,
+                    uint32_t uid, const char *buf, size_t size, off_t offset)
+{
+    struct hub_wbuf *wb = &file->wb;
+    uint64_t now = monotonic_now_ns();
+    int ret = 0;
+
+    pthread_mutex_lock(&file->lock);
+    if (wb->err) {
+        ret = wb->err;
+        wb->err = 0;
+        goto done;
+    }
+    if (wb->len > 0) {
+        if ((offset != wb->off + (off_t)wb->len) || (uid != wb->uid) ||
+                (now - wb->since_ns > fs->wb_max_age_ms * 1000000ULL)) {
+            // We can't (or shouldn't) add this write to the buffer.  Write out
+            // what we have, and start again.
+            ret = hub_wbuf_flush(file, NULL, 0);
+            if (ret) {
+                goto done;
+            }
+        } else if (wb->len + size > fs->wb_size) {
+            // This write continues the buffered data, but doesn't fit.  Write
+            // them both out together.
+            ret = hub_wbuf_flush(file, buf, size);
+            goto done;
+        }
+    }
+    if (!wb->data) {
+        wb->data = malloc(fs->wb_size);
+    }
+    if ((size >= fs->wb_size) || (!wb->data)) {
+        // Large writes go straight through.
+        wb->off = offset;
+        wb->uid = uid;
+        ret = hub_wbuf_flush(file, buf, size);
+        goto done;
+    }
+    if (wb->len == 0) {
+        wb->off = offset;
+        wb->uid = uid;
+        wb->since_ns = now;
+    }
+    memcpy(wb->data + wb->len, buf, size);
+    wb->len += size;
+    if (wb->len == fs->wb_size) {
+        ret = hub_wbuf_flush(file, NULL, 0);
+    }
+
+done:
+    pthread_mutex_unlock(&file->lock);
+    if (ret) {
+        return ret;
+    }
+    return size;
+}
+
 int hub_fgetattr(const char *path, struct stat *stat,
                         struct fuse_file_info *info)
 {
     struct hub_file *file = (struct hub_file*)(uintptr_t)info->fh;
 
+    if (file->ctl) {
+        int ret = ctl_getattr(file->ctl->node, stat);
+        stat->st_size = file->ctl->len;
+        return ret;
+    }
+    throttle_op(file->domain, fuse_get_context()->uid, HUB_OP_FGETATTR);
+    // Make sure that the size we report includes any buffered writes.
+    hub_wbuf_sync(file, 0);
+    if (file->stripe.nfds > 1) {
+        int ret = stripe_fstat(&file->stripe, stat);
+        DEBUG("hub_fgetattr(path=%s, fd=%d) = %d (striped)\n",
+              path, file->fd, ret);
+        return ret;
+    }
     if (fstat(file->fd, stat) < 0) {
         int err = errno;
         DEBUG("hub_fgetattr(path=%s, fd=%d) = %d (%s)\n",
@@ -55,32 +613,146 @@ int hub_fgetattr(const char *path, struct stat *stat,
     return 0;
 }
 
+/**
+ * Open a control file.
+ *
+ * @param fs            The filesystem.
+ * @param path          The overfs path.
+ * @param node          The control node being opened.
+ * @param flags         The open flags.
+ * @param info          The FUSE file info.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+static int hub_open_ctl(const struct hub_fs *fs, const char *path,
+                        enum hub_ctl_node node, int flags,
+                        struct fuse_file_info *info)
+{
+    struct hub_file *file;
+    struct stat st;
+    int ret;
+
+    if (flags & O_CREAT) {
+        return (node == HUB_CTL_MISSING) ? -EPERM : -EEXIST;
+    }
+    ret = ctl_getattr(node, &st);
+    if (ret) {
+        return ret;
+    }
+    if (((flags & O_ACCMODE) != O_RDONLY) && (!(st.st_mode & S_IWUSR))) {
+        return -EACCES;
+    }
+    file = pool_get(&g_file_pool);
+    if (!file) {
+        return -ENOMEM;
+    }
+    ret = ctl_snapshot(fs, node, &file->ctl);
+    if (ret) {
+        pool_put(&g_file_pool, file);
+        return ret;
+    }
+    file->fd = -1;
+    file->stripe.fds = &file->fd;
+    file->path_id = trace_path_id(path);
+    pthread_mutex_init(&file->lock, NULL);
+    // The contents change every time the file is opened, so don't let the
+    // kernel cache them.
+    info->direct_io = 1;
+    info->keep_cache = 0;
+    info->fh = (uintptr_t)(void*)file;
+    return 0;
+}
+
 static int hub_open_impl(const char *path, int addflags,
             mode_t mode, struct fuse_file_info *info)
 {
-    struct hub_fs *fs = fuse_get_context()->private_data;
+    struct fuse_context *ctx = fuse_get_context();
+    struct hub_fs *fs = ctx->private_data;
     int flags = 0, ret = 0;
     char bpath[PATH_MAX] = { 0 };
     struct hub_file *file = NULL;
+    const struct hub_backend *be;
+    enum hub_ctl_node node;
 
-    file = calloc(1, sizeof(struct hub_file));
+    node = ctl_lookup(path);
+    if (node) {
+        return hub_open_ctl(fs, path, node, addflags | info->flags, info);
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, ctx->uid,
+                (addflags & O_CREAT) ? HUB_OP_CREATE : HUB_OP_OPEN);
+    file = pool_get(&g_file_pool);
     if (!file) {
         ret = -ENOMEM;
         goto error;
     }
     file->fd = -1;
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
+    file->stripe.fds = &file->fd;
+    file->domain = be->domain;
+    file->path_id = trace_path_id(path);
+    pthread_mutex_init(&file->lock, NULL);
     // note: we assume that FUSE has already taken care of umask.
     flags = addflags;
     flags |= info->flags;
     if ((flags & O_ACCMODE) == 0)  {
         flags |= O_RDONLY;
     }
-    file->fd = open(bpath, flags, mode);
+    if (be->nroots > 1) {
+        // The kernel gives us the offset to append at, and each member only
+        // holds some of the data, so we can't let the members append.
+        flags &= ~O_APPEND;
+    }
+    if (be->nroots == 1) {
+        file->fd = fdcache_get(bpath, flags, &file->fd_key);
+    }
+    if (file->fd < 0) {
+        file->fd = open(bpath, flags, mode);
+        if ((file->fd < 0) && ((errno == EMFILE) || (errno == ENFILE)) &&
+                fdcache_shrink()) {
+            // Parked fds may be what's using up our fds.
+            file->fd = open(bpath, flags, mode);
+        }
+    }
     if (file->fd < 0) {
         ret = -errno;
         goto error;
     }
+    file->stripe.nfds = 1;
+    if (be->nroots > 1) {
+        ret = hub_open_members(be, path, flags, mode, file);
+        if (ret) {
+            goto error;
+        }
+    }
+    // Write-behind, read-ahead, and the cache tier all work on a single
+    // backing fd, so striped files don't use them.
+    file->wb_enabled = (file->stripe.nfds == 1) && (fs->wb_size > 0) &&
+        ((flags & O_ACCMODE) != O_RDONLY) &&
+        (!(flags & (O_APPEND | O_SYNC | O_DSYNC | O_DIRECT)));
+    if (fs->page_cache ||
+            (throttle_flags(ctx->uid) & UID_FLAG_PAGE_CACHE)) {
+        // Let the kernel cache this file.  The kernel does its own
+        // read-ahead, so we don't need to.
+        info->direct_io = 0;
+        info->keep_cache = hub_keep_cache(file->fd);
+    } else {
+        info->direct_io = 1;
+        info->keep_cache = 0;
+        if (((flags & O_ACCMODE) != O_WRONLY) && (file->stripe.nfds == 1)) {
+            file->ra = ra_alloc(file->fd, file->domain);
+        }
+    }
+    if ((!(flags & O_DIRECT)) && (file->stripe.nfds == 1)) {
+        file->cached = cache_open(file->fd, &file->cache_id);
+    }
+    // Writes which bypass the page cache or are synchronous anyway have
+    // nothing to smooth.
+    if ((fs->smooth_window > 0) && (file->stripe.nfds == 1) &&
+            ((flags & O_ACCMODE) != O_RDONLY) &&
+            (!(flags & (O_SYNC | O_DSYNC | O_DIRECT)))) {
+        file->smooth.window = fs->smooth_window;
+        pthread_mutex_init(&file->smooth.lock, NULL);
+    }
     info->fh = (uintptr_t)(void*)file;
 
 error:
@@ -99,10 +771,9 @@ error:
         return 0;
     }
     if (file) {
-        if (file->fd >= 0) {
-            close(file->fd);
-        }
-        free(file);
+        hub_close_members(file);
+        pthread_mutex_destroy(&file->lock);
+        pool_put(&g_file_pool, file);
     }
     return ret;
 }
@@ -120,6 +791,28 @@ int hub_open(const char *path, struct fuse_file_info *info)
     return hub_open_impl(path, 0, 0, info);
 }
 
+/**
+ * Count a read or a write in the statistics of the UID which did it.
+ *
+ * @param uid           The UID.
+ * @param ops           The operation counter.
+ * @param bytes         The byte counter.
+ * @param ret           The number of bytes transferred, or a negative error
+ *                          code if the operation failed.
+ */
+static void hub_count_io(uint32_t uid, enum hub_stat ops,
+                         enum hub_stat bytes, int ret)
+{
+    uint32_t cls;
+
+    if (ret < 0) {
+        return;
+    }
+    cls = throttle_class(uid);
+    stats_add(cls, ops, 1);
+    stats_add(cls, bytes, ret);
+}
+
 int hub_read(const char *path, char *buf, size_t size,
              off_t offset, struct fuse_file_info *info)
 {
@@ -127,19 +820,43 @@ int hub_read(const char *path, char *buf, size_t size,
     uint32_t uid;
     struct hub_file *file = (struct hub_file*)(uintptr_t)info->fh;
 
+    if (file->ctl) {
+        return ctl_read(file->ctl, buf, size, offset);
+    }
     uid = fuse_get_context()->uid;
     DEBUG("hub_read(path=%s, size=%zd, offset=%" PRId64", uid=%"PRId32"): "
           "begin\n", path, size, (int64_t)offset, uid);
-    throttle(uid, size);
-    ret = pread(file->fd, buf, size, offset);
-    // We're using the direct_io mount option, so we return the number of bytes
-    // read (unless there is an error, in which case we return the negative
-    // error code.) 
-    if (ret < 0) {
-        ret = -errno;
+    // Make sure that we read back anything this file has buffered.
+    hub_wbuf_sync(file, 0);
+    if (file->ra && ra_read(file->ra, uid, buf, size, offset, &ret)) {
+        DEBUG("hub_read(path=%s, size=%zd, offset=%" PRId64", "
+              "uid=%"PRId32") = %d (read-ahead)\n", path, size,
+              (int64_t)offset, uid, ret);
+        hub_count_io(uid, HUB_STAT_READ_OPS, HUB_STAT_READ_BYTES, ret);
+        return ret;
+    }
+    if (file->cached) {
+        ret = cache_read(&file->cache_id, file->fd, file->domain, uid, buf,
+                         size, offset);
+        DEBUG("hub_read(path=%s, size=%zd, offset=%" PRId64", "
+              "uid=%"PRId32") = %d (cache)\n", path, size,
+              (int64_t)offset, uid, ret);
+        hub_count_io(uid, HUB_STAT_READ_OPS, HUB_STAT_READ_BYTES, ret);
+        return ret;
+    }
+    throttle(file->domain, uid, size);
+    // We return the number of bytes read, unless there is an error, in which
+    // case we return the negative error code.  Files which use the page cache
+    // must return all the bytes that were asked for unless we hit the end of
+    // the file, so we retry short reads.
+    if (file->stripe.nfds > 1) {
+        ret = stripe_pread(&file->stripe, buf, size, offset);
+    } else {
+        ret = pread_fully(file->fd, buf, size, offset);
     }
     DEBUG("hub_read(path=%s, size=%zd, offset=%" PRId64", uid=%"PRId32") "
           "= %d\n", path, size, (int64_t)offset, uid, ret);
+    hub_count_io(uid, HUB_STAT_READ_OPS, HUB_STAT_READ_BYTES, ret);
     return ret;
 }
 
@@ -148,79 +865,385 @@ int hub_write(const char *path, const char *buf, size_t size,
 {
     int ret;
     uint32_t uid;
+    struct fuse_context *ctx = fuse_get_context();
+    struct hub_fs *fs = ctx->private_data;
     struct hub_file *file = (struct hub_file*)(uintptr_t)info->fh;
 
-    uid = fuse_get_context()->uid;
+    if (file->ctl) {
+        return ctl_write(file->ctl->node, buf, size);
+    }
+    uid = ctx->uid;
+    if (file->ra) {
+        ra_invalidate(file->ra, offset, size);
+    }
+    if (file->wb_enabled) {
+        ret = hub_wbuf_write(fs, file, uid, buf, size, offset);
+        DEBUG("hub_write(path=%s, size=%zd, offset=%" PRId64", "
+              "uid=%"PRId32") = %d (write-behind)\n", path, size,
+              (int64_t)offset, uid, ret);
+        hub_count_io(uid, HUB_STAT_WRITE_OPS, HUB_STAT_WRITE_BYTES, ret);
+        return ret;
+    }
     DEBUG("hub_write(path=%s, size=%zd, offset=%" PRId64", uid=%"PRId32"): "
           "throttling...\n", path, size, (int64_t)offset, uid);
     //fprintf(stderr, "size = %zd\n", size);
-    throttle(uid, size);
-    ret = pwrite(file->fd, buf, size, offset);
-    // We're using the direct_io mount option, so we return the number of bytes
-    // written (unless there is an error, in which case we return the negative
-    // error code.)
-    if (ret < 0) {
-        ret = -errno;
+    throttle(file->domain, uid, size);
+    // We return the number of bytes written, unless there is an error, in
+    // which case we return the negative error code.  Files which use the page
+    // cache must write everything, so we retry short writes.
+    if (file->stripe.nfds > 1) {
+        ret = stripe_pwrite(&file->stripe, buf, size, offset);
+    } else {
+        struct iovec iov = { .iov_base = (char*)buf, .iov_len = size };
+        ret = pwritev_fully(file->fd, &iov, 1, offset);
+    }
+    if (ret == 0) {
+        ret = size;
+        __sync_fetch_and_add(&file->dirty, size);
+        hub_smooth_write(file, uid, offset, size);
+    }
+    if (file->cached) {
+        cache_invalidate(&file->cache_id);
     }
     DEBUG("hub_write(path=%s, size=%zd, offset=%" PRId64", uid=%"PRId32") "
           "=  %d\n", path, size, (int64_t)offset, uid, ret);
+    hub_count_io(uid, HUB_STAT_WRITE_OPS, HUB_STAT_WRITE_BYTES, ret);
+    return ret;
+}
+
+/**
+ * Most segments of a write that we pass to the underfs in one pwritev.
+ */
+#define HUB_MAX_IOV 16
+
+/**
+ * Nonzero if the underfs has told us that it doesn't support RWF_NOWAIT, so
+ * we shouldn't try it again.  This must be accessed via atomic operations.
+ */
+static int g_nowait_unsupported;
+
+/**
+ * Read as much as the underfs can give us without blocking, which is
+ * roughly what its page cache holds.
+ *
+ * @param fd            The backing file descriptor.
+ * @param buf           The buffer to read into.
+ * @param size          The number of bytes to read.
+ * @param off           The offset to read from.
+ * @param eof           (out param) Set to 1 if we hit the end of the file;
+ *                          0 otherwise.
+ *
+ * @return              The number of bytes read.  If this is short and we
+ *                          didn't hit the end of the file, the rest would
+ *                          have blocked.
+ */
+static size_t hub_read_nowait(int fd, char *buf, size_t size, off_t off,
+                              int *eof)
+{
+    size_t done = 0;
+#ifdef RWF_NOWAIT
+    struct iovec iov;
+    ssize_t res;
+
+    *eof = 0;
+    if (__atomic_load_n(&g_nowait_unsupported, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    while (done < size) {
+        iov.iov_base = buf + done;
+        iov.iov_len = size - done;
+        res = preadv2(fd, &iov, 1, off + done, RWF_NOWAIT);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EOPNOTSUPP) {
+                __atomic_store_n(&g_nowait_unsupported, 1,
+                                 __ATOMIC_RELAXED);
+            }
+            // Most likely EAGAIN, meaning that the rest isn't cached.
+            break;
+        } else if (res == 0) {
+            *eof = 1;
+            break;
+        }
+        done += res;
+    }
+#else
+    (void)fd;
+    (void)buf;
+    (void)size;
+    (void)off;
+    *eof = 0;
+#endif
+    return done;
+}
+
+int hub_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+                 off_t offset, struct fuse_file_info *info)
+{
+    struct hub_file *file = (struct hub_file*)(uintptr_t)info->fh;
+    struct fuse_bufvec *bv;
+    struct fuse_buf *fb;
+    struct stat st;
+    size_t done, len;
+    off_t pos;
+    uint32_t uid;
+    char *mem;
+    int ret, eof;
+
+    // Room for a second buffer, for the part we leave FUSE to splice.
+    bv = malloc(sizeof(struct fuse_bufvec) + sizeof(struct fuse_buf));
+    mem = malloc(size ? size : 1);
+    if ((!bv) || (!mem)) {
+        free(bv);
+        free(mem);
+        return -ENOMEM;
+    }
+    *bv = FUSE_BUFVEC_INIT(0);
+    if (file->ctl || file->ra || file->cached || (file->stripe.nfds > 1)) {
+        // These read into memory their own way.
+        ret = hub_read(path, mem, size, offset, info);
+        if (ret < 0) {
+            free(bv);
+            free(mem);
+            return ret;
+        }
+        bv->buf[0].size = ret;
+        bv->buf[0].mem = mem;
+        *bufp = bv;
+        return 0;
+    }
+    uid = fuse_get_context()->uid;
+    DEBUG("hub_read_buf(path=%s, size=%zd, offset=%" PRId64", "
+          "uid=%"PRId32"): begin\n", path, size, (int64_t)offset, uid);
+    // Make sure that we read back anything this file has buffered.
+    hub_wbuf_sync(file, 0);
+    throttle(file->domain, uid, size);
+    // Copy out whatever is already cached, without tying up this thread
+    // waiting for the disk.
+    done = hub_read_nowait(file->fd, mem, size, offset, &eof);
+    if (done > 0) {
+        bv->buf[0].size = done;
+        bv->buf[0].mem = mem;
+        bv->count = 1;
+    } else {
+        free(mem);
+        bv->count = 0;
+    }
+    if ((done < size) && (!eof)) {
+        // The rest has to come from the disk.  Rather than copying it
+        // through our buffer, have FUSE splice it from the backing file.
+        // Files which use the page cache must get everything up to the end
+        // of the file, so FUSE retries short reads.  Stop at the end of the
+        // file, so that we neither ask for nor count bytes that aren't there.
+        pos = offset + done;
+        len = size - done;
+        if ((fstat(file->fd, &st) == 0) && (st.st_size < (off_t)(pos + len))) {
+            len = (st.st_size > pos) ? (size_t)(st.st_size - pos) : 0;
+        }
+        if (len > 0) {
+            fb = &bv->buf[bv->count++];
+            memset(fb, 0, sizeof(*fb));
+            fb->size = len;
+            fb->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK |
+                FUSE_BUF_FD_RETRY;
+            fb->fd = file->fd;
+            fb->pos = pos;
+            done += len;
+        }
+    }
+    if (bv->count == 0) {
+        // End of file.
+        *bv = FUSE_BUFVEC_INIT(0);
+    }
+    DEBUG("hub_read_buf(path=%s, size=%zd, offset=%" PRId64", "
+          "uid=%"PRId32") = %zd in %zd buffers\n", path, size,
+          (int64_t)offset, uid, done, bv->count);
+    hub_count_io(uid, HUB_STAT_READ_OPS, HUB_STAT_READ_BYTES, done);
+    *bufp = bv;
+    return 0;
+}
+
+/**
+ * Describe the data in a bufvec with an iovec, if it is all in memory.
+ *
+ * @param bv            The bufvec.
+ * @param iov           (out param) The iovec.
+ * @param iovcnt        (out param) The number of segments in the iovec.
+ *
+ * @return              1 on success; 0 if some of the data is in a pipe, or
+ *                          there are more than HUB_MAX_IOV segments.
+ */
+static int hub_bufvec_to_iov(const struct fuse_bufvec *bv,
+                             struct iovec *iov, int *iovcnt)
+{
+    const struct fuse_buf *fb;
+    size_t i, off = bv->off;
+    int n = 0;
+
+    for (i = bv->idx; i < bv->count; i++) {
+        fb = &bv->buf[i];
+        if ((fb->flags & FUSE_BUF_IS_FD) || (n == HUB_MAX_IOV)) {
+            return 0;
+        }
+        if (fb->size > off) {
+            iov[n].iov_base = ((char*)fb->mem) + off;
+            iov[n].iov_len = fb->size - off;
+            n++;
+        }
+        off = 0;
+    }
+    *iovcnt = n;
+    return 1;
+}
+
+int hub_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+                  struct fuse_file_info *info)
+{
+    struct hub_file *file = (struct hub_file*)(uintptr_t)info->fh;
+    size_t size = fuse_buf_size(buf);
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+    struct iovec iov[HUB_MAX_IOV];
+    uint32_t uid;
+    ssize_t res;
+    char *mem;
+    int ret, iovcnt;
+
+    if (file->ctl || file->wb_enabled || (file->stripe.nfds > 1)) {
+        // These need the data in one piece.
+        mem = malloc(size ? size : 1);
+        if (!mem) {
+            return -ENOMEM;
+        }
+        dst.buf[0].mem = mem;
+        res = fuse_buf_copy(&dst, buf, 0);
+        ret = (res < 0) ? (int)res : hub_write(path, mem, res, offset, info);
+        free(mem);
+        return ret;
+    }
+    uid = fuse_get_context()->uid;
+    if (file->ra) {
+        ra_invalidate(file->ra, offset, size);
+    }
+    DEBUG("hub_write_buf(path=%s, size=%zd, offset=%" PRId64", "
+          "uid=%"PRId32"): throttling...\n", path, size, (int64_t)offset,
+          uid);
+    throttle(file->domain, uid, size);
+    if (hub_bufvec_to_iov(buf, iov, &iovcnt)) {
+        // Write every segment with a single system call.
+        ret = pwritev_fully(file->fd, iov, iovcnt, offset);
+        if (ret == 0) {
+            ret = size;
+        }
+    } else {
+        // The data is in a pipe.  Splice it straight into the backing file,
+        // without copying it through our memory.
+        dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK |
+            FUSE_BUF_FD_RETRY;
+        dst.buf[0].fd = file->fd;
+        dst.buf[0].pos = offset;
+        ret = fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+    }
+    if (ret > 0) {
+        __sync_fetch_and_add(&file->dirty, ret);
+        hub_smooth_write(file, uid, offset, ret);
+    }
+    if (file->cached) {
+        cache_invalidate(&file->cache_id);
+    }
+    DEBUG("hub_write_buf(path=%s, size=%zd, offset=%" PRId64", "
+          "uid=%"PRId32") = %d\n", path, size, (int64_t)offset, uid, ret);
+    hub_count_io(uid, HUB_STAT_WRITE_OPS, HUB_STAT_WRITE_BYTES, ret);
     return ret;
 }
 
-int hub_flush(const char *path,
-              struct fuse_file_info *info __attribute__((unused)))
+int hub_flush(const char *path, struct fuse_file_info *info)
 {
+    struct hub_file *file = (struct hub_file*)(uintptr_t)info->fh;
+    int ret;
+
     /*
      * FUSE calls flush() each time close() is called on a file descriptor
      * implemented by FUSE.  Since multiple file descriptors may point to the
      * same file __description__, this may be called multiple times on the same
      * fuse_file_info.
      *
-     * We don't do any caching in hubfs, since the kernel already caches for
-     * us.  So there is nothing to flush here, and hence nothing to do.
+     * The only caching we do ourselves is the optional write-behind buffer.
+     * Writing it out here means that close() reports any errors from the
+     * buffered writes.
      */
-    DEBUG("hub_flush(path=%s) = 0\n", path);
-    return 0;
+    ret = hub_wbuf_sync(file, 1);
+    DEBUG("hub_flush(path=%s) = %d\n", path, ret);
+    return ret;
 }
 
 int hub_release(const char *path, struct fuse_file_info *info)
 {
     struct hub_file *file = (struct hub_file*)(uintptr_t)info->fh;
-    int ret = 0;
+    int ret = 0, ret2;
 
     /*
      * FUSE calls release() when there are no remaining file descriptors
      * referencing this file description (aka fuse_file_info).
-     * At this point, we close the backing file.
+     * At this point, we write out anything that is still buffered, and close
+     * (or park) the backing file.
      */
-    if (close(file->fd) < 0) {
-        // Portability: HP/UX has "issues" where close will sometimes fail with
-        // EINTR.  But we can't just retry because that would cause problems on
-        // Linux.
-        ret = -errno;
+    ret = hub_wbuf_sync(file, 1);
+    ra_free(file->ra);
+    if (file->stripe.nfds == 1) {
+        // Rather than closing the backing file, let the next open of it
+        // reuse the fd.
+        ret2 = fdcache_put(&file->fd_key, file->fd);
+    } else {
+        ret2 = hub_close_members(file);
+    }
+    if (ret2) {
+        ret = ret2;
     }
-    file->fd = -1;
     DEBUG("hub_release(path=%s, file->fd=%d) = %d\n", path, file->fd, ret);
-    free(file);
+    pthread_mutex_destroy(&file->lock);
+    if (file->smooth.window) {
+        pthread_mutex_destroy(&file->smooth.lock);
+    }
+    free(file->wb.data);
+    free(file->ctl);
+    pool_put(&g_file_pool, file);
     return ret;
 }
 
 int hub_fsync(const char *path, int datasync, struct fuse_file_info *info)
 {
     struct hub_file *file = (struct hub_file*)(uintptr_t)info->fh;
-    int ret = 0;
+    int r, ret = 0;
+    unsigned int i;
+    uint32_t uid;
+    uint64_t dirty = 0;
 
-    if (datasync) {
-        if (fdatasync(file->fd) < 0) {
-            ret = -errno;
-        }
-    } else {
-        if (fsync(file->fd) < 0) {
-            ret = -errno;
+    uid = fuse_get_context()->uid;
+    ret = hub_wbuf_sync(file, 1);
+    if (ret) {
+        goto done;
+    }
+    // Charge the fsync for the data it will have to write out, in addition to
+    // its fixed metadata cost.  If the fsync fails, the data is still dirty,
+    // so we put it back for the next attempt to pay for.
+    throttle_op(file->domain, uid, HUB_OP_FSYNC);
+    dirty = __sync_lock_test_and_set(&file->dirty, 0);
+    throttle(file->domain, uid, dirty);
+    // Concurrent fsyncs of the same backing file share one fsync.
+    for (i = 0; i < file->stripe.nfds; i++) {
+        r = syncq_fsync(file->stripe.fds[i], datasync);
+        if (r) {
+            ret = r;
         }
     }
-    DEBUG("hub_fsync(path=%s, file->fd=%d, datasync=%d) = %d\n",
-          path, file->fd, datasync, ret);
+    if (ret) {
+        __sync_fetch_and_add(&file->dirty, dirty);
+    }
+done:
+    DEBUG("hub_fsync(path=%s, file->fd=%d, datasync=%d, dirty=%"PRId64") = "
+          "%d\n", path, file->fd, datasync, dirty, ret);
     return ret;
 }
 
@@ -228,10 +1251,21 @@ int hub_ftruncate(const char *path, off_t len,
                          struct fuse_file_info *info)
 {
     struct hub_file *file = (struct hub_file*)(uintptr_t)info->fh;
+    unsigned int i;
     int ret = 0;
 
-    if (ftruncate(file->fd, len) < 0) {
-        ret = -errno;
+    throttle_op(file->domain, fuse_get_context()->uid, HUB_OP_FTRUNCATE);
+    hub_wbuf_sync(file, 0);
+    if (file->ra) {
+        ra_invalidate(file->ra, 0, 0);
+    }
+    for (i = 0; i < file->stripe.nfds; i++) {
+        if (ftruncate(file->stripe.fds[i], len) < 0) {
+            ret = -errno;
+        }
+    }
+    if (file->cached) {
+        cache_invalidate(&file->cache_id);
     }
     DEBUG("hub_ftruncate(path=%s, len=%"PRId64", file->fd=%d) = %d\n",
           path, (int64_t)len, file->fd, ret);
@@ -243,14 +1277,40 @@ int hub_fallocate(const char *path, int mode,
 {
     struct hub_file *file = (struct hub_file*)(uintptr_t)info->fh;
     int ret = 0;
+    uint32_t uid;
 
-    if (fallocate(file->fd, mode, offset, len) < 0) {
+    // Allocating an extent costs us roughly as much as writing it, since
+    // most filesystems zero the blocks or at least have to journal the new
+    // extent.  Punching a hole is just a metadata operation.
+    uid = fuse_get_context()->uid;
+    throttle_op(file->domain, uid, HUB_OP_FALLOCATE);
+    hub_wbuf_sync(file, 0);
+    if (file->ra) {
+        ra_invalidate(file->ra, offset, len);
+    }
+    if (!(mode & FALLOC_FL_PUNCH_HOLE)) {
+        throttle(file->domain, uid, len);
+    }
+    if (file->stripe.nfds > 1) {
+        ret = stripe_fallocate(&file->stripe, mode, offset, len);
+    } else if (fallocate(file->fd, mode, offset, len) < 0) {
         ret = -errno;
     }
+    if (file->cached) {
+        cache_invalidate(&file->cache_id);
+    }
     DEBUG("hub_fallocate(path=%s, mode=%04o, offset=%"PRId64
           "len=%"PRId64", file->fd=%d) = %d\n", path, mode,
           (int64_t)offset, (int64_t)len, file->fd, ret);
     return ret;
 }
 
+uint64_t hub_file_path_id(const struct fuse_file_info *info)
+{
+    const struct hub_file *file =
+        (const struct hub_file*)(uintptr_t)info->fh;
+
+    return file->path_id;
+}
+
 // vim: ts=4:sw=4:tw=79:et
@@ -20,6 +20,7 @@
 #define IOHUB_FILE_H
 
 #include <fuse.h>
+#include <stdint.h>
 #include <sys/types.h> // for mode_t, dev_t
 #include <unistd.h> // for size_t
 
@@ -30,6 +31,10 @@ int hub_create(const char *path, mode_t mode,
 int hub_open(const char *path, struct fuse_file_info *info);
 int hub_read(const char *, char *, size_t, off_t, struct fuse_file_info *);
 int hub_write(const char *, const char *, size_t, off_t, struct fuse_file_info *);
+int hub_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+                 off_t offset, struct fuse_file_info *info);
+int hub_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+                  struct fuse_file_info *info);
 int hub_flush(const char *path, struct fuse_file_info *info);
 int hub_release(const char *path, struct fuse_file_info *info);
 int hub_fsync(const char *path, int datasync, struct fuse_file_info *info);
@@ -38,6 +43,15 @@ int hub_ftruncate(const char *path, off_t len,
 int hub_fallocate(const char *path, int mode, off_t offset,
                          off_t len, struct fuse_file_info *info);
 
+/**
+ * Get the trace_path_id of the path an open file was opened with.
+ *
+ * @param info          The FUSE file info of an open file.
+ *
+ * @return              The path ID.
+ */
+uint64_t hub_file_path_id(const struct fuse_file_info *info);
+
 #endif
 
 // vim: ts=4:sw=4:et
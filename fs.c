@@ -16,17 +16,29 @@
  * limitations under the License.
  */
 
+#include "backend.h"
+#include "cache.h"
+#include "ctl.h"
+#include "fdcache.h"
 #include "file.h"
 #include "fs.h"
 #include "meta.h"
+#include "prom.h"
+#include "readahead.h"
+#include "stripe.h"
+#include "syncq.h"
 #include "throttle.h"
+#include "timing.h"
+#include "trace.h"
 #include "util.h"
 
 #include <ctype.h>
 #include <errno.h>
 #include <fuse.h>
 #include <limits.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,10 +59,6 @@ static struct fuse_operations hub_oper;
  * allow_other
  *      Allow all users to access the mount.
  *
- * direct_io
- *      Don't cache data in FUSE.  Because the data will be cached by the page
- *      cache anyway, we want this to avoid double-caching.
- *
  * hard_remove
  *      Normally, when an open file is unlinked, FUSE translates that into a
  *      rename to a file named something like .fuse_hiddenXXX.  We don't need
@@ -60,32 +68,326 @@ static struct fuse_operations hub_oper;
 static const char const *MANDATORY_OPTIONS[] = {
     "-odefault_permissions",
     "-oallow_other",
-    "-odirect_io",
     "-ohard_remove",
 };
 
 #define NUM_MANDATORY_OPTIONS \
     (int)(sizeof(MANDATORY_OPTIONS)/sizeof(MANDATORY_OPTIONS[0]))
 
+#define HUB_OPT(templ, field, val) \
+    { templ, offsetof(struct hub_fs, field), val }
+
+/** Keys for mount options which hub_opt_proc handles. */
+enum {
+    HUB_KEY_BACKEND,
+    HUB_KEY_STRIPE,
+};
+
+/**
+ * Mount options which are handled by iohub itself, rather than by FUSE.
+ *
+ * wb_size=N
+ *      Buffer up to N bytes of small sequential writes per open file, and
+ *      write them to the underfs as a single large write.  0 (the default)
+ *      disables write-behind.
+ *
+ * wb_max_age=N
+ *      Flush write-behind data which is more than N milliseconds old on the
+ *      next write to the file.
+ *
+ * ra_window=N
+ *      Once a file is being read sequentially, read ahead of the reader in
+ *      windows of N bytes.  0 (the default) disables read-ahead.
+ *
+ * ra_bufs=N
+ *      Number of read-ahead windows to share between all open files.
+ *
+ * ra_threads=N
+ *      Number of threads to do read-ahead on.
+ *
+ * page_cache
+ *      Let the kernel page cache hold data for all files.  By default, files
+ *      use direct I/O, which avoids caching data both in the page cache of the
+ *      overfs and in that of the underfs.  Only UIDs configured with
+ *      UID_FLAG_PAGE_CACHE use the page cache.
+ *
+ * cache_dir=PATH
+ *      Cache blocks of the underfs in a file in PATH, which should be on a
+ *      faster device such as an SSD or tmpfs.  Reads which hit in the cache
+ *      are only charged cache_hit_pct percent of their size.  By default,
+ *      there is no cache tier.
+ *
+ * cache_size=N
+ *      Size of the cache tier in MiB.
+ *
+ * cache_block=N
+ *      Size in bytes of each block in the cache tier.  Misses read and
+ *      charge for a whole block.
+ *
+ * cache_hit_pct=N
+ *      Percentage of the bytes read from the cache tier that we charge to the
+ *      reader.
+ *
+ * backend=/PREFIX:DIR
+ *      Serve the overfs directory /PREFIX from the underfs directory DIR
+ *      rather than from the root.  May be given more than once.  Each distinct
+ *      device gets its own throttle domain.
+ *
+ * stripe=/PREFIX:DIR1,DIR2[,...]
+ *      Serve the overfs directory /PREFIX from several underfs directories,
+ *      with each file striped across all of them, RAID-0 style.  The striped
+ *      backend is a throttle domain of its own, so UIDs are throttled on the
+ *      aggregate bandwidth.  May be given more than once.
+ *
+ * stripe_size=N
+ *      Size in bytes of each stripe.
+ *
+ * stripe_threads=N
+ *      Number of threads to do striped I/O on.  0 does striped I/O one member
+ *      at a time in the calling thread.
+ *
+ * prom_file=PATH
+ *      Periodically write our statistics to PATH in the Prometheus text
+ *      format, for node_exporter's textfile collector.  By default, nothing
+ *      is exported.
+ *
+ * prom_interval=N
+ *      Seconds between Prometheus exports.
+ *
+ * trace_file=PATH
+ *      Write binary trace records to PATH; see trace.h.  By default, nothing
+ *      is traced.
+ *
+ * trace_level=N
+ *      The trace level to start at.  It can be changed later by writing to
+ *      /.iohub/trace_level.
+ *
+ * fd_cache=N
+ *      Rather than closing the backing file when a file is released, park up
+ *      to N backing fds, and reuse them when the same files are opened again
+ *      with the same flags.  0 (the default) disables the fd cache.
+ *
+ * sync_threads=N
+ *      Number of threads to do fsyncs on.  Concurrent fsyncs of the same
+ *      backing file are coalesced either way.  0 does fsyncs in the calling
+ *      thread.
+ *
+ * smooth_window=N
+ *      Once N bytes have been written to a file, start writing them out to
+ *      the disk with sync_file_range, and wait for the N bytes before them,
+ *      charging the writeback to the writer.  This keeps each file down to
+ *      about 2N bytes of dirty data in the underfs page cache, rather than
+ *      letting the kernel write it out in bursts.  0 (the default) leaves
+ *      writeback to the kernel.
+ */
+static const struct fuse_opt hub_opts[] = {
+    HUB_OPT("wb_size=%u", wb_size, 0),
+    HUB_OPT("wb_max_age=%u", wb_max_age_ms, 0),
+    HUB_OPT("ra_window=%u", ra_window, 0),
+    HUB_OPT("ra_bufs=%u", ra_bufs, 0),
+    HUB_OPT("ra_threads=%u", ra_threads, 0),
+    HUB_OPT("page_cache", page_cache, 1),
+    HUB_OPT("cache_dir=%s", cache_dir, 0),
+    HUB_OPT("cache_size=%u", cache_size_mb, 0),
+    HUB_OPT("cache_block=%u", cache_block, 0),
+    HUB_OPT("cache_hit_pct=%u", cache_hit_pct, 0),
+    HUB_OPT("stripe_size=%u", stripe_size, 0),
+    HUB_OPT("stripe_threads=%u", stripe_threads, 0),
+    HUB_OPT("prom_file=%s", prom_file, 0),
+    HUB_OPT("prom_interval=%u", prom_interval_s, 0),
+    HUB_OPT("trace_file=%s", trace_file, 0),
+    HUB_OPT("trace_level=%u", trace_level, 0),
+    HUB_OPT("fd_cache=%u", fd_cache, 0),
+    HUB_OPT("sync_threads=%u", sync_threads, 0),
+    HUB_OPT("smooth_window=%u", smooth_window, 0),
+    FUSE_OPT_KEY("backend=", HUB_KEY_BACKEND),
+    FUSE_OPT_KEY("stripe=", HUB_KEY_STRIPE),
+    FUSE_OPT_END
+};
+
+/**
+ * Handle the mount options which can't simply be stored in struct hub_fs.
+ *
+ * @param data          The struct hub_fs.
+ * @param arg           The option.
+ * @param key           The HUB_KEY_* key, or one of the FUSE_OPT_KEY_* keys.
+ * @param outargs       The arguments which will be passed on to FUSE.
+ *
+ * @return              0 to discard the option; 1 to pass it on to FUSE; -1
+ *                          on error.
+ */
+static int hub_opt_proc(void *data, const char *arg, int key,
+                        struct fuse_args *outargs __attribute__((unused)))
+{
+    struct hub_fs *fs = data;
+
+    switch (key) {
+    case HUB_KEY_BACKEND:
+        if (backend_add(fs, arg + strlen("backend="), 0)) {
+            return -1;
+        }
+        return 0;
+    case HUB_KEY_STRIPE:
+        if (backend_add(fs, arg + strlen("stripe="), 1)) {
+            return -1;
+        }
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+/** Default value for the wb_max_age option. */
+#define DEFAULT_WB_MAX_AGE_MS 1000
+
+/** Default value for the ra_bufs option. */
+#define DEFAULT_RA_BUFS 64
+
+/** Default value for the ra_threads option. */
+#define DEFAULT_RA_THREADS 4
+
+/** Default value for the cache_size option. */
+#define DEFAULT_CACHE_SIZE_MB 1024
+
+/** Default value for the cache_block option. */
+#define DEFAULT_CACHE_BLOCK 131072
+
+/** Default value for the cache_hit_pct option. */
+#define DEFAULT_CACHE_HIT_PCT 10
+
+/** Default value for the stripe_size option. */
+#define DEFAULT_STRIPE_SIZE 1048576
+
+/** Default value for the stripe_threads option. */
+#define DEFAULT_STRIPE_THREADS 8
+
+/** Default value for the prom_interval option. */
+#define DEFAULT_PROM_INTERVAL_S 15
+
+/** Default value for the trace_level option. */
+#define DEFAULT_TRACE_LEVEL TRACE_LEVEL_OPS
+
+/** Default value for the sync_threads option. */
+#define DEFAULT_SYNC_THREADS 4
+
 static void *hub_init(struct fuse_conn_info *conn)
 {
+    struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
+
+    // We start our threads here, rather than in main, because FUSE forks
+    // when it daemonizes.
+    if (ra_init(fs->ra_window, fs->ra_bufs, fs->ra_threads)) {
+        fprintf(stderr, "hub_init: failed to start read-ahead.  Continuing "
+                "without it.\n");
+    }
+    if (fs->cache_dir && cache_init(fs->cache_dir,
+                ((uint64_t)fs->cache_size_mb) << 20, fs->cache_block,
+                fs->cache_hit_pct)) {
+        fprintf(stderr, "hub_init: failed to set up the cache tier.  "
+                "Continuing without it.\n");
+    }
+    for (be = fs->backends; be; be = be->next) {
+        if (be->nroots > 1) {
+            if (stripe_init(fs->stripe_threads)) {
+                fprintf(stderr, "hub_init: failed to start the striped I/O "
+                        "threads.  Continuing without them.\n");
+            }
+            break;
+        }
+    }
+    if (fs->prom_file && prom_init(fs->prom_file, fs->prom_interval_s,
+                                   fs->num_domains)) {
+        fprintf(stderr, "hub_init: failed to start the Prometheus "
+                "exporter.  Continuing without it.\n");
+    }
+    if (fdcache_init(fs->fd_cache)) {
+        fprintf(stderr, "hub_init: failed to set up the fd cache.  "
+                "Continuing without it.\n");
+    }
+    if (syncq_init(fs->sync_threads)) {
+        fprintf(stderr, "hub_init: failed to start the sync threads.  "
+                "Continuing without them.\n");
+    }
+    if (fs->trace_file && trace_init(fs->trace_file, fs->trace_level)) {
+        fprintf(stderr, "hub_init: failed to start tracing.  Continuing "
+                "without it.\n");
+    }
+    if (ctl_dump_init(fs)) {
+        fprintf(stderr, "hub_init: failed to start the SIGUSR1 statistics "
+                "dump thread.  Continuing without it.\n");
+    }
     conn->want = FUSE_CAP_ASYNC_READ |
         FUSE_CAP_ATOMIC_O_TRUNC	|
         FUSE_CAP_BIG_WRITES	|
         FUSE_CAP_SPLICE_WRITE |
         FUSE_CAP_SPLICE_MOVE |
         FUSE_CAP_SPLICE_READ;
+#ifdef FUSE_CAP_AUTO_INVAL_DATA
+    // For files which use the page cache, have the kernel drop cached data
+    // when it notices that the file's modification time has changed.
+    conn->want |= FUSE_CAP_AUTO_INVAL_DATA;
+#endif
     return fuse_get_context()->private_data;
 }
 
 static void hub_destroy(void *userdata __attribute__((unused)))
 {
+    ra_shutdown();
+    cache_shutdown();
+    stripe_shutdown();
+    ctl_dump_shutdown();
+    prom_shutdown();
+    trace_shutdown();
+    fdcache_shutdown();
+    syncq_shutdown();
 }
 
 static void hub_usage(const char *argv0)
 {
     fprintf(stderr, "\
-usage:  %s [FUSE and mount options] <root> <mount_point>\n", argv0);
+usage:  %s [FUSE and mount options] <root> <mount_point>\n\
+\n\
+iohub options:\n\
+    -o wb_size=N           per-file write-behind buffer size in bytes\n\
+                           (default: 0, disabled)\n\
+    -o wb_max_age=N        flush write-behind data older than N ms\n\
+                           (default: %d)\n\
+    -o ra_window=N         read-ahead window size in bytes\n\
+                           (default: 0, disabled)\n\
+    -o ra_bufs=N           number of read-ahead windows shared by all\n\
+                           files (default: %d)\n\
+    -o ra_threads=N        number of read-ahead threads (default: %d)\n\
+    -o page_cache          use the kernel page cache for all files\n\
+    -o cache_dir=PATH      cache underfs blocks in PATH\n\
+                           (default: none, disabled)\n\
+    -o cache_size=N        cache tier size in MiB (default: %d)\n\
+    -o cache_block=N       cache tier block size in bytes (default: %d)\n\
+    -o cache_hit_pct=N     percentage of cache hits charged to the reader\n\
+                           (default: %d)\n\
+    -o backend=/PREFIX:DIR serve /PREFIX from DIR, with a separate\n\
+                           throttle domain per device\n\
+    -o stripe=/PREFIX:DIR1,DIR2[,...]\n\
+                           serve /PREFIX striped across DIR1, DIR2...\n\
+    -o stripe_size=N       stripe size in bytes (default: %d)\n\
+    -o stripe_threads=N    number of striped I/O threads (default: %d)\n\
+    -o prom_file=PATH      export statistics to PATH in the Prometheus\n\
+                           text format (default: none, disabled)\n\
+    -o prom_interval=N     seconds between exports (default: %d)\n\
+    -o trace_file=PATH     write binary trace records to PATH\n\
+                           (default: none, disabled)\n\
+    -o trace_level=N       0: off, 1: operations, 2: also throttler\n\
+                           events (default: %d)\n\
+    -o fd_cache=N          park up to N backing fds for reuse\n\
+                           (default: 0, disabled)\n\
+    -o sync_threads=N      number of fsync threads (default: %d)\n\
+    -o smooth_window=N     start writeback every N bytes written to a\n\
+                           file (default: 0, disabled)\n",
+            argv0, DEFAULT_WB_MAX_AGE_MS, DEFAULT_RA_BUFS,
+            DEFAULT_RA_THREADS, DEFAULT_CACHE_SIZE_MB, DEFAULT_CACHE_BLOCK,
+            DEFAULT_CACHE_HIT_PCT, DEFAULT_STRIPE_SIZE,
+            DEFAULT_STRIPE_THREADS, DEFAULT_PROM_INTERVAL_S,
+            DEFAULT_TRACE_LEVEL, DEFAULT_SYNC_THREADS);
 }
 
 /**
@@ -154,6 +456,7 @@ static const struct uid_config woot = {
     .next = NULL,
     .uid = 1015,
     .full = 5242880LL,
+    .meta_full = 50000LL,
 };
 
 static const struct uid_config cmccabe = {
@@ -161,6 +464,7 @@ static const struct uid_config cmccabe = {
     .uid = 1014,
     //.full = 262144000LL,
     .full = 1048576LL,
+    .meta_full = 10000LL,
 };
 
 static const struct uid_config uid_config_list = {
@@ -168,6 +472,7 @@ static const struct uid_config uid_config_list = {
     .uid = UNKNOWN_UID,
     .full = 1125899906842624LL,
         //5242880LL,
+    .meta_full = 0,
 };
 
 int main(int argc, char *argv[])
@@ -175,11 +480,12 @@ int main(int argc, char *argv[])
     int ret = EXIT_FAILURE;
     struct hub_fs *fs = NULL;
     struct fuse_args args;
+    struct fuse_operations oper;
+    char **hub_argv = NULL;
+    sigset_t sigs;
 
     memset(&args, 0, sizeof(args));
 
-    throttle_init(&uid_config_list);
-
     if (chdir("/") < 0) {
         perror("hub_main: failed to change directory to /");
         goto done;
@@ -207,26 +513,72 @@ int main(int argc, char *argv[])
         goto done;
     }
 
+    /*
+     * Block SIGUSR1 in every thread.  The thread started by ctl_dump_init
+     * waits for it, and dumps our statistics to stderr.
+     */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &sigs, NULL)) {
+        fprintf(stderr, "hub_main: failed to block SIGUSR1.\n");
+        goto done;
+    }
+
     /* Set up mandatory arguments. */
     if (setup_hub_args(argc, argv, &args, &fs->root)) {
         goto done;
     }
 
+    /*
+     * Pull out the options that are meant for us.  fuse_opt_parse replaces
+     * args.argv with a newly allocated array, so hang on to ours in order to
+     * free it later.
+     */
+    hub_argv = args.argv;
+    fs->wb_max_age_ms = DEFAULT_WB_MAX_AGE_MS;
+    fs->ra_bufs = DEFAULT_RA_BUFS;
+    fs->ra_threads = DEFAULT_RA_THREADS;
+    fs->cache_size_mb = DEFAULT_CACHE_SIZE_MB;
+    fs->cache_block = DEFAULT_CACHE_BLOCK;
+    fs->cache_hit_pct = DEFAULT_CACHE_HIT_PCT;
+    fs->stripe_size = DEFAULT_STRIPE_SIZE;
+    fs->stripe_threads = DEFAULT_STRIPE_THREADS;
+    fs->prom_interval_s = DEFAULT_PROM_INTERVAL_S;
+    fs->trace_level = DEFAULT_TRACE_LEVEL;
+    fs->sync_threads = DEFAULT_SYNC_THREADS;
+    if (fuse_opt_parse(&args, fs, hub_opts, hub_opt_proc)) {
+        fprintf(stderr, "hub_main: failed to parse options.\n");
+        goto done;
+    }
+
     if (access(fs->root, R_OK) < 0) {
         fprintf(stderr, "Bad root argument %s ", fs->root);
         perror("");
         goto done;
     }
+    if (backend_setup(fs)) {
+        goto done;
+    }
+    throttle_init(&uid_config_list, hub_op_default_costs(), fs->num_domains);
 
-    /* Run main FUSE loop. */
-    ret = fuse_main(args.argc, args.argv, &hub_oper, fs);
+    /* Run main FUSE loop, recording the latency of every operation. */
+    timing_wrap(&hub_oper, &oper);
+    ret = fuse_main(args.argc, args.argv, &oper, fs);
 
 done:
+    throttle_shutdown();
     if (fs) {
+        backend_free_all(fs);
         free(fs->root);
+        free(fs->cache_dir);
+        free(fs->prom_file);
+        free(fs->trace_file);
         free(fs);
     }
-    if (args.argv) {
+    if (hub_argv) {
+        fuse_opt_free_args(&args);
+        free(hub_argv);
+    } else if (args.argv) {
         free(args.argv);
     }
     fprintf(stderr, "hub_main exiting with error code %d\n", ret);
@@ -251,6 +603,8 @@ static struct fuse_operations hub_oper = {
     .open = hub_open,
     .read = hub_read,
     .write = hub_write,
+    .read_buf = hub_read_buf,
+    .write_buf = hub_write_buf,
     .statfs = hub_statfs,
     .flush = hub_flush,
     .release = hub_release,
@@ -19,9 +19,98 @@
 #ifndef IOHUB_FS_H
 #define IOHUB_FS_H
 
+struct hub_backend;
+
 struct hub_fs {
     /** Root of the filesystem */
     char *root;
+
+    /**
+     * Backends, in the order their prefixes are matched.  The last one is
+     * always the backend for root.
+     */
+    struct hub_backend *backends;
+
+    /** Number of distinct throttle domains used by the backends. */
+    unsigned int num_domains;
+
+    /** Size in bytes of each stripe of a striped backend. */
+    unsigned int stripe_size;
+
+    /** Number of threads to do striped I/O on. */
+    unsigned int stripe_threads;
+
+    /**
+     * Size in bytes of the per-file write-behind buffer, or 0 if write-behind
+     * is disabled.
+     */
+    unsigned int wb_size;
+
+    /**
+     * Maximum number of milliseconds that data can sit in a write-behind
+     * buffer before the next write to that file flushes it.
+     */
+    unsigned int wb_max_age_ms;
+
+    /** Size in bytes of each read-ahead window, or 0 to disable read-ahead. */
+    unsigned int ra_window;
+
+    /** Number of read-ahead buffers shared between all open files. */
+    unsigned int ra_bufs;
+
+    /** Number of threads to do read-ahead on. */
+    unsigned int ra_threads;
+
+    /**
+     * Nonzero if all files should use the kernel page cache.  Otherwise, only
+     * files opened by UIDs with UID_FLAG_PAGE_CACHE do.
+     */
+    int page_cache;
+
+    /**
+     * Directory on a fast device to cache blocks of the underfs in, or NULL
+     * if the cache tier is disabled.
+     */
+    char *cache_dir;
+
+    /** Size of the cache tier in MiB. */
+    unsigned int cache_size_mb;
+
+    /** Size in bytes of each block in the cache tier. */
+    unsigned int cache_block;
+
+    /**
+     * Percentage of the bytes served from the cache tier that we charge
+     * against the reader's budget.
+     */
+    unsigned int cache_hit_pct;
+
+    /**
+     * File to export statistics to in the Prometheus text format, or NULL if
+     * the exporter is disabled.
+     */
+    char *prom_file;
+
+    /** Seconds between Prometheus exports. */
+    unsigned int prom_interval_s;
+
+    /** File to write binary trace records to, or NULL to disable tracing. */
+    char *trace_file;
+
+    /** The trace level to start at.  See trace.h. */
+    unsigned int trace_level;
+
+    /** Most backing fds to park for reuse, or 0 to disable the fd cache. */
+    unsigned int fd_cache;
+
+    /** Number of threads to do fsyncs on. */
+    unsigned int sync_threads;
+
+    /**
+     * Bytes to let build up in each file before starting to write them out
+     * to the disk, or 0 to leave writeback to the kernel.
+     */
+    unsigned int smooth_window;
 };
 
 #endif
@@ -0,0 +1,125 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hist.h"
+
+#include <stdint.h>
+
+static uint32_t hist_bucket(uint64_t val)
+{
+    uint32_t msb;
+
+    if (val < HIST_SUB_BUCKETS) {
+        return val;
+    }
+    msb = 63 - __builtin_clzll(val);
+    return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) |
+        ((val >> (msb - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+}
+
+/**
+ * Get the smallest value that falls into the bucket after this one.  This is
+ * an upper bound on the values recorded in the bucket.
+ */
+static uint64_t hist_bucket_limit(uint32_t b)
+{
+    uint32_t group = b >> HIST_SUB_BITS, sub = b & (HIST_SUB_BUCKETS - 1);
+
+    if (group == 0) {
+        return b + 1;
+    }
+    return ((uint64_t)(HIST_SUB_BUCKETS + sub + 1)) << (group - 1);
+}
+
+/**
+ * Add to a field which only the calling thread writes.  The atomic store
+ * just makes sure that concurrent readers never see a torn value.
+ */
+static void hist_add(uint64_t *field, uint64_t amt)
+{
+    __atomic_store_n(field, __atomic_load_n(field, __ATOMIC_RELAXED) + amt,
+                     __ATOMIC_RELAXED);
+}
+
+void hist_record(struct hist *h, uint64_t val)
+{
+    hist_add(&h->buckets[hist_bucket(val)], 1);
+    hist_add(&h->count, 1);
+    hist_add(&h->sum, val);
+    if (val > __atomic_load_n(&h->max, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&h->max, val, __ATOMIC_RELAXED);
+    }
+}
+
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+    uint64_t max;
+    uint32_t b;
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        dst->buckets[b] += __atomic_load_n(&src->buckets[b],
+                                           __ATOMIC_RELAXED);
+    }
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    if (max > dst->max) {
+        dst->max = max;
+    }
+}
+
+uint64_t hist_percentile(const struct hist *h, double p)
+{
+    uint64_t seen = 0, total = 0, want;
+    uint32_t b;
+
+    // Count the buckets rather than trusting h->count, which a concurrent
+    // merge may have read at a different moment.
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        total += h->buckets[b];
+    }
+    want = (uint64_t)(total * p);
+    if ((double)want < total * p) {
+        want++;
+    }
+    if (want == 0) {
+        want = 1;
+    }
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= want) {
+            // The bucket limit can overshoot the largest value we saw.
+            return (hist_bucket_limit(b) < h->max) ?
+                hist_bucket_limit(b) : h->max;
+        }
+    }
+    return 0;
+}
+
+uint64_t hist_count_below(const struct hist *h, uint64_t limit)
+{
+    uint64_t count = 0;
+    uint32_t b;
+
+    for (b = 0; (b < HIST_BUCKETS) && (hist_bucket_limit(b) <= limit); b++) {
+        count += h->buckets[b];
+    }
+    return count;
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -0,0 +1,97 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_HIST_H
+#define IOHUB_HIST_H
+
+#include <stdint.h>
+
+/**
+ * Log-linear histograms, for latencies and other values which range over
+ * many orders of magnitude.
+ *
+ * Values below HIST_SUB_BUCKETS get a bucket each.  Above that, each power of
+ * 2 is split into HIST_SUB_BUCKETS linear buckets, so a bucket is never wider
+ * than 1/HIST_SUB_BUCKETS of the values in it.
+ *
+ * Only one thread may record into a histogram, but other threads may merge
+ * from it at the same time.
+ */
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB_BUCKETS)
+
+struct hist {
+    /** Number of values recorded. */
+    uint64_t count;
+
+    /** Sum of the values recorded. */
+    uint64_t sum;
+
+    /** Largest value recorded. */
+    uint64_t max;
+
+    /** Number of values recorded in each bucket. */
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+/**
+ * Record a value.
+ *
+ * @param h             The histogram.
+ * @param val           The value.
+ */
+void hist_record(struct hist *h, uint64_t val);
+
+/**
+ * Add one histogram's values to another's.
+ *
+ * @param dst           The histogram to add to.
+ * @param src           The histogram to add.
+ */
+void hist_merge(struct hist *dst, const struct hist *src);
+
+/**
+ * Estimate a percentile.
+ *
+ * @param h             The histogram.
+ * @param p             The percentile, between 0 and 1.
+ *
+ * @return              An upper bound on the value at that percentile, which
+ *                          is never more than the largest value recorded.
+ *                          0 if the histogram is empty.
+ */
+uint64_t hist_percentile(const struct hist *h, double p);
+
+/**
+ * Count the values below a limit.
+ *
+ * @param h             The histogram.
+ * @param limit         The limit.  The count is exact if the limit is 0, a
+ *                          power of 2, or below HIST_SUB_BUCKETS.  Otherwise,
+ *                          values in the bucket the limit falls into are not
+ *                          counted.
+ *
+ * @return              The number of values less than limit.
+ */
+uint64_t hist_count_below(const struct hist *h, uint64_t limit);
+
+#endif
+
+// vim: ts=4:sw=4:et
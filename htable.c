@@ -24,56 +24,158 @@
 #include <string.h>
 #include <unistd.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 struct htable_pair {
     void *key;
     void *val;
 };
 
+/**
+ * The number of control bytes examined by a single probe step.
+ */
+#define HTABLE_GROUP 16
+
+/**
+ * Control byte value for an empty slot.  Full slots store a 7-bit hash
+ * fragment, so the high bit alone distinguishes the two.
+ */
+#define HTABLE_CTRL_EMPTY 0x80
+
+/**
+ * The capacity we pass to the user's hash function.  We derive both the home
+ * slot and the hash fragment from the result, so it should be as wide as
+ * possible.
+ */
+#define HTABLE_HASH_RANGE 0x80000000U
+
 /**
  * A hash table which uses linear probing.
+ *
+ * Alongside the key/value pairs we keep one control byte per slot holding
+ * either HTABLE_CTRL_EMPTY or a 7-bit fragment of the key's hash.  Lookups
+ * scan HTABLE_GROUP control bytes at a time and only call eq_fun on slots
+ * whose fragment matches.  The first HTABLE_GROUP control bytes are mirrored
+ * after the end of the array so that a group starting near the end can be
+ * loaded without wrapping.
  */
 struct htable {
     uint32_t capacity;
     uint32_t used;
     htable_hash_fn_t hash_fun;
     htable_eq_fn_t eq_fun;
+    uint8_t *ctrl;
     struct htable_pair *elem;
 };
 
+/**
+ * Compute the home slot and hash fragment of a key.
+ *
+ * @param hash_fun      The hash function to use.
+ * @param key           The key.
+ * @param capacity      The capacity of the hash table.  A power of 2.
+ * @param home          (out param) the slot the key hashes to.
+ * @param frag          (out param) the 7-bit hash fragment.
+ */
+static void htable_hash(htable_hash_fn_t hash_fun, const void *key,
+                        uint32_t capacity, uint32_t *home, uint8_t *frag)
+{
+    uint64_t h = hash_fun(key, HTABLE_HASH_RANGE) * 0x9e3779b97f4a7c15ULL;
+
+    // The top bits of the product are the best mixed, so they pick the slot.
+    *home = (uint32_t)(h >> (64 - __builtin_ctz(capacity)));
+    *frag = (uint8_t)(h >> 25) & 0x7f;
+}
+
+/**
+ * Scan a group of control bytes.
+ *
+ * @param ctrl          The first control byte of the group.
+ * @param frag          The hash fragment to look for.
+ * @param match         (out param) bit i is set if ctrl[i] == frag.
+ * @param empty         (out param) bit i is set if ctrl[i] is empty.
+ */
+static inline void htable_group_scan(const uint8_t *ctrl, uint8_t frag,
+                                     uint32_t *match, uint32_t *empty)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+
+    *match = (uint32_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(group, _mm_set1_epi8((char)frag)));
+    *empty = (uint32_t)_mm_movemask_epi8(group);
+#else
+    uint32_t i;
+
+    *match = 0;
+    *empty = 0;
+    for (i = 0; i < HTABLE_GROUP; i++) {
+        if (ctrl[i] == frag) {
+            *match |= 1U << i;
+        } else if (ctrl[i] & HTABLE_CTRL_EMPTY) {
+            *empty |= 1U << i;
+        }
+    }
+#endif
+}
+
+/**
+ * Set the control byte for a slot, along with its mirror if it has one.
+ *
+ * @param ctrl          The control byte array.
+ * @param capacity      The capacity of the hash table.
+ * @param i             The slot.
+ * @param val           The new control byte.
+ */
+static void htable_set_ctrl(uint8_t *ctrl, uint32_t capacity, uint32_t i,
+                            uint8_t val)
+{
+    ctrl[i] = val;
+    // Tables smaller than a group mirror each slot more than once.
+    for (i += capacity; i < capacity + HTABLE_GROUP; i += capacity) {
+        ctrl[i] = val;
+    }
+}
+
 /**
  * An internal function for inserting a value into the hash table.
  *
  * Note: this function assumes that you have made enough space in the table.
  *
- * @param nelem         The new element to insert.
+ * @param nctrl         The control bytes of the table.
+ * @param nelem         The elements of the table.
  * @param capacity      The capacity of the hash table.
  * @param hash_fun      The hash function to use.
  * @param key           The key to insert.
  * @param val           The value to insert.
  */
-static void htable_insert_internal(struct htable_pair *nelem, 
+static void htable_insert_internal(uint8_t *nctrl, struct htable_pair *nelem,
         uint32_t capacity, htable_hash_fn_t hash_fun, void *key,
         void *val)
 {
-    uint32_t i;
+    uint32_t pos, match, empty, i;
+    uint8_t frag;
 
-    i = hash_fun(key, capacity);
+    htable_hash(hash_fun, key, capacity, &pos, &frag);
     while (1) {
-        if (!nelem[i].key) {
+        htable_group_scan(nctrl + pos, frag, &match, &empty);
+        if (empty) {
+            i = (pos + __builtin_ctz(empty)) & (capacity - 1);
+            htable_set_ctrl(nctrl, capacity, i, frag);
             nelem[i].key = key;
             nelem[i].val = val;
             return;
         }
-        i++;
-        if (i == capacity) {
-            i = 0;
-        }
+        pos = (pos + HTABLE_GROUP) & (capacity - 1);
     }
 }
 
 static int htable_realloc(struct htable *htable, uint32_t new_capacity)
 {
     struct htable_pair *nelem;
+    uint8_t *nctrl;
     uint32_t i, old_capacity = htable->capacity;
     htable_hash_fn_t hash_fun = htable->hash_fun;
 
@@ -81,14 +183,22 @@ static int htable_realloc(struct htable *htable, uint32_t new_capacity)
     if (!nelem) {
         return ENOMEM;
     }
+    nctrl = malloc(new_capacity + HTABLE_GROUP);
+    if (!nctrl) {
+        free(nelem);
+        return ENOMEM;
+    }
+    memset(nctrl, HTABLE_CTRL_EMPTY, new_capacity + HTABLE_GROUP);
     for (i = 0; i < old_capacity; i++) {
-        struct htable_pair *pair = htable->elem + i;
-        if (pair->key) {
-            htable_insert_internal(nelem, new_capacity, hash_fun,
+        if (!(htable->ctrl[i] & HTABLE_CTRL_EMPTY)) {
+            struct htable_pair *pair = htable->elem + i;
+            htable_insert_internal(nctrl, nelem, new_capacity, hash_fun,
                                    pair->key, pair->val);
         }
     }
+    free(htable->ctrl);
     free(htable->elem);
+    htable->ctrl = nctrl;
     htable->elem = nelem;
     htable->capacity = new_capacity;
     return 0;
@@ -138,7 +248,7 @@ void htable_visit(struct htable *htable, visitor_fn_t fun, void *ctx)
 
     for (i = 0; i != htable->capacity; ++i) {
         struct htable_pair *elem = htable->elem + i;
-        if (elem->key) {
+        if (!(htable->ctrl[i] & HTABLE_CTRL_EMPTY)) {
             fun(ctx, elem->key, elem->val);
         }
     }
@@ -147,6 +257,7 @@ void htable_visit(struct htable *htable, visitor_fn_t fun, void *ctx)
 void htable_free(struct htable *htable)
 {
     if (htable) {
+        free(htable->ctrl);
         free(htable->elem);
         free(htable);
     }
@@ -158,8 +269,6 @@ int htable_put(struct htable *htable, void *key, void *val)
     uint32_t nused;
 
     // NULL is not a valid key value.
-    // This helps us implement htable_get_internal efficiently, since we know
-    // that we can stop when we encounter the first NULL key.
     if (!key) {
         return EINVAL;
     }
@@ -176,7 +285,7 @@ int htable_put(struct htable *htable, void *key, void *val)
         if (ret)
             return ret;
     }
-    htable_insert_internal(htable->elem, htable->capacity,
+    htable_insert_internal(htable->ctrl, htable->elem, htable->capacity,
                                 htable->hash_fun, key, val);
     htable->used++;
     return 0;
@@ -185,28 +294,30 @@ int htable_put(struct htable *htable, void *key, void *val)
 static int htable_get_internal(const struct htable *htable,
                                const void *key, uint32_t *out)
 {
-    uint32_t start_idx, idx;
+    uint32_t pos, match, empty, idx, mask = htable->capacity - 1;
+    uint8_t frag;
 
-    start_idx = htable->hash_fun(key, htable->capacity);
-    idx = start_idx;
+    htable_hash(htable->hash_fun, key, htable->capacity, &pos, &frag);
     while (1) {
-        struct htable_pair *pair = htable->elem + idx;
-        if (!pair->key) {
-            // We always maintain the invariant that the entries corresponding
-            // to a given key are stored in a contiguous block, not separated
-            // by any NULLs.  So if we encounter a NULL, our search is over.
-            return ENOENT;
-        } else if (htable->eq_fun(pair->key, key)) {
-            *out = idx;
-            return 0;
+        htable_group_scan(htable->ctrl + pos, frag, &match, &empty);
+        // We always maintain the invariant that the entries corresponding to
+        // a given key are stored in a contiguous block, not separated by any
+        // empty slots.  So nothing past the first empty slot can match.
+        if (empty) {
+            match &= (empty & -empty) - 1;
         }
-        idx++;
-        if (idx == htable->capacity) {
-            idx = 0;
+        while (match) {
+            idx = (pos + __builtin_ctz(match)) & mask;
+            if (htable->eq_fun(htable->elem[idx].key, key)) {
+                *out = idx;
+                return 0;
+            }
+            match &= match - 1;
         }
-        if (idx == start_idx) {
+        if (empty) {
             return ENOENT;
         }
+        pos = (pos + HTABLE_GROUP) & mask;
     }
 }
 
@@ -223,33 +334,39 @@ void *htable_get(const struct htable *htable, const void *key)
 void htable_pop(struct htable *htable, const void *key,
                 void **found_key, void **found_val)
 {
-    uint32_t hole, i;
-    const void *nkey;
+    uint32_t hole, i, home, mask = htable->capacity - 1;
+    uint8_t frag;
 
     if (htable_get_internal(htable, key, &hole)) {
         *found_key = NULL;
         *found_val = NULL;
         return;
     }
+    *found_key = htable->elem[hole].key;
+    *found_val = htable->elem[hole].val;
     i = hole;
     htable->used--;
     // We need to maintain the compactness invariant used in
-    // htable_get_internal.  This invariant specifies that the entries for any
-    // given key are never separated by NULLs (although they may be separated
-    // by entries for other keys.)
+    // htable_get_internal.  This invariant specifies that there are no empty
+    // slots between the slot an entry hashes to and the slot it is stored in.
+    // So we shift back any entries after the hole which would otherwise
+    // become unreachable.
     while (1) {
-        i++;
-        if (i == htable->capacity) {
-            i = 0;
-        }
-        nkey = htable->elem[i].key;
-        if (!nkey) {
-            *found_key = htable->elem[hole].key;
-            *found_val = htable->elem[hole].val;
+        i = (i + 1) & mask;
+        if (htable->ctrl[i] & HTABLE_CTRL_EMPTY) {
+            htable_set_ctrl(htable->ctrl, htable->capacity, hole,
+                            HTABLE_CTRL_EMPTY);
             htable->elem[hole].key = NULL;
             htable->elem[hole].val = NULL;
             return;
-        } else if (htable->eq_fun(key, nkey)) {
+        }
+        // The entry at i can fill the hole unless the slot it hashes to lies
+        // cyclically in (hole, i].
+        htable_hash(htable->hash_fun, htable->elem[i].key, htable->capacity,
+                    &home, &frag);
+        if ((hole <= i) ? ((home <= hole) || (home > i)) :
+                ((home <= hole) && (home > i))) {
+            htable_set_ctrl(htable->ctrl, htable->capacity, hole, frag);
             htable->elem[hole].key = htable->elem[i].key;
             htable->elem[hole].val = htable->elem[i].val;
             hole = i;
@@ -267,6 +384,27 @@ uint32_t htable_capacity(const struct htable *htable)
     return htable->capacity;
 }
 
+void htable_probe_hist(const struct htable *htable, uint32_t *hist,
+                       uint32_t nhist)
+{
+    uint32_t i, home, dist;
+    uint8_t frag;
+
+    memset(hist, 0, sizeof(*hist) * nhist);
+    for (i = 0; i < htable->capacity; i++) {
+        if (htable->ctrl[i] & HTABLE_CTRL_EMPTY) {
+            continue;
+        }
+        htable_hash(htable->hash_fun, htable->elem[i].key, htable->capacity,
+                    &home, &frag);
+        dist = (i - home) & (htable->capacity - 1);
+        if (dist >= nhist) {
+            dist = nhist - 1;
+        }
+        hist[dist]++;
+    }
+}
+
 uint32_t ht_hash_string(const void *str, uint32_t max)
 {
     const char *s = str;
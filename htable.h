@@ -30,6 +30,10 @@ struct htable;
 /**
  * An HTable hash function.
  *
+ * The table calls this with a capacity much larger than its own and derives
+ * both the slot and a short hash fragment from the result, so the hash should
+ * spread keys across the whole range it is given.
+ *
  * @param key       The key.
  * @param capacity  The total capacity.
  *
@@ -136,6 +140,22 @@ uint32_t htable_used(const struct htable *htable);
  */
 uint32_t htable_capacity(const struct htable *htable);
 
+/**
+ * Compute the distribution of probe lengths in the hash table.
+ *
+ * The probe length of an entry is the number of slots between the slot it
+ * hashes to and the slot it is stored in.  A successful lookup of the entry
+ * examines that many slots beyond the first.
+ *
+ * @param htable    The hash table.
+ * @param hist      (out param) hist[i] is set to the number of entries with a
+ *                      probe length of i.  The last bucket also counts all
+ *                      longer probes.
+ * @param nhist     The number of buckets in hist.  Must be nonzero.
+ */
+void htable_probe_hist(const struct htable *htable, uint32_t *hist,
+                       uint32_t nhist);
+
 /**
  * Hash a string.
  *
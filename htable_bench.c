@@ -0,0 +1,392 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "htable.h"
+#include "htable_int.h"
+#include "util.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @file htable_bench.c
+ *
+ * Measures the throughput of htable_put, htable_get and htable_pop, and the
+ * distribution of probe lengths, for several key distributions across a
+ * range of load factors.
+ */
+
+#define NUM_PROBE_HIST 8
+
+/**
+ * The load factors to measure.  htable grows once it is half full, so these
+ * cover the whole range a table can be in.
+ */
+static const double LOAD_FACTORS[] = { 0.10, 0.20, 0.30, 0.40, 0.49 };
+
+#define NUM_LOAD_FACTORS \
+    (sizeof(LOAD_FACTORS) / sizeof(LOAD_FACTORS[0]))
+
+/**
+ * A set of keys to benchmark with.
+ */
+struct bench_keys {
+    /** The name to print. */
+    const char *name;
+
+    /** Keys which are inserted into the table. */
+    void **keys;
+
+    /** Keys which are never inserted into the table. */
+    void **miss;
+
+    /** Number of entries in keys and miss. */
+    uint32_t num;
+
+    /** Hash function for the keys. */
+    htable_hash_fn_t hash_fun;
+
+    /** Equality function for the keys. */
+    htable_eq_fn_t eq_fun;
+
+    /** Nonzero if the keys are integers which fit in a uint64_t. */
+    int is_int;
+};
+
+/**
+ * Keeps the compiler from optimizing away lookups.
+ */
+static volatile uintptr_t g_sink;
+
+static void print_usage(void)
+{
+        fprintf(stderr,
+"htable_bench: measures hash table throughput and probe lengths.\n"
+"\n"
+"Usage:\n"
+"htable_bench [capacity] [lookups]\n"
+"\n"
+"capacity is the size of the tables to fill (default 65536).\n"
+"lookups is the number of lookups to time per measurement "
+"(default 4194304).\n");
+}
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static uint32_t int_hash(const void *key, uint32_t capacity)
+{
+    uint64_t h = (uintptr_t)key;
+
+    return (uint32_t)((h ^ (h >> 32)) % capacity);
+}
+
+static int int_eq(const void *a, const void *b)
+{
+    return a == b;
+}
+
+static void keys_free(struct bench_keys *bk)
+{
+    uint32_t i;
+
+    if (!bk->is_int) {
+        for (i = 0; i < bk->num; i++) {
+            free(bk->keys[i]);
+            free(bk->miss[i]);
+        }
+    }
+    free(bk->keys);
+    free(bk->miss);
+}
+
+/**
+ * Sequential integers, like UIDs or inode numbers on a fresh filesystem.
+ */
+static void keys_seq_int(struct bench_keys *bk, uint32_t num)
+{
+    uint32_t i;
+
+    bk->name = "seq_int";
+    bk->keys = xcalloc(num, sizeof(void *));
+    bk->miss = xcalloc(num, sizeof(void *));
+    for (i = 0; i < num; i++) {
+        bk->keys[i] = (void *)(uintptr_t)(i + 1);
+        bk->miss[i] = (void *)(uintptr_t)(num + i + 1);
+    }
+    bk->num = num;
+    bk->hash_fun = int_hash;
+    bk->eq_fun = int_eq;
+    bk->is_int = 1;
+}
+
+/**
+ * Random 64-bit integers.
+ */
+static void keys_rand_int(struct bench_keys *bk, uint32_t num)
+{
+    uint32_t i;
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+
+    bk->name = "rand_int";
+    bk->keys = xcalloc(num, sizeof(void *));
+    bk->miss = xcalloc(num, sizeof(void *));
+    // Even keys go in the table and odd keys don't, so the two sets never
+    // overlap.
+    for (i = 0; i < num; i++) {
+        bk->keys[i] = (void *)(uintptr_t)(xorshift64(&state) & ~1ULL);
+        bk->miss[i] = (void *)(uintptr_t)(xorshift64(&state) | 1ULL);
+    }
+    bk->num = num;
+    bk->hash_fun = int_hash;
+    bk->eq_fun = int_eq;
+    bk->is_int = 1;
+}
+
+/**
+ * File paths which share long common prefixes.
+ */
+static void keys_path(struct bench_keys *bk, uint32_t num)
+{
+    uint32_t i;
+    char buf[128];
+
+    bk->name = "path";
+    bk->keys = xcalloc(num, sizeof(void *));
+    bk->miss = xcalloc(num, sizeof(void *));
+    for (i = 0; i < num; i++) {
+        snprintf(buf, sizeof(buf), "/user/u%04"PRIu32"/data/part-%05"PRIu32,
+                 i % 1000, i / 1000);
+        bk->keys[i] = strdup(buf);
+        snprintf(buf, sizeof(buf), "/user/u%04"PRIu32"/tmp/part-%05"PRIu32,
+                 i % 1000, i / 1000);
+        bk->miss[i] = strdup(buf);
+        if ((!bk->keys[i]) || (!bk->miss[i])) {
+            fprintf(stderr, "keys_path: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    bk->num = num;
+    bk->hash_fun = ht_hash_string;
+    bk->eq_fun = ht_compare_string;
+    bk->is_int = 0;
+}
+
+static double mops(uint64_t ops, uint64_t start_ns)
+{
+    uint64_t ns = monotonic_now_ns() - start_ns;
+
+    if (ns == 0) {
+        ns = 1;
+    }
+    return (ops * 1000.0) / ns;
+}
+
+static struct htable *bench_fill(const struct bench_keys *bk,
+                                 uint32_t capacity, uint32_t num)
+{
+    struct htable *ht;
+    uint32_t i;
+    int ret;
+
+    ht = htable_alloc(capacity, bk->hash_fun, bk->eq_fun);
+    if (!ht) {
+        fprintf(stderr, "htable_alloc failed: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num; i++) {
+        ret = htable_put(ht, bk->keys[i], bk->keys[i]);
+        if (ret) {
+            fprintf(stderr, "htable_put failed: error %d (%s)\n",
+                    ret, strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+    }
+    return ht;
+}
+
+static void bench_htable(const struct bench_keys *bk, uint32_t capacity,
+                         uint32_t lookups, double load)
+{
+    struct htable *ht;
+    uint32_t i, num = capacity * load, hist[NUM_PROBE_HIST];
+    uint64_t start, total = 0, sum = 0;
+    double put, grow, hit, miss, churn;
+    void *key, *val;
+
+    // Growing from the minimum size measures the cost of resizing.
+    start = monotonic_now_ns();
+    ht = bench_fill(bk, 0, num);
+    grow = mops(num, start);
+    htable_free(ht);
+
+    start = monotonic_now_ns();
+    ht = bench_fill(bk, capacity, num);
+    put = mops(num, start);
+
+    start = monotonic_now_ns();
+    for (i = 0; i < lookups; i++) {
+        sum += (uintptr_t)htable_get(ht, bk->keys[i % num]);
+    }
+    hit = mops(lookups, start);
+
+    start = monotonic_now_ns();
+    for (i = 0; i < lookups; i++) {
+        sum += (uintptr_t)htable_get(ht, bk->miss[i % bk->num]);
+    }
+    miss = mops(lookups, start);
+
+    // Removing and re-adding entries exercises the backward shift in
+    // htable_pop.  Each iteration is two operations.
+    start = monotonic_now_ns();
+    for (i = 0; i < lookups / 2; i++) {
+        htable_pop(ht, bk->keys[i % num], &key, &val);
+        htable_put(ht, key, val);
+    }
+    churn = mops((lookups / 2) * 2, start);
+    g_sink = sum;
+
+    htable_probe_hist(ht, hist, NUM_PROBE_HIST);
+    printf("%-9s %4.2f %7.2f %7.2f %7.2f %7.2f %7.2f ", bk->name, load,
+           put, grow, hit, miss, churn);
+    for (i = 0; i < NUM_PROBE_HIST; i++) {
+        total += hist[i];
+    }
+    for (i = 0; i < NUM_PROBE_HIST; i++) {
+        printf(" %5.1f", total ? (hist[i] * 100.0) / total : 0.0);
+    }
+    printf("\n");
+    htable_free(ht);
+}
+
+static void bench_htable_u64(const struct bench_keys *bk, uint32_t capacity,
+                             uint32_t lookups, double load)
+{
+    struct htable_u64 *ht;
+    uint32_t i, num = capacity * load;
+    uint64_t start, sum = 0;
+    double put, grow, hit, miss, churn;
+    void *val;
+
+    start = monotonic_now_ns();
+    ht = htable_u64_alloc(0);
+    for (i = 0; ht && (i < num); i++) {
+        if (htable_u64_put(ht, (uintptr_t)bk->keys[i], bk->keys[i])) {
+            break;
+        }
+    }
+    grow = mops(num, start);
+    htable_u64_free(ht);
+
+    start = monotonic_now_ns();
+    ht = htable_u64_alloc(capacity);
+    if (!ht) {
+        fprintf(stderr, "htable_u64_alloc failed: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num; i++) {
+        htable_u64_put(ht, (uintptr_t)bk->keys[i], bk->keys[i]);
+    }
+    put = mops(num, start);
+
+    start = monotonic_now_ns();
+    for (i = 0; i < lookups; i++) {
+        sum += (uintptr_t)htable_u64_get(ht, (uintptr_t)bk->keys[i % num]);
+    }
+    hit = mops(lookups, start);
+
+    start = monotonic_now_ns();
+    for (i = 0; i < lookups; i++) {
+        sum += (uintptr_t)htable_u64_get(ht,
+                    (uintptr_t)bk->miss[i % bk->num]);
+    }
+    miss = mops(lookups, start);
+
+    start = monotonic_now_ns();
+    for (i = 0; i < lookups / 2; i++) {
+        val = htable_u64_pop(ht, (uintptr_t)bk->keys[i % num]);
+        htable_u64_put(ht, (uintptr_t)bk->keys[i % num], val);
+    }
+    churn = mops((lookups / 2) * 2, start);
+    g_sink = sum;
+
+    printf("%-9s %4.2f %7.2f %7.2f %7.2f %7.2f %7.2f\n", "  u64", load,
+           put, grow, hit, miss, churn);
+    htable_u64_free(ht);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_keys bk;
+    uint32_t capacity = 65536, lookups = 4194304, i, k;
+    void (*const gen[])(struct bench_keys *, uint32_t) = {
+        keys_seq_int,
+        keys_rand_int,
+        keys_path,
+    };
+
+    if (argc > 3) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    if (argc > 1) {
+        capacity = strtoul(argv[1], NULL, 0);
+    }
+    if (argc > 2) {
+        lookups = strtoul(argv[2], NULL, 0);
+    }
+    if ((capacity < 1024) || (capacity > 0x10000000) || (lookups == 0)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    printf("capacity %"PRIu32", %"PRIu32" lookups per measurement.\n",
+           capacity, lookups);
+    printf("Throughput is in millions of operations per second.  The probe "
+           "columns give\nthe percentage of entries stored that many slots "
+           "past the slot they hash to.\n\n");
+    printf("%-9s %4s %7s %7s %7s %7s %7s ", "keys", "load", "put", "grow",
+           "hit", "miss", "churn");
+    for (i = 0; i < NUM_PROBE_HIST; i++) {
+        printf(" %4"PRIu32"%s", i, (i == NUM_PROBE_HIST - 1) ? "+" : " ");
+    }
+    printf("\n");
+    for (k = 0; k < sizeof(gen) / sizeof(gen[0]); k++) {
+        gen[k](&bk, capacity);
+        for (i = 0; i < NUM_LOAD_FACTORS; i++) {
+            bench_htable(&bk, capacity, lookups, LOAD_FACTORS[i]);
+            if (bk.is_int) {
+                bench_htable_u64(&bk, capacity, lookups, LOAD_FACTORS[i]);
+            }
+        }
+        keys_free(&bk);
+    }
+    return EXIT_SUCCESS;
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -0,0 +1,286 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_HTABLE_INT_H
+#define IOHUB_HTABLE_INT_H
+
+#include "htable.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Hash tables specialized for integer keys.
+ *
+ * HTABLE_INT_DEFINE(name, key_type) generates a struct name and a set of
+ * static inline functions name_alloc, name_free, name_put, name_get,
+ * name_pop, name_visit, name_used and name_capacity.  They behave like the
+ * corresponding htable_* functions, but the key is stored inline and hashed
+ * and compared without going through function pointers.
+ *
+ * Every key value is valid, including 0.  As with struct htable, values
+ * cannot be NULL; a NULL value marks an empty slot.
+ */
+
+/**
+ * Hash an integer key into a power-of-2 sized table.
+ *
+ * @param key       The key.
+ * @param capacity  The capacity of the table.  A power of 2.
+ *
+ * @return          The hash slot.
+ */
+static inline uint32_t htable_int_hash(uint64_t key, uint32_t capacity)
+{
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >>
+                      (64 - __builtin_ctz(capacity)));
+}
+
+#define HTABLE_INT_DEFINE(name, key_type)                                   \
+                                                                            \
+struct name##_pair {                                                        \
+    key_type key;                                                           \
+    void *val;                                                              \
+};                                                                          \
+                                                                            \
+struct name {                                                               \
+    uint32_t capacity;                                                      \
+    uint32_t used;                                                          \
+    struct name##_pair *elem;                                               \
+};                                                                          \
+                                                                            \
+typedef void (*name##_visitor_fn_t)(void *ctx, key_type key, void *val);    \
+                                                                            \
+static inline void name##_insert_internal(struct name##_pair *nelem,        \
+        uint32_t capacity, key_type key, void *val)                         \
+{                                                                           \
+    uint32_t i = htable_int_hash((uint64_t)key, capacity);                  \
+                                                                            \
+    while (nelem[i].val) {                                                  \
+        i = (i + 1) & (capacity - 1);                                       \
+    }                                                                       \
+    nelem[i].key = key;                                                     \
+    nelem[i].val = val;                                                     \
+}                                                                           \
+                                                                            \
+static inline int name##_realloc(struct name *ht, uint32_t new_capacity)    \
+{                                                                           \
+    struct name##_pair *nelem;                                              \
+    uint32_t i;                                                             \
+                                                                            \
+    nelem = calloc(new_capacity, sizeof(struct name##_pair));               \
+    if (!nelem) {                                                           \
+        return ENOMEM;                                                      \
+    }                                                                       \
+    for (i = 0; i < ht->capacity; i++) {                                    \
+        if (ht->elem[i].val) {                                              \
+            name##_insert_internal(nelem, new_capacity,                     \
+                                   ht->elem[i].key, ht->elem[i].val);       \
+        }                                                                   \
+    }                                                                       \
+    free(ht->elem);                                                         \
+    ht->elem = nelem;                                                       \
+    ht->capacity = new_capacity;                                            \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+/**                                                                         \
+ * Allocate a new hash table.                                               \
+ *                                                                          \
+ * @param capacity  The minimum suggested starting capacity.                \
+ *                                                                          \
+ * @return          The new hash table on success; NULL on OOM.             \
+ */                                                                         \
+static inline struct name *name##_alloc(uint32_t capacity)                  \
+{                                                                           \
+    struct name *ht;                                                        \
+    uint32_t size = HTABLE_MIN_SIZE;                                        \
+                                                                            \
+    ht = calloc(1, sizeof(*ht));                                            \
+    if (!ht) {                                                              \
+        return NULL;                                                        \
+    }                                                                       \
+    while ((size < capacity) && (size < 0x80000000U)) {                     \
+        size *= 2;                                                          \
+    }                                                                       \
+    if (name##_realloc(ht, size)) {                                         \
+        free(ht);                                                           \
+        return NULL;                                                        \
+    }                                                                       \
+    return ht;                                                              \
+}                                                                           \
+                                                                            \
+/**                                                                         \
+ * Free the hash table.  The values are not freed.                          \
+ *                                                                          \
+ * @param ht        The hash table.                                         \
+ */                                                                         \
+static inline void name##_free(struct name *ht)                             \
+{                                                                           \
+    if (ht) {                                                               \
+        free(ht->elem);                                                     \
+        free(ht);                                                           \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+/**                                                                         \
+ * Add an entry to the hash table.                                          \
+ *                                                                          \
+ * @param ht        The hash table.                                         \
+ * @param key       The key to add.                                         \
+ * @param val       The value to add.  This cannot be NULL.                 \
+ *                                                                          \
+ * @return          0 on success; EINVAL if val is NULL; ENOMEM if there    \
+ *                      is not enough memory to add the element.            \
+ */                                                                         \
+static inline int name##_put(struct name *ht, key_type key, void *val)      \
+{                                                                           \
+    int ret;                                                                \
+                                                                            \
+    if (!val) {                                                             \
+        return EINVAL;                                                      \
+    }                                                                       \
+    if (ht->used + 1 >= (ht->capacity / 2)) {                               \
+        ret = name##_realloc(ht, ht->capacity * 2);                         \
+        if (ret) {                                                          \
+            return ret;                                                     \
+        }                                                                   \
+    }                                                                       \
+    name##_insert_internal(ht->elem, ht->capacity, key, val);               \
+    ht->used++;                                                             \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+static inline int name##_get_internal(const struct name *ht,                \
+                                      key_type key, uint32_t *out)          \
+{                                                                           \
+    uint32_t i = htable_int_hash((uint64_t)key, ht->capacity);              \
+                                                                            \
+    while (ht->elem[i].val) {                                               \
+        if (ht->elem[i].key == key) {                                       \
+            *out = i;                                                       \
+            return 0;                                                       \
+        }                                                                   \
+        i = (i + 1) & (ht->capacity - 1);                                   \
+    }                                                                       \
+    return ENOENT;                                                          \
+}                                                                           \
+                                                                            \
+/**                                                                         \
+ * Get an entry from the hash table.                                        \
+ *                                                                          \
+ * @param ht        The hash table.                                         \
+ * @param key       The key to find.                                        \
+ *                                                                          \
+ * @return          NULL if there is no such entry; the entry otherwise.    \
+ */                                                                         \
+static inline void *name##_get(const struct name *ht, key_type key)         \
+{                                                                           \
+    uint32_t i;                                                             \
+                                                                            \
+    if (name##_get_internal(ht, key, &i)) {                                 \
+        return NULL;                                                        \
+    }                                                                       \
+    return ht->elem[i].val;                                                 \
+}                                                                           \
+                                                                            \
+/**                                                                         \
+ * Get an entry from the hash table and remove it.                          \
+ *                                                                          \
+ * @param ht        The hash table.                                         \
+ * @param key       The key for the entry to find and remove.               \
+ *                                                                          \
+ * @return          NULL if the entry was not found; the removed value      \
+ *                      otherwise.                                          \
+ */                                                                         \
+static inline void *name##_pop(struct name *ht, key_type key)               \
+{                                                                           \
+    uint32_t hole, i, home, mask = ht->capacity - 1;                        \
+    void *val;                                                              \
+                                                                            \
+    if (name##_get_internal(ht, key, &hole)) {                              \
+        return NULL;                                                        \
+    }                                                                       \
+    val = ht->elem[hole].val;                                               \
+    ht->used--;                                                             \
+    /* Shift back entries which would otherwise become unreachable, as */  \
+    /* htable_pop does. */                                                  \
+    i = hole;                                                               \
+    while (1) {                                                             \
+        i = (i + 1) & mask;                                                 \
+        if (!ht->elem[i].val) {                                             \
+            ht->elem[hole].val = NULL;                                      \
+            return val;                                                     \
+        }                                                                   \
+        home = htable_int_hash((uint64_t)ht->elem[i].key, ht->capacity);    \
+        if ((hole <= i) ? ((home <= hole) || (home > i)) :                  \
+                ((home <= hole) && (home > i))) {                           \
+            ht->elem[hole] = ht->elem[i];                                   \
+            hole = i;                                                       \
+        }                                                                   \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+/**                                                                         \
+ * Visit all of the entries in the hash table.                              \
+ *                                                                          \
+ * @param ht        The hash table.                                         \
+ * @param fun       The callback function to invoke on each key and value.  \
+ * @param ctx       Context pointer to pass to the callback.                \
+ */                                                                         \
+static inline void name##_visit(struct name *ht, name##_visitor_fn_t fun,   \
+                                void *ctx)                                  \
+{                                                                           \
+    uint32_t i;                                                             \
+                                                                            \
+    for (i = 0; i < ht->capacity; i++) {                                    \
+        if (ht->elem[i].val) {                                              \
+            fun(ctx, ht->elem[i].key, ht->elem[i].val);                     \
+        }                                                                   \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static inline uint32_t name##_used(const struct name *ht)                   \
+{                                                                           \
+    return ht->used;                                                        \
+}                                                                           \
+                                                                            \
+static inline uint32_t name##_capacity(const struct name *ht)               \
+{                                                                           \
+    return ht->capacity;                                                    \
+}
+
+/**
+ * Tables keyed by 32-bit integers such as UIDs.
+ */
+HTABLE_INT_DEFINE(htable_u32, uint32_t)
+
+/**
+ * Tables keyed by 64-bit integers such as inode numbers.
+ */
+HTABLE_INT_DEFINE(htable_u64, uint64_t)
+
+/**
+ * Tables keyed by file descriptors.
+ */
+HTABLE_INT_DEFINE(htable_fd, int)
+
+#endif
+
+// vim: ts=4:sw=4:tw=79:et
@@ -17,6 +17,7 @@
  */
 
 #include "htable.h"
+#include "htable_int.h"
 #include "test.h"
 
 #include <errno.h>
@@ -63,6 +64,118 @@ static void *htable_pop_val(struct htable *ht, void *key)
     return old_val;
 }
 
+static uint32_t zero_hash(const void *key __attribute__((unused)),
+                          uint32_t size __attribute__((unused)))
+{
+    return 0;
+}
+
+static int test_pop_colliding(void)
+{
+    struct htable *ht;
+
+    // Every key hashes to the same slot, so removing one entry must shift the
+    // others back to keep them reachable.
+    ht = htable_alloc(16, zero_hash, simple_compare);
+    EXPECT_NONNULL(ht);
+    EXPECT_INT_ZERO(htable_put(ht, (void*)1, (void*)101));
+    EXPECT_INT_ZERO(htable_put(ht, (void*)2, (void*)102));
+    EXPECT_INT_ZERO(htable_put(ht, (void*)3, (void*)103));
+    EXPECT_INT_EQ(101, (uintptr_t)htable_pop_val(ht, (void*)1));
+    EXPECT_INT_EQ(102, (uintptr_t)htable_get(ht, (void*)2));
+    EXPECT_INT_EQ(103, (uintptr_t)htable_get(ht, (void*)3));
+    EXPECT_INT_EQ(103, (uintptr_t)htable_pop_val(ht, (void*)3));
+    EXPECT_INT_EQ(102, (uintptr_t)htable_get(ht, (void*)2));
+    EXPECT_INT_EQ(1, htable_used(ht));
+    htable_free(ht);
+    return 0;
+}
+
+static int test_long_chain(void)
+{
+    struct htable *ht;
+    uintptr_t i;
+
+    // A run of colliding keys longer than one probe group, with every other
+    // key removed from the middle of it.
+    ht = htable_alloc(4, zero_hash, simple_compare);
+    EXPECT_NONNULL(ht);
+    for (i = 1; i <= 40; i++) {
+        EXPECT_INT_ZERO(htable_put(ht, (void*)i, (void*)(i + 100)));
+    }
+    for (i = 1; i <= 40; i += 2) {
+        EXPECT_INT_EQ(i + 100, (uintptr_t)htable_pop_val(ht, (void*)i));
+    }
+    for (i = 1; i <= 40; i++) {
+        if (i & 1) {
+            EXPECT_NULL(htable_get(ht, (void*)i));
+        } else {
+            EXPECT_INT_EQ(i + 100, (uintptr_t)htable_get(ht, (void*)i));
+        }
+    }
+    EXPECT_INT_EQ(20, htable_used(ht));
+    htable_free(ht);
+    return 0;
+}
+
+static void sum_u64(void *ctx, uint64_t key, void *val)
+{
+    uint64_t *sum = ctx;
+
+    if (key + 1000 != (uintptr_t)val) {
+        abort();
+    }
+    *sum += key;
+}
+
+static int test_int_tables(void)
+{
+    struct htable_u32 *ht32;
+    struct htable_u64 *ht64;
+    uint64_t i, sum = 0;
+
+    // Zero is a valid integer key.
+    ht32 = htable_u32_alloc(0);
+    EXPECT_NONNULL(ht32);
+    EXPECT_INT_EQ(HTABLE_MIN_SIZE, htable_u32_capacity(ht32));
+    EXPECT_NULL(htable_u32_get(ht32, 0));
+    EXPECT_INT_EQ(EINVAL, htable_u32_put(ht32, 0, NULL));
+    EXPECT_INT_ZERO(htable_u32_put(ht32, 0, (void*)100));
+    EXPECT_INT_ZERO(htable_u32_put(ht32, 0xffffffffU, (void*)101));
+    EXPECT_INT_EQ(100, (uintptr_t)htable_u32_get(ht32, 0));
+    EXPECT_INT_EQ(101, (uintptr_t)htable_u32_get(ht32, 0xffffffffU));
+    EXPECT_INT_EQ(100, (uintptr_t)htable_u32_pop(ht32, 0));
+    EXPECT_NULL(htable_u32_pop(ht32, 0));
+    EXPECT_INT_EQ(1, htable_u32_used(ht32));
+    htable_u32_free(ht32);
+
+    // Grow the table, then remove every other key.
+    ht64 = htable_u64_alloc(4);
+    EXPECT_NONNULL(ht64);
+    for (i = 0; i < 1000; i++) {
+        EXPECT_INT_ZERO(htable_u64_put(ht64, i << 20,
+                                       (void*)(uintptr_t)((i << 20) + 1000)));
+    }
+    EXPECT_INT_EQ(2048, htable_u64_capacity(ht64));
+    for (i = 0; i < 1000; i += 2) {
+        EXPECT_INT_EQ((i << 20) + 1000,
+                      (uintptr_t)htable_u64_pop(ht64, i << 20));
+    }
+    for (i = 0; i < 1000; i++) {
+        if (i & 1) {
+            EXPECT_INT_EQ((i << 20) + 1000,
+                          (uintptr_t)htable_u64_get(ht64, i << 20));
+        } else {
+            EXPECT_NULL(htable_u64_get(ht64, i << 20));
+        }
+    }
+    EXPECT_INT_EQ(500, htable_u64_used(ht64));
+    htable_u64_visit(ht64, sum_u64, &sum);
+    EXPECT_INT_EQ(250000ULL << 20, sum);
+    htable_u64_free(ht64);
+    return 0;
+}
+
 int main(void)
 {
     struct htable *ht;
@@ -92,6 +205,10 @@ int main(void)
     EXPECT_INT_EQ(1, found_102);
     htable_free(ht);
 
+    EXPECT_INT_ZERO(test_pop_colliding());
+    EXPECT_INT_ZERO(test_long_chain());
+    EXPECT_INT_ZERO(test_int_tables());
+
     return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,633 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hist.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * @file io_bench.c
+ *
+ * An end-to-end I/O benchmark.  It runs several workloads at once in a
+ * directory, each in its own process under its own UID, and reports the
+ * throughput and latency each one achieved.  Pointed at an iohub mount and
+ * then at the underfs directly, it shows what iohub costs.  Given the pid of
+ * the iohub daemon, it also reports how much CPU the daemon used per GiB
+ * transferred.
+ */
+
+#define MAX_WORKLOADS 32
+
+#define SEQ_BLOCK (1024 * 1024)
+#define SMALL_BLOCK 4096
+
+/** Percentage of random 4K operations which are reads. */
+#define RAND_READ_PCT 70
+
+/** Number of distinct file names each metadata thread cycles through. */
+#define META_NAMES 1000
+
+enum wl_type {
+    WL_SEQ,
+    WL_RAND4K,
+    WL_META,
+    WL_FSYNC,
+    WL_NUM_TYPES
+};
+
+static const char * const WL_NAMES[WL_NUM_TYPES] = {
+    [WL_SEQ] = "seq",
+    [WL_RAND4K] = "rand4k",
+    [WL_META] = "meta",
+    [WL_FSYNC] = "fsync",
+};
+
+struct wl_result {
+    /** Bytes read or written. */
+    uint64_t bytes;
+
+    /** Operations completed. */
+    uint64_t ops;
+
+    /** Latency histogram. */
+    struct hist lat;
+};
+
+struct workload {
+    enum wl_type type;
+    uint32_t uid;
+    uint32_t nthreads;
+
+    /** Directory the workload runs in. */
+    char dir[PATH_MAX];
+
+    /** Process running the workload. */
+    pid_t pid;
+
+    /** Read end of the pipe the results come back on. */
+    int result_fd;
+
+    struct wl_result result;
+};
+
+struct wl_thread {
+    pthread_t thread;
+    struct workload *wl;
+    uint32_t idx;
+    uint64_t rng;
+    int fd;
+    char *buf;
+    struct wl_result result;
+};
+
+static struct workload g_workloads[MAX_WORKLOADS];
+
+static uint32_t g_num_workloads;
+
+/** Size of the files used by the seq, rand4k and fsync workloads. */
+static uint64_t g_file_size = 64ULL * 1024 * 1024;
+
+/** How long to run, in seconds. */
+static uint32_t g_secs = 10;
+
+/** Monotonic time in nanoseconds at which the threads should stop. */
+static uint64_t g_deadline_ns;
+
+static void print_usage(void)
+{
+        fprintf(stderr,
+"io_bench: runs concurrent I/O workloads and reports their performance.\n"
+"\n"
+"Usage:\n"
+"io_bench [-d seconds] [-s file_mb] [-p daemon_pid] [-w spec]... dir\n"
+"\n"
+"-d seconds      How long to run (default 10).\n"
+"-s file_mb      Size of each data file in MiB (default 64).\n"
+"-p daemon_pid   Report the CPU used by this process per GiB transferred.\n"
+"-w spec         Add a workload.  spec is TYPE:UID:THREADS, where TYPE is\n"
+"                one of:\n"
+"                    seq      sequential 1 MiB writes, then reads\n"
+"                    rand4k   random 4 KiB reads (70%%) and writes\n"
+"                    meta     create, stat and unlink small files\n"
+"                    fsync    4 KiB writes, each followed by fsync\n"
+"                Workloads run as UID if we are root, and as the current\n"
+"                user otherwise.\n"
+"\n"
+"Without -w, runs seq:1014:2, rand4k:1015:4, meta:65534:2 and "
+"fsync:65534:1.\n");
+}
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void result_record(struct wl_result *res, uint64_t start_ns,
+                          uint64_t bytes)
+{
+    uint64_t lat = monotonic_now_ns() - start_ns;
+
+    hist_record(&res->lat, lat);
+    res->bytes += bytes;
+    res->ops++;
+}
+
+static void result_merge(struct wl_result *dst, const struct wl_result *src)
+{
+    dst->bytes += src->bytes;
+    dst->ops += src->ops;
+    hist_merge(&dst->lat, &src->lat);
+}
+
+static void die_errno(const char *what, const char *path)
+{
+    int err = errno;
+
+    fprintf(stderr, "io_bench: %s(%s) failed: error %d (%s)\n",
+            what, path, err, strerror(err));
+    _exit(EXIT_FAILURE);
+}
+
+/**
+ * Create the data file for a thread and fill it, so that reads have
+ * something to read.  This is not timed.
+ */
+static void wl_setup_file(struct wl_thread *wt, const char *name, int fill)
+{
+    char path[PATH_MAX + 32];
+    uint64_t off;
+
+    snprintf(path, sizeof(path), "%s/%s.%"PRIu32, wt->wl->dir, name,
+             wt->idx);
+    wt->fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (wt->fd < 0) {
+        die_errno("open", path);
+    }
+    for (off = 0; fill && (off < g_file_size); off += SEQ_BLOCK) {
+        if (pwrite(wt->fd, wt->buf, SEQ_BLOCK, off) != SEQ_BLOCK) {
+            die_errno("pwrite", path);
+        }
+    }
+}
+
+static void wl_run_seq(struct wl_thread *wt)
+{
+    uint64_t off = 0, start;
+    int reading = 0;
+    ssize_t res;
+
+    while ((start = monotonic_now_ns()) < g_deadline_ns) {
+        if (reading) {
+            res = pread(wt->fd, wt->buf, SEQ_BLOCK, off);
+        } else {
+            res = pwrite(wt->fd, wt->buf, SEQ_BLOCK, off);
+        }
+        if (res != SEQ_BLOCK) {
+            die_errno(reading ? "pread" : "pwrite", wt->wl->dir);
+        }
+        result_record(&wt->result, start, SEQ_BLOCK);
+        off += SEQ_BLOCK;
+        if (off >= g_file_size) {
+            off = 0;
+            reading = !reading;
+        }
+    }
+}
+
+static void wl_run_rand4k(struct wl_thread *wt)
+{
+    uint64_t off, start, r;
+    ssize_t res;
+    int reading;
+
+    while ((start = monotonic_now_ns()) < g_deadline_ns) {
+        r = xorshift64(&wt->rng);
+        off = (r % (g_file_size / SMALL_BLOCK)) * SMALL_BLOCK;
+        reading = ((r >> 40) % 100) < RAND_READ_PCT;
+        if (reading) {
+            res = pread(wt->fd, wt->buf, SMALL_BLOCK, off);
+        } else {
+            res = pwrite(wt->fd, wt->buf, SMALL_BLOCK, off);
+        }
+        if (res != SMALL_BLOCK) {
+            die_errno(reading ? "pread" : "pwrite", wt->wl->dir);
+        }
+        result_record(&wt->result, start, SMALL_BLOCK);
+    }
+}
+
+static void wl_run_meta(struct wl_thread *wt)
+{
+    char path[PATH_MAX + 32];
+    uint64_t start, n = 0;
+    struct stat st;
+    int fd;
+
+    while ((start = monotonic_now_ns()) < g_deadline_ns) {
+        snprintf(path, sizeof(path), "%s/meta.%"PRIu32".%"PRIu64,
+                 wt->wl->dir, wt->idx, (n++) % META_NAMES);
+        fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if ((fd < 0) || close(fd)) {
+            die_errno("open", path);
+        }
+        result_record(&wt->result, start, 0);
+        start = monotonic_now_ns();
+        if (stat(path, &st)) {
+            die_errno("stat", path);
+        }
+        result_record(&wt->result, start, 0);
+        start = monotonic_now_ns();
+        if (unlink(path)) {
+            die_errno("unlink", path);
+        }
+        result_record(&wt->result, start, 0);
+    }
+}
+
+static void wl_run_fsync(struct wl_thread *wt)
+{
+    uint64_t off = 0, start;
+
+    while ((start = monotonic_now_ns()) < g_deadline_ns) {
+        if (pwrite(wt->fd, wt->buf, SMALL_BLOCK, off) != SMALL_BLOCK) {
+            die_errno("pwrite", wt->wl->dir);
+        }
+        if (fsync(wt->fd)) {
+            die_errno("fsync", wt->wl->dir);
+        }
+        result_record(&wt->result, start, SMALL_BLOCK);
+        off += SMALL_BLOCK;
+        if (off >= g_file_size) {
+            off = 0;
+        }
+    }
+}
+
+static void *wl_thread_run(void *arg)
+{
+    struct wl_thread *wt = arg;
+
+    switch (wt->wl->type) {
+    case WL_SEQ:
+        wl_run_seq(wt);
+        break;
+    case WL_RAND4K:
+        wl_run_rand4k(wt);
+        break;
+    case WL_META:
+        wl_run_meta(wt);
+        break;
+    case WL_FSYNC:
+        wl_run_fsync(wt);
+        break;
+    default:
+        break;
+    }
+    return NULL;
+}
+
+/**
+ * Run a workload.  This is called in the workload's own process, and never
+ * returns.
+ *
+ * @param wl            The workload.
+ * @param go_fd         A pipe which becomes readable when all the workloads
+ *                          should start.
+ * @param result_fd     A pipe to write the results to.
+ */
+static void wl_main(struct workload *wl, int go_fd, int result_fd)
+{
+    struct wl_thread *threads;
+    struct wl_result res;
+    uint32_t i;
+    char go;
+    int ret;
+
+    if ((geteuid() == 0) && (wl->uid != 0)) {
+        if (setgid(wl->uid) || setuid(wl->uid)) {
+            die_errno("setuid", wl->dir);
+        }
+    }
+    threads = xcalloc(wl->nthreads, sizeof(*threads));
+    for (i = 0; i < wl->nthreads; i++) {
+        struct wl_thread *wt = &threads[i];
+        wt->wl = wl;
+        wt->idx = i;
+        wt->rng = ((uint64_t)(wl - g_workloads) << 32) ^ (i + 1) ^
+            0x9e3779b97f4a7c15ULL;
+        wt->fd = -1;
+        wt->buf = xcalloc(1, SEQ_BLOCK);
+        memset(wt->buf, 'a' + (i % 26), SEQ_BLOCK);
+        switch (wl->type) {
+        case WL_SEQ:
+            wl_setup_file(wt, "seq", 0);
+            break;
+        case WL_RAND4K:
+            wl_setup_file(wt, "rand4k", 1);
+            break;
+        case WL_FSYNC:
+            wl_setup_file(wt, "fsync", 0);
+            break;
+        default:
+            break;
+        }
+    }
+    // Wait for every workload to finish setting up.  The parent starts us
+    // by closing the pipe, so we read EOF.
+    if (read(go_fd, &go, 1) < 0) {
+        die_errno("read", "go pipe");
+    }
+    g_deadline_ns = monotonic_now_ns() + (g_secs * 1000000000ULL);
+    for (i = 0; i < wl->nthreads; i++) {
+        ret = pthread_create(&threads[i].thread, NULL, wl_thread_run,
+                             &threads[i]);
+        if (ret) {
+            errno = ret;
+            die_errno("pthread_create", wl->dir);
+        }
+    }
+    memset(&res, 0, sizeof(res));
+    for (i = 0; i < wl->nthreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        result_merge(&res, &threads[i].result);
+        if (threads[i].fd >= 0) {
+            close(threads[i].fd);
+        }
+        free(threads[i].buf);
+    }
+    free(threads);
+    if (write(result_fd, &res, sizeof(res)) != sizeof(res)) {
+        die_errno("write", "result pipe");
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static int parse_workload(const char *spec)
+{
+    struct workload *wl;
+    char *end;
+    size_t len;
+    int t;
+
+    if (g_num_workloads == MAX_WORKLOADS) {
+        fprintf(stderr, "io_bench: too many workloads.\n");
+        return EINVAL;
+    }
+    wl = &g_workloads[g_num_workloads];
+    memset(wl, 0, sizeof(*wl));
+    for (t = 0; t < WL_NUM_TYPES; t++) {
+        len = strlen(WL_NAMES[t]);
+        if ((!strncmp(spec, WL_NAMES[t], len)) && (spec[len] == ':')) {
+            break;
+        }
+    }
+    if (t == WL_NUM_TYPES) {
+        goto invalid;
+    }
+    wl->type = t;
+    wl->uid = strtoul(spec + len + 1, &end, 0);
+    if (*end != ':') {
+        goto invalid;
+    }
+    wl->nthreads = strtoul(end + 1, &end, 0);
+    if ((*end) || (wl->nthreads == 0)) {
+        goto invalid;
+    }
+    wl->result_fd = -1;
+    g_num_workloads++;
+    return 0;
+
+invalid:
+    fprintf(stderr, "io_bench: invalid workload spec '%s'\n", spec);
+    return EINVAL;
+}
+
+static int read_result(int fd, struct wl_result *res)
+{
+    char *buf = (char *)res;
+    size_t done = 0;
+    ssize_t ret;
+
+    while (done < sizeof(*res)) {
+        ret = read(fd, buf + done, sizeof(*res) - done);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        } else if (ret == 0) {
+            return EPIPE;
+        }
+        done += ret;
+    }
+    return 0;
+}
+
+/**
+ * Get the CPU time used by a process.
+ *
+ * @param pid           The process.
+ * @param secs          (out param) User plus system CPU seconds.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+static int proc_cpu_secs(pid_t pid, double *secs)
+{
+    char path[64], buf[1024], *p;
+    unsigned long utime, stime;
+    ssize_t res;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno;
+    }
+    res = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (res <= 0) {
+        return EIO;
+    }
+    buf[res] = '\0';
+    // The command name can contain spaces, so start after its closing
+    // parenthesis.  utime and stime are the 14th and 15th fields.
+    p = strrchr(buf, ')');
+    if ((!p) || (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u "
+                        "%*u %lu %lu", &utime, &stime) != 2)) {
+        return EIO;
+    }
+    *secs = ((double)(utime + stime)) / sysconf(_SC_CLK_TCK);
+    return 0;
+}
+
+static void print_results(pid_t daemon_pid, double cpu_secs)
+{
+    struct workload *wl;
+    uint64_t total_bytes = 0;
+    uint32_t i;
+
+    printf("%-8s %6s %7s %9s %10s %9s %9s %9s\n", "workload", "uid",
+           "threads", "MiB/s", "ops/s", "p50_us", "p99_us", "p999_us");
+    for (i = 0; i < g_num_workloads; i++) {
+        wl = &g_workloads[i];
+        total_bytes += wl->result.bytes;
+        printf("%-8s %6"PRIu32" %7"PRIu32" %9.2f %10.1f %9.1f %9.1f "
+               "%9.1f\n", WL_NAMES[wl->type], wl->uid, wl->nthreads,
+               (wl->result.bytes / 1048576.0) / g_secs,
+               ((double)wl->result.ops) / g_secs,
+               hist_percentile(&wl->result.lat, 0.50) / 1000.0,
+               hist_percentile(&wl->result.lat, 0.99) / 1000.0,
+               hist_percentile(&wl->result.lat, 0.999) / 1000.0);
+    }
+    if (daemon_pid) {
+        printf("daemon cpu: %.2f s, %.3f s per GiB\n", cpu_secs,
+               total_bytes ? cpu_secs / (total_bytes / 1073741824.0) : 0.0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int c, go_pipe[2], result_pipe[2], status, ret = EXIT_FAILURE;
+    pid_t daemon_pid = 0;
+    double cpu_start = 0, cpu_end = 0;
+    struct workload *wl;
+    const char *base;
+    uint32_t i;
+
+    while ((c = getopt(argc, argv, "d:hp:s:w:")) != -1) {
+        switch (c) {
+        case 'd':
+            g_secs = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            daemon_pid = strtol(optarg, NULL, 0);
+            break;
+        case 's':
+            g_file_size = strtoull(optarg, NULL, 0) * 1024 * 1024;
+            break;
+        case 'w':
+            if (parse_workload(optarg)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return (c == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if ((optind != argc - 1) || (g_secs == 0) || (g_file_size == 0)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    base = argv[optind];
+    if (g_num_workloads == 0) {
+        parse_workload("seq:1014:2");
+        parse_workload("rand4k:1015:4");
+        parse_workload("meta:65534:2");
+        parse_workload("fsync:65534:1");
+    }
+    if (geteuid() != 0) {
+        fprintf(stderr, "io_bench: not running as root, so all workloads "
+                "will run as uid %d.\n", (int)geteuid());
+    }
+    if (pipe(go_pipe)) {
+        die_errno("pipe", "go");
+    }
+    for (i = 0; i < g_num_workloads; i++) {
+        wl = &g_workloads[i];
+        snprintf(wl->dir, sizeof(wl->dir), "%s/io_bench.%"PRIu32, base, i);
+        if (access(wl->dir, F_OK) == 0) {
+            recursive_unlink(wl->dir);
+        }
+        if (mkdir(wl->dir, 0755)) {
+            die_errno("mkdir", wl->dir);
+        }
+        if ((geteuid() == 0) && chown(wl->dir, wl->uid, wl->uid)) {
+            die_errno("chown", wl->dir);
+        }
+        if (pipe(result_pipe)) {
+            die_errno("pipe", "result");
+        }
+        wl->pid = fork();
+        if (wl->pid < 0) {
+            die_errno("fork", wl->dir);
+        } else if (wl->pid == 0) {
+            close(go_pipe[1]);
+            close(result_pipe[0]);
+            wl_main(wl, go_pipe[0], result_pipe[1]);
+        }
+        close(result_pipe[1]);
+        wl->result_fd = result_pipe[0];
+    }
+    close(go_pipe[0]);
+    if (daemon_pid && proc_cpu_secs(daemon_pid, &cpu_start)) {
+        fprintf(stderr, "io_bench: can't read the CPU time of pid %d\n",
+                (int)daemon_pid);
+        daemon_pid = 0;
+    }
+    // Closing the write end wakes up every workload at once.
+    close(go_pipe[1]);
+    for (i = 0; i < g_num_workloads; i++) {
+        wl = &g_workloads[i];
+        if (read_result(wl->result_fd, &wl->result)) {
+            fprintf(stderr, "io_bench: workload %s:%"PRIu32":%"PRIu32
+                    " failed.\n", WL_NAMES[wl->type], wl->uid,
+                    wl->nthreads);
+            goto done;
+        }
+    }
+    if (daemon_pid && proc_cpu_secs(daemon_pid, &cpu_end)) {
+        daemon_pid = 0;
+    }
+    print_results(daemon_pid, cpu_end - cpu_start);
+    ret = EXIT_SUCCESS;
+
+done:
+    for (i = 0; i < g_num_workloads; i++) {
+        wl = &g_workloads[i];
+        if (wl->pid > 0) {
+            waitpid(wl->pid, &status, 0);
+        }
+        if (wl->result_fd >= 0) {
+            close(wl->result_fd);
+        }
+        recursive_unlink(wl->dir);
+    }
+    return ret;
+}
+
+// vim: ts=4:sw=4:tw=79:et
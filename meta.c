@@ -16,9 +16,12 @@
  * limitations under the License.
  */
 
+#include "backend.h"
+#include "ctl.h"
 #include "fs.h"
 #include "log.h"
 #include "meta.h"
+#include "throttle.h"
 
 #include <ctype.h>
 #include <dirent.h>
@@ -38,15 +41,74 @@
 
 // TODO: remove PATH_MAX hacks
 
+/**
+ * An open directory.
+ */
+struct hub_dir {
+    /** The underfs directory stream, or NULL for the control directory. */
+    DIR *dp;
+
+    /** The throttle domain of the backend the directory is on. */
+    uint32_t domain;
+};
+
+/**
+ * Decide what to make of an error from applying a namespace operation to one
+ * member of a backend.
+ *
+ * The first member of a striped backend is authoritative.  The others may be
+ * missing entries which only exist in the first, like symlinks, so we don't
+ * mind if they don't have the entry or already have it.
+ *
+ * @param i             The index of the member.
+ * @param err           The error code.
+ *
+ * @return              0 if the error should be ignored; the negative error
+ *                          code otherwise.
+ */
+static int hub_member_err(unsigned int i, int err)
+{
+    if ((i > 0) && ((err == ENOENT) || (err == EEXIST))) {
+        return 0;
+    }
+    return -err;
+}
+
 int hub_getattr(const char *path, struct stat *stbuf)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
+    struct stat mst;
+    enum hub_ctl_node node;
+    unsigned int i;
     int ret = 0;
     char bpath[PATH_MAX];
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
+    node = ctl_lookup(path);
+    if (node) {
+        return ctl_getattr(node, stbuf);
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_GETATTR);
+
     if (stat(bpath, stbuf) < 0) {
         ret = -errno;
+    } else if (S_ISREG(stbuf->st_mode)) {
+        // A striped file is as long as its longest member.
+        for (i = 1; i < be->nroots; i++) {
+            backend_member_path(be, i, path, bpath, sizeof(bpath));
+            if (stat(bpath, &mst) < 0) {
+                ret = hub_member_err(i, errno);
+                if (ret) {
+                    break;
+                }
+                continue;
+            }
+            if (mst.st_size > stbuf->st_size) {
+                stbuf->st_size = mst.st_size;
+            }
+            stbuf->st_blocks += mst.st_blocks;
+        }
     }
     DEBUG("hub_getattr(path=%s, bpath=%s) = %d (%s)\n",
           path, bpath, ret, terror(-ret));
@@ -56,10 +118,17 @@ int hub_getattr(const char *path, struct stat *stbuf)
 int hub_readlink(const char *path, char *buf, size_t size)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     ssize_t res;
     char bpath[PATH_MAX];
     int ret = 0;
 
+    if (ctl_lookup(path)) {
+        return -EINVAL;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_READLINK);
+
     // POSIX semantics are a bit different than FUSE semantics... POSIX doesn't
     // require NULL-termination, but FUSE does.  POSIX also returns the length
     // of the text we fetched, but FUSE does not.
@@ -67,7 +136,6 @@ int hub_readlink(const char *path, char *buf, size_t size)
         ret = 0;
         goto done;
     }
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
     res = readlink(bpath, buf, size);
     if (res < 0) {
         ret = -errno;
@@ -85,13 +153,26 @@ done:
 int hub_mknod(const char *path, mode_t mode, dev_t dev)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
+    unsigned int i;
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
+    if (ctl_lookup(path)) {
+        return -EPERM;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_MKNOD);
+
     // note: we assume that FUSE has already taken care of umask.
-    if (mknod(bpath, mode, dev) < 0) {
-        ret = -errno;
+    for (i = 0; i < be->nroots; i++) {
+        backend_member_path(be, i, path, bpath, sizeof(bpath));
+        if (mknod(bpath, mode, dev) < 0) {
+            ret = hub_member_err(i, errno);
+            if (ret) {
+                break;
+            }
+        }
     }
     DEBUG("hub_mknod(path=%s, bpath=%s, mode=%04o, dev=%"PRId64") = %d\n",
           path, bpath, mode, (int64_t)dev, ret);
@@ -101,13 +182,26 @@ int hub_mknod(const char *path, mode_t mode, dev_t dev)
 int hub_mkdir(const char *path, mode_t mode)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
+    unsigned int i;
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
+    if (ctl_lookup(path)) {
+        return -EPERM;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_MKDIR);
+
     // note: we assume that FUSE has already taken care of umask.
-    if (mkdir(bpath, mode) < 0) {
-        ret = -errno;
+    for (i = 0; i < be->nroots; i++) {
+        backend_member_path(be, i, path, bpath, sizeof(bpath));
+        if (mkdir(bpath, mode) < 0) {
+            ret = hub_member_err(i, errno);
+            if (ret) {
+                break;
+            }
+        }
     }
     DEBUG("hub_mkdir(path=%s, bpath=%s, mode=%04o) = %d\n",
           path, bpath, mode, ret);
@@ -117,12 +211,25 @@ int hub_mkdir(const char *path, mode_t mode)
 int hub_unlink(const char *path)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
+    unsigned int i;
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
-    if (unlink(bpath) < 0) {
-        ret = -errno;
+    if (ctl_lookup(path)) {
+        return -EPERM;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_UNLINK);
+
+    for (i = 0; i < be->nroots; i++) {
+        backend_member_path(be, i, path, bpath, sizeof(bpath));
+        if (unlink(bpath) < 0) {
+            ret = hub_member_err(i, errno);
+            if (ret) {
+                break;
+            }
+        }
     }
     DEBUG("hub_unlink(path=%s, bpath=%s) = %d (%s)\n",
           path, bpath, ret, terror(-ret));
@@ -132,12 +239,25 @@ int hub_unlink(const char *path)
 int hub_rmdir(const char *path)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
+    unsigned int i;
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
-    if (rmdir(bpath) < 0) {
-        ret = -errno;
+    if (ctl_lookup(path)) {
+        return -EPERM;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_RMDIR);
+
+    for (i = 0; i < be->nroots; i++) {
+        backend_member_path(be, i, path, bpath, sizeof(bpath));
+        if (rmdir(bpath) < 0) {
+            ret = hub_member_err(i, errno);
+            if (ret) {
+                break;
+            }
+        }
     }
     DEBUG("hub_rmdir(path=%s, bpath=%s) = %d (%s)\n",
           path, bpath, ret, terror(-ret));
@@ -147,11 +267,17 @@ int hub_rmdir(const char *path)
 int hub_symlink(const char *oldpath, const char *newpath)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char boldpath[PATH_MAX], bnewpath[PATH_MAX];
     int ret = 0;
 
-    snprintf(boldpath, sizeof(boldpath), "%s%s", fs->root, oldpath);
-    snprintf(bnewpath, sizeof(bnewpath), "%s%s", fs->root, newpath);
+    if (ctl_lookup(newpath)) {
+        return -EPERM;
+    }
+    backend_path(fs, oldpath, boldpath, sizeof(boldpath));
+    be = backend_path(fs, newpath, bnewpath, sizeof(bnewpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_SYMLINK);
+
     if (symlink(boldpath, bnewpath) < 0) {
         ret = -errno;
     }
@@ -164,13 +290,33 @@ int hub_symlink(const char *oldpath, const char *newpath)
 int hub_rename(const char *oldpath, const char *newpath) 
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *obe, *nbe;
     char boldpath[PATH_MAX], bnewpath[PATH_MAX];
+    unsigned int i;
     int ret = 0;
 
-    snprintf(boldpath, sizeof(boldpath), "%s%s", fs->root, oldpath);
-    snprintf(bnewpath, sizeof(bnewpath), "%s%s", fs->root, newpath);
-    if (rename(boldpath, bnewpath) < 0) {
-        ret = -errno;
+    if (ctl_lookup(oldpath) || ctl_lookup(newpath)) {
+        return -EPERM;
+    }
+    obe = backend_path(fs, oldpath, boldpath, sizeof(boldpath));
+    nbe = backend_path(fs, newpath, bnewpath, sizeof(bnewpath));
+    throttle_op(nbe->domain, fuse_get_context()->uid, HUB_OP_RENAME);
+
+    if (obe != nbe) {
+        // Backends are separate underfs directories, possibly on separate
+        // devices, so we can't rename between them.
+        ret = -EXDEV;
+    } else {
+        for (i = 0; i < obe->nroots; i++) {
+            backend_member_path(obe, i, oldpath, boldpath, sizeof(boldpath));
+            backend_member_path(nbe, i, newpath, bnewpath, sizeof(bnewpath));
+            if (rename(boldpath, bnewpath) < 0) {
+                ret = hub_member_err(i, errno);
+                if (ret) {
+                    break;
+                }
+            }
+        }
     }
     DEBUG("hub_rename(oldpath=%s, boldpath=%s, newpath=%s, bnewpath=%s) = "
           "%d (%s)\n", oldpath, boldpath, newpath, bnewpath, ret,
@@ -181,13 +327,33 @@ int hub_rename(const char *oldpath, const char *newpath)
 int hub_link(const char *oldpath, const char *newpath) 
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *obe, *nbe;
     char boldpath[PATH_MAX], bnewpath[PATH_MAX];
+    unsigned int i;
     int ret = 0;
 
-    snprintf(boldpath, sizeof(boldpath), "%s%s", fs->root, oldpath);
-    snprintf(bnewpath, sizeof(bnewpath), "%s%s", fs->root, newpath);
-    if (link(boldpath, bnewpath) < 0) {
-        ret = -errno;
+    if (ctl_lookup(oldpath) || ctl_lookup(newpath)) {
+        return -EPERM;
+    }
+    obe = backend_path(fs, oldpath, boldpath, sizeof(boldpath));
+    nbe = backend_path(fs, newpath, bnewpath, sizeof(bnewpath));
+    throttle_op(nbe->domain, fuse_get_context()->uid, HUB_OP_LINK);
+
+    if (obe != nbe) {
+        // Backends are separate underfs directories, possibly on separate
+        // devices, so we can't link between them.
+        ret = -EXDEV;
+    } else {
+        for (i = 0; i < obe->nroots; i++) {
+            backend_member_path(obe, i, oldpath, boldpath, sizeof(boldpath));
+            backend_member_path(nbe, i, newpath, bnewpath, sizeof(bnewpath));
+            if (link(boldpath, bnewpath) < 0) {
+                ret = hub_member_err(i, errno);
+                if (ret) {
+                    break;
+                }
+            }
+        }
     }
     DEBUG("hub_link(oldpath=%s, boldpath=%s, newpath=%s, bnewpath=%s) = "
           "%d (%s)\n", oldpath, boldpath, newpath, bnewpath, ret,
@@ -198,12 +364,25 @@ int hub_link(const char *oldpath, const char *newpath)
 int hub_chmod(const char *path, mode_t mode) 
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
+    unsigned int i;
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
-    if (chmod(bpath, mode) < 0) {
-        ret = -errno;
+    if (ctl_lookup(path)) {
+        return -EPERM;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_CHMOD);
+
+    for (i = 0; i < be->nroots; i++) {
+        backend_member_path(be, i, path, bpath, sizeof(bpath));
+        if (chmod(bpath, mode) < 0) {
+            ret = hub_member_err(i, errno);
+            if (ret) {
+                break;
+            }
+        }
     }
     DEBUG("hub_chmod(path=%s, bpath=%s) = %d (%s)\n",
           path, bpath, ret, terror(-ret));
@@ -213,12 +392,25 @@ int hub_chmod(const char *path, mode_t mode)
 int hub_chown(const char *path, uid_t uid, gid_t gid)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
+    unsigned int i;
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
-    if (chown(bpath, uid, gid) < 0) {
-        ret = -errno;
+    if (ctl_lookup(path)) {
+        return -EPERM;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_CHOWN);
+
+    for (i = 0; i < be->nroots; i++) {
+        backend_member_path(be, i, path, bpath, sizeof(bpath));
+        if (chown(bpath, uid, gid) < 0) {
+            ret = hub_member_err(i, errno);
+            if (ret) {
+                break;
+            }
+        }
     }
     DEBUG("hub_chown(path=%s, bpath=%s) = %d (%s)\n",
           path, bpath, ret, terror(-ret));
@@ -228,12 +420,25 @@ int hub_chown(const char *path, uid_t uid, gid_t gid)
 int hub_truncate(const char *path, off_t off)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
+    unsigned int i;
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
-    if (truncate(bpath, off) < 0) {
-        ret = -errno;
+    if (ctl_lookup(path)) {
+        return -EPERM;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_TRUNCATE);
+
+    for (i = 0; i < be->nroots; i++) {
+        backend_member_path(be, i, path, bpath, sizeof(bpath));
+        if (truncate(bpath, off) < 0) {
+            ret = hub_member_err(i, errno);
+            if (ret) {
+                break;
+            }
+        }
     }
     DEBUG("hub_truncate(path=%s, bpath=%s, off=%"PRId64") = %d (%s)\n",
           path, bpath, (int64_t)off, ret, terror(-ret));
@@ -243,12 +448,25 @@ int hub_truncate(const char *path, off_t off)
 int hub_utime(const char *path, struct utimbuf *buf)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
+    unsigned int i;
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
-    if (utime(bpath, buf) < 0) {
-        ret = -errno;
+    if (ctl_lookup(path)) {
+        return -EPERM;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_UTIME);
+
+    for (i = 0; i < be->nroots; i++) {
+        backend_member_path(be, i, path, bpath, sizeof(bpath));
+        if (utime(bpath, buf) < 0) {
+            ret = hub_member_err(i, errno);
+            if (ret) {
+                break;
+            }
+        }
     }
     if (!buf) {
         // If buf == NULL, we attempted to set the times to the current time.
@@ -265,10 +483,17 @@ int hub_utime(const char *path, struct utimbuf *buf)
 int hub_statfs(const char *path, struct statvfs *vfs)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
+    if (ctl_lookup(path)) {
+        // Report on the filesystem the control directory is mounted in.
+        path = "/";
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_STATFS);
+
     if (statvfs(bpath, vfs) < 0) {
         ret = -errno;
     }
@@ -299,10 +524,16 @@ int hub_setxattr(const char *path, const char *name, const char *value,
                         size_t size, int flags)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX], *nvalue = NULL;
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
+    if (ctl_lookup(path)) {
+        return -EPERM;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_SETXATTR);
+
     if (setxattr(bpath, name, value, size, flags) < 0) {
         ret = -errno;
     }
@@ -323,10 +554,16 @@ done:
 int hub_getxattr(const char *path, const char *name, char *value, size_t size)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX], *nvalue = NULL;
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
+    if (ctl_lookup(path)) {
+        return -ENODATA;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_GETXATTR);
+
     if (getxattr(bpath, name, value, size) < 0) {
         ret = -errno;
     }
@@ -352,10 +589,17 @@ done:
 int hub_listxattr(const char *path, char *list, size_t size)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
+    if (ctl_lookup(path)) {
+        // Control files have no extended attributes.
+        return 0;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_LISTXATTR);
+
     if (listxattr(bpath, list, size) < 0) {
         ret = -errno;
     }
@@ -367,10 +611,16 @@ int hub_listxattr(const char *path, char *list, size_t size)
 int hub_removexattr(const char *path, const char *name)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
+    if (ctl_lookup(path)) {
+        return -EPERM;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_REMOVEXATTR);
+
     if (removexattr(bpath, name) < 0) {
         ret = -errno;
     }
@@ -379,20 +629,62 @@ int hub_removexattr(const char *path, const char *name)
     return 0;
 }
 
+/**
+ * Open the control directory.
+ *
+ * @param node          The control node being opened.
+ * @param info          The FUSE file info.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+static int hub_opendir_ctl(enum hub_ctl_node node,
+                           struct fuse_file_info *info)
+{
+    struct hub_dir *dir;
+
+    if (node == HUB_CTL_MISSING) {
+        return -ENOENT;
+    } else if (node != HUB_CTL_DIR) {
+        return -ENOTDIR;
+    }
+    dir = calloc(1, sizeof(*dir));
+    if (!dir) {
+        return -ENOMEM;
+    }
+    info->fh = (uintptr_t)dir;
+    return 0;
+}
+
 int hub_opendir(const char *path, struct fuse_file_info *info)
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
-    DIR *dp;
+    struct hub_dir *dir;
+    enum hub_ctl_node node;
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
-    dp = opendir(bpath);
-    if (!dp) {
+    node = ctl_lookup(path);
+    if (node) {
+        return hub_opendir_ctl(node, info);
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_OPENDIR);
+
+    dir = malloc(sizeof(*dir));
+    if (!dir) {
+        ret = -ENOMEM;
+        goto done;
+    }
+    dir->domain = be->domain;
+    dir->dp = opendir(bpath);
+    if (!dir->dp) {
         ret = -errno;
+        free(dir);
     } else {
-        info->fh = (uintptr_t)dp;
+        info->fh = (uintptr_t)dir;
     }
+done:
     DEBUG("hub_opendir(path=%s, bpath=%s) = %d (%s)\n",
           path, bpath, ret, terror(-ret));
     return ret;
@@ -401,10 +693,16 @@ int hub_opendir(const char *path, struct fuse_file_info *info)
 int hub_readdir(const char *path, void *buf,
                 fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *info)
 {
-    DIR *dp = (DIR*)(uintptr_t)info->fh;
+    struct hub_dir *dir = (struct hub_dir*)(uintptr_t)info->fh;
+    DIR *dp = dir->dp;
     struct dirent *de;
     int ret = 0;
 
+    if (!dp) {
+        return ctl_readdir(buf, filler);
+    }
+    throttle_op(dir->domain, fuse_get_context()->uid, HUB_OP_READDIR);
+
     DEBUG("hub_readdir(path=%s, offset=%"PRId64") begin\n",
           path, (int64_t)offset);
     errno = 0;
@@ -458,12 +756,19 @@ int hub_readdir(const char *path, void *buf,
 
 int hub_releasedir(const char *path, struct fuse_file_info *info)
 {
-    DIR *dp = (DIR*)(uintptr_t)info->fh;
+    struct hub_dir *dir = (struct hub_dir*)(uintptr_t)info->fh;
     int ret = 0;
 
-    if (closedir(dp) < 0) {
+    if (!dir->dp) {
+        free(dir);
+        return 0;
+    }
+    throttle_op(dir->domain, fuse_get_context()->uid, HUB_OP_RELEASEDIR);
+
+    if (closedir(dir->dp) < 0) {
         ret = -errno;
     }
+    free(dir);
     DEBUG("hub_releasedir(path=%s) = %d (%s)\n",
           path, ret, terror(-ret));
     return ret;
@@ -472,10 +777,16 @@ int hub_releasedir(const char *path, struct fuse_file_info *info)
 int hub_fsyncdir(const char *path, int datasync, struct fuse_file_info *info)
 {
     int ret = 0;
-    DIR *dp = (DIR *)info->fh;
+    struct hub_dir *dir = (struct hub_dir*)(uintptr_t)info->fh;
+    DIR *dp = dir->dp;
+
+    if (!dp) {
+        return 0;
+    }
+    throttle_op(dir->domain, fuse_get_context()->uid, HUB_OP_FSYNCDIR);
 
     if (datasync) {
-        if (fdatasync(dirfd(dp) < 0)) {
+        if (fdatasync(dirfd(dp)) < 0) {
             ret = -errno;
         }
     } else {
@@ -491,12 +802,25 @@ int hub_fsyncdir(const char *path, int datasync, struct fuse_file_info *info)
 int hub_utimens(const char *path, const struct timespec tv[2])
 {
     struct hub_fs *fs = fuse_get_context()->private_data;
+    const struct hub_backend *be;
     char bpath[PATH_MAX];
+    unsigned int i;
     int ret = 0;
 
-    snprintf(bpath, sizeof(bpath), "%s%s", fs->root, path);
-    if (utimensat(AT_FDCWD, bpath, tv, 0) < 0) {
-        ret = -errno;
+    if (ctl_lookup(path)) {
+        return -EPERM;
+    }
+    be = backend_path(fs, path, bpath, sizeof(bpath));
+    throttle_op(be->domain, fuse_get_context()->uid, HUB_OP_UTIMENS);
+
+    for (i = 0; i < be->nroots; i++) {
+        backend_member_path(be, i, path, bpath, sizeof(bpath));
+        if (utimensat(AT_FDCWD, bpath, tv, 0) < 0) {
+            ret = hub_member_err(i, errno);
+            if (ret) {
+                break;
+            }
+        }
     }
     DEBUG("hub_utimens(path=%s, atime.tv_sec=%"PRId64", "
         "atime.tv_nsec=%"PRId64", mtime.tv_sec=%"PRId64", "
@@ -0,0 +1,110 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "op.h"
+
+static const char * const HUB_OP_NAMES[HUB_NUM_OPS] = {
+    [HUB_OP_GETATTR] = "getattr",
+    [HUB_OP_READLINK] = "readlink",
+    [HUB_OP_MKNOD] = "mknod",
+    [HUB_OP_MKDIR] = "mkdir",
+    [HUB_OP_UNLINK] = "unlink",
+    [HUB_OP_RMDIR] = "rmdir",
+    [HUB_OP_SYMLINK] = "symlink",
+    [HUB_OP_RENAME] = "rename",
+    [HUB_OP_LINK] = "link",
+    [HUB_OP_CHMOD] = "chmod",
+    [HUB_OP_CHOWN] = "chown",
+    [HUB_OP_TRUNCATE] = "truncate",
+    [HUB_OP_UTIME] = "utime",
+    [HUB_OP_STATFS] = "statfs",
+    [HUB_OP_SETXATTR] = "setxattr",
+    [HUB_OP_GETXATTR] = "getxattr",
+    [HUB_OP_LISTXATTR] = "listxattr",
+    [HUB_OP_REMOVEXATTR] = "removexattr",
+    [HUB_OP_OPENDIR] = "opendir",
+    [HUB_OP_READDIR] = "readdir",
+    [HUB_OP_RELEASEDIR] = "releasedir",
+    [HUB_OP_FSYNCDIR] = "fsyncdir",
+    [HUB_OP_UTIMENS] = "utimens",
+    [HUB_OP_CREATE] = "create",
+    [HUB_OP_OPEN] = "open",
+    [HUB_OP_READ] = "read",
+    [HUB_OP_WRITE] = "write",
+    [HUB_OP_FLUSH] = "flush",
+    [HUB_OP_RELEASE] = "release",
+    [HUB_OP_FSYNC] = "fsync",
+    [HUB_OP_FGETATTR] = "fgetattr",
+    [HUB_OP_FTRUNCATE] = "ftruncate",
+    [HUB_OP_FALLOCATE] = "fallocate",
+};
+
+const char *hub_op_name(enum hub_op op)
+{
+    if (((int)op < 0) || (op >= HUB_NUM_OPS)) {
+        return "unknown";
+    }
+    return HUB_OP_NAMES[op];
+}
+
+/**
+ * The number of metadata budget units which each operation costs.
+ *
+ * Operations which modify the namespace cost the most, since they force the
+ * underfs to write to its journal.  Reads and writes are not listed here,
+ * since they are throttled by the number of bytes they transfer.  fsync and
+ * fallocate are charged for the bytes they force out or allocate in addition
+ * to the cost listed here.
+ */
+static const uint32_t HUB_OP_COSTS[HUB_NUM_OPS] = {
+    [HUB_OP_GETATTR] = 1,
+    [HUB_OP_READLINK] = 1,
+    [HUB_OP_MKNOD] = 10,
+    [HUB_OP_MKDIR] = 10,
+    [HUB_OP_UNLINK] = 10,
+    [HUB_OP_RMDIR] = 10,
+    [HUB_OP_SYMLINK] = 10,
+    [HUB_OP_RENAME] = 10,
+    [HUB_OP_LINK] = 10,
+    [HUB_OP_CHMOD] = 5,
+    [HUB_OP_CHOWN] = 5,
+    [HUB_OP_TRUNCATE] = 5,
+    [HUB_OP_UTIME] = 5,
+    [HUB_OP_STATFS] = 1,
+    [HUB_OP_SETXATTR] = 5,
+    [HUB_OP_GETXATTR] = 1,
+    [HUB_OP_LISTXATTR] = 1,
+    [HUB_OP_REMOVEXATTR] = 5,
+    [HUB_OP_OPENDIR] = 1,
+    [HUB_OP_READDIR] = 2,
+    [HUB_OP_FSYNCDIR] = 10,
+    [HUB_OP_UTIMENS] = 5,
+    [HUB_OP_CREATE] = 10,
+    [HUB_OP_OPEN] = 1,
+    [HUB_OP_FSYNC] = 10,
+    [HUB_OP_FGETATTR] = 1,
+    [HUB_OP_FTRUNCATE] = 5,
+    [HUB_OP_FALLOCATE] = 5,
+};
+
+const uint32_t *hub_op_default_costs(void)
+{
+    return HUB_OP_COSTS;
+}
+
+// vim: ts=4:sw=4:tw=79:et
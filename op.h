@@ -0,0 +1,86 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_OP_H
+#define IOHUB_OP_H
+
+#include <stdint.h>
+
+/**
+ * The filesystem operations which iohub implements.
+ *
+ * These are used to index per-operation tables, such as the metadata cost
+ * table passed to throttle_init.
+ */
+enum hub_op {
+    HUB_OP_GETATTR = 0,
+    HUB_OP_READLINK,
+    HUB_OP_MKNOD,
+    HUB_OP_MKDIR,
+    HUB_OP_UNLINK,
+    HUB_OP_RMDIR,
+    HUB_OP_SYMLINK,
+    HUB_OP_RENAME,
+    HUB_OP_LINK,
+    HUB_OP_CHMOD,
+    HUB_OP_CHOWN,
+    HUB_OP_TRUNCATE,
+    HUB_OP_UTIME,
+    HUB_OP_STATFS,
+    HUB_OP_SETXATTR,
+    HUB_OP_GETXATTR,
+    HUB_OP_LISTXATTR,
+    HUB_OP_REMOVEXATTR,
+    HUB_OP_OPENDIR,
+    HUB_OP_READDIR,
+    HUB_OP_RELEASEDIR,
+    HUB_OP_FSYNCDIR,
+    HUB_OP_UTIMENS,
+    HUB_OP_CREATE,
+    HUB_OP_OPEN,
+    HUB_OP_READ,
+    HUB_OP_WRITE,
+    HUB_OP_FLUSH,
+    HUB_OP_RELEASE,
+    HUB_OP_FSYNC,
+    HUB_OP_FGETATTR,
+    HUB_OP_FTRUNCATE,
+    HUB_OP_FALLOCATE,
+    HUB_NUM_OPS
+};
+
+/**
+ * Get the name of an operation.
+ *
+ * @param op            The operation.
+ *
+ * @return              A statically allocated name, like "getattr".
+ */
+const char *hub_op_name(enum hub_op op);
+
+/**
+ * Get the metadata cost of each operation which the daemon uses.
+ *
+ * @return              A statically allocated array of HUB_NUM_OPS costs,
+ *                          suitable for throttle_init.
+ */
+const uint32_t *hub_op_default_costs(void);
+
+#endif
+
+// vim: ts=4:sw=4:et
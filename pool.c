@@ -0,0 +1,276 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Number of objects in each slab. */
+#define POOL_SLAB_OBJS 32
+
+/** Objects are aligned to this many bytes.  Must be a power of 2. */
+#define POOL_ALIGN 16
+
+/**
+ * A slab.  The objects follow the header.
+ */
+struct pool_slab {
+    /** Next slab of the pool. */
+    struct pool_slab *next;
+
+    /** Keeps the objects aligned to POOL_ALIGN. */
+    uint64_t pad;
+};
+
+/**
+ * A thread's free list for a pool.  Free objects are linked through their
+ * first word.
+ */
+struct pool_cache {
+    /** The first free object, or NULL. */
+    void *head;
+
+    /** Number of free objects. */
+    uint32_t len;
+};
+
+/** Protects g_pools and g_num_pools, and assigning pool indexes. */
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** The pools, by index. */
+static struct pool *g_pools[POOL_MAX];
+
+/**
+ * Number of pools in g_pools.  This must be accessed via atomic operations.
+ */
+static int g_num_pools;
+
+/** Gives a thread's free objects back to the depots when it exits. */
+static pthread_key_t g_pool_key;
+
+static pthread_once_t g_pool_once = PTHREAD_ONCE_INIT;
+
+/** This thread's free lists, indexed by pool. */
+static __thread struct pool_cache t_pool_caches[POOL_MAX];
+
+/** Nonzero once g_pool_key has been set for this thread. */
+static __thread int t_pool_registered;
+
+static size_t pool_stride(const struct pool *pool)
+{
+    return (pool->obj_size + POOL_ALIGN - 1) & ~((size_t)POOL_ALIGN - 1);
+}
+
+/**
+ * Add a chain of free objects to a pool's depot.
+ *
+ * @param pool          The pool.
+ * @param head          The first object in the chain.
+ * @param tail          The last object in the chain.
+ * @param len           The number of objects in the chain.
+ */
+static void pool_depot_put(struct pool *pool, void *head, void *tail,
+                           uint64_t len)
+{
+    pthread_mutex_lock(&pool->lock);
+    *(void **)tail = pool->depot;
+    pool->depot = head;
+    pool->depot_len += len;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_release_caches(void *arg)
+{
+    struct pool_cache *cache, *caches = arg;
+    void *tail;
+    int i, num_pools;
+
+    t_pool_registered = 0;
+    num_pools = __atomic_load_n(&g_num_pools, __ATOMIC_ACQUIRE);
+    for (i = 0; i < num_pools; i++) {
+        cache = &caches[i];
+        if (!cache->head) {
+            continue;
+        }
+        for (tail = cache->head; *(void **)tail; tail = *(void **)tail) {
+            ;
+        }
+        pool_depot_put(g_pools[i], cache->head, tail, cache->len);
+        cache->head = NULL;
+        cache->len = 0;
+    }
+}
+
+static void pool_init_once(void)
+{
+    if (pthread_key_create(&g_pool_key, pool_release_caches)) {
+        fprintf(stderr, "pool_init_once: pthread_key_create failed.\n");
+        abort();
+    }
+}
+
+/**
+ * Give a pool an index, if it doesn't have one yet.
+ *
+ * @param pool          The pool.
+ *
+ * @return              1 plus the pool's index.
+ */
+static int pool_register(struct pool *pool)
+{
+    int idx;
+
+    pthread_mutex_lock(&g_pool_lock);
+    idx = __atomic_load_n(&pool->idx, __ATOMIC_RELAXED);
+    if (!idx) {
+        if (g_num_pools == POOL_MAX) {
+            fprintf(stderr, "pool_register: too many pools.\n");
+            abort();
+        }
+        g_pools[g_num_pools] = pool;
+        idx = g_num_pools + 1;
+        __atomic_store_n(&g_num_pools, idx, __ATOMIC_RELEASE);
+        __atomic_store_n(&pool->idx, idx, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&g_pool_lock);
+    return idx;
+}
+
+/**
+ * Get the calling thread's free list for a pool.
+ */
+static struct pool_cache *pool_get_cache(struct pool *pool)
+{
+    int idx = __atomic_load_n(&pool->idx, __ATOMIC_ACQUIRE);
+
+    if (!idx) {
+        idx = pool_register(pool);
+    }
+    if (!t_pool_registered) {
+        pthread_once(&g_pool_once, pool_init_once);
+        pthread_setspecific(g_pool_key, t_pool_caches);
+        t_pool_registered = 1;
+    }
+    return &t_pool_caches[idx - 1];
+}
+
+/**
+ * Add free objects to an empty free list, from the depot if it has any, and
+ * from a new slab otherwise.
+ *
+ * @param pool          The pool.
+ * @param cache         The calling thread's free list for the pool.
+ *
+ * @return              0 on success; ENOMEM if we ran out of memory.
+ */
+static int pool_refill(struct pool *pool, struct pool_cache *cache)
+{
+    struct pool_slab *slab;
+    size_t stride = pool_stride(pool);
+    uint32_t i;
+    void *obj;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->depot) {
+        for (i = 0; (i < POOL_BATCH) && pool->depot; i++) {
+            obj = pool->depot;
+            pool->depot = *(void **)obj;
+            *(void **)obj = cache->head;
+            cache->head = obj;
+        }
+        pool->depot_len -= i;
+        cache->len += i;
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    slab = malloc(sizeof(*slab) + (stride * POOL_SLAB_OBJS));
+    if (!slab) {
+        return ENOMEM;
+    }
+    for (i = 0; i < POOL_SLAB_OBJS; i++) {
+        obj = ((char *)(slab + 1)) + (stride * i);
+        *(void **)obj = cache->head;
+        cache->head = obj;
+    }
+    cache->len += POOL_SLAB_OBJS;
+    pthread_mutex_lock(&pool->lock);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->capacity += POOL_SLAB_OBJS;
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void *pool_get(struct pool *pool)
+{
+    struct pool_cache *cache = pool_get_cache(pool);
+    void *obj;
+
+    if ((!cache->head) && pool_refill(pool, cache)) {
+        return NULL;
+    }
+    obj = cache->head;
+    cache->head = *(void **)obj;
+    cache->len--;
+    memset(obj, 0, pool->obj_size);
+    return obj;
+}
+
+void pool_put(struct pool *pool, void *obj)
+{
+    struct pool_cache *cache;
+    void *head, *tail;
+    uint32_t i;
+
+    if (!obj) {
+        return;
+    }
+    cache = pool_get_cache(pool);
+    *(void **)obj = cache->head;
+    cache->head = obj;
+    if (++cache->len <= POOL_CACHE_MAX) {
+        return;
+    }
+    // This thread frees more than it allocates.  Give a batch to the depot
+    // for the threads which allocate more than they free.
+    head = cache->head;
+    tail = head;
+    for (i = 1; i < POOL_BATCH; i++) {
+        tail = *(void **)tail;
+    }
+    cache->head = *(void **)tail;
+    cache->len -= POOL_BATCH;
+    pool_depot_put(pool, head, tail, POOL_BATCH);
+}
+
+uint64_t pool_capacity(struct pool *pool)
+{
+    uint64_t capacity;
+
+    pthread_mutex_lock(&pool->lock);
+    capacity = pool->capacity;
+    pthread_mutex_unlock(&pool->lock);
+    return capacity;
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -0,0 +1,118 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_POOL_H
+#define IOHUB_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Pools of fixed-size objects, for per-handle state which is allocated and
+ * freed on every open and release.
+ *
+ * Objects are carved out of slabs, and freed objects are kept on free lists
+ * rather than being given back to malloc.  Each thread has a free list of
+ * its own for each pool, so most allocations and frees take no locks.
+ *
+ * FUSE may release a file on a different thread than the one which opened
+ * it, so a thread may free more objects than it allocates.  Each thread's
+ * free list is bounded: once it holds POOL_CACHE_MAX objects, a batch of
+ * them goes back to the pool's shared depot, where other threads pick them
+ * up.  Threads which exit give all of theirs back.  So the depot lock is
+ * taken at most once per batch, and no thread can hoard free objects.
+ *
+ * Slabs are never freed, so a pool holds on to as many objects as were ever
+ * in use at once.
+ */
+
+/** Most objects a thread keeps on its free list for a pool. */
+#define POOL_CACHE_MAX 64
+
+/** Number of objects moved between a thread and the depot at once. */
+#define POOL_BATCH 32
+
+/** Most pools there can be. */
+#define POOL_MAX 8
+
+struct pool_slab;
+
+/**
+ * A pool.  Pools are statically allocated with POOL_INITIALIZER, and live
+ * for the life of the process.
+ */
+struct pool {
+    /** Size of each object in bytes.  Immutable. */
+    size_t obj_size;
+
+    /** Protects the fields below. */
+    pthread_mutex_t lock;
+
+    /** Free objects which no thread holds on to. */
+    void *depot;
+
+    /** Number of objects in depot. */
+    uint64_t depot_len;
+
+    /** Every slab carved so far. */
+    struct pool_slab *slabs;
+
+    /** Number of objects carved so far. */
+    uint64_t capacity;
+
+    /**
+     * 1 plus the index of this pool's free list in each thread's array of
+     * them, or 0 if that hasn't been assigned yet.  Must be accessed via
+     * atomic operations.
+     */
+    int idx;
+};
+
+#define POOL_INITIALIZER(size) \
+    { (size), PTHREAD_MUTEX_INITIALIZER, NULL, 0, NULL, 0, 0 }
+
+/**
+ * Allocate an object.
+ *
+ * @param pool          The pool.
+ *
+ * @return              The object, zeroed, or NULL if we ran out of memory.
+ */
+void *pool_get(struct pool *pool);
+
+/**
+ * Free an object.
+ *
+ * @param pool          The pool the object came from.
+ * @param obj           The object, or NULL.
+ */
+void pool_put(struct pool *pool, void *obj);
+
+/**
+ * Get the number of objects a pool has carved out of its slabs.
+ *
+ * @param pool          The pool.
+ *
+ * @return              The number of objects, whether in use or free.
+ */
+uint64_t pool_capacity(struct pool *pool);
+
+#endif
+
+// vim: ts=4:sw=4:et
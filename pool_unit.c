@@ -0,0 +1,159 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pool.h"
+#include "test.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_TEST_OBJS 10000
+
+#define POOL_TEST_THREADS 4
+
+/** Objects each thread allocates in test_concurrent. */
+#define POOL_TEST_OBJS_PER_THREAD 2000
+
+struct pool_test_obj {
+    uint64_t owner;
+    uint64_t idx;
+    char data[37];
+};
+
+static struct pool g_test_pool =
+    POOL_INITIALIZER(sizeof(struct pool_test_obj));
+
+static struct pool_test_obj *g_objs[POOL_TEST_OBJS];
+
+static pthread_barrier_t g_barrier;
+
+static void *put_all(void *arg __attribute__((unused)))
+{
+    int i;
+
+    for (i = 0; i < POOL_TEST_OBJS; i++) {
+        pool_put(&g_test_pool, g_objs[i]);
+        g_objs[i] = NULL;
+    }
+    return NULL;
+}
+
+static int test_reuse(void)
+{
+    struct pool_test_obj *a, *b, zero;
+
+    memset(&zero, 0, sizeof(zero));
+    a = pool_get(&g_test_pool);
+    EXPECT_NONNULL(a);
+    EXPECT_INT_ZERO(memcmp(a, &zero, sizeof(zero)));
+    memset(a, 0xff, sizeof(*a));
+    pool_put(&g_test_pool, a);
+    // A freed object is handed out again, zeroed.
+    b = pool_get(&g_test_pool);
+    EXPECT_INT_EQ((uintptr_t)a, (uintptr_t)b);
+    EXPECT_INT_ZERO(memcmp(b, &zero, sizeof(zero)));
+    pool_put(&g_test_pool, b);
+    pool_put(&g_test_pool, NULL);
+    return 0;
+}
+
+static int test_cross_thread(void)
+{
+    pthread_t thread;
+    uint64_t capacity;
+    int i;
+
+    for (i = 0; i < POOL_TEST_OBJS; i++) {
+        g_objs[i] = pool_get(&g_test_pool);
+        EXPECT_NONNULL(g_objs[i]);
+    }
+    capacity = pool_capacity(&g_test_pool);
+    EXPECT_INT_GE(capacity, POOL_TEST_OBJS);
+    // Objects freed by another thread come back to us, rather than the pool
+    // growing.
+    EXPECT_INT_ZERO(pthread_create(&thread, NULL, put_all, NULL));
+    EXPECT_INT_ZERO(pthread_join(thread, NULL));
+    for (i = 0; i < POOL_TEST_OBJS; i++) {
+        g_objs[i] = pool_get(&g_test_pool);
+        EXPECT_NONNULL(g_objs[i]);
+    }
+    EXPECT_INT_EQ(capacity, pool_capacity(&g_test_pool));
+    put_all(NULL);
+    return 0;
+}
+
+static void *concurrent_run(void *arg)
+{
+    uint64_t id = (uintptr_t)arg, next, i;
+    struct pool_test_obj *obj;
+
+    // Each thread allocates a batch of objects, and then frees the batch of
+    // the next thread.
+    for (i = 0; i < POOL_TEST_OBJS_PER_THREAD; i++) {
+        obj = pool_get(&g_test_pool);
+        if (!obj) {
+            abort();
+        }
+        obj->owner = id;
+        obj->idx = i;
+        g_objs[(id * POOL_TEST_OBJS_PER_THREAD) + i] = obj;
+    }
+    pthread_barrier_wait(&g_barrier);
+    next = (id + 1) % POOL_TEST_THREADS;
+    for (i = 0; i < POOL_TEST_OBJS_PER_THREAD; i++) {
+        obj = g_objs[(next * POOL_TEST_OBJS_PER_THREAD) + i];
+        if ((obj->owner != next) || (obj->idx != i)) {
+            fprintf(stderr, "concurrent_run: object %p was handed out "
+                    "twice.\n", obj);
+            abort();
+        }
+        pool_put(&g_test_pool, obj);
+    }
+    return NULL;
+}
+
+static int test_concurrent(void)
+{
+    pthread_t threads[POOL_TEST_THREADS];
+    uintptr_t i;
+
+    EXPECT_INT_ZERO(pthread_barrier_init(&g_barrier, NULL,
+                                         POOL_TEST_THREADS));
+    for (i = 0; i < POOL_TEST_THREADS; i++) {
+        EXPECT_INT_ZERO(pthread_create(&threads[i], NULL, concurrent_run,
+                                       (void *)i));
+    }
+    for (i = 0; i < POOL_TEST_THREADS; i++) {
+        EXPECT_INT_ZERO(pthread_join(threads[i], NULL));
+    }
+    pthread_barrier_destroy(&g_barrier);
+    return 0;
+}
+
+int main(void)
+{
+    EXPECT_INT_ZERO(test_reuse());
+    EXPECT_INT_ZERO(test_cross_thread());
+    EXPECT_INT_ZERO(test_concurrent());
+    return EXIT_SUCCESS;
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -0,0 +1,360 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hist.h"
+#include "op.h"
+#include "prom.h"
+#include "stats.h"
+#include "throttle.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * The latency histograms we export have a bucket for every power of
+ * 2^PROM_LAT_STEP nanoseconds from 2^PROM_LAT_MIN (about a microsecond) to
+ * 2^PROM_LAT_MAX (about a minute).  Our own histograms have many more
+ * buckets, but each exported bucket is another time series to store.
+ */
+#define PROM_LAT_MIN 10
+#define PROM_LAT_MAX 36
+#define PROM_LAT_STEP 2
+
+/**
+ * How a stats.h counter is exported.
+ */
+struct prom_counter {
+    /** Metric name. */
+    const char *name;
+
+    /** Help text. */
+    const char *help;
+
+    /** Nonzero if the counter is in nanoseconds, and exported in seconds. */
+    int ns;
+};
+
+static const struct prom_counter PROM_COUNTERS[HUB_NUM_STATS] = {
+    [HUB_STAT_READ_BYTES] = { "iohub_read_bytes_total",
+        "Bytes returned by read.", 0 },
+    [HUB_STAT_WRITE_BYTES] = { "iohub_write_bytes_total",
+        "Bytes accepted by write.", 0 },
+    [HUB_STAT_READ_OPS] = { "iohub_read_ops_total",
+        "Successful reads.", 0 },
+    [HUB_STAT_WRITE_OPS] = { "iohub_write_ops_total",
+        "Successful writes.", 0 },
+    [HUB_STAT_META_OPS] = { "iohub_meta_ops_total",
+        "Metadata operations.", 0 },
+    [HUB_STAT_THROTTLE_WAITS] = { "iohub_throttle_waits_total",
+        "Number of times a thread slept waiting for budget.", 0 },
+    [HUB_STAT_THROTTLE_NS] = { "iohub_throttle_wait_seconds_total",
+        "Time spent asleep waiting for budget.", 1 },
+    [HUB_STAT_THROTTLE_RETRIES] = { "iohub_throttle_retries_total",
+        "Budget updates retried because of a concurrent update.", 0 },
+};
+
+/** Protects g_prom_stop. */
+static pthread_mutex_t g_prom_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Signalled when g_prom_stop is set. */
+static pthread_cond_t g_prom_cond = PTHREAD_COND_INITIALIZER;
+
+/** Set to tell the exporter thread to exit. */
+static int g_prom_stop;
+
+/** Nonzero if the exporter thread is running. */
+static int g_prom_running;
+
+static pthread_t g_prom_thread;
+
+/** The file to write.  Immutable while the thread runs. */
+static char *g_prom_path;
+
+/** Seconds between exports.  Immutable while the thread runs. */
+static unsigned int g_prom_interval_s;
+
+/** The number of throttle domains.  Immutable while the thread runs. */
+static uint32_t g_prom_num_domains;
+
+/**
+ * Write the label which identifies a class.
+ */
+static void prom_write_uid(FILE *fp, uint32_t cls)
+{
+    uint32_t uid = throttle_class_uid(cls);
+
+    if (uid == UNKNOWN_UID) {
+        fprintf(fp, "uid=\"unknown\"");
+    } else {
+        fprintf(fp, "uid=\"%"PRIu32"\"", uid);
+    }
+}
+
+static void prom_write_counters(FILE *fp)
+{
+    uint32_t cls, stat, num_classes = throttle_num_classes();
+    uint64_t *ctrs;
+
+    ctrs = calloc((size_t)num_classes * HUB_NUM_STATS, sizeof(uint64_t));
+    if (!ctrs) {
+        return;
+    }
+    for (cls = 0; cls < num_classes; cls++) {
+        stats_sum(cls, ctrs + (cls * HUB_NUM_STATS));
+    }
+    for (stat = 0; stat < HUB_NUM_STATS; stat++) {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n",
+                PROM_COUNTERS[stat].name, PROM_COUNTERS[stat].help,
+                PROM_COUNTERS[stat].name);
+        for (cls = 0; cls < num_classes; cls++) {
+            fprintf(fp, "%s{", PROM_COUNTERS[stat].name);
+            prom_write_uid(fp, cls);
+            if (PROM_COUNTERS[stat].ns) {
+                fprintf(fp, "} %.9f\n",
+                        ctrs[(cls * HUB_NUM_STATS) + stat] / 1e9);
+            } else {
+                fprintf(fp, "} %"PRIu64"\n",
+                        ctrs[(cls * HUB_NUM_STATS) + stat]);
+            }
+        }
+    }
+    free(ctrs);
+}
+
+static void prom_write_gauges(FILE *fp, uint32_t num_domains)
+{
+    uint32_t cls, dom, num_classes = throttle_num_classes();
+    uint64_t bytes, meta;
+
+    fprintf(fp, "# HELP iohub_throttle_queue_depth Threads waiting for "
+            "budget.\n# TYPE iohub_throttle_queue_depth gauge\n");
+    for (cls = 0; cls < num_classes; cls++) {
+        fprintf(fp, "iohub_throttle_queue_depth{");
+        prom_write_uid(fp, cls);
+        fprintf(fp, "} %"PRIu32"\n", throttle_class_waiters(cls));
+    }
+    fprintf(fp, "# HELP iohub_throttle_avail_bytes Bytes left in the "
+            "current period.\n# TYPE iohub_throttle_avail_bytes gauge\n");
+    for (cls = 0; cls < num_classes; cls++) {
+        for (dom = 0; dom < num_domains; dom++) {
+            throttle_class_avail(cls, dom, &bytes, &meta);
+            fprintf(fp, "iohub_throttle_avail_bytes{");
+            prom_write_uid(fp, cls);
+            fprintf(fp, ",domain=\"%"PRIu32"\"} %"PRIu64"\n", dom, bytes);
+        }
+    }
+    fprintf(fp, "# HELP iohub_throttle_avail_meta Metadata units left in "
+            "the current period.\n# TYPE iohub_throttle_avail_meta gauge\n");
+    for (cls = 0; cls < num_classes; cls++) {
+        for (dom = 0; dom < num_domains; dom++) {
+            throttle_class_avail(cls, dom, &bytes, &meta);
+            fprintf(fp, "iohub_throttle_avail_meta{");
+            prom_write_uid(fp, cls);
+            fprintf(fp, ",domain=\"%"PRIu32"\"} %"PRIu64"\n", dom, meta);
+        }
+    }
+}
+
+/**
+ * Write one latency histogram.
+ */
+static void prom_write_hist(FILE *fp, const char *name, uint32_t cls,
+                            enum hub_op op, const struct hist *h)
+{
+    uint32_t shift;
+
+    for (shift = PROM_LAT_MIN; shift <= PROM_LAT_MAX;
+            shift += PROM_LAT_STEP) {
+        fprintf(fp, "%s_bucket{", name);
+        prom_write_uid(fp, cls);
+        fprintf(fp, ",op=\"%s\",le=\"%.12g\"} %"PRIu64"\n", hub_op_name(op),
+                (1ULL << shift) / 1e9, hist_count_below(h, 1ULL << shift));
+    }
+    fprintf(fp, "%s_bucket{", name);
+    prom_write_uid(fp, cls);
+    fprintf(fp, ",op=\"%s\",le=\"+Inf\"} %"PRIu64"\n", hub_op_name(op),
+            h->count);
+    fprintf(fp, "%s_sum{", name);
+    prom_write_uid(fp, cls);
+    fprintf(fp, ",op=\"%s\"} %.9f\n", hub_op_name(op), h->sum / 1e9);
+    fprintf(fp, "%s_count{", name);
+    prom_write_uid(fp, cls);
+    fprintf(fp, ",op=\"%s\"} %"PRIu64"\n", hub_op_name(op), h->count);
+}
+
+/**
+ * Write one latency histogram for every operation each class has done.
+ *
+ * @param fp            The file.
+ * @param name          The metric name.
+ * @param service       Nonzero to write the service time histograms; zero
+ *                          to write the throttler wait histograms.
+ * @param oh            Scratch space.
+ */
+static void prom_write_latency(FILE *fp, const char *name, int service,
+                               struct stats_op_hist *oh)
+{
+    uint32_t cls, op, num_classes = throttle_num_classes();
+
+    for (cls = 0; cls < num_classes; cls++) {
+        for (op = 0; op < HUB_NUM_OPS; op++) {
+            stats_op_sum(cls, op, oh);
+            if (oh->service.count == 0) {
+                continue;
+            }
+            prom_write_hist(fp, name, cls, op,
+                            service ? &oh->service : &oh->wait);
+        }
+    }
+}
+
+static void prom_write_latencies(FILE *fp)
+{
+    struct stats_op_hist *oh;
+
+    oh = malloc(sizeof(*oh));
+    if (!oh) {
+        return;
+    }
+    fprintf(fp, "# HELP iohub_op_wait_seconds Time operations spent "
+            "waiting for the throttler.\n"
+            "# TYPE iohub_op_wait_seconds histogram\n");
+    prom_write_latency(fp, "iohub_op_wait_seconds", 0, oh);
+    fprintf(fp, "# HELP iohub_op_service_seconds Time operations took once "
+            "admitted.\n# TYPE iohub_op_service_seconds histogram\n");
+    prom_write_latency(fp, "iohub_op_service_seconds", 1, oh);
+    free(oh);
+}
+
+int prom_export(const char *path, uint32_t num_domains)
+{
+    char tmp[PATH_MAX];
+    FILE *fp;
+    int fd, ret;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        return ENAMETOOLONG;
+    }
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return errno;
+    }
+    fp = fdopen(fd, "w");
+    if (!fp) {
+        ret = errno;
+        close(fd);
+        unlink(tmp);
+        return ret;
+    }
+    prom_write_counters(fp);
+    prom_write_gauges(fp, num_domains);
+    prom_write_latencies(fp);
+    ret = ferror(fp) ? EIO : 0;
+    if (fclose(fp) && !ret) {
+        ret = errno;
+    }
+    if (!ret && (rename(tmp, path) < 0)) {
+        ret = errno;
+    }
+    if (ret) {
+        unlink(tmp);
+    }
+    return ret;
+}
+
+static void prom_export_or_warn(void)
+{
+    int ret;
+
+    ret = prom_export(g_prom_path, g_prom_num_domains);
+    if (ret) {
+        fprintf(stderr, "prom_export(%s) failed: error %d (%s)\n",
+                g_prom_path, ret, strerror(ret));
+    }
+}
+
+static void *prom_thread(void *arg __attribute__((unused)))
+{
+    struct timespec deadline;
+
+    pthread_mutex_lock(&g_prom_lock);
+    while (!g_prom_stop) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += g_prom_interval_s;
+        while ((!g_prom_stop) && (pthread_cond_timedwait(&g_prom_cond,
+                    &g_prom_lock, &deadline) != ETIMEDOUT)) {
+            ;
+        }
+        pthread_mutex_unlock(&g_prom_lock);
+        prom_export_or_warn();
+        pthread_mutex_lock(&g_prom_lock);
+    }
+    pthread_mutex_unlock(&g_prom_lock);
+    return NULL;
+}
+
+int prom_init(const char *path, unsigned int interval_s, uint32_t num_domains)
+{
+    int ret;
+
+    if (interval_s == 0) {
+        return EINVAL;
+    }
+    g_prom_path = strdup(path);
+    if (!g_prom_path) {
+        return ENOMEM;
+    }
+    g_prom_interval_s = interval_s;
+    g_prom_num_domains = num_domains;
+    g_prom_stop = 0;
+    ret = pthread_create(&g_prom_thread, NULL, prom_thread, NULL);
+    if (ret) {
+        free(g_prom_path);
+        g_prom_path = NULL;
+        return ret;
+    }
+    g_prom_running = 1;
+    return 0;
+}
+
+void prom_shutdown(void)
+{
+    if (!g_prom_running) {
+        return;
+    }
+    pthread_mutex_lock(&g_prom_lock);
+    g_prom_stop = 1;
+    pthread_cond_signal(&g_prom_cond);
+    pthread_mutex_unlock(&g_prom_lock);
+    pthread_join(g_prom_thread, NULL);
+    g_prom_running = 0;
+    free(g_prom_path);
+    g_prom_path = NULL;
+}
+
+// vim: ts=4:sw=4:tw=79:et
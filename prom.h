@@ -0,0 +1,65 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_PROM_H
+#define IOHUB_PROM_H
+
+#include <stdint.h>
+
+/**
+ * Periodically export our statistics to a file in the Prometheus text
+ * format, for node_exporter's textfile collector to pick up.
+ *
+ * The file is written to a temporary name and renamed into place, so the
+ * collector never sees a partly written file.  The numbers come from the
+ * same per-thread counters as /.iohub/stats, so exporting them adds no
+ * locking to the I/O path.
+ */
+
+/**
+ * Start the exporter thread.
+ *
+ * Since this starts a thread, it must be called after FUSE daemonizes.
+ *
+ * @param path          The file to write.  Its directory must also hold the
+ *                          temporary file.  Copied.
+ * @param interval_s    Seconds between exports.
+ * @param num_domains   The number of throttle domains.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+int prom_init(const char *path, unsigned int interval_s, uint32_t num_domains);
+
+/**
+ * Stop the exporter thread, if it is running, after a final export.
+ */
+void prom_shutdown(void);
+
+/**
+ * Write the statistics to a file.
+ *
+ * @param path          The file to write.
+ * @param num_domains   The number of throttle domains.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+int prom_export(const char *path, uint32_t num_domains);
+
+#endif
+
+// vim: ts=4:sw=4:et
@@ -0,0 +1,455 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "log.h"
+#include "readahead.h"
+#include "throttle.h"
+#include "util.h"
+#include "workq.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @file readahead.c
+ *
+ * Userspace read-ahead for sequential readers.
+ *
+ * Files which don't use the page cache are opened with direct_io, so the
+ * kernel doesn't do any read-ahead for them.  So we watch the offsets that
+ * each open file is read at, and once a file has been read sequentially a few
+ * times in a row, we start reading the next few windows of the file into
+ * buffers on a pool of background threads.
+ * Later reads are then served straight out of those buffers.
+ *
+ * Read-ahead is charged to the reader's throttle budget up front, when it is
+ * started.  We never wait for budget to do read-ahead; if the reader doesn't
+ * have enough budget to spare, we just don't read ahead, and the reader goes
+ * through the normal throttled path.
+ *
+ * The buffers come from a fixed-size pool shared by all files, so the amount
+ * of memory used for read-ahead is bounded.
+ */
+
+/** Number of windows we keep per file. */
+#define RA_NUM_SLOTS 2
+
+/** Number of sequential reads in a row before we start reading ahead. */
+#define RA_SEQ_THRESHOLD 2
+
+struct ra_buf {
+    /** Next buffer in the free pool. */
+    struct ra_buf *next;
+
+    /** The memory. */
+    char *data;
+};
+
+enum ra_slot_state {
+    RA_SLOT_EMPTY = 0,
+    RA_SLOT_PENDING,
+    RA_SLOT_READY,
+};
+
+/**
+ * A window of read-ahead data.
+ */
+struct ra_slot {
+    /** The read-ahead state this slot belongs to. */
+    struct hub_ra *ra;
+
+    /** State of this slot. */
+    enum ra_slot_state state;
+
+    /** Nonzero if the file was modified while this slot was pending. */
+    int stale;
+
+    /** The buffer, or NULL if the slot is empty. */
+    struct ra_buf *buf;
+
+    /** File offset of the start of this window. */
+    off_t off;
+
+    /**
+     * Number of bytes read, or a negative error code.  Less than the window
+     * size if we hit the end of the file.
+     */
+    ssize_t len;
+
+    /** Work item used to fill this slot. */
+    struct workq_item item;
+};
+
+struct hub_ra {
+    /** The backing file descriptor. */
+    int fd;
+
+    /** The throttle domain of the backing file. */
+    uint32_t domain;
+
+    /** Protects all the fields below, and the slots. */
+    pthread_mutex_t lock;
+
+    /** Signalled when a slot stops being pending. */
+    pthread_cond_t cond;
+
+    /** The offset a sequential reader would read at next. */
+    off_t next_off;
+
+    /** Number of sequential reads we've seen in a row, up to the threshold. */
+    unsigned seq;
+
+    /** The offset of the end of the file, if we've hit it; -1 otherwise. */
+    off_t eof_off;
+
+    /** Read-ahead windows. */
+    struct ra_slot slot[RA_NUM_SLOTS];
+};
+
+/** Size of each read-ahead window, or 0 if read-ahead is disabled. */
+static size_t g_ra_window;
+
+/** Work queue to do read-ahead on. */
+static struct workq *g_ra_workq;
+
+/** Protects g_ra_pool. */
+static pthread_mutex_t g_ra_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Free buffers. */
+static struct ra_buf *g_ra_pool;
+
+/** All buffers. */
+static struct ra_buf *g_ra_bufs;
+
+/** Number of entries in g_ra_bufs. */
+static int g_ra_nbufs;
+
+static struct ra_buf *ra_buf_get(void)
+{
+    struct ra_buf *buf;
+
+    pthread_mutex_lock(&g_ra_pool_lock);
+    buf = g_ra_pool;
+    if (buf) {
+        g_ra_pool = buf->next;
+    }
+    pthread_mutex_unlock(&g_ra_pool_lock);
+    return buf;
+}
+
+static void ra_buf_put(struct ra_buf *buf)
+{
+    pthread_mutex_lock(&g_ra_pool_lock);
+    buf->next = g_ra_pool;
+    g_ra_pool = buf;
+    pthread_mutex_unlock(&g_ra_pool_lock);
+}
+
+int ra_init(size_t window, int nbufs, int nthreads)
+{
+    int i, ret;
+
+    if ((window == 0) || (nbufs <= 0)) {
+        return 0;
+    }
+    g_ra_bufs = xcalloc(nbufs, sizeof(struct ra_buf));
+    for (i = 0; i < nbufs; i++) {
+        g_ra_bufs[i].data = malloc(window);
+        if (!g_ra_bufs[i].data) {
+            ret = ENOMEM;
+            goto error;
+        }
+        g_ra_nbufs++;
+        ra_buf_put(&g_ra_bufs[i]);
+    }
+    ret = workq_alloc("readahead", nthreads, &g_ra_workq);
+    if (ret) {
+        goto error;
+    }
+    g_ra_window = window;
+    return 0;
+
+error:
+    fprintf(stderr, "ra_init(window=%zd, nbufs=%d, nthreads=%d) failed: "
+            "error %d (%s)\n", window, nbufs, nthreads, ret, terror(ret));
+    ra_shutdown();
+    return ret;
+}
+
+void ra_shutdown(void)
+{
+    int i;
+
+    workq_free(g_ra_workq);
+    g_ra_workq = NULL;
+    g_ra_window = 0;
+    for (i = 0; i < g_ra_nbufs; i++) {
+        free(g_ra_bufs[i].data);
+    }
+    free(g_ra_bufs);
+    g_ra_bufs = NULL;
+    g_ra_nbufs = 0;
+    g_ra_pool = NULL;
+}
+
+struct hub_ra *ra_alloc(int fd, uint32_t domain)
+{
+    struct hub_ra *ra;
+    int i;
+
+    if (g_ra_window == 0) {
+        return NULL;
+    }
+    ra = calloc(1, sizeof(*ra));
+    if (!ra) {
+        return NULL;
+    }
+    ra->fd = fd;
+    ra->domain = domain;
+    ra->next_off = -1;
+    ra->eof_off = -1;
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->cond, NULL);
+    for (i = 0; i < RA_NUM_SLOTS; i++) {
+        ra->slot[i].ra = ra;
+    }
+    return ra;
+}
+
+/**
+ * Return a ready slot's buffer to the pool.  Must be called with the lock
+ * held.
+ */
+static void ra_slot_clear(struct ra_slot *slot)
+{
+    ra_buf_put(slot->buf);
+    slot->buf = NULL;
+    slot->state = RA_SLOT_EMPTY;
+    slot->stale = 0;
+}
+
+void ra_free(struct hub_ra *ra)
+{
+    int i;
+
+    if (!ra) {
+        return;
+    }
+    pthread_mutex_lock(&ra->lock);
+    for (i = 0; i < RA_NUM_SLOTS; i++) {
+        while (ra->slot[i].state == RA_SLOT_PENDING) {
+            pthread_cond_wait(&ra->cond, &ra->lock);
+        }
+        if (ra->slot[i].state == RA_SLOT_READY) {
+            ra_slot_clear(&ra->slot[i]);
+        }
+    }
+    pthread_mutex_unlock(&ra->lock);
+    pthread_cond_destroy(&ra->cond);
+    pthread_mutex_destroy(&ra->lock);
+    free(ra);
+}
+
+/**
+ * Fill a read-ahead slot.  Runs on the read-ahead work queue.
+ */
+static void ra_fill(void *v)
+{
+    struct ra_slot *slot = v;
+    struct hub_ra *ra = slot->ra;
+    ssize_t len;
+
+    len = pread_fully(ra->fd, slot->buf->data, g_ra_window, slot->off);
+    DEBUG("ra_fill(fd=%d, off=%"PRId64") = %zd\n", ra->fd,
+          (int64_t)slot->off, len);
+    pthread_mutex_lock(&ra->lock);
+    slot->len = len;
+    if (slot->stale) {
+        ra_slot_clear(slot);
+    } else {
+        slot->state = RA_SLOT_READY;
+        if ((len >= 0) && (len < (ssize_t)g_ra_window)) {
+            ra->eof_off = slot->off + len;
+        }
+    }
+    pthread_cond_broadcast(&ra->cond);
+    pthread_mutex_unlock(&ra->lock);
+}
+
+/**
+ * Find the slot which holds, or will hold, the data at the given offset.
+ * Must be called with the lock held.
+ */
+static struct ra_slot *ra_find_slot(struct hub_ra *ra, off_t off)
+{
+    int i;
+    struct ra_slot *slot;
+
+    for (i = 0; i < RA_NUM_SLOTS; i++) {
+        slot = &ra->slot[i];
+        if ((slot->state == RA_SLOT_EMPTY) || (slot->stale)) {
+            continue;
+        }
+        if ((off >= slot->off) && (off < slot->off + (off_t)g_ra_window)) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Start reading ahead of the reader, filling up any empty slots.  Must be
+ * called with the lock held.
+ */
+static void ra_schedule(struct hub_ra *ra, uint32_t uid)
+{
+    int i;
+    off_t start = ra->next_off;
+    struct ra_slot *slot;
+    struct ra_buf *buf;
+
+    // Start after the furthest window we already have.
+    for (i = 0; i < RA_NUM_SLOTS; i++) {
+        slot = &ra->slot[i];
+        if ((slot->state != RA_SLOT_EMPTY) && (!slot->stale) &&
+                (slot->off + (off_t)g_ra_window > start)) {
+            start = slot->off + g_ra_window;
+        }
+    }
+    for (i = 0; i < RA_NUM_SLOTS; i++) {
+        slot = &ra->slot[i];
+        if (slot->state != RA_SLOT_EMPTY) {
+            continue;
+        }
+        if ((ra->eof_off >= 0) && (start >= ra->eof_off)) {
+            break;
+        }
+        buf = ra_buf_get();
+        if (!buf) {
+            break;
+        }
+        if (throttle_try(ra->domain, uid, g_ra_window)) {
+            ra_buf_put(buf);
+            break;
+        }
+        slot->state = RA_SLOT_PENDING;
+        slot->stale = 0;
+        slot->buf = buf;
+        slot->off = start;
+        slot->len = 0;
+        slot->item.fn = ra_fill;
+        slot->item.arg = slot;
+        workq_submit(g_ra_workq, &slot->item);
+        start += g_ra_window;
+    }
+}
+
+int ra_read(struct hub_ra *ra, uint32_t uid, char *buf, size_t size,
+            off_t off, int *res)
+{
+    struct ra_slot *slot;
+    int i, served = 0;
+    off_t avail;
+
+    pthread_mutex_lock(&ra->lock);
+    if (off == ra->next_off) {
+        if (ra->seq < RA_SEQ_THRESHOLD) {
+            ra->seq++;
+        }
+    } else {
+        ra->seq = 0;
+    }
+    ra->next_off = off + size;
+    while (1) {
+        slot = ra_find_slot(ra, off);
+        if ((!slot) || (slot->state != RA_SLOT_PENDING)) {
+            break;
+        }
+        pthread_cond_wait(&ra->cond, &ra->lock);
+    }
+    if (slot && (slot->len >= 0)) {
+        avail = slot->off + slot->len - off;
+        if (avail >= (off_t)size) {
+            memcpy(buf, slot->buf->data + (off - slot->off), size);
+            *res = size;
+            served = 1;
+        } else if (slot->len < (ssize_t)g_ra_window) {
+            // This window contains the end of the file.
+            if (avail < 0) {
+                avail = 0;
+            }
+            memcpy(buf, slot->buf->data + (off - slot->off), avail);
+            *res = avail;
+            served = 1;
+        }
+    }
+    // Give back buffers which the reader is done with.  If the reader doesn't
+    // look sequential any more, give back everything.
+    for (i = 0; i < RA_NUM_SLOTS; i++) {
+        slot = &ra->slot[i];
+        if (slot->state != RA_SLOT_READY) {
+            continue;
+        }
+        if ((ra->seq == 0) || (slot->len < 0) ||
+                (ra->next_off >= slot->off + slot->len)) {
+            ra_slot_clear(slot);
+        }
+    }
+    if (ra->seq >= RA_SEQ_THRESHOLD) {
+        ra_schedule(ra, uid);
+    }
+    pthread_mutex_unlock(&ra->lock);
+    DEBUG("ra_read(fd=%d, size=%zd, off=%"PRId64") = %s\n", ra->fd, size,
+          (int64_t)off, served ? "hit" : "miss");
+    return served;
+}
+
+void ra_invalidate(struct hub_ra *ra, off_t off, size_t len)
+{
+    int i;
+    struct ra_slot *slot;
+
+    pthread_mutex_lock(&ra->lock);
+    for (i = 0; i < RA_NUM_SLOTS; i++) {
+        slot = &ra->slot[i];
+        if (slot->state == RA_SLOT_EMPTY) {
+            continue;
+        }
+        if (slot->off + (off_t)g_ra_window <= off) {
+            continue;
+        }
+        if ((len != 0) && (off + (off_t)len <= slot->off)) {
+            continue;
+        }
+        if (slot->state == RA_SLOT_PENDING) {
+            slot->stale = 1;
+        } else {
+            ra_slot_clear(slot);
+        }
+    }
+    // The file may have grown.
+    ra->eof_off = -1;
+    pthread_mutex_unlock(&ra->lock);
+}
+
+// vim: ts=4:sw=4:tw=79:et
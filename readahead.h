@@ -0,0 +1,104 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_READAHEAD_H
+#define IOHUB_READAHEAD_H
+
+#include <stdint.h> // for uint32_t
+#include <sys/types.h> // for off_t
+#include <unistd.h> // for size_t
+
+/**
+ * Per-file read-ahead state.
+ */
+struct hub_ra;
+
+/**
+ * Start the read-ahead engine.
+ *
+ * Since this starts threads, it must be called after FUSE daemonizes.
+ *
+ * @param window        Size in bytes of each read-ahead window.  0 disables
+ *                          read-ahead.
+ * @param nbufs         Number of window-sized buffers shared between all
+ *                          files.
+ * @param nthreads      Number of threads to do read-ahead I/O on.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+int ra_init(size_t window, int nbufs, int nthreads);
+
+/**
+ * Stop the read-ahead engine and free its buffers.
+ *
+ * All read-ahead state must have been freed with ra_free before this is
+ * called.
+ */
+void ra_shutdown(void);
+
+/**
+ * Allocate read-ahead state for a file.
+ *
+ * @param fd            The backing file descriptor to read ahead from.
+ * @param domain        The throttle domain to charge read-ahead to.
+ *
+ * @return              The new state, or NULL if read-ahead is disabled or we
+ *                          are out of memory.
+ */
+struct hub_ra *ra_alloc(int fd, uint32_t domain);
+
+/**
+ * Free read-ahead state, waiting for any read-ahead in progress to finish.
+ *
+ * @param ra            The read-ahead state, or NULL.
+ */
+void ra_free(struct hub_ra *ra);
+
+/**
+ * Try to serve a read from the read-ahead buffers.
+ *
+ * This also does sequential access detection, and starts more read-ahead if
+ * the reader looks sequential and has enough throttle budget to spare.
+ *
+ * @param ra            The read-ahead state.
+ * @param uid           The UID doing the read.  Read-ahead is charged to it.
+ * @param buf           The buffer to read into.
+ * @param size          Number of bytes to read.
+ * @param off           File offset to read from.
+ * @param res           (out param) The number of bytes read, if the read was
+ *                          served.
+ *
+ * @return              1 if the read was served; 0 if the caller needs to do
+ *                          the read itself.
+ */
+int ra_read(struct hub_ra *ra, uint32_t uid, char *buf, size_t size,
+            off_t off, int *res);
+
+/**
+ * Discard any read-ahead data for a range which is being modified.
+ *
+ * @param ra            The read-ahead state.
+ * @param off           Start of the range.
+ * @param len           Length of the range.  0 means until the end of the
+ *                          file.
+ */
+void ra_invalidate(struct hub_ra *ra, off_t off, size_t len);
+
+#endif
+
+// vim: ts=4:sw=4:et
@@ -0,0 +1,272 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stats.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * One thread's counters.
+ */
+struct stats_block {
+    /** Next block in g_stats_blocks. */
+    struct stats_block *next;
+
+    /**
+     * The counters.  Only the owning thread writes these, but other threads
+     * read them, so they must be accessed via atomic operations.
+     */
+    uint64_t ctr[STATS_MAX_CLASSES][HUB_NUM_STATS];
+
+    /**
+     * Latency histograms, or NULL for operations this thread hasn't served.
+     * Only the owning thread sets these, but other threads read them, so they
+     * must be accessed via atomic operations.
+     */
+    struct stats_op_hist *ops[STATS_MAX_CLASSES][HUB_NUM_OPS];
+};
+
+static const char * const HUB_STAT_NAMES[HUB_NUM_STATS] = {
+    [HUB_STAT_READ_BYTES] = "read_bytes",
+    [HUB_STAT_WRITE_BYTES] = "write_bytes",
+    [HUB_STAT_READ_OPS] = "read_ops",
+    [HUB_STAT_WRITE_OPS] = "write_ops",
+    [HUB_STAT_META_OPS] = "meta_ops",
+    [HUB_STAT_THROTTLE_WAITS] = "throttle_waits",
+    [HUB_STAT_THROTTLE_NS] = "throttle_wait_ns",
+    [HUB_STAT_THROTTLE_RETRIES] = "throttle_retries",
+};
+
+/** Protects g_stats_blocks and g_stats_exited. */
+static pthread_mutex_t g_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** The blocks of all live threads which have counted anything. */
+static struct stats_block *g_stats_blocks;
+
+/** The counts of threads which have exited. */
+static uint64_t g_stats_exited[STATS_MAX_CLASSES][HUB_NUM_STATS];
+
+/** The latency histograms of threads which have exited. */
+static struct stats_op_hist *
+    g_stats_exited_ops[STATS_MAX_CLASSES][HUB_NUM_OPS];
+
+/** Releases a thread's block when it exits. */
+static pthread_key_t g_stats_key;
+
+static pthread_once_t g_stats_once = PTHREAD_ONCE_INIT;
+
+/** This thread's block, or NULL if it doesn't have one yet. */
+static __thread struct stats_block *t_stats_block;
+
+/** Nonzero while this thread is timing an operation. */
+static __thread int t_op_active;
+
+/** Monotonic time at which this thread's current operation started. */
+static __thread uint64_t t_op_start_ns;
+
+/** Nanoseconds this thread's current operation has spent in the throttler. */
+static __thread uint64_t t_op_wait_ns;
+
+static void stats_release_block(void *arg)
+{
+    struct stats_block *blk = arg, **cur;
+    struct stats_op_hist *oh;
+    uint32_t cls, stat, op;
+
+    pthread_mutex_lock(&g_stats_lock);
+    for (cur = &g_stats_blocks; *cur; cur = &(*cur)->next) {
+        if (*cur == blk) {
+            *cur = blk->next;
+            break;
+        }
+    }
+    for (cls = 0; cls < STATS_MAX_CLASSES; cls++) {
+        for (stat = 0; stat < HUB_NUM_STATS; stat++) {
+            g_stats_exited[cls][stat] += blk->ctr[cls][stat];
+        }
+        for (op = 0; op < HUB_NUM_OPS; op++) {
+            oh = blk->ops[cls][op];
+            if (!oh) {
+                continue;
+            }
+            if (g_stats_exited_ops[cls][op]) {
+                hist_merge(&g_stats_exited_ops[cls][op]->wait, &oh->wait);
+                hist_merge(&g_stats_exited_ops[cls][op]->service,
+                           &oh->service);
+                free(oh);
+            } else {
+                g_stats_exited_ops[cls][op] = oh;
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_stats_lock);
+    free(blk);
+}
+
+static void stats_init_once(void)
+{
+    if (pthread_key_create(&g_stats_key, stats_release_block)) {
+        fprintf(stderr, "stats_init_once: pthread_key_create failed.\n");
+        abort();
+    }
+}
+
+/**
+ * Get the calling thread's block, allocating one if it doesn't have one yet.
+ */
+static struct stats_block *stats_get_block(void)
+{
+    struct stats_block *blk = t_stats_block;
+
+    if (blk) {
+        return blk;
+    }
+    pthread_once(&g_stats_once, stats_init_once);
+    blk = xcalloc(1, sizeof(*blk));
+    pthread_mutex_lock(&g_stats_lock);
+    blk->next = g_stats_blocks;
+    g_stats_blocks = blk;
+    pthread_mutex_unlock(&g_stats_lock);
+    pthread_setspecific(g_stats_key, blk);
+    t_stats_block = blk;
+    return blk;
+}
+
+void stats_add(uint32_t cls, enum hub_stat stat, uint64_t amt)
+{
+    struct stats_block *blk;
+    uint64_t *ctr;
+
+    if (cls >= STATS_MAX_CLASSES) {
+        return;
+    }
+    blk = stats_get_block();
+    ctr = &blk->ctr[cls][stat];
+    // We are the only writer, so there is no need for a locked add.  The
+    // atomic store just makes sure that readers never see a torn value.
+    __atomic_store_n(ctr, __atomic_load_n(ctr, __ATOMIC_RELAXED) + amt,
+                     __ATOMIC_RELAXED);
+}
+
+void stats_sum(uint32_t cls, uint64_t *out)
+{
+    struct stats_block *blk;
+    uint32_t stat;
+
+    memset(out, 0, sizeof(uint64_t) * HUB_NUM_STATS);
+    if (cls >= STATS_MAX_CLASSES) {
+        return;
+    }
+    pthread_mutex_lock(&g_stats_lock);
+    for (stat = 0; stat < HUB_NUM_STATS; stat++) {
+        out[stat] = g_stats_exited[cls][stat];
+    }
+    for (blk = g_stats_blocks; blk; blk = blk->next) {
+        for (stat = 0; stat < HUB_NUM_STATS; stat++) {
+            out[stat] += __atomic_load_n(&blk->ctr[cls][stat],
+                                         __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&g_stats_lock);
+}
+
+void stats_op_begin(void)
+{
+    t_op_active = 1;
+    t_op_wait_ns = 0;
+    t_op_start_ns = monotonic_now_ns();
+}
+
+void stats_op_wait(uint64_t ns)
+{
+    if (t_op_active) {
+        t_op_wait_ns += ns;
+    }
+}
+
+void stats_op_end(uint32_t cls, enum hub_op op, struct stats_op_time *out)
+{
+    struct stats_block *blk;
+    struct stats_op_hist *oh;
+    struct stats_op_time t;
+
+    memset(&t, 0, sizeof(t));
+    if (t_op_active) {
+        t_op_active = 0;
+        t.end_ns = monotonic_now_ns();
+        t.wait_ns = t_op_wait_ns;
+        // The throttler may use a different clock than we do, so don't let
+        // the service time go negative.
+        if (t.end_ns - t_op_start_ns > t_op_wait_ns) {
+            t.service_ns = t.end_ns - t_op_start_ns - t_op_wait_ns;
+        }
+        if ((cls < STATS_MAX_CLASSES) && ((int)op >= 0) &&
+                (op < HUB_NUM_OPS)) {
+            blk = stats_get_block();
+            oh = blk->ops[cls][op];
+            if (!oh) {
+                oh = xcalloc(1, sizeof(*oh));
+                __atomic_store_n(&blk->ops[cls][op], oh, __ATOMIC_RELEASE);
+            }
+            hist_record(&oh->wait, t.wait_ns);
+            hist_record(&oh->service, t.service_ns);
+        }
+    }
+    if (out) {
+        *out = t;
+    }
+}
+
+void stats_op_sum(uint32_t cls, enum hub_op op, struct stats_op_hist *out)
+{
+    struct stats_block *blk;
+    struct stats_op_hist *oh;
+
+    memset(out, 0, sizeof(*out));
+    if ((cls >= STATS_MAX_CLASSES) || ((int)op < 0) || (op >= HUB_NUM_OPS)) {
+        return;
+    }
+    pthread_mutex_lock(&g_stats_lock);
+    oh = g_stats_exited_ops[cls][op];
+    if (oh) {
+        hist_merge(&out->wait, &oh->wait);
+        hist_merge(&out->service, &oh->service);
+    }
+    for (blk = g_stats_blocks; blk; blk = blk->next) {
+        oh = __atomic_load_n(&blk->ops[cls][op], __ATOMIC_ACQUIRE);
+        if (oh) {
+            hist_merge(&out->wait, &oh->wait);
+            hist_merge(&out->service, &oh->service);
+        }
+    }
+    pthread_mutex_unlock(&g_stats_lock);
+}
+
+const char *stats_name(enum hub_stat stat)
+{
+    if (((int)stat < 0) || (stat >= HUB_NUM_STATS)) {
+        return "unknown";
+    }
+    return HUB_STAT_NAMES[stat];
+}
+
+// vim: ts=4:sw=4:tw=79:et
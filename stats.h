@@ -0,0 +1,166 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_STATS_H
+#define IOHUB_STATS_H
+
+#include "hist.h"
+#include "op.h"
+
+#include <stdint.h>
+
+/**
+ * Per-class I/O statistics.
+ *
+ * A class is one of the throttler's UID allocations (see throttle_class).
+ * Each thread keeps its own block of counters, which only it writes, so
+ * counting an operation never takes a lock or bounces a cache line between
+ * CPUs.  Readers add up every thread's block.  When a thread exits, its
+ * counts are folded into a shared total so that they aren't lost.
+ *
+ * Threads also keep latency histograms for each operation they serve, split
+ * into the time spent waiting for the throttler to admit the operation and
+ * the rest, which is mostly spent in the underfs.  These are allocated the
+ * first time a thread serves a given operation for a given class.
+ */
+
+/** Maximum number of classes we keep statistics for. */
+#define STATS_MAX_CLASSES 64
+
+enum hub_stat {
+    /** Bytes returned by read. */
+    HUB_STAT_READ_BYTES = 0,
+
+    /** Bytes accepted by write. */
+    HUB_STAT_WRITE_BYTES,
+
+    /** Successful reads. */
+    HUB_STAT_READ_OPS,
+
+    /** Successful writes. */
+    HUB_STAT_WRITE_OPS,
+
+    /** Metadata operations. */
+    HUB_STAT_META_OPS,
+
+    /** Number of times a thread slept in the throttler. */
+    HUB_STAT_THROTTLE_WAITS,
+
+    /** Nanoseconds spent asleep in the throttler. */
+    HUB_STAT_THROTTLE_NS,
+
+    /**
+     * Number of times a budget update had to be retried because another
+     * thread changed the budget at the same time.
+     */
+    HUB_STAT_THROTTLE_RETRIES,
+
+    HUB_NUM_STATS,
+};
+
+/**
+ * Latency histograms for one operation in one class.
+ */
+struct stats_op_hist {
+    /** Nanoseconds spent waiting for the throttler. */
+    struct hist wait;
+
+    /** Nanoseconds spent doing the operation once it was admitted. */
+    struct hist service;
+};
+
+/**
+ * The timing of one operation, as measured by stats_op_end.
+ */
+struct stats_op_time {
+    /** Monotonic time at which the operation finished. */
+    uint64_t end_ns;
+
+    /** Nanoseconds spent waiting for the throttler. */
+    uint64_t wait_ns;
+
+    /** Nanoseconds spent doing the operation once it was admitted. */
+    uint64_t service_ns;
+};
+
+/**
+ * Add to one of the calling thread's counters.
+ *
+ * @param cls           The class.  Classes at or above STATS_MAX_CLASSES
+ *                          are ignored.
+ * @param stat          The counter.
+ * @param amt           The amount to add.
+ */
+void stats_add(uint32_t cls, enum hub_stat stat, uint64_t amt);
+
+/**
+ * Add up every thread's counters for a class.
+ *
+ * The totals are not a consistent snapshot: counters which other threads are
+ * updating at the same time may or may not include the latest updates.
+ *
+ * @param cls           The class.
+ * @param out           (out param) Array of HUB_NUM_STATS totals.
+ */
+void stats_sum(uint32_t cls, uint64_t *out);
+
+/**
+ * Start timing an operation on the calling thread.
+ */
+void stats_op_begin(void);
+
+/**
+ * Account time spent waiting for the throttler to the operation the calling
+ * thread is timing.  Does nothing if it isn't timing one.
+ *
+ * @param ns            Nanoseconds spent waiting.
+ */
+void stats_op_wait(uint64_t ns);
+
+/**
+ * Finish timing an operation on the calling thread, and record its latency.
+ *
+ * @param cls           The class.  Classes at or above STATS_MAX_CLASSES
+ *                          are not recorded.
+ * @param op            The operation.
+ * @param out           (out param) If non-NULL, the operation's timing.  All
+ *                          zeroes if the thread wasn't timing one.
+ */
+void stats_op_end(uint32_t cls, enum hub_op op, struct stats_op_time *out);
+
+/**
+ * Merge every thread's latency histograms for an operation in a class.
+ *
+ * @param cls           The class.
+ * @param op            The operation.
+ * @param out           (out param) The merged histograms.
+ */
+void stats_op_sum(uint32_t cls, enum hub_op op, struct stats_op_hist *out);
+
+/**
+ * Get the name of a counter.
+ *
+ * @param stat          The counter.
+ *
+ * @return              A statically allocated name.
+ */
+const char *stats_name(enum hub_stat stat);
+
+#endif
+
+// vim: ts=4:sw=4:et
@@ -0,0 +1,353 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stripe.h"
+#include "util.h"
+#include "workq.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * @file stripe.c
+ *
+ * The data path for striped backends.
+ *
+ * A striped file is split into fixed-size stripes, which are dealt out to its
+ * member files round-robin.  Each stripe is stored at its natural offset in
+ * its member file, and the member files are sparse everywhere else.  This
+ * keeps the mapping trivial: the size of the file is just the size of its
+ * largest member, and truncating the file truncates every member to the same
+ * length.
+ *
+ * A request which touches more than one member is split into one piece per
+ * member, and the pieces are done in parallel on a pool of threads, with the
+ * calling thread doing the first piece itself.  Requests are throttled by the
+ * caller as a whole, so per-UID limits apply to the aggregate bandwidth.
+ */
+
+enum stripe_op {
+    STRIPE_OP_READ,
+    STRIPE_OP_WRITE,
+    STRIPE_OP_FALLOCATE,
+};
+
+/**
+ * A request against a striped file.
+ */
+struct stripe_req {
+    /** The striped file. */
+    const struct hub_stripe *st;
+
+    /** What to do. */
+    enum stripe_op op;
+
+    /** The buffer to read into or write from. */
+    char *buf;
+
+    /** File offset of the start of the request. */
+    off_t off;
+
+    /** Length of the request in bytes. */
+    uint64_t len;
+
+    /** The fallocate mode. */
+    int mode;
+
+    /** Protects the fields below. */
+    pthread_mutex_t lock;
+
+    /** Signalled when pending drops to 0. */
+    pthread_cond_t cond;
+
+    /** Number of pieces which haven't finished yet. */
+    unsigned int pending;
+
+    /** The first error any piece hit, as a negative error code, or 0. */
+    int err;
+
+    /** Nonzero if any read came up short. */
+    int short_read;
+};
+
+/**
+ * The piece of a request which touches one member.
+ */
+struct stripe_piece {
+    struct workq_item item;
+
+    /** The request. */
+    struct stripe_req *req;
+
+    /** Index of the member. */
+    unsigned int member;
+};
+
+/** The work queue for striped I/O, or NULL if we do it all inline. */
+static struct workq *g_stripe_workq;
+
+int stripe_init(int nthreads)
+{
+    if (nthreads <= 0) {
+        return 0;
+    }
+    return workq_alloc("stripe", nthreads, &g_stripe_workq);
+}
+
+void stripe_shutdown(void)
+{
+    workq_free(g_stripe_workq);
+    g_stripe_workq = NULL;
+}
+
+/**
+ * Do the part of a request which touches one member.
+ *
+ * @param req           The request.
+ * @param member        The index of the member.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+static int stripe_do_member(struct stripe_req *req, unsigned int member)
+{
+    const struct hub_stripe *st = req->st;
+    uint64_t k, first, last, cstart, cend;
+    struct iovec iov;
+    ssize_t res;
+    int ret;
+
+    first = req->off / st->stripe_size;
+    last = (req->off + req->len - 1) / st->stripe_size;
+    // Find the first stripe in the request which belongs to this member.
+    k = first + ((member + st->nfds - (first % st->nfds)) % st->nfds);
+    for (; k <= last; k += st->nfds) {
+        cstart = k * st->stripe_size;
+        if (cstart < (uint64_t)req->off) {
+            cstart = req->off;
+        }
+        cend = (k + 1) * st->stripe_size;
+        if (cend > req->off + req->len) {
+            cend = req->off + req->len;
+        }
+        switch (req->op) {
+        case STRIPE_OP_READ:
+            res = pread_fully(st->fds[member], req->buf + (cstart - req->off),
+                              cend - cstart, cstart);
+            if (res < 0) {
+                return res;
+            }
+            if ((uint64_t)res < cend - cstart) {
+                // Either a hole, or the end of the file.  stripe_pread
+                // works out which.
+                memset(req->buf + (cstart - req->off) + res, 0,
+                       (cend - cstart) - res);
+                pthread_mutex_lock(&req->lock);
+                req->short_read = 1;
+                pthread_mutex_unlock(&req->lock);
+            }
+            break;
+        case STRIPE_OP_WRITE:
+            iov.iov_base = req->buf + (cstart - req->off);
+            iov.iov_len = cend - cstart;
+            ret = pwritev_fully(st->fds[member], &iov, 1, cstart);
+            if (ret) {
+                return ret;
+            }
+            break;
+        case STRIPE_OP_FALLOCATE:
+            if (fallocate(st->fds[member], req->mode, cstart,
+                          cend - cstart) < 0) {
+                return -errno;
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+static void stripe_piece_run(void *arg)
+{
+    struct stripe_piece *piece = arg;
+    struct stripe_req *req = piece->req;
+    int ret;
+
+    ret = stripe_do_member(req, piece->member);
+    pthread_mutex_lock(&req->lock);
+    if (ret && !req->err) {
+        req->err = ret;
+    }
+    if (--req->pending == 0) {
+        pthread_cond_signal(&req->cond);
+    }
+    pthread_mutex_unlock(&req->lock);
+}
+
+/**
+ * Run a request against every member it touches.
+ *
+ * @param req           The request.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+static int stripe_run(struct stripe_req *req)
+{
+    const struct hub_stripe *st = req->st;
+    struct stripe_piece *pieces = NULL;
+    uint64_t nstripes;
+    unsigned int i, nmembers, member;
+    int ret = 0;
+
+    if (req->len == 0) {
+        return 0;
+    }
+    nstripes = ((req->off + req->len - 1) / st->stripe_size) -
+        (req->off / st->stripe_size) + 1;
+    nmembers = (nstripes < st->nfds) ? nstripes : st->nfds;
+    member = (req->off / st->stripe_size) % st->nfds;
+    pthread_mutex_init(&req->lock, NULL);
+    pthread_cond_init(&req->cond, NULL);
+    if (g_stripe_workq && (nmembers > 1)) {
+        pieces = calloc(nmembers, sizeof(*pieces));
+    }
+    if (!pieces) {
+        // Just do everything ourselves.
+        for (i = 0; i < nmembers; i++) {
+            ret = stripe_do_member(req, (member + i) % st->nfds);
+            if (ret) {
+                break;
+            }
+        }
+        goto done;
+    }
+    req->pending = nmembers;
+    for (i = 0; i < nmembers; i++) {
+        pieces[i].req = req;
+        pieces[i].member = (member + i) % st->nfds;
+        pieces[i].item.fn = stripe_piece_run;
+        pieces[i].item.arg = &pieces[i];
+        if (i > 0) {
+            workq_submit(g_stripe_workq, &pieces[i].item);
+        }
+    }
+    stripe_piece_run(&pieces[0]);
+    pthread_mutex_lock(&req->lock);
+    while (req->pending > 0) {
+        pthread_cond_wait(&req->cond, &req->lock);
+    }
+    ret = req->err;
+    pthread_mutex_unlock(&req->lock);
+    free(pieces);
+
+done:
+    pthread_cond_destroy(&req->cond);
+    pthread_mutex_destroy(&req->lock);
+    return ret;
+}
+
+ssize_t stripe_pread(const struct hub_stripe *st, char *buf, size_t size,
+                     off_t off)
+{
+    struct stripe_req req;
+    struct stat stbuf;
+    int ret;
+
+    memset(&req, 0, sizeof(req));
+    req.st = st;
+    req.op = STRIPE_OP_READ;
+    req.buf = buf;
+    req.off = off;
+    req.len = size;
+    ret = stripe_run(&req);
+    if (ret) {
+        return ret;
+    }
+    if (!req.short_read) {
+        return size;
+    }
+    // Some member came up short.  That might be a hole, or it might be the
+    // end of the file, depending on the size of the other members.
+    ret = stripe_fstat(st, &stbuf);
+    if (ret) {
+        return ret;
+    }
+    if (stbuf.st_size <= off) {
+        return 0;
+    }
+    if ((uint64_t)(stbuf.st_size - off) < size) {
+        return stbuf.st_size - off;
+    }
+    return size;
+}
+
+int stripe_pwrite(const struct hub_stripe *st, const char *buf, size_t size,
+                  off_t off)
+{
+    struct stripe_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.st = st;
+    req.op = STRIPE_OP_WRITE;
+    req.buf = (char*)buf;
+    req.off = off;
+    req.len = size;
+    return stripe_run(&req);
+}
+
+int stripe_fstat(const struct hub_stripe *st, struct stat *stbuf)
+{
+    struct stat mst;
+    unsigned int i;
+
+    if (fstat(st->fds[0], stbuf) < 0) {
+        return -errno;
+    }
+    for (i = 1; i < st->nfds; i++) {
+        if (fstat(st->fds[i], &mst) < 0) {
+            return -errno;
+        }
+        if (mst.st_size > stbuf->st_size) {
+            stbuf->st_size = mst.st_size;
+        }
+        stbuf->st_blocks += mst.st_blocks;
+    }
+    return 0;
+}
+
+int stripe_fallocate(const struct hub_stripe *st, int mode, off_t off,
+                     off_t len)
+{
+    struct stripe_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.st = st;
+    req.op = STRIPE_OP_FALLOCATE;
+    req.off = off;
+    req.len = len;
+    req.mode = mode;
+    return stripe_run(&req);
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -0,0 +1,117 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_STRIPE_H
+#define IOHUB_STRIPE_H
+
+#include <stdint.h> // for uint32_t
+#include <sys/types.h> // for off_t
+#include <unistd.h> // for size_t
+
+struct stat;
+
+/**
+ * The member files of a striped file.
+ *
+ * Stripe N of the file lives at its natural offset in fds[N % nfds].
+ */
+struct hub_stripe {
+    /** File descriptors of the member files. */
+    int *fds;
+
+    /** Number of member files. */
+    unsigned int nfds;
+
+    /** Size in bytes of each stripe. */
+    uint32_t stripe_size;
+};
+
+/**
+ * Start the threads which do striped I/O in parallel.
+ *
+ * Since this starts threads, it must be called after FUSE daemonizes.  If it
+ * isn't called, striped I/O is done one member at a time.
+ *
+ * @param nthreads      Number of threads.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+int stripe_init(int nthreads);
+
+/**
+ * Stop the striped I/O threads.
+ */
+void stripe_shutdown(void);
+
+/**
+ * Read from a striped file.
+ *
+ * @param st            The striped file.
+ * @param buf           The buffer to read into.
+ * @param size          Number of bytes to read.
+ * @param off           File offset to read from.
+ *
+ * @return              The number of bytes read, which is only less than
+ *                          size at the end of the file; or a negative error
+ *                          code.
+ */
+ssize_t stripe_pread(const struct hub_stripe *st, char *buf, size_t size,
+                     off_t off);
+
+/**
+ * Write to a striped file.
+ *
+ * @param st            The striped file.
+ * @param buf           The data to write.
+ * @param size          Number of bytes to write.
+ * @param off           File offset to write at.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+int stripe_pwrite(const struct hub_stripe *st, const char *buf, size_t size,
+                  off_t off);
+
+/**
+ * Get the attributes of a striped file.
+ *
+ * The size is the largest of the member sizes, and the block count is the
+ * total.  Everything else comes from the first member.
+ *
+ * @param st            The striped file.
+ * @param stbuf         (out param) The attributes.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+int stripe_fstat(const struct hub_stripe *st, struct stat *stbuf);
+
+/**
+ * Allocate or deallocate space in a striped file.
+ *
+ * @param st            The striped file.
+ * @param mode          The fallocate mode.
+ * @param off           The file offset to start at.
+ * @param len           Number of bytes.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+int stripe_fallocate(const struct hub_stripe *st, int mode, off_t off,
+                     off_t len);
+
+#endif
+
+// vim: ts=4:sw=4:et
@@ -0,0 +1,327 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "htable.h"
+#include "log.h"
+#include "syncq.h"
+#include "util.h"
+#include "workq.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Initial capacity of g_syncq_inodes. */
+#define SYNCQ_INITIAL_CAPACITY 64
+
+struct syncq_key {
+    dev_t dev;
+    ino_t ino;
+};
+
+/**
+ * The fsyncs of one backing inode.  An inode is only in g_syncq_inodes while
+ * somebody is waiting on it.  Everything but key and item is protected by
+ * g_syncq_lock.
+ *
+ * fsyncs of an inode are numbered from 1, and never overlap.  A caller which
+ * arrives while fsync number N has started, but not finished, needs number
+ * N + 1 to have finished before it can return.
+ */
+struct syncq_inode {
+    struct syncq_key key;
+
+    /** Item for running an fsync on the sync threads. */
+    struct workq_item item;
+
+    /** Signalled when an fsync finishes. */
+    pthread_cond_t cond;
+
+    /** Number of callers waiting on this inode. */
+    int waiters;
+
+    /** Nonzero if an fsync is queued or running. */
+    int busy;
+
+    /**
+     * The fd of the most recent caller.  That caller is waiting for the next
+     * fsync, so the fd stays open at least until the next fsync is done.
+     */
+    int fd;
+
+    /** Nonzero if somebody waiting for the next fsync needs a full fsync. */
+    int full;
+
+    /** Number of fsyncs started. */
+    uint64_t started;
+
+    /** Number of fsyncs finished. */
+    uint64_t finished;
+
+    /** Number of the last fsync which failed, or 0. */
+    uint64_t failed;
+
+    /** The error code of that fsync. */
+    int failed_err;
+};
+
+/** Protects g_syncq_inodes, and the inodes in it. */
+static pthread_mutex_t g_syncq_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Maps struct syncq_key to the inodes which are being synced, or NULL if
+ * syncq_init hasn't been called.
+ */
+static struct htable *g_syncq_inodes;
+
+/** The sync threads, or NULL if fsyncs run on the calling thread. */
+static struct workq *g_syncq_workq;
+
+/** Number of fsyncs done.  Must be accessed via atomic operations. */
+static uint64_t g_syncq_flushes;
+
+/** Number of callers in g_syncq_inodes.  Protected by g_syncq_lock. */
+static int g_syncq_waiting;
+
+/** Substitute for fsync and fdatasync, or NULL.  Set by syncq_set_sync_fn. */
+static syncq_sync_fn_t g_syncq_sync_fn;
+
+static uint32_t syncq_hash(const void *key, uint32_t capacity)
+{
+    const struct syncq_key *k = key;
+    uint64_t h = (((uint64_t)k->dev) * 31) + k->ino;
+
+    return (uint32_t)((h ^ (h >> 32)) % capacity);
+}
+
+static int syncq_eq(const void *a, const void *b)
+{
+    const struct syncq_key *ka = a, *kb = b;
+
+    return (ka->dev == kb->dev) && (ka->ino == kb->ino);
+}
+
+/**
+ * Sync a file.
+ *
+ * @param fd            The file descriptor.
+ * @param datasync      Nonzero if an fdatasync will do.
+ *
+ * @return              0 on success; -1 with errno set otherwise.
+ */
+static int syncq_sync(int fd, int datasync)
+{
+    __atomic_add_fetch(&g_syncq_flushes, 1, __ATOMIC_RELAXED);
+    if (g_syncq_sync_fn) {
+        return g_syncq_sync_fn(fd, datasync);
+    }
+    return datasync ? fdatasync(fd) : fsync(fd);
+}
+
+/**
+ * Do the next fsync of an inode.
+ *
+ * Must be called with g_syncq_lock held, and busy set.  Drops the lock while
+ * the fsync runs.
+ *
+ * @param inode         The inode.
+ */
+static void syncq_flush(struct syncq_inode *inode)
+{
+    uint64_t num;
+    int fd, full, ret;
+
+    num = ++inode->started;
+    fd = inode->fd;
+    full = inode->full;
+    inode->full = 0;
+    pthread_mutex_unlock(&g_syncq_lock);
+    ret = (syncq_sync(fd, !full) < 0) ? errno : 0;
+    pthread_mutex_lock(&g_syncq_lock);
+    inode->finished = num;
+    if (ret) {
+        inode->failed = num;
+        inode->failed_err = ret;
+    }
+    inode->busy = 0;
+    pthread_cond_broadcast(&inode->cond);
+}
+
+/**
+ * Run an fsync on a sync thread.
+ *
+ * @param arg           The struct syncq_inode.  Somebody is waiting on it,
+ *                          so it can't be freed until we're done.
+ */
+static void syncq_run(void *arg)
+{
+    struct syncq_inode *inode = arg;
+
+    pthread_mutex_lock(&g_syncq_lock);
+    syncq_flush(inode);
+    pthread_mutex_unlock(&g_syncq_lock);
+}
+
+int syncq_init(int nthreads)
+{
+    int ret;
+
+    pthread_mutex_lock(&g_syncq_lock);
+    g_syncq_inodes = htable_alloc(SYNCQ_INITIAL_CAPACITY, syncq_hash,
+                                  syncq_eq);
+    pthread_mutex_unlock(&g_syncq_lock);
+    if (!g_syncq_inodes) {
+        ret = ENOMEM;
+        goto error;
+    }
+    if (nthreads > 0) {
+        ret = workq_alloc("sync", nthreads, &g_syncq_workq);
+        if (ret) {
+            goto error;
+        }
+    }
+    return 0;
+
+error:
+    fprintf(stderr, "syncq_init(nthreads=%d) failed: error %d (%s)\n",
+            nthreads, ret, terror(ret));
+    syncq_shutdown();
+    return ret;
+}
+
+void syncq_shutdown(void)
+{
+    workq_free(g_syncq_workq);
+    g_syncq_workq = NULL;
+    pthread_mutex_lock(&g_syncq_lock);
+    if (g_syncq_inodes) {
+        htable_free(g_syncq_inodes);
+        g_syncq_inodes = NULL;
+    }
+    pthread_mutex_unlock(&g_syncq_lock);
+}
+
+/**
+ * Do an fsync on the calling thread, without coalescing it with anyone else's.
+ *
+ * @param fd            The fd to sync.
+ * @param datasync      Nonzero if an fdatasync will do.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+static int syncq_fsync_direct(int fd, int datasync)
+{
+    int ret;
+
+    ret = syncq_sync(fd, datasync);
+    return (ret < 0) ? -errno : 0;
+}
+
+int syncq_fsync(int fd, int datasync)
+{
+    struct syncq_inode *inode;
+    struct syncq_key key;
+    struct stat st;
+    void *found_key, *found_val;
+    uint64_t num;
+    int ret;
+
+    if (fstat(fd, &st) < 0) {
+        return -errno;
+    }
+    memset(&key, 0, sizeof(key));
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    pthread_mutex_lock(&g_syncq_lock);
+    if (!g_syncq_inodes) {
+        pthread_mutex_unlock(&g_syncq_lock);
+        return syncq_fsync_direct(fd, datasync);
+    }
+    inode = htable_get(g_syncq_inodes, &key);
+    if (!inode) {
+        inode = xcalloc(1, sizeof(*inode));
+        inode->key = key;
+        inode->item.fn = syncq_run;
+        inode->item.arg = inode;
+        if (htable_put(g_syncq_inodes, &inode->key, inode)) {
+            // The table couldn't grow.  Just do it ourselves.
+            pthread_mutex_unlock(&g_syncq_lock);
+            free(inode);
+            return syncq_fsync_direct(fd, datasync);
+        }
+        pthread_cond_init(&inode->cond, NULL);
+    }
+    // Whatever we wrote is only covered by an fsync which starts after now.
+    num = inode->started + 1;
+    inode->waiters++;
+    g_syncq_waiting++;
+    inode->fd = fd;
+    if (!datasync) {
+        inode->full = 1;
+    }
+    while (inode->finished < num) {
+        if (inode->busy) {
+            pthread_cond_wait(&inode->cond, &g_syncq_lock);
+        } else {
+            inode->busy = 1;
+            if (g_syncq_workq) {
+                workq_submit(g_syncq_workq, &inode->item);
+            } else {
+                syncq_flush(inode);
+            }
+        }
+    }
+    // If any fsync since we arrived failed, some of our data may not have
+    // made it to the disk.
+    ret = (inode->failed >= num) ? -inode->failed_err : 0;
+    g_syncq_waiting--;
+    if (--inode->waiters == 0) {
+        htable_pop(g_syncq_inodes, &key, &found_key, &found_val);
+        pthread_cond_destroy(&inode->cond);
+        free(inode);
+    }
+    pthread_mutex_unlock(&g_syncq_lock);
+    return ret;
+}
+
+void syncq_set_sync_fn(syncq_sync_fn_t fn)
+{
+    g_syncq_sync_fn = fn;
+}
+
+int syncq_waiting(void)
+{
+    int waiting;
+
+    pthread_mutex_lock(&g_syncq_lock);
+    waiting = g_syncq_waiting;
+    pthread_mutex_unlock(&g_syncq_lock);
+    return waiting;
+}
+
+uint64_t syncq_flushes(void)
+{
+    return __atomic_load_n(&g_syncq_flushes, __ATOMIC_RELAXED);
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -0,0 +1,106 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_SYNCQ_H
+#define IOHUB_SYNCQ_H
+
+#include <stdint.h>
+
+/**
+ * Group commit for fsync.
+ *
+ * Databases and the like often have several threads calling fsync on the
+ * same file at once.  Each fsync forces out everything written to the file
+ * before it started, so one fsync which starts after all of them arrived
+ * satisfies them all.  syncq_fsync waits for such an fsync, starting one if
+ * none is pending, so concurrent callers on the same backing inode share a
+ * single fsync rather than each doing their own back to back.
+ *
+ * The fsyncs themselves run on a dedicated pool of sync threads, which
+ * bounds how many are hitting the underfs at once, or on the calling thread
+ * if the pool has no threads.
+ */
+
+/**
+ * Start the sync threads.
+ *
+ * Since this starts threads, it must be called after FUSE daemonizes.
+ *
+ * @param nthreads      Number of sync threads.  0 does fsyncs on the
+ *                          calling thread.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+int syncq_init(int nthreads);
+
+/**
+ * Stop the sync threads.
+ *
+ * Nobody may be in syncq_fsync.
+ */
+void syncq_shutdown(void);
+
+/**
+ * Wait for an fsync or fdatasync of a file which started after this call.
+ *
+ * @param fd            A file descriptor of the file.  It must stay open
+ *                          until this returns.
+ * @param datasync      Nonzero if an fdatasync will do.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+int syncq_fsync(int fd, int datasync);
+
+/**
+ * A function which syncs a file the way fsync or fdatasync does.
+ *
+ * @param fd            The file descriptor.
+ * @param datasync      Nonzero if an fdatasync will do.
+ *
+ * @return              0 on success; -1 with errno set otherwise.
+ */
+typedef int (*syncq_sync_fn_t)(int fd, int datasync);
+
+/**
+ * Change how fsyncs are done.
+ *
+ * Tests can substitute a function which blocks, to control when fsyncs
+ * finish.  Nobody may be in syncq_fsync while this is called.
+ *
+ * @param fn            The function, or NULL to go back to fsync and
+ *                          fdatasync.
+ */
+void syncq_set_sync_fn(syncq_sync_fn_t fn);
+
+/**
+ * Get the number of callers waiting in syncq_fsync.
+ *
+ * @return              The number of callers.
+ */
+int syncq_waiting(void);
+
+/**
+ * Get the number of fsyncs we have done.
+ *
+ * @return              The number of fsync and fdatasync calls made.
+ */
+uint64_t syncq_flushes(void);
+
+#endif
+
+// vim: ts=4:sw=4:et
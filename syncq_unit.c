@@ -0,0 +1,254 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "syncq.h"
+#include "test.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SYNCQ_TEST_THREADS 8
+
+#define SYNCQ_TEST_ITERS 100
+
+struct syncq_thread {
+    pthread_t thread;
+    int fd;
+    int idx;
+    int err;
+};
+
+static void *syncq_thread_run(void *arg)
+{
+    struct syncq_thread *st = arg;
+    char c = 'a' + st->idx;
+    int i, ret;
+
+    for (i = 0; i < SYNCQ_TEST_ITERS; i++) {
+        if (pwrite(st->fd, &c, 1, st->idx) != 1) {
+            st->err = errno;
+            break;
+        }
+        ret = syncq_fsync(st->fd, i & 1);
+        if (ret) {
+            st->err = -ret;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Have several threads write to a file and sync it at once.
+ *
+ * @param path          The file.
+ * @param nthreads      Number of sync threads.
+ *
+ * @return              0 on success.
+ */
+static int test_concurrent(const char *path, int nthreads)
+{
+    struct syncq_thread st[SYNCQ_TEST_THREADS];
+    uint64_t start, flushes;
+    int i;
+
+    EXPECT_INT_ZERO(syncq_init(nthreads));
+    start = syncq_flushes();
+    for (i = 0; i < SYNCQ_TEST_THREADS; i++) {
+        memset(&st[i], 0, sizeof(st[i]));
+        // Every thread has an fd of its own, but they share an inode.
+        st[i].fd = open(path, O_WRONLY);
+        EXPECT_INT_GE(st[i].fd, 0);
+        st[i].idx = i;
+        EXPECT_INT_ZERO(pthread_create(&st[i].thread, NULL,
+                                       syncq_thread_run, &st[i]));
+    }
+    for (i = 0; i < SYNCQ_TEST_THREADS; i++) {
+        EXPECT_INT_ZERO(pthread_join(st[i].thread, NULL));
+        EXPECT_INT_ZERO(st[i].err);
+        close(st[i].fd);
+    }
+    // Calls which arrived together may have shared an fsync.
+    flushes = syncq_flushes() - start;
+    EXPECT_INT_GT(flushes, 0);
+    EXPECT_INT_GE(SYNCQ_TEST_THREADS * SYNCQ_TEST_ITERS, flushes);
+    syncq_shutdown();
+    return 0;
+}
+
+/**
+ * A sync function whose first call blocks until the test lets it go.
+ */
+struct syncq_gate {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int released;
+    int calls;
+    int datasync[SYNCQ_TEST_THREADS + 2];
+};
+
+static struct syncq_gate g_gate = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int syncq_gated_sync(int fd, int datasync)
+{
+    pthread_mutex_lock(&g_gate.lock);
+    if (g_gate.calls < SYNCQ_TEST_THREADS + 2) {
+        g_gate.datasync[g_gate.calls] = datasync;
+    }
+    g_gate.calls++;
+    pthread_cond_broadcast(&g_gate.cond);
+    while (!g_gate.released) {
+        pthread_cond_wait(&g_gate.cond, &g_gate.lock);
+    }
+    pthread_mutex_unlock(&g_gate.lock);
+    return datasync ? fdatasync(fd) : fsync(fd);
+}
+
+struct syncq_waiter {
+    pthread_t thread;
+    int fd;
+    int datasync;
+    int ret;
+};
+
+static void *syncq_waiter_run(void *arg)
+{
+    struct syncq_waiter *sw = arg;
+
+    sw->ret = syncq_fsync(sw->fd, sw->datasync);
+    return NULL;
+}
+
+/**
+ * Check that callers which queue up behind a running fsync all share the
+ * next one.
+ *
+ * @param path          The file.
+ * @param any_full      Nonzero if one of the waiters should ask for a full
+ *                          fsync.
+ *
+ * @return              0 on success.
+ */
+static int test_group_commit(const char *path, int any_full)
+{
+    struct syncq_waiter leader, sw[SYNCQ_TEST_THREADS];
+    uint64_t start;
+    int i;
+
+    memset(&g_gate.datasync, 0, sizeof(g_gate.datasync));
+    g_gate.released = 0;
+    g_gate.calls = 0;
+    EXPECT_INT_ZERO(syncq_init(1));
+    syncq_set_sync_fn(syncq_gated_sync);
+    start = syncq_flushes();
+    memset(&leader, 0, sizeof(leader));
+    leader.fd = open(path, O_WRONLY);
+    EXPECT_INT_GE(leader.fd, 0);
+    leader.datasync = 1;
+    EXPECT_INT_ZERO(pthread_create(&leader.thread, NULL,
+                                   syncq_waiter_run, &leader));
+    // Wait for the sync thread to get stuck in the first fsync.
+    pthread_mutex_lock(&g_gate.lock);
+    while (g_gate.calls < 1) {
+        pthread_cond_wait(&g_gate.cond, &g_gate.lock);
+    }
+    pthread_mutex_unlock(&g_gate.lock);
+    for (i = 0; i < SYNCQ_TEST_THREADS; i++) {
+        memset(&sw[i], 0, sizeof(sw[i]));
+        sw[i].fd = open(path, O_WRONLY);
+        EXPECT_INT_GE(sw[i].fd, 0);
+        sw[i].datasync = !(any_full && (i == SYNCQ_TEST_THREADS / 2));
+        EXPECT_INT_ZERO(pthread_create(&sw[i].thread, NULL,
+                                       syncq_waiter_run, &sw[i]));
+    }
+    while (syncq_waiting() < SYNCQ_TEST_THREADS + 1) {
+        usleep(1000);
+    }
+    pthread_mutex_lock(&g_gate.lock);
+    g_gate.released = 1;
+    pthread_cond_broadcast(&g_gate.cond);
+    pthread_mutex_unlock(&g_gate.lock);
+    EXPECT_INT_ZERO(pthread_join(leader.thread, NULL));
+    EXPECT_INT_ZERO(leader.ret);
+    close(leader.fd);
+    for (i = 0; i < SYNCQ_TEST_THREADS; i++) {
+        EXPECT_INT_ZERO(pthread_join(sw[i].thread, NULL));
+        EXPECT_INT_ZERO(sw[i].ret);
+        close(sw[i].fd);
+    }
+    // Everyone who queued up behind the first fsync shared the second.
+    EXPECT_INT_EQ(2, g_gate.calls);
+    EXPECT_INT_EQ(1, g_gate.datasync[0]);
+    EXPECT_INT_EQ((!any_full), g_gate.datasync[1]);
+    EXPECT_INT_EQ(2, syncq_flushes() - start);
+    syncq_set_sync_fn(NULL);
+    syncq_shutdown();
+    return 0;
+}
+
+/**
+ * Check that an fsync's error gets back to its caller.
+ *
+ * @param nthreads      Number of sync threads.
+ *
+ * @return              0 on success.
+ */
+static int test_errors(int nthreads)
+{
+    int fds[2];
+
+    EXPECT_INT_ZERO(syncq_init(nthreads));
+    EXPECT_INT_EQ(-EBADF, syncq_fsync(-1, 0));
+    // Pipes can't be synced.
+    EXPECT_INT_ZERO(pipe(fds));
+    EXPECT_INT_EQ(-EINVAL, syncq_fsync(fds[0], 1));
+    EXPECT_INT_EQ(-EINVAL, syncq_fsync(fds[0], 0));
+    close(fds[0]);
+    close(fds[1]);
+    syncq_shutdown();
+    return 0;
+}
+
+int main(void)
+{
+    char path[] = "/tmp/syncq_unit.XXXXXX";
+    int fd;
+
+    fd = mkstemp(path);
+    die_if(fd < 0);
+    close(fd);
+    EXPECT_INT_ZERO(test_concurrent(path, 0));
+    EXPECT_INT_ZERO(test_concurrent(path, 4));
+    EXPECT_INT_ZERO(test_group_commit(path, 0));
+    EXPECT_INT_ZERO(test_group_commit(path, 1));
+    EXPECT_INT_ZERO(test_errors(0));
+    EXPECT_INT_ZERO(test_errors(4));
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -15,11 +15,16 @@ usage() {
 test.sh: test the iohub userspace scheduler.
 
 usage:
-    test.sh [test-name]
+    test.sh [test-name] [args]
 
 available tests:
     simple: test mounting followed by unmounting.
     fs_test: start iohub and run fs_test on the overfs.
+    bench [disk-dir]: run io_bench on the raw underfs and then through
+        iohub, first in /dev/shm and then in a scratch directory created
+        inside disk-dir (default: bench_underfs next to this script) and
+        removed afterwards.  Extra io_bench arguments can be passed in the
+        IO_BENCH_ARGS environment variable.
 EOF
 }
 
@@ -31,16 +36,23 @@ setup_fuse() {
     [ -x "${IOHUB_BIN}" ] || \
         die "failed to find iohub binary in the ${SCRIPT_DIR} directory."
 
-    # Initialize constants
-    UNDERFS="/dev/shm/underfs"
+    # Initialize constants.  The underfs can be overridden by the caller, in
+    # which case it is the caller's to create and clean up.
+    UNDERFS="${1:-/dev/shm/underfs}"
     OVERFS="/dev/shm/overfs"
+    IOHUB_OPTS=()
+    # Other UIDs can only use the mount if we allow it, which needs root.
+    [ "$(id -u)" -eq 0 ] && IOHUB_OPTS=(-o allow_other)
 
     # Clean up any issues with previous script runs.
     /usr/bin/fusermount -u "${OVERFS}"
-    rm -rf "${UNDERFS}" "${OVERFS}"
+    if [ -z "${1}" ]; then
+        rm -rf "${UNDERFS}"
+    fi
+    rm -rf "${OVERFS}"
     mkdir -p "${UNDERFS}" "${OVERFS}" || \
         die "failed to mkdir under or over fs mount points."
-    "${IOHUB_BIN}" -f "${UNDERFS}" "${OVERFS}" &
+    "${IOHUB_BIN}" -f "${IOHUB_OPTS[@]}" "${UNDERFS}" "${OVERFS}" &
     FUSE_PID=$!
 }
 
@@ -67,6 +79,40 @@ fs_test() {
     kill_fuse
 }
 
+bench_one() {
+    local UNDER="${1}"
+    echo "*** raw underfs ${UNDER}"
+    chmod 1777 "${UNDER}"
+    do_or_die "${IO_BENCH_BIN}" ${IO_BENCH_ARGS} "${UNDER}"
+    echo "*** iohub over ${UNDER}"
+    setup_fuse "${UNDER}"
+    chmod 1777 "${UNDER}"
+    sleep 1
+    do_or_die "${IO_BENCH_BIN}" ${IO_BENCH_ARGS} -p "${FUSE_PID}" "${OVERFS}"
+    kill_fuse
+}
+
+bench() {
+    echo "*** Running bench..."
+    SCRIPT_DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+    IO_BENCH_BIN="${SCRIPT_DIR}/io_bench"
+    [ -x "${IO_BENCH_BIN}" ] || \
+        die "failed to find io_bench binary in the ${SCRIPT_DIR} directory."
+    rm -rf "/dev/shm/underfs"
+    mkdir -p "/dev/shm/underfs" || die "failed to mkdir /dev/shm/underfs"
+    bench_one "/dev/shm/underfs"
+    rm -rf "/dev/shm/underfs"
+    # Only ever delete our own scratch directory inside disk-dir, never
+    # disk-dir itself.
+    local DISK_DIR="${1:-${SCRIPT_DIR}/bench_underfs}"
+    mkdir -p "${DISK_DIR}" || die "failed to mkdir ${DISK_DIR}"
+    local UNDER
+    UNDER=$(mktemp -d "${DISK_DIR}/iohub_bench.XXXXXX") || \
+        die "failed to create a scratch directory in ${DISK_DIR}"
+    bench_one "${UNDER}"
+    rm -rf "${UNDER}"
+}
+
 ### Main
 if [ $# -lt 1 ]; then
     usage
@@ -79,6 +125,7 @@ case "${TEST_NAME}" in
     --help) usage; exit 0;;
     simple) simple_test;;
     fs_test) fs_test;;
+    bench) bench "${@}";;
     *)  echo "Unknown test ${TEST_NAME}"
         echo
         usage;;
@@ -16,8 +16,10 @@
  * limitations under the License.
  */
 
-#include "htable.h"
+#include "htable_int.h"
+#include "stats.h"
 #include "throttle.h"
+#include "trace.h"
 #include "util.h"
 
 #include <errno.h>
@@ -45,11 +47,26 @@
  *
  * So foo can "steal" some bytes from the global pool once he exceeds his
  * minimum.  So can other users.
+ *
+ * Requests bigger than an entire period's allocation, such as an fsync that
+ * has to write out a lot of dirty data, are charged one period at a time.
+ *
+ * Metadata operations (creates, unlinks, renames, getattrs, and so forth) are
+ * throttled the same way, but against a separate per-period budget of cost
+ * units.  Each operation type has a configurable cost, so that operations
+ * which are expensive for the underfs journal, like create or rename, can be
+ * made to cost more than cheap ones like getattr.
+ *
+ * Each underlying device is a separate throttle domain.  A UID gets its full
+ * allocation of bytes and metadata units in every domain, so that saturating
+ * one disk doesn't use up the budget it has on another.
+ *
+ * Each configured UID (and the UNKNOWN_UID allocation that all other UIDs
+ * share) is a "class" for the purposes of statistics.  We count metadata
+ * operations and the time spent waiting for budget per class; see stats.h.
+ * Budget renewals and sleeps can also be traced; see trace.h.
  */
 
-/** Seconds per throttling period. */
-#define SECS_PER_PERIOD 5
-
 /** 
  * Number of bits we use to identify a throttling period.
  */
@@ -60,12 +77,16 @@
  */
 #define PERIOD_MASK ((1 << BITS_PER_PERIOD) - 1)
 
-struct uid_data {
-    /** Allocation that this UID should get each period.  Immutable. */
+/**
+ * An amount of something (bytes, metadata operations) which is handed out
+ * each period.
+ */
+struct throttle_budget {
+    /** Allocation that this budget should get each period.  Immutable. */
     uint64_t full;
 
     /**
-     * Top bits: remaining bytes in this period.
+     * Top bits: remaining units in this period.
      * Bottom BITS_PER_PERIOD bits: current period.
      *
      * This must be accessed via atomic operations.
@@ -73,55 +94,169 @@ struct uid_data {
     uint64_t cur;
 };
 
+/**
+ * The budgets a UID has in one throttle domain.
+ */
+struct uid_domain {
+    /** Bytes of I/O. */
+    struct throttle_budget bytes;
+
+    /** Metadata operation cost units. */
+    struct throttle_budget meta;
+};
+
+struct uid_data {
+    /** UID_FLAG_* flags.  Immutable. */
+    uint32_t flags;
+
+    /** The configured UID.  Immutable. */
+    uint32_t uid;
+
+    /** The statistics class.  Immutable. */
+    uint32_t cls;
+
+    /**
+     * Number of threads currently asleep waiting for budget.
+     *
+     * This must be accessed via atomic operations.
+     */
+    uint32_t waiters;
+
+    /** Budgets for each throttle domain. */
+    struct uid_domain doms[0];
+};
+
 /**
  * Table mapping UIDs to uid_data structures.
  *
  * We don't remove or insert anything from this table after throttle_init
  * completes, so we can safely access it without a lock.
  */
-static struct htable *g_uid_table;
+static struct htable_u32 *g_uid_table;
 
-static uint32_t uid_hash_fun(const void *key, uint32_t capacity)
+/**
+ * The uid_data structures, indexed by class.  Immutable after throttle_init.
+ */
+static struct uid_data **g_classes;
+
+/**
+ * The number of classes.  Immutable after throttle_init.
+ */
+static uint32_t g_num_classes;
+
+/**
+ * The metadata cost of each operation.  Immutable after throttle_init.
+ */
+static uint32_t g_op_costs[HUB_NUM_OPS];
+
+/**
+ * The number of throttle domains.  Immutable after throttle_init.
+ */
+static uint32_t g_num_domains;
+
+static uint64_t system_now_ns(void *ctx __attribute__((unused)))
 {
-    uint32_t uid = (uint32_t)(uintptr_t)key;
-    return uid % capacity;
+    int ret;
+    struct timespec ts;
+
+    ret = clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    if (ret) {
+        ret = errno;
+        fprintf(stderr, "clock_gettime failed with error %d (%s)\n",
+                ret, strerror(ret));
+        abort();
+    }
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
 }
 
-static int uid_eq_fun(const void *a, const void *b)
+static void system_sleep_ns(void *ctx __attribute__((unused)), uint64_t ns)
 {
-    uint32_t ua = (uint32_t)(uintptr_t)a;
-    uint32_t ub = (uint32_t)(uintptr_t)b;
-    return ua == ub;
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    nanosleep(&ts, NULL);
 }
 
-void throttle_init(const struct uid_config *list)
+static const struct throttle_clock g_system_clock = {
+    .now_ns = system_now_ns,
+    .sleep_ns = system_sleep_ns,
+    .ctx = NULL,
+};
+
+/**
+ * The clock used to divide time into periods and to wait for the next one.
+ * Set by throttle_set_clock.
+ */
+static const struct throttle_clock *g_clock = &g_system_clock;
+
+void throttle_init(const struct uid_config *list, const uint32_t *op_costs,
+                   uint32_t num_domains)
 {
     const struct uid_config *conf;
-    int ret, len = 0;
+    int i, ret, len = 0;
+    uint32_t dom;
     struct uid_data *udata;
 
+    if (num_domains == 0) {
+        fprintf(stderr, "throttle_init: there must be at least one "
+                "throttle domain.\n");
+        abort();
+    }
+    g_num_domains = num_domains;
+
     for (conf = list; conf; conf = conf->next) {
         len++;
     }
-    g_uid_table = htable_alloc(len * 4, uid_hash_fun, uid_eq_fun);
+    g_classes = xcalloc(len, sizeof(struct uid_data *));
+    g_num_classes = 0;
+    g_uid_table = htable_u32_alloc(len * 4);
     if (!g_uid_table) {
-        fprintf(stderr, "throttle_init: htable_alloc failed: out "
+        fprintf(stderr, "throttle_init: htable_u32_alloc failed: out "
                 "of memory.\n");
         abort();
     }
+    for (i = 0; i < HUB_NUM_OPS; i++) {
+        g_op_costs[i] = op_costs ? op_costs[i] : 0;
+    }
     for (conf = list; conf; conf = conf->next) {
-        udata = xcalloc(1, sizeof(*udata));
-        udata->full = conf->full;
-        fprintf(stderr, "throttle_init(uid=%"PRId32") = { full:%"PRId64" }\n",
-                conf->uid, udata->full);
-        ret = htable_put(g_uid_table, (void*)(uintptr_t)conf->uid, udata);
+        udata = xcalloc(1, sizeof(*udata) +
+                        (sizeof(struct uid_domain) * num_domains));
+        for (dom = 0; dom < num_domains; dom++) {
+            udata->doms[dom].bytes.full = conf->full;
+            udata->doms[dom].meta.full = conf->meta_full;
+        }
+        udata->flags = conf->flags;
+        udata->uid = conf->uid;
+        udata->cls = g_num_classes;
+        if (conf->full == 0) {
+            fprintf(stderr, "throttle_init: uid %"PRId32" must have a "
+                    "nonzero byte allocation.\n", conf->uid);
+            abort();
+        }
+        fprintf(stderr, "throttle_init(uid=%"PRId32") = { full:%"PRId64
+                ", meta_full:%"PRId64", domains:%"PRId32" }\n", conf->uid,
+                conf->full, conf->meta_full, num_domains);
+        for (i = 0; i < HUB_NUM_OPS; i++) {
+            if ((conf->meta_full != 0) &&
+                    (g_op_costs[i] > conf->meta_full)) {
+                fprintf(stderr, "throttle_init: uid %"PRId32" has a "
+                        "meta_full of %"PRId64", which is less than the "
+                        "cost of a single %s operation (%"PRId32").\n",
+                        conf->uid, conf->meta_full, hub_op_name(i),
+                        g_op_costs[i]);
+                abort();
+            }
+        }
+        ret = htable_u32_put(g_uid_table, conf->uid, udata);
         if (ret) {
-            fprintf(stderr, "throttle_init: htable_put failed: error "
+            fprintf(stderr, "throttle_init: htable_u32_put failed: error "
                     "%d (%s)\n", ret, strerror(ret));
             abort();
         }
+        g_classes[g_num_classes++] = udata;
     }
-    if (!htable_get(g_uid_table, (void*)(uintptr_t)UNKNOWN_UID)) {
+    if (!htable_u32_get(g_uid_table, UNKNOWN_UID)) {
         fprintf(stderr, "throttle_init: you must specify an allocation "
                 "for uid %d (all UIDs that we don't know about).\n",
                 UNKNOWN_UID);
@@ -129,66 +264,275 @@ void throttle_init(const struct uid_config *list)
     }
 }
 
-void throttle(uint32_t uid, uint64_t amt)
+static struct uid_data *uid_data_get(uint32_t uid)
 {
     struct uid_data *udata;
-    int ret;
-    uint32_t cur_period, prev_period;
-    uint64_t avail, prev, next, nprev;
-    struct timespec cur, delta;
 
-    udata = htable_get(g_uid_table, (void*)(uintptr_t)uid);
+    udata = htable_u32_get(g_uid_table, uid);
     if (!udata) {
-        udata = htable_get(g_uid_table, (void*)(uintptr_t)UNKNOWN_UID);
+        udata = htable_u32_get(g_uid_table, UNKNOWN_UID);
     }
-    prev = __sync_fetch_and_or(&udata->cur, 0);
-    while (1) {
-        // Calculate the current period from the coarse monotonic time.
-        // This should only take a few nanoseconds on modern Linux setups.
-        ret = clock_gettime(CLOCK_MONOTONIC_RAW, &cur);
-        if (ret) {
-            fprintf(stderr, "clock_gettime failed with error %d (%s)\n",
-                    ret, strerror(ret));
-            abort();
+    return udata;
+}
+
+static struct uid_domain *uid_domain_get(struct uid_data *udata,
+                                         uint32_t dom)
+{
+    if (dom >= g_num_domains) {
+        fprintf(stderr, "uid_domain_get: invalid throttle domain %"PRId32
+                " (there are %"PRId32")\n", dom, g_num_domains);
+        abort();
+    }
+    return &udata->doms[dom];
+}
+
+/**
+ * Trace something the throttler did, if we are tracing at
+ * TRACE_LEVEL_THROTTLE.
+ *
+ * @param udata         The UID it was done for.
+ * @param type          The TRACE_TYPE_* of the event.
+ * @param size          The number of units involved.
+ * @param wait_ns       Nanoseconds spent asleep.
+ */
+static void throttle_trace(const struct uid_data *udata,
+                           enum trace_type type, uint64_t size,
+                           uint64_t wait_ns)
+{
+    struct trace_rec rec;
+
+    if (!trace_enabled(TRACE_LEVEL_THROTTLE)) {
+        return;
+    }
+    memset(&rec, 0, sizeof(rec));
+    // Trace records are in monotonic time, whatever clock we throttle on.
+    rec.ts_ns = monotonic_now_ns();
+    rec.size = size;
+    rec.wait_ns = wait_ns;
+    rec.uid = udata->uid;
+    rec.op = TRACE_NO_OP;
+    rec.type = type;
+    trace_emit(&rec);
+}
+
+/**
+ * Claim some units from a budget.
+ *
+ * @param udata         The UID the budget belongs to.  Time spent waiting
+ *                          is accounted to it.
+ * @param budget        The budget to claim from.
+ * @param amt           The number of units to claim.
+ * @param wait          If nonzero, block until the units are available.
+ *                          Otherwise, give up if they are not available
+ *                          right now.
+ *
+ * @return              0 on success; EAGAIN if wait was 0 and the units were
+ *                          not available.
+ */
+static int throttle_budget_claim(struct uid_data *udata,
+                                 struct throttle_budget *budget, uint64_t amt,
+                                 int wait)
+{
+    uint32_t cur_period, prev_period;
+    uint64_t avail, prev, next, nprev, now, period, delta, woke;
+
+    // Requests for more than an entire period's worth of units, like an
+    // fsync of a lot of dirty data, are paid off one full period at a time.
+    if (amt > budget->full) {
+        if (!wait) {
+            return EAGAIN;
+        }
+        while (amt > budget->full) {
+            throttle_budget_claim(udata, budget, budget->full, 1);
+            amt -= budget->full;
         }
-        cur_period = (cur.tv_sec / SECS_PER_PERIOD) & PERIOD_MASK;
+    }
+    prev = __sync_fetch_and_or(&budget->cur, 0);
+    while (1) {
+        // Calculate the current period from the monotonic time.  This should
+        // only take a few nanoseconds on modern Linux setups.
+        now = g_clock->now_ns(g_clock->ctx);
+        period = now / NS_PER_PERIOD;
+        cur_period = period & PERIOD_MASK;
         prev_period = prev & PERIOD_MASK;
         if (cur_period != prev_period) {
             // If the next period has rolled around, our allocation should have
             // renewed.
-            avail = udata->full;
-            fprintf(stderr, "renewing allocation to %"PRId64"\n", avail);
+            avail = budget->full;
+            throttle_trace(udata, TRACE_TYPE_RENEW, avail, 0);
         } else {
-            // See how many bytes are remaining for us in this period.
+            // See how many units are remaining for us in this period.
             avail = prev >> BITS_PER_PERIOD;
         }
         if (avail < amt) {
-            if (amt > udata->full) {
-                fprintf(stderr, "throttle: asked for more bytes than we can "
-                        "source throughout an entire period.  full = %"PRId64
-                        ", but we asked for %"PRId64"\n", udata->full, amt);
-                abort();
+            if (!wait) {
+                return EAGAIN;
             }
             // Try to sleep for the rest of the period.
-            delta.tv_sec = ((cur_period + 1) * SECS_PER_PERIOD) - cur.tv_sec;
-            delta.tv_nsec = 1000000000LL - cur.tv_nsec;
-            fprintf(stderr, "nanosleep(delta.tv_sec=%lld, delta.tv_nsec=%lld)\n",
-                    (long long)delta.tv_sec, (long long)delta.tv_nsec);
-            nanosleep(&delta, NULL);
-            prev = __sync_fetch_and_or(&udata->cur, 0);
+            delta = ((period + 1) * NS_PER_PERIOD) - now;
+            __sync_fetch_and_add(&udata->waiters, 1);
+            g_clock->sleep_ns(g_clock->ctx, delta);
+            __sync_fetch_and_sub(&udata->waiters, 1);
+            woke = g_clock->now_ns(g_clock->ctx);
+            throttle_trace(udata, TRACE_TYPE_SLEEP, amt, woke - now);
+            stats_add(udata->cls, HUB_STAT_THROTTLE_WAITS, 1);
+            stats_add(udata->cls, HUB_STAT_THROTTLE_NS, woke - now);
+            stats_op_wait(woke - now);
+            prev = __sync_fetch_and_or(&budget->cur, 0);
             continue;
         }
         avail -= amt;
         next = cur_period | (avail << BITS_PER_PERIOD);
-        nprev = __sync_val_compare_and_swap(&udata->cur, prev, next);
+        nprev = __sync_val_compare_and_swap(&budget->cur, prev, next);
         if (nprev == prev) {
-            // We have successfully claimed some bandwidth from the current
+            // We have successfully claimed some units from the current
             // period.  We're done for now.
             break;
         }
-        // Try, try again.
+        // Try, try again.  The count is per thread, so that counting doesn't
+        // add to the contention.
+        stats_add(udata->cls, HUB_STAT_THROTTLE_RETRIES, 1);
         prev = nprev;
     }
+    return 0;
+}
+
+void throttle(uint32_t dom, uint32_t uid, uint64_t amt)
+{
+    struct uid_data *udata = uid_data_get(uid);
+    struct uid_domain *udom = uid_domain_get(udata, dom);
+
+    throttle_budget_claim(udata, &udom->bytes, amt, 1);
+}
+
+int throttle_try(uint32_t dom, uint32_t uid, uint64_t amt)
+{
+    struct uid_data *udata = uid_data_get(uid);
+    struct uid_domain *udom = uid_domain_get(udata, dom);
+
+    return throttle_budget_claim(udata, &udom->bytes, amt, 0);
+}
+
+uint32_t throttle_flags(uint32_t uid)
+{
+    return uid_data_get(uid)->flags;
+}
+
+void throttle_op(uint32_t dom, uint32_t uid, enum hub_op op)
+{
+    struct uid_data *udata = uid_data_get(uid);
+    struct uid_domain *udom;
+    uint32_t cost = g_op_costs[op];
+
+    stats_add(udata->cls, HUB_STAT_META_OPS, 1);
+    if (cost == 0) {
+        return;
+    }
+    udom = uid_domain_get(udata, dom);
+    if (udom->meta.full == 0) {
+        return;
+    }
+    throttle_budget_claim(udata, &udom->meta, cost, 1);
+}
+
+void throttle_set_clock(const struct throttle_clock *clock)
+{
+    g_clock = clock ? clock : &g_system_clock;
+}
+
+static void uid_data_free(void *ctx __attribute__((unused)),
+                          uint32_t uid __attribute__((unused)), void *val)
+{
+    free(val);
+}
+
+void throttle_shutdown(void)
+{
+    if (g_uid_table) {
+        htable_u32_visit(g_uid_table, uid_data_free, NULL);
+        htable_u32_free(g_uid_table);
+        g_uid_table = NULL;
+    }
+    free(g_classes);
+    g_classes = NULL;
+    g_num_classes = 0;
+}
+
+uint64_t throttle_cas_retries(void)
+{
+    uint64_t ctrs[HUB_NUM_STATS], total = 0;
+    uint32_t cls;
+
+    for (cls = 0; cls < g_num_classes; cls++) {
+        stats_sum(cls, ctrs);
+        total += ctrs[HUB_STAT_THROTTLE_RETRIES];
+    }
+    return total;
+}
+
+uint32_t throttle_class(uint32_t uid)
+{
+    return uid_data_get(uid)->cls;
+}
+
+uint32_t throttle_num_classes(void)
+{
+    return g_num_classes;
+}
+
+/**
+ * Get the data for a class.
+ *
+ * @param cls           The class.  Aborts if it is not valid.
+ */
+static struct uid_data *class_data_get(uint32_t cls)
+{
+    if (cls >= g_num_classes) {
+        fprintf(stderr, "class_data_get: invalid class %"PRId32
+                " (there are %"PRId32")\n", cls, g_num_classes);
+        abort();
+    }
+    return g_classes[cls];
+}
+
+uint32_t throttle_class_uid(uint32_t cls)
+{
+    return class_data_get(cls)->uid;
+}
+
+uint32_t throttle_class_waiters(uint32_t cls)
+{
+    return __atomic_load_n(&class_data_get(cls)->waiters, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the number of units left in a budget.
+ *
+ * @param budget        The budget.
+ * @param period        The current period.
+ *
+ * @return              The number of units that could be claimed without
+ *                          waiting.
+ */
+static uint64_t throttle_budget_avail(struct throttle_budget *budget,
+                                      uint64_t period)
+{
+    uint64_t cur = __atomic_load_n(&budget->cur, __ATOMIC_RELAXED);
+
+    if ((cur & PERIOD_MASK) != (period & PERIOD_MASK)) {
+        return budget->full;
+    }
+    return cur >> BITS_PER_PERIOD;
+}
+
+void throttle_class_avail(uint32_t cls, uint32_t dom, uint64_t *bytes,
+                          uint64_t *meta)
+{
+    struct uid_domain *udom = uid_domain_get(class_data_get(cls), dom);
+    uint64_t period = g_clock->now_ns(g_clock->ctx) / NS_PER_PERIOD;
+
+    *bytes = throttle_budget_avail(&udom->bytes, period);
+    *meta = throttle_budget_avail(&udom->meta, period);
 }
 
 // vim: ts=4:sw=4:tw=79:et
@@ -19,12 +19,56 @@
 #ifndef IOHUB_THROTTLE_H
 #define IOHUB_THROTTLE_H
 
+#include "op.h"
+
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdint.h>
 
 #define UNKNOWN_UID 0xffffffff
 
+/**
+ * Seconds per throttling period.  Each UID's budget is renewed to its full
+ * allocation at the start of every period.
+ */
+#define SECS_PER_PERIOD 5
+
+/** Nanoseconds per throttling period. */
+#define NS_PER_PERIOD (SECS_PER_PERIOD * 1000000000ULL)
+
+/**
+ * Let the kernel page cache hold data for files opened by this UID, rather
+ * than using direct I/O.  This is a good idea for read-mostly UIDs, since
+ * re-reads of cached data never reach us.  Only the bytes that actually reach
+ * the underfs are throttled.
+ */
+#define UID_FLAG_PAGE_CACHE 0x1
+
+/**
+ * A source of time for the throttler.
+ */
+struct throttle_clock {
+    /**
+     * Get the current monotonic time.
+     *
+     * @param ctx           The clock's context pointer.
+     *
+     * @return              The time in nanoseconds.
+     */
+    uint64_t (*now_ns)(void *ctx);
+
+    /**
+     * Block the calling thread for a while.
+     *
+     * @param ctx           The clock's context pointer.
+     * @param ns            The number of nanoseconds to sleep.
+     */
+    void (*sleep_ns)(void *ctx, uint64_t ns);
+
+    /** Context pointer passed to the functions above. */
+    void *ctx;
+};
+
 struct uid_config {
     /** Next in linked list. */
     const struct uid_config *next;
@@ -34,6 +78,15 @@ struct uid_config {
 
     /** Minimum bytes per period. */
     uint64_t full;
+
+    /**
+     * Metadata operation cost units per period.  0 means that metadata
+     * operations are not throttled for this UID.
+     */
+    uint64_t meta_full;
+
+    /** UID_FLAG_* flags. */
+    uint32_t flags;
 };
 
 /**
@@ -43,18 +96,143 @@ struct uid_config {
  *
  * @param list          Linked list of uid_config structures to configure the
  *                          throttler with.  Non-owned pointer.
+ * @param op_costs      Array of HUB_NUM_OPS costs, giving the number of units
+ *                          each operation takes from the metadata budget.
+ *                          NULL if metadata operations should not be
+ *                          throttled.  Non-owned pointer.
+ * @param num_domains   Number of throttle domains.  Each domain has its own
+ *                          set of budgets.
+ */
+void throttle_init(const struct uid_config *list, const uint32_t *op_costs,
+                   uint32_t num_domains);
+
+/**
+ * Free the resources allocated by throttle_init.
+ *
+ * No other threads may be using the throttler.
  */
-void throttle_init(const struct uid_config *list);
+void throttle_shutdown(void);
+
+/**
+ * Change the clock used by the throttler.
+ *
+ * By default the throttler uses CLOCK_MONOTONIC_RAW and nanosleep.  Tests and
+ * simulations can substitute a virtual clock.  No other threads may be using
+ * the throttler while the clock is changed.
+ *
+ * @param clock         The new clock, or NULL to go back to the system
+ *                          clock.  Non-owned pointer, which must remain valid
+ *                          until the clock is changed again.
+ */
+void throttle_set_clock(const struct throttle_clock *clock);
 
 /**
  * Throttle the current thread.
  *
  * This will block until the system is ready to let us do the operation.
  *
+ * @param dom           The throttle domain of the device being accessed.
  * @param uid           The current user ID.
  * @param amt           Size of the I/O operation we'd like to do.
  */
-void throttle(uint32_t uid, uint64_t amt);
+void throttle(uint32_t dom, uint32_t uid, uint64_t amt);
+
+/**
+ * Try to claim some bytes without blocking.
+ *
+ * This is useful for speculative I/O, like read-ahead, which we'd rather skip
+ * than wait for.
+ *
+ * @param dom           The throttle domain of the device being accessed.
+ * @param uid           The user ID to charge.
+ * @param amt           Size of the I/O operation we'd like to do.
+ *
+ * @return              0 if the bytes were claimed; EAGAIN if the UID doesn't
+ *                          have enough bytes left in this period.
+ */
+int throttle_try(uint32_t dom, uint32_t uid, uint64_t amt);
+
+/**
+ * Get the flags configured for a UID.
+ *
+ * @param uid           The user ID.
+ *
+ * @return              The UID_FLAG_* flags for the UID.
+ */
+uint32_t throttle_flags(uint32_t uid);
+
+/**
+ * Throttle the current thread for a metadata operation.
+ *
+ * This will block until the UID has enough metadata budget left to pay for
+ * the operation.
+ *
+ * @param dom           The throttle domain of the device being accessed.
+ * @param uid           The current user ID.
+ * @param op            The operation we'd like to do.
+ */
+void throttle_op(uint32_t dom, uint32_t uid, enum hub_op op);
+
+/**
+ * Get the number of times a budget update had to be retried because another
+ * thread changed the budget at the same time.
+ *
+ * @return              The number of retries by the classes set up by
+ *                          throttle_init, since the process started.
+ */
+uint64_t throttle_cas_retries(void);
+
+/**
+ * Get the statistics class a UID is accounted to.
+ *
+ * Each configured UID has a class of its own.  UIDs without a configuration
+ * share the class of UNKNOWN_UID.
+ *
+ * @param uid           The user ID.
+ *
+ * @return              The class, which is less than throttle_num_classes().
+ */
+uint32_t throttle_class(uint32_t uid);
+
+/**
+ * Get the number of statistics classes.
+ *
+ * @return              The number of classes.
+ */
+uint32_t throttle_num_classes(void);
+
+/**
+ * Get the configured UID of a class.
+ *
+ * @param cls           The class.
+ *
+ * @return              The UID.  UNKNOWN_UID for the class shared by UIDs
+ *                          without a configuration.
+ */
+uint32_t throttle_class_uid(uint32_t cls);
+
+/**
+ * Get the number of threads currently waiting for budget in a class.
+ *
+ * @param cls           The class.
+ *
+ * @return              The number of waiting threads.
+ */
+uint32_t throttle_class_waiters(uint32_t cls);
+
+/**
+ * Get the budget a class has left in the current period.
+ *
+ * @param cls           The class.
+ * @param dom           The throttle domain.
+ * @param bytes         (out param) Bytes which could be claimed without
+ *                          waiting.
+ * @param meta          (out param) Metadata units which could be claimed
+ *                          without waiting.  Always 0 if the class's
+ *                          metadata operations are not throttled.
+ */
+void throttle_class_avail(uint32_t cls, uint32_t dom, uint64_t *bytes,
+                          uint64_t *meta);
 
 #endif
 
@@ -0,0 +1,428 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hist.h"
+#include "throttle.h"
+#include "util.h"
+#include "vclock.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @file throttle_bench.c
+ *
+ * A standalone simulator for the throttler.  Each simulated UID gets a number
+ * of threads which call throttle() in a loop with request sizes drawn from a
+ * configurable distribution, optionally sleeping afterwards to stand in for
+ * the time the I/O itself would take.  At the end we report the throughput
+ * each UID achieved, the latency of admission, the number of CAS retries and
+ * Jain's fairness index over the UIDs' share of their configured rates.
+ *
+ * Every thread seeds its own random number generator from its UID and thread
+ * index, so a given command line always issues the same sequence of requests.
+ * With -v, the simulation runs on a virtual clock, so that a long simulated
+ * run finishes in a fraction of the time and its results are reproducible.
+ */
+
+#define MAX_SIM_UIDS 64
+
+enum size_dist {
+    SIZE_DIST_FIXED,
+    SIZE_DIST_UNIFORM,
+    SIZE_DIST_EXP,
+};
+
+struct sim_uid {
+    /** Throttler configuration for this UID. */
+    struct uid_config conf;
+
+    /** Configured rate in bytes per second. */
+    uint64_t rate;
+
+    /** Number of threads issuing requests. */
+    uint32_t nthreads;
+
+    /** Request size distribution. */
+    enum size_dist dist;
+
+    /** First size parameter: the fixed size, minimum, or mean. */
+    uint64_t size_a;
+
+    /** Second size parameter: the maximum for uniform sizes. */
+    uint64_t size_b;
+
+    /** Total bytes admitted.  Accessed via atomic operations. */
+    uint64_t bytes;
+
+    /** Total requests admitted.  Accessed via atomic operations. */
+    uint64_t reqs;
+
+    /** Admission latency histogram.  Protected by lock. */
+    struct hist lat;
+
+    /** Protects lat. */
+    pthread_mutex_t lock;
+};
+
+struct sim_thread {
+    pthread_t thread;
+    struct sim_uid *su;
+    uint64_t rng;
+};
+
+static struct sim_uid g_uids[MAX_SIM_UIDS];
+
+static uint32_t g_num_uids;
+
+/** Monotonic time in nanoseconds at which the threads should stop. */
+static uint64_t g_deadline_ns;
+
+/** Simulated service time per request, in microseconds. */
+static uint32_t g_service_us;
+
+/** The virtual clock, or NULL to use the real one. */
+static struct vclock *g_vc;
+
+static uint64_t bench_now_ns(void)
+{
+    return g_vc ? vclock_now_ns(g_vc) : monotonic_now_ns();
+}
+
+static void bench_sleep_us(uint32_t us)
+{
+    struct timespec ts;
+
+    if (g_vc) {
+        vclock_sleep_ns(g_vc, us * 1000ULL);
+        return;
+    }
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+static void print_usage(void)
+{
+        fprintf(stderr,
+"throttle_bench: simulates many UIDs competing for throttled I/O.\n"
+"\n"
+"Usage:\n"
+"throttle_bench [-d seconds] [-s service_us] [-v] [-u spec]...\n"
+"\n"
+"-d seconds      How long to run (default 15).  Throttling periods are "
+"%d\n"
+"                seconds long, so runs should cover several of them.\n"
+"-s service_us   Sleep this many microseconds after each admitted request\n"
+"                to simulate the I/O itself (default 0).\n"
+"-v              Run on a virtual clock.  Time only passes while every\n"
+"                thread is waiting, so long runs finish quickly.\n"
+"-u spec         Add a simulated UID.  spec is UID:RATE:THREADS:SIZES, where\n"
+"                RATE is the configured rate in bytes per second, THREADS\n"
+"                is the number of threads issuing requests, and SIZES is\n"
+"                one of:\n"
+"                    fixed=N       every request is N bytes\n"
+"                    uniform=A-B   uniformly distributed in [A, B]\n"
+"                    exp=M         exponentially distributed with mean M\n"
+"\n"
+"Without -u, two UIDs with the same rate compete: one with 4 threads doing\n"
+"128 KiB requests and one with 16 threads doing 4 KiB to 1 MiB requests.\n",
+        SECS_PER_PERIOD);
+}
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static uint64_t sim_size(struct sim_uid *su, uint64_t *rng)
+{
+    double u;
+
+    switch (su->dist) {
+    case SIZE_DIST_UNIFORM:
+        return su->size_a +
+            (xorshift64(rng) % (su->size_b - su->size_a + 1));
+    case SIZE_DIST_EXP:
+        // Use the top 53 bits for a uniform double in (0, 1].
+        u = ((xorshift64(rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+        return (uint64_t)(-log(u) * su->size_a) + 1;
+    case SIZE_DIST_FIXED:
+    default:
+        return su->size_a;
+    }
+}
+
+static void *sim_thread_run(void *arg)
+{
+    struct sim_thread *st = arg;
+    struct sim_uid *su = st->su;
+    uint64_t start, now, size, bytes = 0, reqs = 0;
+    struct hist *lat;
+
+    lat = xcalloc(1, sizeof(*lat));
+    while (1) {
+        size = sim_size(su, &st->rng);
+        start = bench_now_ns();
+        if (start >= g_deadline_ns) {
+            break;
+        }
+        throttle(0, su->conf.uid, size);
+        now = bench_now_ns();
+        // Requests admitted after the deadline are not counted, since the
+        // throughput is computed over the nominal duration.
+        if (now > g_deadline_ns) {
+            break;
+        }
+        hist_record(lat, now - start);
+        bytes += size;
+        reqs++;
+        if (g_service_us) {
+            bench_sleep_us(g_service_us);
+        }
+    }
+    if (g_vc) {
+        vclock_leave(g_vc);
+    }
+    __sync_fetch_and_add(&su->bytes, bytes);
+    __sync_fetch_and_add(&su->reqs, reqs);
+    pthread_mutex_lock(&su->lock);
+    hist_merge(&su->lat, lat);
+    pthread_mutex_unlock(&su->lock);
+    free(lat);
+    return NULL;
+}
+
+static int parse_size_dist(struct sim_uid *su, const char *str)
+{
+    char *end;
+
+    if (!strncmp(str, "fixed=", 6)) {
+        su->dist = SIZE_DIST_FIXED;
+        su->size_a = strtoull(str + 6, &end, 0);
+    } else if (!strncmp(str, "uniform=", 8)) {
+        su->dist = SIZE_DIST_UNIFORM;
+        su->size_a = strtoull(str + 8, &end, 0);
+        if (*end != '-') {
+            return EINVAL;
+        }
+        su->size_b = strtoull(end + 1, &end, 0);
+        if (su->size_b < su->size_a) {
+            return EINVAL;
+        }
+    } else if (!strncmp(str, "exp=", 4)) {
+        su->dist = SIZE_DIST_EXP;
+        su->size_a = strtoull(str + 4, &end, 0);
+    } else {
+        return EINVAL;
+    }
+    if ((*end) || (su->size_a == 0)) {
+        return EINVAL;
+    }
+    return 0;
+}
+
+static int parse_uid(const char *spec)
+{
+    struct sim_uid *su;
+    char *end;
+    int ret;
+
+    if (g_num_uids == MAX_SIM_UIDS) {
+        fprintf(stderr, "throttle_bench: too many UIDs.\n");
+        return EINVAL;
+    }
+    su = &g_uids[g_num_uids];
+    memset(su, 0, sizeof(*su));
+    su->conf.uid = strtoul(spec, &end, 0);
+    if (*end != ':') {
+        goto invalid;
+    }
+    su->rate = strtoull(end + 1, &end, 0);
+    if ((*end != ':') || (su->rate == 0)) {
+        goto invalid;
+    }
+    su->nthreads = strtoul(end + 1, &end, 0);
+    if (*end != ':') {
+        goto invalid;
+    }
+    ret = parse_size_dist(su, end + 1);
+    if (ret) {
+        goto invalid;
+    }
+    su->conf.full = su->rate * SECS_PER_PERIOD;
+    g_num_uids++;
+    return 0;
+
+invalid:
+    fprintf(stderr, "throttle_bench: invalid UID spec '%s'\n", spec);
+    return EINVAL;
+}
+
+static void add_default_uids(void)
+{
+    parse_uid("1000:20971520:4:fixed=131072");
+    parse_uid("1001:20971520:16:uniform=4096-1048576");
+}
+
+static void print_results(double secs)
+{
+    uint32_t i;
+    uint64_t total;
+    double share, sum = 0, sum_sq = 0;
+    struct sim_uid *su;
+
+    printf("%-10s %8s %10s %10s %6s %10s %10s %10s %10s %10s\n",
+           "uid", "threads", "rate", "achieved", "share", "reqs",
+           "p50_us", "p99_us", "p99.9_us", "max_us");
+    for (i = 0; i < g_num_uids; i++) {
+        su = &g_uids[i];
+        total = su->reqs;
+        share = (su->bytes / secs) / su->rate;
+        sum += share;
+        sum_sq += share * share;
+        printf("%-10"PRIu32" %8"PRIu32" %10.2f %10.2f %6.3f %10"PRIu64
+               " %10.1f %10.1f %10.1f %10.1f\n",
+               su->conf.uid, su->nthreads, su->rate / 1048576.0,
+               (su->bytes / secs) / 1048576.0, share, total,
+               hist_percentile(&su->lat, 0.50) / 1000.0,
+               hist_percentile(&su->lat, 0.99) / 1000.0,
+               hist_percentile(&su->lat, 0.999) / 1000.0,
+               su->lat.max / 1000.0);
+    }
+    printf("\nRates are in MiB/s.  share is achieved / rate.\n");
+    printf("CAS retries: %"PRIu64"\n", throttle_cas_retries());
+    printf("Jain's fairness index over shares: %.4f\n",
+           (sum_sq > 0) ? (sum * sum) / (g_num_uids * sum_sq) : 1.0);
+}
+
+int main(int argc, char **argv)
+{
+    struct uid_config unknown, *list = NULL;
+    struct throttle_clock clock;
+    struct sim_thread *threads;
+    uint32_t i, j, nthreads = 0, secs = 15;
+    uint64_t start;
+    int c, ret, virt = 0;
+
+    while ((c = getopt(argc, argv, "d:hs:u:v")) != -1) {
+        switch (c) {
+        case 'd':
+            secs = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            g_service_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'u':
+            if (parse_uid(optarg)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'v':
+            virt = 1;
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return (c == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if ((optind != argc) || (secs == 0)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    if (g_num_uids == 0) {
+        add_default_uids();
+    }
+    // The throttler requires an allocation for unknown UIDs.  None of our
+    // threads use it.
+    memset(&unknown, 0, sizeof(unknown));
+    unknown.uid = UNKNOWN_UID;
+    unknown.full = 1;
+    for (i = 0; i < g_num_uids; i++) {
+        if (g_uids[i].conf.uid == UNKNOWN_UID) {
+            break;
+        }
+    }
+    if (i == g_num_uids) {
+        list = &unknown;
+    }
+    for (i = 0; i < g_num_uids; i++) {
+        g_uids[i].conf.next = list;
+        list = &g_uids[i].conf;
+        pthread_mutex_init(&g_uids[i].lock, NULL);
+        nthreads += g_uids[i].nthreads;
+    }
+    if (virt) {
+        g_vc = vclock_alloc(monotonic_now_ns());
+        vclock_to_throttle_clock(g_vc, &clock);
+        throttle_set_clock(&clock);
+    }
+    throttle_init(list, NULL, 1);
+
+    threads = xcalloc(nthreads, sizeof(*threads));
+    start = bench_now_ns();
+    g_deadline_ns = start + (secs * 1000000000ULL);
+    nthreads = 0;
+    for (i = 0; i < g_num_uids; i++) {
+        for (j = 0; j < g_uids[i].nthreads; j++) {
+            struct sim_thread *st = &threads[nthreads++];
+            st->su = &g_uids[i];
+            st->rng = ((uint64_t)g_uids[i].conf.uid << 32) ^ (j + 1) ^
+                0x9e3779b97f4a7c15ULL;
+            // Join on the thread's behalf, so that virtual time can't move
+            // until every thread is running.
+            if (g_vc) {
+                vclock_join(g_vc);
+            }
+            ret = pthread_create(&st->thread, NULL, sim_thread_run, st);
+            if (ret) {
+                fprintf(stderr, "throttle_bench: pthread_create failed: "
+                        "error %d (%s)\n", ret, strerror(ret));
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    print_results(secs);
+    for (i = 0; i < g_num_uids; i++) {
+        pthread_mutex_destroy(&g_uids[i].lock);
+    }
+    free(threads);
+    throttle_shutdown();
+    throttle_set_clock(NULL);
+    vclock_free(g_vc);
+    return EXIT_SUCCESS;
+}
+
+// vim: ts=4:sw=4:tw=79:et
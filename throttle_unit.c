@@ -0,0 +1,282 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stats.h"
+#include "test.h"
+#include "throttle.h"
+#include "vclock.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Start the tests well into a period, at an arbitrary point in time.
+ */
+#define START_NS ((1000 * NS_PER_PERIOD) + 1234567)
+
+#define PERIOD_START(p) ((p) * NS_PER_PERIOD)
+
+#define FAIR_UIDS 2
+#define FAIR_THREADS_PER_UID 4
+#define FAIR_PERIODS 1000
+#define FAIR_REQ 100
+
+static struct vclock *g_vc;
+
+static struct throttle_clock g_clock;
+
+/**
+ * Set up the throttler with a virtual clock and two UIDs.
+ *
+ * uid 1000 gets 1000 bytes and 25 metadata units per period; everybody else
+ * gets 10 bytes and no metadata throttling.
+ */
+static void setup(uint32_t num_domains, const uint32_t *op_costs)
+{
+    static struct uid_config unknown, conf;
+
+    memset(&unknown, 0, sizeof(unknown));
+    unknown.uid = UNKNOWN_UID;
+    unknown.full = 10;
+    memset(&conf, 0, sizeof(conf));
+    conf.next = &unknown;
+    conf.uid = 1000;
+    conf.full = 1000;
+    conf.meta_full = 25;
+    g_vc = vclock_alloc(START_NS);
+    vclock_to_throttle_clock(g_vc, &g_clock);
+    throttle_set_clock(&g_clock);
+    throttle_init(&conf, op_costs, num_domains);
+}
+
+static void teardown(void)
+{
+    throttle_shutdown();
+    throttle_set_clock(NULL);
+    vclock_free(g_vc);
+    g_vc = NULL;
+}
+
+static int test_claim_and_rollover(void)
+{
+    setup(1, NULL);
+    EXPECT_INT_ZERO(throttle_try(0, 1000, 600));
+    EXPECT_INT_EQ(EAGAIN, throttle_try(0, 1000, 600));
+    EXPECT_INT_ZERO(throttle_try(0, 1000, 400));
+    EXPECT_INT_EQ(EAGAIN, throttle_try(0, 1000, 1));
+    EXPECT_INT_EQ(START_NS, vclock_now_ns(g_vc));
+
+    // Blocking waits for exactly the start of the next period.
+    throttle(0, 1000, 100);
+    EXPECT_INT_EQ(PERIOD_START(1001), vclock_now_ns(g_vc));
+    EXPECT_INT_ZERO(throttle_try(0, 1000, 900));
+    EXPECT_INT_EQ(EAGAIN, throttle_try(0, 1000, 1));
+
+    // A period with no activity doesn't carry anything over.
+    vclock_sleep_ns(g_vc, 3 * NS_PER_PERIOD);
+    EXPECT_INT_EQ(EAGAIN, throttle_try(0, 1000, 1001));
+    EXPECT_INT_ZERO(throttle_try(0, 1000, 1000));
+    teardown();
+    return 0;
+}
+
+static int test_large_request(void)
+{
+    setup(1, NULL);
+    // More than a period's worth can't be claimed without waiting.
+    EXPECT_INT_EQ(EAGAIN, throttle_try(0, 1000, 1001));
+
+    // It is paid off one period at a time: 1000 now, 1000 in the next
+    // period, and the last 500 in the one after that.
+    throttle(0, 1000, 2500);
+    EXPECT_INT_EQ(PERIOD_START(1002), vclock_now_ns(g_vc));
+    EXPECT_INT_ZERO(throttle_try(0, 1000, 500));
+    EXPECT_INT_EQ(EAGAIN, throttle_try(0, 1000, 1));
+    teardown();
+    return 0;
+}
+
+static int test_domains_and_unknown(void)
+{
+    setup(2, NULL);
+    EXPECT_INT_ZERO(throttle_try(0, 1000, 1000));
+    EXPECT_INT_EQ(EAGAIN, throttle_try(0, 1000, 1));
+    EXPECT_INT_ZERO(throttle_try(1, 1000, 1000));
+
+    // UIDs without a configuration share the UNKNOWN_UID allocation.
+    EXPECT_INT_ZERO(throttle_try(0, 4242, 6));
+    EXPECT_INT_EQ(EAGAIN, throttle_try(0, 4243, 6));
+    EXPECT_INT_ZERO(throttle_try(0, 4243, 4));
+    teardown();
+    return 0;
+}
+
+static int test_meta(void)
+{
+    uint32_t op_costs[HUB_NUM_OPS];
+
+    memset(op_costs, 0, sizeof(op_costs));
+    op_costs[HUB_OP_CREATE] = 10;
+    setup(1, op_costs);
+    throttle_op(0, 1000, HUB_OP_CREATE);
+    throttle_op(0, 1000, HUB_OP_CREATE);
+    throttle_op(0, 1000, HUB_OP_GETATTR);
+    EXPECT_INT_EQ(START_NS, vclock_now_ns(g_vc));
+    throttle_op(0, 1000, HUB_OP_CREATE);
+    EXPECT_INT_EQ(PERIOD_START(1001), vclock_now_ns(g_vc));
+
+    // The unknown UID has no metadata budget, so it is never throttled.
+    throttle_op(0, 4242, HUB_OP_CREATE);
+    throttle_op(0, 4242, HUB_OP_CREATE);
+    throttle_op(0, 4242, HUB_OP_CREATE);
+    EXPECT_INT_EQ(PERIOD_START(1001), vclock_now_ns(g_vc));
+    teardown();
+    return 0;
+}
+
+static void *stats_thread_run(void *arg __attribute__((unused)))
+{
+    stats_add(0, HUB_STAT_READ_BYTES, 5);
+    return NULL;
+}
+
+static int test_stats(void)
+{
+    uint64_t before[HUB_NUM_STATS], after[HUB_NUM_STATS], bytes, meta;
+    pthread_t thread;
+
+    setup(1, NULL);
+    EXPECT_INT_EQ(2, throttle_num_classes());
+    EXPECT_INT_EQ(0, throttle_class(1000));
+    EXPECT_INT_EQ(1, throttle_class(4242));
+    EXPECT_INT_EQ(1000, throttle_class_uid(0));
+    EXPECT_INT_EQ(UNKNOWN_UID, throttle_class_uid(1));
+    stats_sum(0, before);
+
+    // Waiting for the next period is accounted to the UID's class.
+    EXPECT_INT_ZERO(throttle_try(0, 1000, 1000));
+    throttle(0, 1000, 100);
+    throttle_op(0, 1000, HUB_OP_GETATTR);
+    EXPECT_INT_ZERO(throttle_class_waiters(0));
+    throttle_class_avail(0, 0, &bytes, &meta);
+    EXPECT_INT_EQ(900, bytes);
+    EXPECT_INT_EQ(25, meta);
+
+    // Counts from threads which have exited are kept.
+    EXPECT_INT_ZERO(pthread_create(&thread, NULL, stats_thread_run, NULL));
+    EXPECT_INT_ZERO(pthread_join(thread, NULL));
+    stats_sum(0, after);
+    EXPECT_INT_EQ(1, after[HUB_STAT_THROTTLE_WAITS] -
+                  before[HUB_STAT_THROTTLE_WAITS]);
+    EXPECT_INT_EQ(PERIOD_START(1001) - START_NS,
+                  after[HUB_STAT_THROTTLE_NS] - before[HUB_STAT_THROTTLE_NS]);
+    EXPECT_INT_EQ(1, after[HUB_STAT_META_OPS] - before[HUB_STAT_META_OPS]);
+    EXPECT_INT_EQ(5, after[HUB_STAT_READ_BYTES] -
+                  before[HUB_STAT_READ_BYTES]);
+    teardown();
+    return 0;
+}
+
+struct fair_thread {
+    pthread_t thread;
+    uint32_t uid;
+    uint64_t end_ns;
+    uint64_t bytes;
+};
+
+static void *fair_thread_run(void *arg)
+{
+    struct fair_thread *ft = arg;
+
+    while (vclock_now_ns(g_vc) < ft->end_ns) {
+        throttle(0, ft->uid, FAIR_REQ);
+        if (vclock_now_ns(g_vc) < ft->end_ns) {
+            ft->bytes += FAIR_REQ;
+        }
+    }
+    vclock_leave(g_vc);
+    return NULL;
+}
+
+static int test_long_run_fairness(void)
+{
+    static struct uid_config unknown, confs[FAIR_UIDS];
+    struct fair_thread ft[FAIR_UIDS * FAIR_THREADS_PER_UID];
+    uint64_t bytes[FAIR_UIDS], start_ns;
+    uint32_t i;
+
+    // Simulate FAIR_PERIODS periods (well over an hour) of several threads
+    // per UID competing for their budgets.
+    memset(&unknown, 0, sizeof(unknown));
+    unknown.uid = UNKNOWN_UID;
+    unknown.full = 10;
+    for (i = 0; i < FAIR_UIDS; i++) {
+        memset(&confs[i], 0, sizeof(confs[i]));
+        confs[i].next = i ? &confs[i - 1] : &unknown;
+        confs[i].uid = 2000 + i;
+        confs[i].full = (i + 1) * 1000;
+    }
+    g_vc = vclock_alloc(START_NS);
+    vclock_to_throttle_clock(g_vc, &g_clock);
+    throttle_set_clock(&g_clock);
+    throttle_init(&confs[FAIR_UIDS - 1], NULL, 1);
+    start_ns = PERIOD_START(1001);
+    vclock_sleep_ns(g_vc, start_ns - START_NS);
+    for (i = 0; i < FAIR_UIDS * FAIR_THREADS_PER_UID; i++) {
+        ft[i].uid = 2000 + (i % FAIR_UIDS);
+        ft[i].end_ns = start_ns + (FAIR_PERIODS * NS_PER_PERIOD);
+        ft[i].bytes = 0;
+        // Join on behalf of the thread, so that the clock can't advance
+        // before every thread has started.
+        vclock_join(g_vc);
+    }
+    for (i = 0; i < FAIR_UIDS * FAIR_THREADS_PER_UID; i++) {
+        EXPECT_INT_ZERO(pthread_create(&ft[i].thread, NULL,
+                                       fair_thread_run, &ft[i]));
+    }
+    memset(bytes, 0, sizeof(bytes));
+    for (i = 0; i < FAIR_UIDS * FAIR_THREADS_PER_UID; i++) {
+        EXPECT_INT_ZERO(pthread_join(ft[i].thread, NULL));
+        bytes[i % FAIR_UIDS] += ft[i].bytes;
+    }
+    // Every period's budget was used in full, and nothing more.
+    for (i = 0; i < FAIR_UIDS; i++) {
+        EXPECT_INT_EQ(confs[i].full * FAIR_PERIODS, bytes[i]);
+    }
+    EXPECT_INT_EQ(start_ns + (FAIR_PERIODS * NS_PER_PERIOD),
+                  vclock_now_ns(g_vc));
+    teardown();
+    return 0;
+}
+
+int main(void)
+{
+    EXPECT_INT_ZERO(test_claim_and_rollover());
+    EXPECT_INT_ZERO(test_large_request());
+    EXPECT_INT_ZERO(test_domains_and_unknown());
+    EXPECT_INT_ZERO(test_meta());
+    EXPECT_INT_ZERO(test_stats());
+    EXPECT_INT_ZERO(test_long_run_fairness());
+    return EXIT_SUCCESS;
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -0,0 +1,262 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file.h"
+#include "op.h"
+#include "stats.h"
+#include "throttle.h"
+#include "timing.h"
+#include "trace.h"
+
+#include <fuse.h>
+#include <string.h>
+#include <sys/types.h>
+
+struct stat;
+struct statvfs;
+struct utimbuf;
+
+/** The operations we are wrapping.  Immutable after timing_wrap. */
+static struct fuse_operations g_inner;
+
+/**
+ * Finish timing an operation, and trace it if we are tracing operations.
+ *
+ * @param op            The operation.
+ * @param path_id       The trace_path_id of the file it was on, or 0.
+ * @param off           The file offset it was at, or 0.
+ * @param size          The number of bytes it was for, or 0.
+ */
+static void timing_end(enum hub_op op, uint64_t path_id, uint64_t off,
+                       uint64_t size)
+{
+    uint32_t uid = fuse_get_context()->uid;
+    struct stats_op_time t;
+    struct trace_rec rec;
+
+    stats_op_end(throttle_class(uid), op, &t);
+    if (!trace_enabled(TRACE_LEVEL_OPS)) {
+        return;
+    }
+    memset(&rec, 0, sizeof(rec));
+    rec.ts_ns = t.end_ns;
+    rec.off = off;
+    rec.size = size;
+    rec.wait_ns = t.wait_ns;
+    rec.svc_ns = t.service_ns;
+    rec.path_id = path_id;
+    rec.uid = uid;
+    rec.op = op;
+    rec.type = TRACE_TYPE_OP;
+    trace_emit(&rec);
+}
+
+/**
+ * Define a wrapper which times an operation on a range of a file.
+ *
+ * The path ID is worked out before the operation, since release frees the
+ * file it is kept in.
+ *
+ * @param name          The name of the operation in struct fuse_operations.
+ * @param op            The hub_op to record the latency under.
+ * @param params        The parenthesized parameter list.
+ * @param args          The parenthesized argument list to pass on.
+ * @param id            The path ID to trace.
+ * @param off           The file offset to trace.
+ * @param size          The size to trace.
+ */
+#define TIMED_IO_OP(name, op, params, args, id, off, size) \
+    static int timed_##name params \
+    { \
+        uint64_t path_id = 0; \
+        int ret; \
+        \
+        if (trace_enabled(TRACE_LEVEL_OPS)) { \
+            path_id = id; \
+        } \
+        stats_op_begin(); \
+        ret = g_inner.name args; \
+        timing_end(op, path_id, off, size); \
+        return ret; \
+    }
+
+/**
+ * Define a wrapper which times an operation on a path.
+ *
+ * @param name          The name of the operation in struct fuse_operations.
+ * @param op            The hub_op to record the latency under.
+ * @param params        The parenthesized parameter list, which must include
+ *                          path.
+ * @param args          The parenthesized argument list to pass on.
+ */
+#define TIMED_OP(name, op, params, args) \
+    TIMED_IO_OP(name, op, params, args, trace_path_id(path), 0, 0)
+
+/**
+ * Define a wrapper which times an operation on an open file.  The path may
+ * be NULL, so the file's path ID is traced.
+ *
+ * @param name          The name of the operation in struct fuse_operations.
+ * @param op            The hub_op to record the latency under.
+ * @param params        The parenthesized parameter list, which must include
+ *                          info.
+ * @param args          The parenthesized argument list to pass on.
+ */
+#define TIMED_FILE_OP(name, op, params, args) \
+    TIMED_IO_OP(name, op, params, args, hub_file_path_id(info), 0, 0)
+
+TIMED_OP(getattr, HUB_OP_GETATTR,
+         (const char *path, struct stat *stbuf), (path, stbuf))
+TIMED_OP(readlink, HUB_OP_READLINK,
+         (const char *path, char *buf, size_t size), (path, buf, size))
+TIMED_OP(mknod, HUB_OP_MKNOD,
+         (const char *path, mode_t mode, dev_t dev), (path, mode, dev))
+TIMED_OP(mkdir, HUB_OP_MKDIR,
+         (const char *path, mode_t mode), (path, mode))
+TIMED_OP(unlink, HUB_OP_UNLINK, (const char *path), (path))
+TIMED_OP(rmdir, HUB_OP_RMDIR, (const char *path), (path))
+TIMED_IO_OP(symlink, HUB_OP_SYMLINK,
+            (const char *oldpath, const char *newpath), (oldpath, newpath),
+            trace_path_id(newpath), 0, 0)
+TIMED_IO_OP(rename, HUB_OP_RENAME,
+            (const char *oldpath, const char *newpath), (oldpath, newpath),
+            trace_path_id(oldpath), 0, 0)
+TIMED_IO_OP(link, HUB_OP_LINK,
+            (const char *oldpath, const char *newpath), (oldpath, newpath),
+            trace_path_id(oldpath), 0, 0)
+TIMED_OP(chmod, HUB_OP_CHMOD,
+         (const char *path, mode_t mode), (path, mode))
+TIMED_OP(chown, HUB_OP_CHOWN,
+         (const char *path, uid_t uid, gid_t gid), (path, uid, gid))
+TIMED_IO_OP(truncate, HUB_OP_TRUNCATE,
+            (const char *path, off_t off), (path, off), trace_path_id(path),
+            0, off)
+TIMED_OP(utime, HUB_OP_UTIME,
+         (const char *path, struct utimbuf *buf), (path, buf))
+TIMED_OP(open, HUB_OP_OPEN,
+         (const char *path, struct fuse_file_info *info), (path, info))
+TIMED_IO_OP(read, HUB_OP_READ,
+            (const char *path, char *buf, size_t size, off_t offset,
+             struct fuse_file_info *info), (path, buf, size, offset, info),
+            hub_file_path_id(info), offset, size)
+TIMED_IO_OP(write, HUB_OP_WRITE,
+            (const char *path, const char *buf, size_t size, off_t offset,
+             struct fuse_file_info *info), (path, buf, size, offset, info),
+            hub_file_path_id(info), offset, size)
+TIMED_IO_OP(read_buf, HUB_OP_READ,
+            (const char *path, struct fuse_bufvec **bufp, size_t size,
+             off_t offset, struct fuse_file_info *info),
+            (path, bufp, size, offset, info),
+            hub_file_path_id(info), offset, size)
+TIMED_IO_OP(write_buf, HUB_OP_WRITE,
+            (const char *path, struct fuse_bufvec *buf, off_t offset,
+             struct fuse_file_info *info), (path, buf, offset, info),
+            hub_file_path_id(info), offset, fuse_buf_size(buf))
+TIMED_OP(statfs, HUB_OP_STATFS,
+         (const char *path, struct statvfs *vfs), (path, vfs))
+TIMED_FILE_OP(flush, HUB_OP_FLUSH,
+              (const char *path, struct fuse_file_info *info), (path, info))
+TIMED_FILE_OP(release, HUB_OP_RELEASE,
+              (const char *path, struct fuse_file_info *info), (path, info))
+TIMED_FILE_OP(fsync, HUB_OP_FSYNC,
+              (const char *path, int datasync, struct fuse_file_info *info),
+              (path, datasync, info))
+TIMED_OP(setxattr, HUB_OP_SETXATTR,
+         (const char *path, const char *name, const char *value,
+          size_t size, int flags), (path, name, value, size, flags))
+TIMED_OP(getxattr, HUB_OP_GETXATTR,
+         (const char *path, const char *name, char *value, size_t size),
+         (path, name, value, size))
+TIMED_OP(listxattr, HUB_OP_LISTXATTR,
+         (const char *path, char *list, size_t size), (path, list, size))
+TIMED_OP(removexattr, HUB_OP_REMOVEXATTR,
+         (const char *path, const char *name), (path, name))
+TIMED_OP(opendir, HUB_OP_OPENDIR,
+         (const char *path, struct fuse_file_info *info), (path, info))
+TIMED_OP(readdir, HUB_OP_READDIR,
+         (const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
+          struct fuse_file_info *info), (path, buf, filler, offset, info))
+TIMED_OP(releasedir, HUB_OP_RELEASEDIR,
+         (const char *path, struct fuse_file_info *info), (path, info))
+TIMED_OP(fsyncdir, HUB_OP_FSYNCDIR,
+         (const char *path, int datasync, struct fuse_file_info *info),
+         (path, datasync, info))
+TIMED_OP(create, HUB_OP_CREATE,
+         (const char *path, mode_t mode, struct fuse_file_info *info),
+         (path, mode, info))
+TIMED_IO_OP(ftruncate, HUB_OP_FTRUNCATE,
+            (const char *path, off_t len, struct fuse_file_info *info),
+            (path, len, info), hub_file_path_id(info), 0, len)
+TIMED_FILE_OP(fgetattr, HUB_OP_FGETATTR,
+              (const char *path, struct stat *stbuf,
+               struct fuse_file_info *info), (path, stbuf, info))
+TIMED_OP(utimens, HUB_OP_UTIMENS,
+         (const char *path, const struct timespec tv[2]), (path, tv))
+TIMED_IO_OP(fallocate, HUB_OP_FALLOCATE,
+            (const char *path, int mode, off_t offset, off_t len,
+             struct fuse_file_info *info), (path, mode, offset, len, info),
+            hub_file_path_id(info), offset, len)
+
+#define TIMED_WRAP(name) \
+    if (inner->name) { \
+        outer->name = timed_##name; \
+    }
+
+void timing_wrap(const struct fuse_operations *inner,
+                 struct fuse_operations *outer)
+{
+    g_inner = *inner;
+    *outer = *inner;
+    TIMED_WRAP(getattr);
+    TIMED_WRAP(readlink);
+    TIMED_WRAP(mknod);
+    TIMED_WRAP(mkdir);
+    TIMED_WRAP(unlink);
+    TIMED_WRAP(rmdir);
+    TIMED_WRAP(symlink);
+    TIMED_WRAP(rename);
+    TIMED_WRAP(link);
+    TIMED_WRAP(chmod);
+    TIMED_WRAP(chown);
+    TIMED_WRAP(truncate);
+    TIMED_WRAP(utime);
+    TIMED_WRAP(open);
+    TIMED_WRAP(read);
+    TIMED_WRAP(write);
+    TIMED_WRAP(read_buf);
+    TIMED_WRAP(write_buf);
+    TIMED_WRAP(statfs);
+    TIMED_WRAP(flush);
+    TIMED_WRAP(release);
+    TIMED_WRAP(fsync);
+    TIMED_WRAP(setxattr);
+    TIMED_WRAP(getxattr);
+    TIMED_WRAP(listxattr);
+    TIMED_WRAP(removexattr);
+    TIMED_WRAP(opendir);
+    TIMED_WRAP(readdir);
+    TIMED_WRAP(releasedir);
+    TIMED_WRAP(fsyncdir);
+    TIMED_WRAP(create);
+    TIMED_WRAP(ftruncate);
+    TIMED_WRAP(fgetattr);
+    TIMED_WRAP(utimens);
+    TIMED_WRAP(fallocate);
+}
+
+// vim: ts=4:sw=4:tw=79:et
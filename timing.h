@@ -0,0 +1,42 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_TIMING_H
+#define IOHUB_TIMING_H
+
+#include <fuse.h>
+
+/**
+ * Wrap FUSE operations so that their latency is recorded.
+ *
+ * Each wrapped operation is timed from start to finish and recorded in the
+ * stats.h latency histograms of the calling UID's class, split into the time
+ * spent waiting for the throttler and the rest.  At TRACE_LEVEL_OPS and
+ * above, each operation is also traced; see trace.h.
+ *
+ * @param inner         The operations to wrap.  Copied, so this need not
+ *                          remain valid.  May only be called once.
+ * @param outer         (out param) The wrapped operations.  Operations which
+ *                          are not set in inner are not set here either.
+ */
+void timing_wrap(const struct fuse_operations *inner,
+                 struct fuse_operations *outer);
+
+#endif
+
+// vim: ts=4:sw=4:et
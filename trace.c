@@ -0,0 +1,397 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace.h"
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Number of records in each thread's ring.  Must be a power of 2. */
+#define TRACE_RING_RECS 4096
+
+#define TRACE_RING_MASK (TRACE_RING_RECS - 1)
+
+/** Milliseconds between drains. */
+#define TRACE_DRAIN_MS 100
+
+/**
+ * One thread's ring of records.
+ */
+struct trace_ring {
+    /** Next ring in g_trace_rings.  Protected by g_trace_lock. */
+    struct trace_ring *next;
+
+    /**
+     * Number of records ever added.  Only the owning thread writes this, but
+     * the drain thread reads it, so it must be accessed via atomic
+     * operations.
+     */
+    uint64_t head;
+
+    /**
+     * Number of records dropped because the ring was full.  Only the owning
+     * thread writes this, but the drain thread reads it, so it must be
+     * accessed via atomic operations.
+     */
+    uint64_t dropped;
+
+    /** Keeps the owner's fields and the drain thread's on separate lines. */
+    char pad[64];
+
+    /**
+     * Number of records ever drained.  Only the drain thread writes this,
+     * but the owning thread reads it, so it must be accessed via atomic
+     * operations.
+     */
+    uint64_t tail;
+
+    /** The number of drops already reported.  Protected by g_trace_lock. */
+    uint64_t dropped_seen;
+
+    /**
+     * Nonzero once the owning thread has exited, and the ring can be freed
+     * once it has been drained.  Protected by g_trace_lock.
+     */
+    int dead;
+
+    /** The records. */
+    struct trace_rec recs[TRACE_RING_RECS];
+};
+
+/**
+ * Protects g_trace_rings, g_trace_fp, g_trace_running and g_trace_stop, and
+ * the fields of struct trace_ring which say so.
+ */
+static pthread_mutex_t g_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Signalled when g_trace_stop is set. */
+static pthread_cond_t g_trace_cond = PTHREAD_COND_INITIALIZER;
+
+/** The rings of every thread which has traced anything. */
+static struct trace_ring *g_trace_rings;
+
+/** The trace file, or NULL if we aren't running. */
+static FILE *g_trace_fp;
+
+/** Nonzero if the drain thread is running. */
+static int g_trace_running;
+
+/** Set to tell the drain thread to exit. */
+static int g_trace_stop;
+
+static pthread_t g_trace_thread;
+
+/**
+ * The trace level.  This must be accessed via atomic operations.
+ */
+static int g_trace_level;
+
+/** Releases a thread's ring when it exits. */
+static pthread_key_t g_trace_key;
+
+static pthread_once_t g_trace_once = PTHREAD_ONCE_INIT;
+
+/** This thread's ring, or NULL if it doesn't have one yet. */
+static __thread struct trace_ring *t_trace_ring;
+
+/**
+ * Remove a ring from g_trace_rings and free it.
+ *
+ * Must be called with g_trace_lock held.
+ */
+static void trace_free_ring(struct trace_ring *ring)
+{
+    struct trace_ring **cur;
+
+    for (cur = &g_trace_rings; *cur; cur = &(*cur)->next) {
+        if (*cur == ring) {
+            *cur = ring->next;
+            break;
+        }
+    }
+    free(ring);
+}
+
+static void trace_release_ring(void *arg)
+{
+    struct trace_ring *ring = arg;
+
+    t_trace_ring = NULL;
+    pthread_mutex_lock(&g_trace_lock);
+    if (g_trace_running) {
+        // Let the drain thread write out what is left first.
+        ring->dead = 1;
+    } else {
+        trace_free_ring(ring);
+    }
+    pthread_mutex_unlock(&g_trace_lock);
+}
+
+static void trace_init_once(void)
+{
+    if (pthread_key_create(&g_trace_key, trace_release_ring)) {
+        fprintf(stderr, "trace_init_once: pthread_key_create failed.\n");
+        abort();
+    }
+}
+
+/**
+ * Get the calling thread's ring, allocating one if it doesn't have one yet.
+ */
+static struct trace_ring *trace_get_ring(void)
+{
+    struct trace_ring *ring = t_trace_ring;
+
+    if (ring) {
+        return ring;
+    }
+    pthread_once(&g_trace_once, trace_init_once);
+    ring = xcalloc(1, sizeof(*ring));
+    pthread_mutex_lock(&g_trace_lock);
+    ring->next = g_trace_rings;
+    g_trace_rings = ring;
+    pthread_mutex_unlock(&g_trace_lock);
+    pthread_setspecific(g_trace_key, ring);
+    t_trace_ring = ring;
+    return ring;
+}
+
+void trace_emit(const struct trace_rec *rec)
+{
+    struct trace_ring *ring = trace_get_ring();
+    uint64_t head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >=
+            TRACE_RING_RECS) {
+        __atomic_store_n(&ring->dropped,
+                __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED) + 1,
+                __ATOMIC_RELAXED);
+        return;
+    }
+    ring->recs[head & TRACE_RING_MASK] = *rec;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Write out the records in a ring, and note any that were dropped.
+ *
+ * Must be called with g_trace_lock held.
+ */
+static void trace_drain_ring(struct trace_ring *ring)
+{
+    struct trace_rec drop;
+    uint64_t head, tail, dropped, n;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    tail = ring->tail;
+    while (tail != head) {
+        // Write out up to the end of the array, then wrap around.
+        n = head - tail;
+        if (n > TRACE_RING_RECS - (tail & TRACE_RING_MASK)) {
+            n = TRACE_RING_RECS - (tail & TRACE_RING_MASK);
+        }
+        fwrite(&ring->recs[tail & TRACE_RING_MASK], sizeof(struct trace_rec),
+               n, g_trace_fp);
+        tail += n;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    if (dropped != ring->dropped_seen) {
+        memset(&drop, 0, sizeof(drop));
+        drop.ts_ns = monotonic_now_ns();
+        drop.size = dropped - ring->dropped_seen;
+        drop.op = TRACE_NO_OP;
+        drop.type = TRACE_TYPE_DROP;
+        fwrite(&drop, sizeof(drop), 1, g_trace_fp);
+        ring->dropped_seen = dropped;
+    }
+}
+
+/**
+ * Write out every ring, and free the rings of threads which have exited.
+ *
+ * Must be called with g_trace_lock held.
+ */
+static void trace_drain_all(void)
+{
+    struct trace_ring *ring, *next;
+    int ret;
+
+    for (ring = g_trace_rings; ring; ring = next) {
+        next = ring->next;
+        trace_drain_ring(ring);
+        if (ring->dead) {
+            trace_free_ring(ring);
+        }
+    }
+    if ((fflush(g_trace_fp) == EOF) || ferror(g_trace_fp)) {
+        ret = errno;
+        fprintf(stderr, "trace_drain_all: error writing the trace file: "
+                "error %d (%s)\n", ret, strerror(ret));
+        clearerr(g_trace_fp);
+    }
+}
+
+static void *trace_thread(void *arg __attribute__((unused)))
+{
+    struct timespec deadline;
+
+    pthread_mutex_lock(&g_trace_lock);
+    while (1) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += TRACE_DRAIN_MS * 1000000LL;
+        if (deadline.tv_nsec >= 1000000000LL) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000LL;
+        }
+        while ((!g_trace_stop) && (pthread_cond_timedwait(&g_trace_cond,
+                    &g_trace_lock, &deadline) != ETIMEDOUT)) {
+            ;
+        }
+        trace_drain_all();
+        if (g_trace_stop) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_trace_lock);
+    return NULL;
+}
+
+int trace_init(const char *path, enum trace_level level)
+{
+    struct trace_file_hdr hdr;
+    struct trace_ring *ring;
+    FILE *fp;
+    int ret;
+
+    if (((int)level < 0) || (level > TRACE_LEVEL_MAX)) {
+        return EINVAL;
+    }
+    fp = fopen(path, "w");
+    if (!fp) {
+        return errno;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.rec_size = sizeof(struct trace_rec);
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+        ret = errno;
+        fclose(fp);
+        return ret;
+    }
+    pthread_mutex_lock(&g_trace_lock);
+    // Throw away anything left over from an earlier trace.
+    for (ring = g_trace_rings; ring; ring = ring->next) {
+        __atomic_store_n(&ring->tail,
+                __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE),
+                __ATOMIC_RELEASE);
+        ring->dropped_seen = __atomic_load_n(&ring->dropped,
+                                             __ATOMIC_RELAXED);
+    }
+    g_trace_fp = fp;
+    g_trace_stop = 0;
+    ret = pthread_create(&g_trace_thread, NULL, trace_thread, NULL);
+    if (ret) {
+        g_trace_fp = NULL;
+        pthread_mutex_unlock(&g_trace_lock);
+        fclose(fp);
+        return ret;
+    }
+    g_trace_running = 1;
+    __atomic_store_n(&g_trace_level, level, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g_trace_lock);
+    return 0;
+}
+
+void trace_shutdown(void)
+{
+    struct trace_ring *ring, *next;
+
+    pthread_mutex_lock(&g_trace_lock);
+    if (!g_trace_running) {
+        pthread_mutex_unlock(&g_trace_lock);
+        return;
+    }
+    __atomic_store_n(&g_trace_level, TRACE_LEVEL_OFF, __ATOMIC_RELAXED);
+    g_trace_stop = 1;
+    pthread_cond_signal(&g_trace_cond);
+    pthread_mutex_unlock(&g_trace_lock);
+    // The drain thread drains everything once more on its way out.
+    pthread_join(g_trace_thread, NULL);
+    pthread_mutex_lock(&g_trace_lock);
+    g_trace_running = 0;
+    for (ring = g_trace_rings; ring; ring = next) {
+        next = ring->next;
+        if (ring->dead) {
+            trace_free_ring(ring);
+        }
+    }
+    fclose(g_trace_fp);
+    g_trace_fp = NULL;
+    pthread_mutex_unlock(&g_trace_lock);
+}
+
+int trace_set_level(enum trace_level level)
+{
+    int ret = 0;
+
+    if (((int)level < 0) || (level > TRACE_LEVEL_MAX)) {
+        return EINVAL;
+    }
+    pthread_mutex_lock(&g_trace_lock);
+    if ((level != TRACE_LEVEL_OFF) && (!g_trace_running)) {
+        ret = EOPNOTSUPP;
+    } else {
+        __atomic_store_n(&g_trace_level, level, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&g_trace_lock);
+    return ret;
+}
+
+uint64_t trace_path_id(const char *path)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    if (!path) {
+        return 0;
+    }
+    // 64-bit FNV-1a.
+    for (; *path; path++) {
+        hash ^= (unsigned char)*path;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash ? hash : 1;
+}
+
+enum trace_level trace_get_level(void)
+{
+    return __atomic_load_n(&g_trace_level, __ATOMIC_RELAXED);
+}
+
+int trace_enabled(enum trace_level level)
+{
+    return __atomic_load_n(&g_trace_level, __ATOMIC_RELAXED) >= (int)level;
+}
+
+// vim: ts=4:sw=4:tw=79:et
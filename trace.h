@@ -0,0 +1,200 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_TRACE_H
+#define IOHUB_TRACE_H
+
+#include <stdint.h>
+
+/**
+ * Binary event tracing.
+ *
+ * Each thread which traces something gets a ring buffer of fixed-size
+ * records, which only it writes and only the drain thread reads.  Adding a
+ * record is a couple of plain stores and a release store of the ring's head,
+ * with no locks and no system calls, so tracing can stay on in production.
+ * If the drain thread falls behind and a ring fills up, new records are
+ * dropped and counted rather than making the traced thread wait.
+ *
+ * The drain thread periodically copies every ring to the trace file.  The
+ * file starts with a struct trace_file_hdr, followed by struct trace_rec
+ * records in host byte order.  Records from different threads are not in
+ * timestamp order.
+ *
+ * What gets traced is controlled by the trace level, which can be changed
+ * while the daemon is running through /.iohub/trace_level.
+ *
+ * A trace at TRACE_LEVEL_OPS is a capture of the workload, which
+ * trace_replay can play back against a mount or the throttler.  Paths are
+ * not recorded, only a hash of each one (see trace_path_id), so a capture
+ * tells you which operations hit the same file without saying which file.
+ */
+
+/** The magic number at the start of a trace file. */
+#define TRACE_MAGIC "IOHUBTRC"
+
+/** The version of the trace file format. */
+#define TRACE_VERSION 2
+
+/** The op of records which aren't about a particular operation. */
+#define TRACE_NO_OP 0xffff
+
+enum trace_level {
+    /** Trace nothing. */
+    TRACE_LEVEL_OFF = 0,
+
+    /** Trace every operation served through timing_wrap. */
+    TRACE_LEVEL_OPS,
+
+    /**
+     * Also trace the throttler renewing budgets and putting threads to
+     * sleep.
+     */
+    TRACE_LEVEL_THROTTLE,
+
+    TRACE_LEVEL_MAX = TRACE_LEVEL_THROTTLE,
+};
+
+enum trace_type {
+    /**
+     * An operation finished.  off and size are the operation's, for those
+     * which have them.  wait_ns and svc_ns are its throttler wait and
+     * service time.
+     */
+    TRACE_TYPE_OP = 0,
+
+    /** A UID's budget was renewed to size units for a new period. */
+    TRACE_TYPE_RENEW,
+
+    /** A thread claiming size units slept wait_ns for the next period. */
+    TRACE_TYPE_SLEEP,
+
+    /** size records were dropped because a ring was full. */
+    TRACE_TYPE_DROP,
+};
+
+struct trace_file_hdr {
+    /** TRACE_MAGIC, without the terminating NUL. */
+    char magic[8];
+
+    /** TRACE_VERSION. */
+    uint32_t version;
+
+    /** sizeof(struct trace_rec). */
+    uint32_t rec_size;
+};
+
+struct trace_rec {
+    /** CLOCK_MONOTONIC time at which the event finished, in nanoseconds. */
+    uint64_t ts_ns;
+
+    /** File offset, or 0. */
+    uint64_t off;
+
+    /** Size in bytes or budget units, or 0. */
+    uint64_t size;
+
+    /** Nanoseconds spent waiting for the throttler. */
+    uint64_t wait_ns;
+
+    /** Nanoseconds spent doing the operation once it was admitted. */
+    uint64_t svc_ns;
+
+    /** The trace_path_id of the file the operation was on, or 0. */
+    uint64_t path_id;
+
+    /** The UID.  For throttler events, the configured UID of the class. */
+    uint32_t uid;
+
+    /** The hub_op, or TRACE_NO_OP. */
+    uint16_t op;
+
+    /** The trace_type. */
+    uint8_t type;
+
+    uint8_t pad;
+};
+
+/**
+ * Start the drain thread, and start tracing.
+ *
+ * Since this starts a thread, it must be called after FUSE daemonizes.
+ *
+ * @param path          The trace file.  It is truncated.
+ * @param level         The trace level to start at.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+int trace_init(const char *path, enum trace_level level);
+
+/**
+ * Stop tracing, write out what the rings hold, and stop the drain thread, if
+ * it is running.
+ */
+void trace_shutdown(void);
+
+/**
+ * Change the trace level.
+ *
+ * @param level         The new level.
+ *
+ * @return              0 on success; EINVAL if the level is out of range;
+ *                          EOPNOTSUPP if tracing to something other than
+ *                          TRACE_LEVEL_OFF was asked for but trace_init
+ *                          hasn't been called.
+ */
+int trace_set_level(enum trace_level level);
+
+/**
+ * Get the trace level.
+ *
+ * @return              The current level.
+ */
+enum trace_level trace_get_level(void);
+
+/**
+ * Find out whether events at a level are being traced.
+ *
+ * @param level         The level.
+ *
+ * @return              Nonzero if they are.
+ */
+int trace_enabled(enum trace_level level);
+
+/**
+ * Get the identifier under which operations on a path are traced.
+ *
+ * @param path          The overfs path, or NULL.
+ *
+ * @return              A 64-bit hash of the path, which is never 0; or 0 if
+ *                          path was NULL.
+ */
+uint64_t trace_path_id(const char *path);
+
+/**
+ * Add a record to the calling thread's ring.
+ *
+ * Callers should check trace_enabled first, since this doesn't.
+ *
+ * @param rec           The record.  Copied.
+ */
+void trace_emit(const struct trace_rec *rec);
+
+#endif
+
+// vim: ts=4:sw=4:et
@@ -0,0 +1,770 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hist.h"
+#include "htable_int.h"
+#include "op.h"
+#include "throttle.h"
+#include "trace.h"
+#include "util.h"
+#include "vclock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fsuid.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @file trace_replay.c
+ *
+ * Plays back a workload captured with -o trace_file (see trace.h), so that
+ * production traffic can be reproduced offline.
+ *
+ * With -m, the operations are replayed against files in a directory, which
+ * would normally be on an iohub mount.  The capture only has a hash of each
+ * path, so every path gets a file of its own named after the hash, created
+ * before the replay starts and sized to cover every read of it.  Operations
+ * which don't map onto such a file, like mkdir or rename, are skipped.
+ *
+ * Without -m, the operations are fed straight to the throttler, which is
+ * handy for trying out changes to it.  Reads and writes claim their size in
+ * bytes and everything else claims its metadata cost, and then the thread
+ * sleeps for the operation's recorded service time to stand in for the I/O.
+ *
+ * Each UID in the trace gets several threads, which take the UID's
+ * operations in the order they originally started.  By default each one is
+ * issued at the time it originally started, relative to the start of the
+ * trace.  With -a, each is issued as soon as a thread is free, and without
+ * -m the service times are skipped too.
+ */
+
+#define MAX_REPLAY_UIDS 64
+
+#define DEFAULT_THREADS_PER_UID 4
+
+/** Reads and writes bigger than this are cut short. */
+#define MAX_IO_SIZE (16 * 1024 * 1024)
+
+struct replay_uid {
+    uint32_t uid;
+
+    /**
+     * The UID's records, sorted by start time.  ts_ns holds the start time
+     * rather than the finish time.
+     */
+    struct trace_rec *recs;
+
+    /** Number of records. */
+    uint64_t nrecs;
+
+    /** Index of the next record to issue.  Accessed via atomic operations. */
+    uint64_t next;
+
+    /** Protects everything below. */
+    pthread_mutex_t lock;
+
+    /** Bytes read or written. */
+    uint64_t bytes;
+
+    /** Operations replayed. */
+    uint64_t ops;
+
+    /** Operations which couldn't be replayed. */
+    uint64_t skipped;
+
+    /** Operations which failed. */
+    uint64_t errors;
+
+    /** Largest delay in issuing an operation past its due time. */
+    uint64_t max_lag_ns;
+
+    /** Latency of the replayed operations. */
+    struct hist lat;
+};
+
+struct replay_file {
+    /** An open file descriptor. */
+    int fd;
+
+    /** Size to make the file before the replay starts. */
+    uint64_t size;
+
+    /** The path of the file. */
+    char path[PATH_MAX];
+};
+
+struct replay_thread {
+    pthread_t thread;
+    struct replay_uid *ru;
+    char *buf;
+};
+
+static struct replay_uid g_uids[MAX_REPLAY_UIDS];
+
+static uint32_t g_num_uids;
+
+/** Throttler allocations given with -u. */
+static struct uid_config g_confs[MAX_REPLAY_UIDS];
+
+static uint32_t g_num_confs;
+
+/** Nonzero to replay as fast as possible. */
+static int g_asap;
+
+/** The directory to replay against, or NULL to use the throttler. */
+static const char *g_dir;
+
+/** Maps path IDs to struct replay_file.  Immutable during the replay. */
+static struct htable_u64 *g_files;
+
+/** Start time of the earliest record in the trace. */
+static uint64_t g_first_ns;
+
+/** Time at which the replay started. */
+static uint64_t g_base_ns;
+
+/** The virtual clock, or NULL to use the real one. */
+static struct vclock *g_vc;
+
+static uint64_t replay_now_ns(void)
+{
+    return g_vc ? vclock_now_ns(g_vc) : monotonic_now_ns();
+}
+
+static void replay_sleep_ns(uint64_t ns)
+{
+    struct timespec ts;
+
+    if (g_vc) {
+        vclock_sleep_ns(g_vc, ns);
+        return;
+    }
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    nanosleep(&ts, NULL);
+}
+
+static void print_usage(void)
+{
+        fprintf(stderr,
+"trace_replay: plays back a trace captured with -o trace_file.\n"
+"\n"
+"Usage:\n"
+"trace_replay [-a] [-m dir] [-t threads] [-u spec]... [-v] trace_file\n"
+"\n"
+"-a              Issue operations as fast as possible, rather than at the\n"
+"                times they were originally issued.\n"
+"-m dir          Replay against files created in dir, which would normally\n"
+"                be on an iohub mount.  Operations run as the UID that did\n"
+"                them if we are root, and as the current user otherwise.\n"
+"                Without -m, replay against the throttler in this process.\n"
+"-t threads      Threads to replay each UID's operations on (default %d).\n"
+"-u spec         Without -m, give a UID a throttler allocation.  spec is\n"
+"                UID:RATE[:META_RATE], where RATE is in bytes per second,\n"
+"                and META_RATE is in metadata cost units per second\n"
+"                (default 0, unthrottled).  UID may be \"unknown\" for the\n"
+"                allocation shared by every other UID, which is unlimited\n"
+"                unless given.\n"
+"-v              Without -m, run on a virtual clock.  Time only passes\n"
+"                while every thread is waiting, so long traces replay\n"
+"                quickly.\n",
+        DEFAULT_THREADS_PER_UID);
+}
+
+static int parse_conf(const char *spec)
+{
+    struct uid_config *conf;
+    char *end;
+    uint64_t rate;
+
+    if (g_num_confs == MAX_REPLAY_UIDS) {
+        fprintf(stderr, "trace_replay: too many UIDs.\n");
+        return EINVAL;
+    }
+    conf = &g_confs[g_num_confs];
+    memset(conf, 0, sizeof(*conf));
+    if (!strncmp(spec, "unknown:", 8)) {
+        conf->uid = UNKNOWN_UID;
+        end = (char *)spec + 7;
+    } else {
+        conf->uid = strtoul(spec, &end, 0);
+    }
+    if (*end != ':') {
+        goto invalid;
+    }
+    rate = strtoull(end + 1, &end, 0);
+    if (rate == 0) {
+        goto invalid;
+    }
+    conf->full = rate * SECS_PER_PERIOD;
+    if (*end == ':') {
+        conf->meta_full = strtoull(end + 1, &end, 0) * SECS_PER_PERIOD;
+    }
+    if (*end) {
+        goto invalid;
+    }
+    g_num_confs++;
+    return 0;
+
+invalid:
+    fprintf(stderr, "trace_replay: invalid UID spec '%s'\n", spec);
+    return EINVAL;
+}
+
+static int rec_start_cmp(const void *a, const void *b)
+{
+    const struct trace_rec *ra = a, *rb = b;
+
+    if (ra->ts_ns < rb->ts_ns) {
+        return -1;
+    }
+    return (ra->ts_ns > rb->ts_ns) ? 1 : 0;
+}
+
+/**
+ * Read the operations in a trace, and sort them out by UID.
+ *
+ * @param path          The trace file.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+static int load_trace(const char *path)
+{
+    struct trace_file_hdr hdr;
+    struct trace_rec *recs = NULL, *rec;
+    uint64_t i, nrecs = 0, cap = 0;
+    uint32_t u;
+    FILE *fp;
+    int ret = 0;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        ret = errno;
+        fprintf(stderr, "trace_replay: failed to open %s: error %d (%s)\n",
+                path, ret, strerror(ret));
+        return ret;
+    }
+    if ((fread(&hdr, sizeof(hdr), 1, fp) != 1) ||
+            memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) ||
+            (hdr.version != TRACE_VERSION) ||
+            (hdr.rec_size != sizeof(struct trace_rec))) {
+        fprintf(stderr, "trace_replay: %s is not a version %d trace "
+                "file.\n", path, TRACE_VERSION);
+        fclose(fp);
+        return EINVAL;
+    }
+    while (1) {
+        if (nrecs == cap) {
+            cap = cap ? cap * 2 : 4096;
+            recs = realloc(recs, cap * sizeof(*recs));
+            if (!recs) {
+                fprintf(stderr, "trace_replay: out of memory.\n");
+                abort();
+            }
+        }
+        rec = &recs[nrecs];
+        if (fread(rec, sizeof(*rec), 1, fp) != 1) {
+            break;
+        }
+        // Only operations are replayed.
+        if ((rec->type != TRACE_TYPE_OP) || (rec->op >= HUB_NUM_OPS)) {
+            continue;
+        }
+        if (rec->ts_ns > rec->wait_ns + rec->svc_ns) {
+            rec->ts_ns -= rec->wait_ns + rec->svc_ns;
+        }
+        nrecs++;
+    }
+    fclose(fp);
+    if (nrecs == 0) {
+        fprintf(stderr, "trace_replay: %s has no operations in it.\n", path);
+        free(recs);
+        return EINVAL;
+    }
+    qsort(recs, nrecs, sizeof(*recs), rec_start_cmp);
+    g_first_ns = recs[0].ts_ns;
+    for (i = 0; i < nrecs; i++) {
+        for (u = 0; u < g_num_uids; u++) {
+            if (g_uids[u].uid == recs[i].uid) {
+                break;
+            }
+        }
+        if (u == g_num_uids) {
+            if (g_num_uids == MAX_REPLAY_UIDS) {
+                fprintf(stderr, "trace_replay: the trace has more than %d "
+                        "UIDs in it.\n", MAX_REPLAY_UIDS);
+                ret = EINVAL;
+                goto done;
+            }
+            g_uids[u].uid = recs[i].uid;
+            pthread_mutex_init(&g_uids[u].lock, NULL);
+            g_num_uids++;
+        }
+        g_uids[u].nrecs++;
+    }
+    for (u = 0; u < g_num_uids; u++) {
+        g_uids[u].recs = xcalloc(g_uids[u].nrecs, sizeof(struct trace_rec));
+        g_uids[u].nrecs = 0;
+    }
+    for (i = 0; i < nrecs; i++) {
+        for (u = 0; g_uids[u].uid != recs[i].uid; u++) {
+            ;
+        }
+        g_uids[u].recs[g_uids[u].nrecs++] = recs[i];
+    }
+
+done:
+    free(recs);
+    return ret;
+}
+
+/**
+ * Find out whether an operation is replayed against a mount on the file its
+ * path ID names.
+ */
+static int replay_op_uses_file(enum hub_op op)
+{
+    switch (op) {
+    case HUB_OP_GETATTR:
+    case HUB_OP_TRUNCATE:
+    case HUB_OP_OPEN:
+    case HUB_OP_CREATE:
+    case HUB_OP_READ:
+    case HUB_OP_WRITE:
+    case HUB_OP_FSYNC:
+    case HUB_OP_FGETATTR:
+    case HUB_OP_FTRUNCATE:
+    case HUB_OP_FALLOCATE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Create a file for each path in the trace.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+static int setup_files(void)
+{
+    char dir[PATH_MAX];
+    struct replay_file *rf;
+    struct trace_rec *rec;
+    uint64_t i;
+    uint32_t u;
+    int ret;
+
+    snprintf(dir, sizeof(dir), "%s/trace_replay", g_dir);
+    if (access(dir, F_OK) == 0) {
+        recursive_unlink(dir);
+    }
+    if (mkdir(dir, 0777) || chmod(dir, 0777)) {
+        ret = errno;
+        fprintf(stderr, "trace_replay: failed to create %s: error %d "
+                "(%s)\n", dir, ret, strerror(ret));
+        return ret;
+    }
+    g_files = htable_u64_alloc(1024);
+    if (!g_files) {
+        return ENOMEM;
+    }
+    for (u = 0; u < g_num_uids; u++) {
+        for (i = 0; i < g_uids[u].nrecs; i++) {
+            rec = &g_uids[u].recs[i];
+            if ((rec->path_id == 0) || (!replay_op_uses_file(rec->op))) {
+                continue;
+            }
+            rf = htable_u64_get(g_files, rec->path_id);
+            if (!rf) {
+                rf = xcalloc(1, sizeof(*rf));
+                rf->fd = -1;
+                snprintf(rf->path, sizeof(rf->path),
+                         "%s/trace_replay/%016"PRIx64, g_dir, rec->path_id);
+                ret = htable_u64_put(g_files, rec->path_id, rf);
+                if (ret) {
+                    free(rf);
+                    return ret;
+                }
+            }
+            if ((rec->op == HUB_OP_READ) &&
+                    (rec->off + rec->size > rf->size)) {
+                rf->size = rec->off + rec->size;
+            }
+        }
+    }
+    return 0;
+}
+
+static void open_file(void *ctx, uint64_t path_id __attribute__((unused)),
+                      void *val)
+{
+    struct replay_file *rf = val;
+    int *err = ctx;
+
+    if (*err) {
+        return;
+    }
+    rf->fd = open(rf->path, O_CREAT | O_RDWR, 0666);
+    if ((rf->fd < 0) || fchmod(rf->fd, 0666) ||
+            ftruncate(rf->fd, rf->size)) {
+        *err = errno;
+        fprintf(stderr, "trace_replay: failed to set up %s: error %d (%s)\n",
+                rf->path, *err, strerror(*err));
+    }
+}
+
+static void close_file(void *ctx __attribute__((unused)),
+                       uint64_t path_id __attribute__((unused)), void *val)
+{
+    struct replay_file *rf = val;
+
+    if (rf->fd >= 0) {
+        close(rf->fd);
+    }
+    free(rf);
+}
+
+/**
+ * Replay an operation against the throttler.
+ *
+ * @return              The number of bytes read or written.
+ */
+static uint64_t replay_throttle(const struct trace_rec *rec)
+{
+    uint64_t bytes = 0;
+
+    switch (rec->op) {
+    case HUB_OP_READ:
+    case HUB_OP_WRITE:
+        throttle(0, rec->uid, rec->size);
+        bytes = rec->size;
+        break;
+    case HUB_OP_FALLOCATE:
+        // Like hub_fallocate, charge for the metadata and the extent.
+        throttle_op(0, rec->uid, rec->op);
+        throttle(0, rec->uid, rec->size);
+        break;
+    default:
+        throttle_op(0, rec->uid, rec->op);
+        break;
+    }
+    if ((!g_asap) && (rec->svc_ns)) {
+        replay_sleep_ns(rec->svc_ns);
+    }
+    return bytes;
+}
+
+/**
+ * Replay an operation against the files in g_dir.
+ *
+ * @param rt            The thread.
+ * @param rec           The record.
+ * @param bytes         (out param) The number of bytes read or written.
+ *
+ * @return              0 on success; ENOTSUP if the operation can't be
+ *                          replayed; error code otherwise.
+ */
+static int replay_file_op(struct replay_thread *rt,
+                          const struct trace_rec *rec, uint64_t *bytes)
+{
+    struct replay_file *rf = NULL;
+    struct statvfs vfs;
+    struct stat st;
+    size_t size = rec->size;
+    ssize_t res;
+    int fd;
+
+    *bytes = 0;
+    if (rec->op == HUB_OP_STATFS) {
+        return statvfs(g_dir, &vfs) ? errno : 0;
+    }
+    if (replay_op_uses_file(rec->op)) {
+        rf = htable_u64_get(g_files, rec->path_id);
+    }
+    if (!rf) {
+        return ENOTSUP;
+    }
+    if (size > MAX_IO_SIZE) {
+        size = MAX_IO_SIZE;
+    }
+    switch (rec->op) {
+    case HUB_OP_READ:
+        res = pread(rf->fd, rt->buf, size, rec->off);
+        break;
+    case HUB_OP_WRITE:
+        res = pwrite(rf->fd, rt->buf, size, rec->off);
+        break;
+    case HUB_OP_FSYNC:
+        res = fsync(rf->fd);
+        break;
+    case HUB_OP_TRUNCATE:
+    case HUB_OP_FTRUNCATE:
+        res = ftruncate(rf->fd, rec->size);
+        break;
+    case HUB_OP_FALLOCATE:
+        res = fallocate(rf->fd, 0, rec->off, rec->size);
+        break;
+    case HUB_OP_GETATTR:
+        res = stat(rf->path, &st);
+        break;
+    case HUB_OP_FGETATTR:
+        res = fstat(rf->fd, &st);
+        break;
+    case HUB_OP_OPEN:
+    case HUB_OP_CREATE:
+        fd = open(rf->path, O_RDONLY);
+        res = (fd < 0) ? -1 : close(fd);
+        break;
+    default:
+        return ENOTSUP;
+    }
+    if (res < 0) {
+        return errno;
+    }
+    if ((rec->op == HUB_OP_READ) || (rec->op == HUB_OP_WRITE)) {
+        *bytes = res;
+    }
+    return 0;
+}
+
+static void *replay_thread_run(void *arg)
+{
+    struct replay_thread *rt = arg;
+    struct replay_uid *ru = rt->ru;
+    const struct trace_rec *rec;
+    uint64_t i, due, start, bytes, max_lag_ns = 0;
+    uint64_t total_bytes = 0, ops = 0, skipped = 0, errors = 0;
+    struct hist *lat;
+    int ret;
+
+    lat = xcalloc(1, sizeof(*lat));
+    if (g_dir && (geteuid() == 0)) {
+        // These only change the calling thread's filesystem credentials.
+        setfsgid(ru->uid);
+        setfsuid(ru->uid);
+    }
+    while ((i = __sync_fetch_and_add(&ru->next, 1)) < ru->nrecs) {
+        rec = &ru->recs[i];
+        start = replay_now_ns();
+        if (!g_asap) {
+            due = g_base_ns + (rec->ts_ns - g_first_ns);
+            if (due > start) {
+                replay_sleep_ns(due - start);
+                start = replay_now_ns();
+            } else if (start - due > max_lag_ns) {
+                max_lag_ns = start - due;
+            }
+        }
+        if (g_dir) {
+            ret = replay_file_op(rt, rec, &bytes);
+            if (ret == ENOTSUP) {
+                skipped++;
+                continue;
+            } else if (ret) {
+                errors++;
+            }
+        } else {
+            bytes = replay_throttle(rec);
+        }
+        hist_record(lat, replay_now_ns() - start);
+        total_bytes += bytes;
+        ops++;
+    }
+    if (g_vc) {
+        vclock_leave(g_vc);
+    }
+    pthread_mutex_lock(&ru->lock);
+    ru->bytes += total_bytes;
+    ru->ops += ops;
+    ru->skipped += skipped;
+    ru->errors += errors;
+    if (max_lag_ns > ru->max_lag_ns) {
+        ru->max_lag_ns = max_lag_ns;
+    }
+    hist_merge(&ru->lat, lat);
+    pthread_mutex_unlock(&ru->lock);
+    free(lat);
+    return NULL;
+}
+
+static void print_results(double secs)
+{
+    struct replay_uid *ru;
+    uint32_t i;
+
+    printf("%-10s %10s %10s %8s %10s %10s %10s %10s %10s\n", "uid", "ops",
+           "skipped", "errors", "MiB/s", "p50_us", "p99_us", "p99.9_us",
+           "lag_ms");
+    for (i = 0; i < g_num_uids; i++) {
+        ru = &g_uids[i];
+        printf("%-10"PRIu32" %10"PRIu64" %10"PRIu64" %8"PRIu64" %10.2f "
+               "%10.1f %10.1f %10.1f %10.1f\n", ru->uid, ru->ops,
+               ru->skipped, ru->errors, (ru->bytes / secs) / 1048576.0,
+               hist_percentile(&ru->lat, 0.50) / 1000.0,
+               hist_percentile(&ru->lat, 0.99) / 1000.0,
+               hist_percentile(&ru->lat, 0.999) / 1000.0,
+               ru->max_lag_ns / 1000000.0);
+    }
+    printf("\nReplayed in %.2f s.  lag_ms is the longest an operation was "
+           "issued past\nits original time.\n", secs);
+}
+
+/**
+ * Set up the throttler with the allocations given by -u.
+ */
+static void setup_throttle(struct throttle_clock *clock)
+{
+    static struct uid_config unknown;
+    struct uid_config *list = NULL;
+    uint32_t i;
+
+    for (i = 0; i < g_num_confs; i++) {
+        if (g_confs[i].uid == UNKNOWN_UID) {
+            break;
+        }
+    }
+    if (i == g_num_confs) {
+        // Like the daemon, let UIDs without an allocation do what they like.
+        memset(&unknown, 0, sizeof(unknown));
+        unknown.uid = UNKNOWN_UID;
+        unknown.full = 1125899906842624LL;
+        list = &unknown;
+    }
+    for (i = 0; i < g_num_confs; i++) {
+        g_confs[i].next = list;
+        list = &g_confs[i];
+    }
+    if (g_vc) {
+        vclock_to_throttle_clock(g_vc, clock);
+        throttle_set_clock(clock);
+    }
+    throttle_init(list, hub_op_default_costs(), 1);
+}
+
+int main(int argc, char **argv)
+{
+    struct replay_thread *threads;
+    struct throttle_clock clock;
+    uint32_t i, j, nthreads, threads_per_uid = DEFAULT_THREADS_PER_UID;
+    int c, ret, virt = 0;
+
+    while ((c = getopt(argc, argv, "ahm:t:u:v")) != -1) {
+        switch (c) {
+        case 'a':
+            g_asap = 1;
+            break;
+        case 'm':
+            g_dir = optarg;
+            break;
+        case 't':
+            threads_per_uid = strtoul(optarg, NULL, 0);
+            break;
+        case 'u':
+            if (parse_conf(optarg)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'v':
+            virt = 1;
+            break;
+        case 'h':
+        default:
+            print_usage();
+            return (c == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if ((optind != argc - 1) || (threads_per_uid == 0) ||
+            (g_dir && (virt || g_num_confs))) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+    if (load_trace(argv[optind])) {
+        return EXIT_FAILURE;
+    }
+    if (g_dir) {
+        ret = setup_files();
+        if (!ret) {
+            htable_u64_visit(g_files, open_file, &ret);
+        }
+        if (ret) {
+            return EXIT_FAILURE;
+        }
+        if (geteuid() != 0) {
+            fprintf(stderr, "trace_replay: not running as root, so all "
+                    "operations will run as uid %d.\n", (int)geteuid());
+        }
+    } else {
+        if (virt) {
+            g_vc = vclock_alloc(monotonic_now_ns());
+        }
+        setup_throttle(&clock);
+    }
+    nthreads = g_num_uids * threads_per_uid;
+    threads = xcalloc(nthreads, sizeof(*threads));
+    g_base_ns = replay_now_ns();
+    for (i = 0; i < g_num_uids; i++) {
+        for (j = 0; j < threads_per_uid; j++) {
+            struct replay_thread *rt = &threads[(i * threads_per_uid) + j];
+            rt->ru = &g_uids[i];
+            rt->buf = xcalloc(1, MAX_IO_SIZE);
+            // Join on the thread's behalf, so that virtual time can't move
+            // until every thread is running.
+            if (g_vc) {
+                vclock_join(g_vc);
+            }
+            ret = pthread_create(&rt->thread, NULL, replay_thread_run, rt);
+            if (ret) {
+                fprintf(stderr, "trace_replay: pthread_create failed: "
+                        "error %d (%s)\n", ret, strerror(ret));
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        free(threads[i].buf);
+    }
+    print_results((replay_now_ns() - g_base_ns) / 1000000000.0);
+    free(threads);
+    if (g_dir) {
+        htable_u64_visit(g_files, close_file, NULL);
+        htable_u64_free(g_files);
+    } else {
+        throttle_shutdown();
+        throttle_set_clock(NULL);
+        vclock_free(g_vc);
+    }
+    for (i = 0; i < g_num_uids; i++) {
+        pthread_mutex_destroy(&g_uids[i].lock);
+        free(g_uids[i].recs);
+    }
+    return EXIT_SUCCESS;
+}
+
+// vim: ts=4:sw=4:tw=79:et
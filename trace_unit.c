@@ -0,0 +1,178 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "test.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_THREADS 4
+
+/** Few enough that no ring fills up before the drain thread gets to it. */
+#define TRACE_RECS_PER_THREAD 1000
+
+/** More than a ring holds. */
+#define TRACE_FLOOD_RECS 100000
+
+struct trace_thread {
+    pthread_t thread;
+    uint32_t uid;
+    uint64_t nrecs;
+};
+
+static void *trace_thread_run(void *arg)
+{
+    struct trace_thread *tt = arg;
+    struct trace_rec rec;
+    uint64_t i;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.uid = tt->uid;
+    rec.type = TRACE_TYPE_OP;
+    for (i = 0; i < tt->nrecs; i++) {
+        rec.off = i;
+        trace_emit(&rec);
+    }
+    return NULL;
+}
+
+/**
+ * Read a trace file back, and count the records in it.
+ *
+ * @param path          The trace file.
+ * @param uid_recs      (out param) For each UID below TRACE_THREADS, the
+ *                          number of TRACE_TYPE_OP records from it.  Each
+ *                          UID's offsets must be increasing.
+ * @param dropped       (out param) The total of the TRACE_TYPE_DROP records.
+ *
+ * @return              0 on success; -1 if the file is malformed.
+ */
+static int read_trace(const char *path, uint64_t *uid_recs,
+                      uint64_t *dropped)
+{
+    struct trace_file_hdr hdr;
+    struct trace_rec rec;
+    uint64_t next_off[TRACE_THREADS];
+    FILE *fp;
+
+    memset(uid_recs, 0, sizeof(uint64_t) * TRACE_THREADS);
+    memset(next_off, 0, sizeof(next_off));
+    *dropped = 0;
+    fp = fopen(path, "r");
+    EXPECT_NONNULL(fp);
+    EXPECT_INT_EQ(1, fread(&hdr, sizeof(hdr), 1, fp));
+    EXPECT_INT_ZERO(memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)));
+    EXPECT_INT_EQ(TRACE_VERSION, hdr.version);
+    EXPECT_INT_EQ(sizeof(struct trace_rec), hdr.rec_size);
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        if (rec.type == TRACE_TYPE_DROP) {
+            *dropped += rec.size;
+            continue;
+        }
+        EXPECT_INT_EQ(TRACE_TYPE_OP, rec.type);
+        EXPECT_INT_LT(rec.uid, TRACE_THREADS);
+        EXPECT_INT_GE(rec.off, next_off[rec.uid]);
+        next_off[rec.uid] = rec.off + 1;
+        uid_recs[rec.uid]++;
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int test_levels(void)
+{
+    EXPECT_INT_EQ(TRACE_LEVEL_OFF, trace_get_level());
+    EXPECT_INT_ZERO(trace_enabled(TRACE_LEVEL_OPS));
+    // There is nowhere to put records until trace_init is called.
+    EXPECT_INT_EQ(EOPNOTSUPP, trace_set_level(TRACE_LEVEL_OPS));
+    EXPECT_INT_EQ(EINVAL, trace_set_level(TRACE_LEVEL_MAX + 1));
+    EXPECT_INT_ZERO(trace_set_level(TRACE_LEVEL_OFF));
+    return 0;
+}
+
+static int test_drain(const char *path)
+{
+    struct trace_thread tt[TRACE_THREADS];
+    uint64_t uid_recs[TRACE_THREADS], dropped;
+    int i;
+
+    EXPECT_INT_ZERO(trace_init(path, TRACE_LEVEL_OPS));
+    EXPECT_INT_NONZERO(trace_enabled(TRACE_LEVEL_OPS));
+    EXPECT_INT_ZERO(trace_enabled(TRACE_LEVEL_THROTTLE));
+    EXPECT_INT_ZERO(trace_set_level(TRACE_LEVEL_THROTTLE));
+    EXPECT_INT_NONZERO(trace_enabled(TRACE_LEVEL_THROTTLE));
+    for (i = 0; i < TRACE_THREADS; i++) {
+        tt[i].uid = i;
+        tt[i].nrecs = TRACE_RECS_PER_THREAD;
+        EXPECT_INT_ZERO(pthread_create(&tt[i].thread, NULL,
+                                       trace_thread_run, &tt[i]));
+    }
+    for (i = 0; i < TRACE_THREADS; i++) {
+        EXPECT_INT_ZERO(pthread_join(tt[i].thread, NULL));
+    }
+    // Records from threads which have exited are still written out.
+    trace_shutdown();
+    EXPECT_INT_EQ(TRACE_LEVEL_OFF, trace_get_level());
+    EXPECT_INT_ZERO(read_trace(path, uid_recs, &dropped));
+    for (i = 0; i < TRACE_THREADS; i++) {
+        EXPECT_INT_EQ(TRACE_RECS_PER_THREAD, uid_recs[i]);
+    }
+    EXPECT_INT_ZERO(dropped);
+    return 0;
+}
+
+static int test_overflow(const char *path)
+{
+    struct trace_thread tt;
+    uint64_t uid_recs[TRACE_THREADS], dropped;
+
+    // A thread which outruns the drain thread loses records, but every lost
+    // record is accounted for.
+    EXPECT_INT_ZERO(trace_init(path, TRACE_LEVEL_OPS));
+    tt.uid = 0;
+    tt.nrecs = TRACE_FLOOD_RECS;
+    trace_thread_run(&tt);
+    trace_shutdown();
+    EXPECT_INT_ZERO(read_trace(path, uid_recs, &dropped));
+    EXPECT_INT_GT(dropped, 0);
+    EXPECT_INT_EQ(TRACE_FLOOD_RECS, uid_recs[0] + dropped);
+    return 0;
+}
+
+int main(void)
+{
+    char path[] = "/tmp/trace_unit.XXXXXX";
+    int fd;
+
+    fd = mkstemp(path);
+    die_if(fd < 0);
+    close(fd);
+    EXPECT_INT_ZERO(test_levels());
+    EXPECT_INT_ZERO(test_drain(path));
+    EXPECT_INT_ZERO(test_overflow(path));
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -28,6 +28,8 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 void *xcalloc(size_t nmemb, size_t size)
@@ -165,6 +167,67 @@ int open_flags_to_str(int flags, char *str, size_t max_len)
     return 0;
 }
 
+uint64_t monotonic_now_ns(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+        int err = errno;
+        fprintf(stderr, "clock_gettime failed with error %d (%s)\n",
+                err, terror(err));
+        abort();
+    }
+    return (((uint64_t)ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+}
+
+ssize_t pread_fully(int fd, char *buf, size_t size, off_t off)
+{
+    ssize_t res;
+    size_t done = 0;
+
+    while (done < size) {
+        res = pread(fd, buf + done, size - done, off + done);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        } else if (res == 0) {
+            break;
+        }
+        done += res;
+    }
+    return done;
+}
+
+int pwritev_fully(int fd, struct iovec *iov, int iovcnt, off_t off)
+{
+    ssize_t res;
+
+    while (iovcnt > 0) {
+        res = pwritev(fd, iov, iovcnt, off);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        } else if (res == 0) {
+            return -EIO;
+        }
+        off += res;
+        while ((iovcnt > 0) && ((size_t)res >= iov->iov_len)) {
+            res -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = ((char*)iov->iov_base) + res;
+            iov->iov_len -= res;
+        }
+    }
+    return 0;
+}
+
 static int recursive_unlink_helper(int dirfd, const char *name)
 {
     int fd = -1, ret = 0;
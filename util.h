@@ -19,8 +19,12 @@
 #ifndef IOHUB_UTIL_H
 #define IOHUB_UTIL_H
 
+#include <stdint.h> // for uint64_t
+#include <sys/types.h> // for off_t, ssize_t
 #include <unistd.h> // for size_t
 
+struct iovec;
+
 /**
  * Allocate a new region of memory and zero it, or die.
  */
@@ -52,6 +56,39 @@ int snappend(char *str, size_t str_len, const char *fmt, ...)
  */
 int open_flags_to_str(int flags, char *str, size_t max_len);
 
+/**
+ * Get the current monotonic time.
+ *
+ * @return          The monotonic time in nanoseconds.
+ */
+uint64_t monotonic_now_ns(void);
+
+/**
+ * Read into a buffer, retrying on short reads.
+ *
+ * @param fd            The file descriptor to read from.
+ * @param buf           The buffer.
+ * @param size          Number of bytes to read.
+ * @param off           File offset to read at.
+ *
+ * @return              The number of bytes read, which is only less than
+ *                          size at the end of the file; or a negative error
+ *                          code.
+ */
+ssize_t pread_fully(int fd, char *buf, size_t size, off_t off);
+
+/**
+ * Write out some buffers, retrying on short writes.
+ *
+ * @param fd            The file descriptor to write to.
+ * @param iov           The buffers.  Will be modified.
+ * @param iovcnt        Number of buffers.
+ * @param off           File offset to write at.
+ *
+ * @return              0 on success; negative error code otherwise.
+ */
+int pwritev_fully(int fd, struct iovec *iov, int iovcnt, off_t off);
+
 /**
  * Recursively unlink a path.
  * Symlinks will be followed.
@@ -0,0 +1,195 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "throttle.h"
+#include "util.h"
+#include "vclock.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * A participant waiting for virtual time to reach its wakeup time.  These
+ * live on the sleeping thread's stack.
+ */
+struct vclock_sleeper {
+    /** Next sleeper in the list. */
+    struct vclock_sleeper *next;
+
+    /** Virtual time to wake up at. */
+    uint64_t wake_ns;
+
+    /** Set once the sleeper has been woken up. */
+    int done;
+};
+
+struct vclock {
+    /** Protects everything below. */
+    pthread_mutex_t lock;
+
+    /** Signalled whenever the time advances. */
+    pthread_cond_t cond;
+
+    /** The current virtual time. */
+    uint64_t now_ns;
+
+    /** Number of participating threads. */
+    uint32_t participants;
+
+    /** Number of participating threads which are not asleep. */
+    uint32_t runnable;
+
+    /** Sleeping participants. */
+    struct vclock_sleeper *sleepers;
+};
+
+struct vclock *vclock_alloc(uint64_t start_ns)
+{
+    struct vclock *vc;
+
+    vc = xcalloc(1, sizeof(*vc));
+    pthread_mutex_init(&vc->lock, NULL);
+    pthread_cond_init(&vc->cond, NULL);
+    vc->now_ns = start_ns;
+    return vc;
+}
+
+void vclock_free(struct vclock *vc)
+{
+    if (!vc) {
+        return;
+    }
+    if (vc->participants) {
+        fprintf(stderr, "vclock_free: %"PRIu32" participants remain.\n",
+                vc->participants);
+        abort();
+    }
+    pthread_cond_destroy(&vc->cond);
+    pthread_mutex_destroy(&vc->lock);
+    free(vc);
+}
+
+/**
+ * Advance the time to the earliest wakeup, if every participant is asleep.
+ *
+ * Must be called with the lock held.
+ *
+ * @param vc            The clock.
+ */
+static void vclock_advance(struct vclock *vc)
+{
+    struct vclock_sleeper **cur, *s;
+    uint64_t wake_ns = UINT64_MAX;
+
+    if ((vc->runnable) || (!vc->sleepers)) {
+        return;
+    }
+    for (s = vc->sleepers; s; s = s->next) {
+        if (s->wake_ns < wake_ns) {
+            wake_ns = s->wake_ns;
+        }
+    }
+    if (wake_ns > vc->now_ns) {
+        vc->now_ns = wake_ns;
+    }
+    // Make the sleepers runnable here rather than when they get around to
+    // waking, so that nobody advances the clock again in the meantime.
+    cur = &vc->sleepers;
+    while (*cur) {
+        s = *cur;
+        if (s->wake_ns <= vc->now_ns) {
+            *cur = s->next;
+            s->done = 1;
+            vc->runnable++;
+        } else {
+            cur = &s->next;
+        }
+    }
+    pthread_cond_broadcast(&vc->cond);
+}
+
+void vclock_join(struct vclock *vc)
+{
+    pthread_mutex_lock(&vc->lock);
+    vc->participants++;
+    vc->runnable++;
+    pthread_mutex_unlock(&vc->lock);
+}
+
+void vclock_leave(struct vclock *vc)
+{
+    pthread_mutex_lock(&vc->lock);
+    vc->participants--;
+    vc->runnable--;
+    vclock_advance(vc);
+    pthread_mutex_unlock(&vc->lock);
+}
+
+uint64_t vclock_now_ns(struct vclock *vc)
+{
+    uint64_t now_ns;
+
+    pthread_mutex_lock(&vc->lock);
+    now_ns = vc->now_ns;
+    pthread_mutex_unlock(&vc->lock);
+    return now_ns;
+}
+
+void vclock_sleep_ns(struct vclock *vc, uint64_t ns)
+{
+    struct vclock_sleeper self;
+
+    pthread_mutex_lock(&vc->lock);
+    if (!vc->participants) {
+        vc->now_ns += ns;
+        pthread_mutex_unlock(&vc->lock);
+        return;
+    }
+    self.wake_ns = vc->now_ns + ns;
+    self.done = 0;
+    self.next = vc->sleepers;
+    vc->sleepers = &self;
+    vc->runnable--;
+    vclock_advance(vc);
+    while (!self.done) {
+        pthread_cond_wait(&vc->cond, &vc->lock);
+    }
+    pthread_mutex_unlock(&vc->lock);
+}
+
+static uint64_t vclock_throttle_now_ns(void *ctx)
+{
+    return vclock_now_ns(ctx);
+}
+
+static void vclock_throttle_sleep_ns(void *ctx, uint64_t ns)
+{
+    vclock_sleep_ns(ctx, ns);
+}
+
+void vclock_to_throttle_clock(struct vclock *vc,
+                              struct throttle_clock *clock)
+{
+    clock->now_ns = vclock_throttle_now_ns;
+    clock->sleep_ns = vclock_throttle_sleep_ns;
+    clock->ctx = vc;
+}
+
+// vim: ts=4:sw=4:tw=79:et
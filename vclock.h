@@ -0,0 +1,99 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_VCLOCK_H
+#define IOHUB_VCLOCK_H
+
+#include <stdint.h>
+
+struct throttle_clock;
+struct vclock;
+
+/**
+ * A virtual clock, for driving the throttler in tests and simulations.
+ *
+ * Virtual time only moves when somebody sleeps.  With no participating
+ * threads, vclock_sleep_ns simply advances the clock and returns at once,
+ * which suits single-threaded tests.
+ *
+ * Threads which call vclock_join become participants.  When a participant
+ * sleeps, it blocks until every participant is asleep, at which point the
+ * clock jumps to the earliest wakeup time and those sleepers resume.  Time
+ * spent running between sleeps is free, so hours of simulated traffic take as
+ * long as the work done in them.
+ */
+
+/**
+ * Allocate a virtual clock.
+ *
+ * @param start_ns      The initial time in nanoseconds.
+ *
+ * @return              The new clock.  Aborts on OOM.
+ */
+struct vclock *vclock_alloc(uint64_t start_ns);
+
+/**
+ * Free a virtual clock.  There must be no participants left.
+ *
+ * @param vc            The clock, or NULL.
+ */
+void vclock_free(struct vclock *vc);
+
+/**
+ * Make the calling thread a participant.
+ *
+ * @param vc            The clock.
+ */
+void vclock_join(struct vclock *vc);
+
+/**
+ * Stop the calling thread from being a participant.
+ *
+ * @param vc            The clock.
+ */
+void vclock_leave(struct vclock *vc);
+
+/**
+ * Get the current virtual time.
+ *
+ * @param vc            The clock.
+ *
+ * @return              The current time in nanoseconds.
+ */
+uint64_t vclock_now_ns(struct vclock *vc);
+
+/**
+ * Sleep in virtual time.
+ *
+ * @param vc            The clock.
+ * @param ns            Nanoseconds to sleep.
+ */
+void vclock_sleep_ns(struct vclock *vc, uint64_t ns);
+
+/**
+ * Fill in a throttle_clock which uses this virtual clock.
+ *
+ * @param vc            The clock.
+ * @param clock         (out param) The throttle clock.
+ */
+void vclock_to_throttle_clock(struct vclock *vc,
+                              struct throttle_clock *clock);
+
+#endif
+
+// vim: ts=4:sw=4:et
@@ -0,0 +1,145 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "log.h"
+#include "util.h"
+#include "workq.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct workq {
+    /** Name of this work queue. */
+    char *name;
+
+    /** Protects all the fields below. */
+    pthread_mutex_t lock;
+
+    /** Signalled when there is new work, or when we are shutting down. */
+    pthread_cond_t cond;
+
+    /** First item in the queue, or NULL. */
+    struct workq_item *head;
+
+    /** Last item in the queue, or NULL. */
+    struct workq_item *tail;
+
+    /** Nonzero if the threads should exit once the queue is empty. */
+    int shutdown;
+
+    /** Number of threads we started. */
+    int nthreads;
+
+    /** The threads. */
+    pthread_t *threads;
+};
+
+static void *workq_thread(void *v)
+{
+    struct workq *wq = v;
+    struct workq_item *item;
+
+    pthread_mutex_lock(&wq->lock);
+    while (1) {
+        item = wq->head;
+        if (item) {
+            wq->head = item->next;
+            if (!wq->head) {
+                wq->tail = NULL;
+            }
+            pthread_mutex_unlock(&wq->lock);
+            item->fn(item->arg);
+            pthread_mutex_lock(&wq->lock);
+            continue;
+        }
+        if (wq->shutdown) {
+            break;
+        }
+        pthread_cond_wait(&wq->cond, &wq->lock);
+    }
+    pthread_mutex_unlock(&wq->lock);
+    return NULL;
+}
+
+int workq_alloc(const char *name, int nthreads, struct workq **out)
+{
+    struct workq *wq;
+    int ret;
+
+    wq = xcalloc(1, sizeof(*wq));
+    wq->name = strdup(name);
+    if (!wq->name) {
+        free(wq);
+        return ENOMEM;
+    }
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+    wq->threads = xcalloc(nthreads, sizeof(pthread_t));
+    for (wq->nthreads = 0; wq->nthreads < nthreads; wq->nthreads++) {
+        ret = pthread_create(&wq->threads[wq->nthreads], NULL,
+                             workq_thread, wq);
+        if (ret) {
+            fprintf(stderr, "workq_alloc(%s): pthread_create failed: "
+                    "error %d (%s)\n", name, ret, terror(ret));
+            workq_free(wq);
+            return ret;
+        }
+    }
+    *out = wq;
+    return 0;
+}
+
+void workq_submit(struct workq *wq, struct workq_item *item)
+{
+    item->next = NULL;
+    pthread_mutex_lock(&wq->lock);
+    if (wq->tail) {
+        wq->tail->next = item;
+    } else {
+        wq->head = item;
+    }
+    wq->tail = item;
+    pthread_cond_signal(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+void workq_free(struct workq *wq)
+{
+    int i;
+
+    if (!wq) {
+        return;
+    }
+    pthread_mutex_lock(&wq->lock);
+    wq->shutdown = 1;
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+    for (i = 0; i < wq->nthreads; i++) {
+        pthread_join(wq->threads[i], NULL);
+    }
+    pthread_cond_destroy(&wq->cond);
+    pthread_mutex_destroy(&wq->lock);
+    free(wq->threads);
+    free(wq->name);
+    free(wq);
+}
+
+// vim: ts=4:sw=4:tw=79:et
@@ -0,0 +1,76 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef IOHUB_WORKQ_H
+#define IOHUB_WORKQ_H
+
+struct workq;
+
+typedef void (*workq_fn_t)(void *arg);
+
+/**
+ * An item of work.
+ *
+ * Items are embedded in whatever structure they operate on, so that
+ * submitting work never needs to allocate memory.  An item must not be
+ * resubmitted until its function has started running.
+ */
+struct workq_item {
+    /** Next item in the queue.  Private to the work queue. */
+    struct workq_item *next;
+
+    /** The function to run. */
+    workq_fn_t fn;
+
+    /** The argument to pass to fn. */
+    void *arg;
+};
+
+/**
+ * Create a work queue, and start its threads.
+ *
+ * Note that threads don't survive a fork, so this must not be called before
+ * FUSE daemonizes.
+ *
+ * @param name          Name of the work queue, for error messages.
+ * @param nthreads      Number of threads to run work items on.
+ * @param out           (out param) The new work queue.
+ *
+ * @return              0 on success; error code otherwise.
+ */
+int workq_alloc(const char *name, int nthreads, struct workq **out);
+
+/**
+ * Submit an item of work to run on one of the work queue's threads.
+ *
+ * @param wq            The work queue.
+ * @param item          The item.  Its fn and arg fields must be set.
+ */
+void workq_submit(struct workq *wq, struct workq_item *item);
+
+/**
+ * Run everything that has been submitted, stop the threads, and free the work
+ * queue.
+ *
+ * @param wq            The work queue, or NULL.
+ */
+void workq_free(struct workq *wq);
+
+#endif
+
+// vim: ts=4:sw=4:et